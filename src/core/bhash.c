@@ -15,6 +15,19 @@
 #include "cassert.h"
 
 #define i_GET16BITS(d) (*((const uint16_t*)(d)))
+#define i_GET32BITS(d) (*((const uint32_t*)(d)))
+#define i_GET64BITS(d) (*((const uint64_t*)(d)))
+#define i_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* 64 bits hash for file contents (xxHash64) */
+/* https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md */
+/* Built from 32 bits halves: 'long long' literals aren't C++98 (core also builds as C++) */
+#define i_U64(hi, lo) ((((uint64_t)(hi)) << 32) | (uint64_t)(lo))
+#define i_PRIME64_1 i_U64(0x9E3779B1, 0x85EBCA87)
+#define i_PRIME64_2 i_U64(0xC2B2AE3D, 0x27D4EB4F)
+#define i_PRIME64_3 i_U64(0x165667B1, 0x9E3779F9)
+#define i_PRIME64_4 i_U64(0x85EBCA77, 0xC2B2AE63)
+#define i_PRIME64_5 i_U64(0x27D4EB2F, 0x165667C5)
 /*#define get16bits(d) ((((uint32_t)(((const uint8_t *)(d))[1])) << 8)+(uint32_t)(((const uint8_t *)(d))[0]) )*/
 		
 /*---------------------------------------------------------------------------*/
@@ -103,3 +116,88 @@ uint32_t bhash_append_real32(const uint32_t hash, const real32_t value)
 
 
 
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint64_t i_round64(uint64_t acc, const uint64_t value)
+{
+    acc += value * i_PRIME64_2;
+    acc = i_ROTL64(acc, 31);
+    return acc * i_PRIME64_1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint64_t i_merge64(uint64_t acc, const uint64_t value)
+{
+    acc ^= i_round64(0, value);
+    return acc * i_PRIME64_1 + i_PRIME64_4;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint64_t bhash_from_block64(const byte_t *data, const uint32_t size, const uint64_t seed)
+{
+    const byte_t *end = data + size;
+    uint64_t hash;
+    cassert(data != NULL || size == 0);
+
+    if (size >= 32)
+    {
+        const byte_t *limit = end - 32;
+        uint64_t v1 = seed + i_PRIME64_1 + i_PRIME64_2;
+        uint64_t v2 = seed + i_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - i_PRIME64_1;
+
+        /* Four independent lanes */
+        do
+        {
+            v1 = i_round64(v1, i_GET64BITS(data));
+            v2 = i_round64(v2, i_GET64BITS(data + 8));
+            v3 = i_round64(v3, i_GET64BITS(data + 16));
+            v4 = i_round64(v4, i_GET64BITS(data + 24));
+            data += 32;
+        } while (data <= limit);
+
+        hash = i_ROTL64(v1, 1) + i_ROTL64(v2, 7) + i_ROTL64(v3, 12) + i_ROTL64(v4, 18);
+        hash = i_merge64(hash, v1);
+        hash = i_merge64(hash, v2);
+        hash = i_merge64(hash, v3);
+        hash = i_merge64(hash, v4);
+    }
+    else
+    {
+        hash = seed + i_PRIME64_5;
+    }
+
+    hash += (uint64_t)size;
+
+    while (data + 8 <= end)
+    {
+        hash ^= i_round64(0, i_GET64BITS(data));
+        hash = i_ROTL64(hash, 27) * i_PRIME64_1 + i_PRIME64_4;
+        data += 8;
+    }
+
+    if (data + 4 <= end)
+    {
+        hash ^= (uint64_t)i_GET32BITS(data) * i_PRIME64_1;
+        hash = i_ROTL64(hash, 23) * i_PRIME64_2 + i_PRIME64_3;
+        data += 4;
+    }
+
+    while (data < end)
+    {
+        hash ^= (uint64_t)(*data) * i_PRIME64_5;
+        hash = i_ROTL64(hash, 11) * i_PRIME64_1;
+        data += 1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= i_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= i_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -20,6 +20,8 @@ uint32_t bhash_append_uint32(const uint32_t hash, const uint32_t value);
 
 uint32_t bhash_append_real32(const uint32_t hash, const real32_t value);
 
+uint64_t bhash_from_block64(const byte_t *data, const uint32_t size, const uint64_t seed);
+
 __END_C
 
 #define bhash_from_object(data, type)\
@@ -15,6 +15,7 @@
 #include "core.inl"
 #include "heap.inl"
 #include "dbind.inl"
+#include "event.inl"
 #include "stream.inl"
 #include "bmem.h"
 #include "bproc.h"
@@ -75,6 +76,7 @@ void core_start(void)
         _heap_start();
         _stm_start();
         _dbind_start();
+        _event_start();
         cassert_set_func(NULL, i_assert_to_log);
         i_CORE.NUM_USERS = 1;
         #if defined (__APPLE__) || defined (__LINUX__)
@@ -97,6 +99,7 @@ void core_finish(void)
     if (i_CORE.NUM_USERS == 1)
     {
         i_CORE.NUM_USERS = 0;
+        _event_finish();
         _dbind_finish();
         _stm_finish();
         _heap_finish();
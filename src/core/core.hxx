@@ -226,6 +226,7 @@ typedef struct _rbtree_t RBTree;
 typedef const char_t* ResId;
 typedef struct _respack ResPack;
 typedef struct _regex RegEx;
+typedef struct _regexset RegExSet;
 typedef struct _stream_t Stream;
 typedef struct _string_t String;
 typedef struct _direntry_t DirEntry;
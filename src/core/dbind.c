@@ -22,12 +22,25 @@
 #include "cassert.h"
 #include "heap.h"
 #include "log.h"
+#include "osbs.h"
 #include "ptr.h"
 #include "stream.h"
 #include "strings.h"
 
 typedef union i_attr_t i_Attr;
 typedef struct i_databind_t i_DataBind;
+typedef struct i_op_t i_Op;
+typedef struct i_slot_t i_Slot;
+typedef struct i_table_t i_Table;
+
+#define PLAN_BLOCK  0x100000
+
+typedef enum _opcode_t
+{
+    i_ekOP_RUN,
+    i_ekOP_FIX,
+    i_ekOP_VALUE
+} opcode_t;
 
 union i_attr_t
 {
@@ -113,6 +126,23 @@ struct _stbind_t
     FPtr_write func_write;
     FPtr_destroy func_destroy;
     ArrSt(DBind) *members;
+    ArrSt(i_Op) *plan;
+    bool_t pod;
+    bool_t hashed;
+    uint32_t nslots;
+    int32_t *disp;
+    DBind **slots;
+};
+
+/* Serialization plan step. RUN copies 'size' raw bytes, FIX post-processes
+   a member of the previous RUN after reading and VALUE falls back to the
+   generic member serializer. */
+struct i_op_t
+{
+    opcode_t code;
+    uint16_t offset;
+    uint16_t size;
+    DBind *member;
 };
 
 struct _enumvbind_t
@@ -128,10 +158,27 @@ struct _enumbind_t
     ArrSt(EnumVBind) *values;
 };
 
+/* Open addressing hash table (linear probing) indexing types by name */
+struct i_slot_t
+{
+    uint32_t hash;
+    const char_t *key;
+    void *value;
+};
+
+struct i_table_t
+{
+    i_Slot *slots;
+    uint32_t size;
+    uint32_t count;
+};
+
 struct i_databind_t
 {
     ArrPt(StBind) *stbinds;
     ArrPt(EnumBind) *ebinds;
+    i_Table sttable;
+    i_Table etable;
 };
 
 /*---------------------------------------------------------------------------*/
@@ -140,6 +187,7 @@ DeclSt(EnumVBind);
 DeclPt(EnumBind);
 DeclSt(DBind);
 DeclPt(StBind);
+DeclSt(i_Op);
 
 //struct StBindData{ StBind elem[1024];};struct ArrStStBind{ uint32_t reserved; uint32_t size; uint16_t elem_sizeof; struct StBindData *content;}; struct ArrStStBind;inline struct ArrStStBind* arrst_StBind_create(const uint16_t esize){ return (struct ArrStStBind*)array_create(esize, (const char_t*)("ArrSt::""StBind"));}inline struct ArrStStBind* arrst_StBind_copy(const struct ArrStStBind *array, void(func_copy)(StBind*, const StBind*)){ return (struct ArrStStBind*)array_copy((Array*)array, (FPtr_scopy)func_copy, (const char_t*)("ArrSt::""StBind"));}inline struct ArrStStBind* arrst_StBind_read(Stream *stream, const uint16_t esize, void(func_read)(Stream*, StBind*)){ return (struct ArrStStBind*)array_read(stream, esize, (FPtr_read_init)func_read, (const char_t*)("ArrSt::""StBind"));}inline void arrst_StBind_destroy(struct ArrStStBind **array, void(func_remove)(StBind*)){ array_destroy((Array**)array, (FPtr_remove)func_remove, (const char_t*)("ArrSt::""StBind"));}inline void arrst_StBind_destopt(struct ArrStStBind **array, void(func_remove)(StBind*)){ array_destopt((Array**)array, (FPtr_remove)func_remove, (const char_t*)("ArrSt::""StBind"));}inline void arrst_StBind_clear(struct ArrStStBind *array, void(func_remove)(StBind*)){ array_clear((Array*)array, (FPtr_remove)func_remove);}inline void arrst_StBind_write(Stream *stream, const struct ArrStStBind *array, void(func_write)(Stream*, const StBind*)){ array_write(stream, (const Array*)array, (FPtr_write)func_write);}inline uint32_t arrst_StBind_size(const struct ArrStStBind *array){ return array_size((const Array*)array);}inline StBind *arrst_StBind_get(struct ArrStStBind *array, const uint32_t pos){ return (StBind*)array_get((Array*)array, pos);}inline const StBind *arrst_StBind_get_const(const struct ArrStStBind *array, const uint32_t pos){ return (const StBind*)array_get((Array*)array, pos);}inline StBind *arrst_StBind_last(struct ArrStStBind *array){ return (StBind*)array_get_last((Array*)array);}inline const StBind *arrst_StBind_last_const(const struct ArrStStBind *array){ return (const StBind*)array_get_last((const Array*)array);}inline StBind *arrst_StBind_all(struct ArrStStBind *array){ return (StBind*)array_all((Array*)array);}inline const StBind *arrst_StBind_all_const(const struct ArrStStBind *array){ return (const StBind*)array_all((Array*)array);}inline StBind *arrst_StBind_insert(struct ArrStStBind *array, const uint32_t pos, const uint32_t n){ return (StBind*)array_insert((Array*)array, pos, n);}inline StBind *arrst_StBind_insert0(struct ArrStStBind *array, const uint32_t pos, const uint32_t n){ return (StBind*)array_insert0((Array*)array, pos, n);}inline void arrst_StBind_join(struct ArrStStBind *dest, const struct ArrStStBind *src, void(func_copy)(StBind*, const StBind*)){ array_join((Array*)dest, (const Array*)src, (FPtr_scopy)func_copy);}inline void arrst_StBind_delete(struct ArrStStBind *array, const uint32_t pos, void(func_remove)(StBind*)){ array_delete((Array*)array, pos, 1, (FPtr_remove)func_remove);}inline void arrst_StBind_pop(struct ArrStStBind *array, void(func_remove)(StBind*)){ array_pop((Array*)array, (FPtr_remove)func_remove);}inline void arrst_StBind_sort(struct ArrStStBind *array, int(func_compare)(const StBind*, const StBind*)){ array_sort((Array*)array, (FPtr_compare)func_compare);}inline void arrst_StBind_sort_ex(struct ArrStStBind *array, FPtr_compare_ex func_compare, void *data){ array_sort_ex((Array*)array, func_compare, data);}inline StBind* arrst_StBind_search(struct ArrStStBind *array, FPtr_compare func_compare, const void *key, uint32_t *pos){ return (StBind*)array_search((Array*)array, func_compare, key, pos);}inline const StBind* arrst_StBind_search_const(const struct ArrStStBind *array, FPtr_compare func_compare, const void *key, uint32_t *pos){ return (const StBind*)array_search((Array*)array, func_compare, key, pos);}inline StBind* arrst_StBind_bsearch(struct ArrStStBind *array, FPtr_compare func_compare, const void *key, uint32_t *pos){ return (StBind*)array_bsearch((Array*)array, func_compare, key, pos);}inline const StBind* arrst_StBind_bsearch_const(const struct ArrStStBind *array, FPtr_compare func_compare, const void *key, uint32_t *pos){ return (const StBind*)array_bsearch((Array*)array, func_compare, key, pos);}inline void arrst_StBind_end(void);
 //struct DBindData{ DBind elem[1024];};
@@ -186,50 +234,208 @@ static void i_remove_object(byte_t *data, const StBind *stbind, const uint16_t s
 static void i_destroy_object(byte_t **data, const StBind *stbind, const uint16_t size);
 static void i_write_value(Stream *stm, DBind *dbind, dtype_t type, const char_t *subtype, const void *data);
 static bool_t i_read_value(Stream *stm, DBind *dbind, dtype_t type, const char_t *subtype, void *data);
-static i_DataBind i_DATABIND = { 0, 0 };
+static void i_build_plan(StBind *stbind);
+static void i_mph(StBind *stbind);
+static i_DataBind i_DATABIND = { 0, 0, { 0, 0, 0 }, { 0, 0, 0 } };
 
 /*---------------------------------------------------------------------------*/
 
-static StBind *i_find_stbind(const char_t *type, uint32_t *index)
+/* FNV-1a, 'seed' selects a different function of the family */
+static uint32_t i_hash(const char_t *str, const uint32_t seed)
 {
-    arrpt_foreach(bind, i_DATABIND.stbinds, StBind)
-        int compare = str_cmp(bind->type, type);
-        if (compare == 0)
+    register uint32_t hash = 2166136261u ^ (seed * 2654435769u);
+    cassert_no_null(str);
+    while (*str != '\0')
+    {
+        hash ^= (uint32_t)(uint8_t)*str++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void *i_table_get(const i_Table *table, const char_t *key)
+{
+    cassert_no_null(table);
+    if (table->count > 0)
+    {
+        uint32_t hash = i_hash(key, 0);
+        uint32_t mask = table->size - 1;
+        uint32_t i = hash & mask;
+        while (table->slots[i].key != NULL)
         {
-            return bind;
+            if (table->slots[i].hash == hash && str_equ_c(table->slots[i].key, key) == TRUE)
+                return table->slots[i].value;
+            i = (i + 1) & mask;
         }
-        else if (compare > 0)
+    }
+
+    return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_table_insert(i_Slot *slots, const uint32_t size, const uint32_t hash, const char_t *key, void *value)
+{
+    uint32_t i = hash & (size - 1);
+    while (slots[i].key != NULL)
+        i = (i + 1) & (size - 1);
+    slots[i].hash = hash;
+    slots[i].key = key;
+    slots[i].value = value;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* 'key' must live as long as the table (the type name of the bind) */
+static void i_table_put(i_Table *table, const char_t *key, void *value)
+{
+    cassert_no_null(table);
+    cassert(i_table_get(table, key) == NULL);
+
+    /* Load factor below 1/2 */
+    if ((table->count + 1) * 2 > table->size)
+    {
+        uint32_t i, size = table->size > 0 ? table->size * 2 : 64;
+        i_Slot *slots = heap_new_n0(size, i_Slot);
+        for (i = 0; i < table->size; ++i)
         {
-            ptr_assign(index, bind_i);
-            return NULL;
+            if (table->slots[i].key != NULL)
+                i_table_insert(slots, size, table->slots[i].hash, table->slots[i].key, table->slots[i].value);
         }
-    arrpt_end();
 
-    if (index != NULL)
-        *index = arrpt_size(i_DATABIND.stbinds, StBind);
-    return NULL;
+        if (table->slots != NULL)
+            heap_delete_n(&table->slots, table->size, i_Slot);
+
+        table->slots = slots;
+        table->size = size;
+    }
+
+    i_table_insert(table->slots, table->size, i_hash(key, 0), key, value);
+    table->count += 1;
 }
 
 /*---------------------------------------------------------------------------*/
 
-static EnumBind *i_find_enum(const char_t *type, uint32_t *index)
+static void i_table_remove(i_Table *table)
 {
-    arrpt_foreach(bind, i_DATABIND.ebinds, EnumBind)
-        int compare = str_cmp(bind->type, type);
-        if (compare == 0)
+    cassert_no_null(table);
+    if (table->slots != NULL)
+        heap_delete_n(&table->slots, table->size, i_Slot);
+    table->size = 0;
+    table->count = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static StBind *i_find_stbind(const char_t *type, uint32_t *index)
+{
+    StBind *stbind = (StBind*)i_table_get(&i_DATABIND.sttable, type);
+
+    /* Sorted insert position, only required when registering */
+    if (stbind == NULL && index != NULL)
+    {
+        uint32_t i = 0, j = arrpt_size(i_DATABIND.stbinds, StBind);
+        while (i < j)
         {
-            return bind;
+            uint32_t k = (i + j) / 2;
+            if (str_cmp(arrpt_get(i_DATABIND.stbinds, k, StBind)->type, type) < 0)
+                i = k + 1;
+            else
+                j = k;
         }
-        else if (compare > 0)
+
+        *index = i;
+    }
+
+    return stbind;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static EnumBind *i_find_enum(const char_t *type, uint32_t *index)
+{
+    EnumBind *ebind = (EnumBind*)i_table_get(&i_DATABIND.etable, type);
+
+    if (ebind == NULL && index != NULL)
+    {
+        uint32_t i = 0, j = arrpt_size(i_DATABIND.ebinds, EnumBind);
+        while (i < j)
         {
-            ptr_assign(index, bind_i);
-            return NULL;
+            uint32_t k = (i + j) / 2;
+            if (str_cmp(arrpt_get(i_DATABIND.ebinds, k, EnumBind)->type, type) < 0)
+                i = k + 1;
+            else
+                j = k;
         }
-    arrpt_end();
 
-    if (index != NULL)
-        *index = arrpt_size(i_DATABIND.ebinds, EnumBind);
-    return NULL;
+        *index = i;
+    }
+
+    return ebind;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_register_stbind(StBind *stbind, const uint32_t index)
+{
+    cassert_no_null(stbind);
+    arrpt_insert(i_DATABIND.stbinds, index, stbind, StBind);
+    i_table_put(&i_DATABIND.sttable, tc(stbind->type), stbind);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_remove_mph(StBind *stbind)
+{
+    cassert_no_null(stbind);
+    if (stbind->disp != NULL)
+    {
+        heap_delete_n(&stbind->disp, stbind->nslots, int32_t);
+        heap_delete_n(&stbind->slots, stbind->nslots, DBind*);
+    }
+
+    stbind->nslots = 0;
+    stbind->hashed = FALSE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* 'stbind' is 'inner' or has it as an embedded (ekDTYPE_OBJECT) member, at any depth */
+static bool_t i_embeds(const StBind *stbind, const StBind *inner)
+{
+    cassert_no_null(stbind);
+    if (stbind == inner)
+        return TRUE;
+
+    if (stbind->members != NULL)
+    {
+        arrst_foreach_const(member, stbind->members, DBind)
+            if (member->type == ekDTYPE_OBJECT && i_embeds(member->attr.object.stbind, inner) == TRUE)
+                return TRUE;
+        arrst_end();
+    }
+
+    return FALSE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * Plans and member hashes are rebuilt each time a struct changes, never on
+ * first use, so serialization and lookups don't modify the registry.
+ * Plans keep member pointers of any struct embedded in them.
+ */
+static void i_update_stbind(StBind *stbind)
+{
+    arrpt_foreach(bind, i_DATABIND.stbinds, StBind)
+        if (bind->members != NULL && i_embeds(bind, stbind) == TRUE)
+            i_build_plan(bind);
+    arrpt_end();
+    i_remove_mph(stbind);
+    i_mph(stbind);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -310,6 +516,8 @@ static void i_remove_stbind(StBind *stbind)
     cassert_no_null(stbind);
     if (stbind->members != NULL)
         arrst_destroy(&stbind->members, i_remove_member, DBind);
+    arrst_destopt(&stbind->plan, NULL, i_Op);
+    i_remove_mph(stbind);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -366,6 +574,8 @@ void _dbind_finish(void)
         arrpt_destroy(&i_DATABIND.stbinds, i_destroy_stbind, StBind);
 
         arrpt_destroy(&i_DATABIND.ebinds, i_destroy_enumbind, EnumBind);
+        i_table_remove(&i_DATABIND.sttable);
+        i_table_remove(&i_DATABIND.etable);
     }
 }
 
@@ -677,10 +887,11 @@ static StBind *i_stbind(const char_t *type, const uint16_t size)
     if (stbind == NULL)
     {
         stbind = heap_new0(StBind);
-        arrpt_insert(i_DATABIND.stbinds, index, stbind, StBind);
         stbind->type = str_c(type);
         stbind->size = size;
         stbind->members = arrst_create(DBind);
+        i_register_stbind(stbind, index);
+        i_update_stbind(stbind);
     }
 
     return stbind;
@@ -909,6 +1120,8 @@ static void i_add_member(StBind *stbind, const char_t *mname, const char_t *mtyp
             case ekDTYPE_UNKNOWN:
             cassert_default();
             }
+
+            i_update_stbind(stbind);
         }
         else
         {
@@ -938,10 +1151,10 @@ void dbind_imp(
     if (stbind == NULL)
     {
         stbind = heap_new0(StBind);
-        arrpt_insert(i_DATABIND.stbinds, index, stbind, StBind);
         stbind->type = str_c(type);
         stbind->size = size;
         stbind->members = arrst_create(DBind);
+        i_register_stbind(stbind, index);
     }
 
     i_add_member(stbind, mname, mtype, moffset, msize);
@@ -959,6 +1172,7 @@ static EnumBind *i_enum_bind(const char_t *type)
         ebind->type = str_c(type);
         ebind->values = arrst_create(EnumVBind);
         arrpt_insert(i_DATABIND.ebinds, index, ebind, EnumBind);
+        i_table_put(&i_DATABIND.etable, tc(ebind->type), ebind);
     }
 
     return ebind;
@@ -1026,9 +1240,9 @@ void dbind_opaque_imp(
     StBind *stbind = i_find_stbind(type, &index);
     cassert(stbind == NULL);
     stbind = heap_new0(StBind);
-    arrpt_insert(i_DATABIND.stbinds, index, stbind, StBind);
     stbind->type = str_c(type);
     stbind->size = sizeof(void*);
+    i_register_stbind(stbind, index);
     stbind->members = NULL;
     stbind->func_data = func_data;
     stbind->func_buffer = func_buffer;
@@ -1623,10 +1837,318 @@ void dbind_destopt_imp(byte_t **data, const char_t *type)
 
 /*---------------------------------------------------------------------------*/
 
+/* Bytes of a member that is serialized as its raw native representation, 0 otherwise */
+static uint16_t i_pod_size(const dtype_t type)
+{
+    switch (type) {
+    case ekDTYPE_BOOL:
+        return sizeof(bool_t);
+    case ekDTYPE_INT8:
+    case ekDTYPE_UINT8:
+        return 1;
+    case ekDTYPE_INT16:
+    case ekDTYPE_UINT16:
+        return 2;
+    case ekDTYPE_INT32:
+    case ekDTYPE_UINT32:
+    case ekDTYPE_REAL32:
+        return 4;
+    case ekDTYPE_INT64:
+    case ekDTYPE_UINT64:
+    case ekDTYPE_REAL64:
+        return 8;
+    case ekDTYPE_ENUM:
+        return sizeof(enum_t) == sizeof(int32_t) ? 4 : 0;
+    case ekDTYPE_STRING:
+    case ekDTYPE_STRING_PTR:
+    case ekDTYPE_ARRAY:
+    case ekDTYPE_ARRPTR:
+    case ekDTYPE_OBJECT:
+    case ekDTYPE_OBJECT_PTR:
+    case ekDTYPE_OBJECT_OPAQUE:
+    case ekDTYPE_UNKNOWN:
+        break;
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_plan_members(ArrSt(i_Op) *plan, uint32_t *run, const StBind *stbind, const uint16_t base)
+{
+    cassert_no_null(run);
+    cassert_no_null(stbind);
+    arrst_foreach(member, stbind->members, DBind)
+        uint16_t offset = (uint16_t)(base + member->offset);
+        if (i_pod_size(member->type) == member->size)
+        {
+            i_Op *op = NULL;
+
+            /* Members adjacent in memory (no padding) join the open run */
+            if (*run != UINT32_MAX)
+            {
+                op = arrst_get(plan, *run, i_Op);
+                if (op->offset + op->size != offset)
+                    op = NULL;
+            }
+
+            if (op != NULL)
+            {
+                op->size = (uint16_t)(op->size + member->size);
+            }
+            else
+            {
+                *run = arrst_size(plan, i_Op);
+                op = arrst_new(plan, i_Op);
+                op->code = i_ekOP_RUN;
+                op->offset = offset;
+                op->size = member->size;
+                op->member = NULL;
+            }
+
+            if (member->type == ekDTYPE_BOOL || member->type == ekDTYPE_REAL32 || member->type == ekDTYPE_REAL64)
+            {
+                op = arrst_new(plan, i_Op);
+                op->code = i_ekOP_FIX;
+                op->offset = offset;
+                op->size = member->size;
+                op->member = member;
+            }
+        }
+        else if (member->type == ekDTYPE_OBJECT)
+        {
+            /* Embedded structs are flattened into the parent plan */
+            i_plan_members(plan, run, member->attr.object.stbind, offset);
+        }
+        else
+        {
+            i_Op *op = arrst_new(plan, i_Op);
+            op->code = i_ekOP_VALUE;
+            op->offset = offset;
+            op->size = member->size;
+            op->member = member;
+            *run = UINT32_MAX;
+        }
+    arrst_end();
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_build_plan(StBind *stbind)
+{
+    uint32_t run = UINT32_MAX;
+    cassert_no_null(stbind);
+    cassert_no_null(stbind->members);
+    arrst_destopt(&stbind->plan, NULL, i_Op);
+    stbind->plan = arrst_create(i_Op);
+    i_plan_members(stbind->plan, &run, stbind, 0);
+
+    /* A single run without padding holes: the whole struct is a byte copy */
+    stbind->pod = FALSE;
+    if (arrst_size(stbind->plan, i_Op) > 0)
+    {
+        const i_Op *op = arrst_get_const(stbind->plan, 0, i_Op);
+        if (op->code == i_ekOP_RUN && op->offset == 0 && op->size == stbind->size)
+            stbind->pod = TRUE;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE const ArrSt(i_Op) *i_plan(const StBind *stbind)
+{
+    cassert_no_null(stbind);
+    cassert_no_null(stbind->plan);
+    return stbind->plan;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_fix_value(DBind *dbind, const dtype_t type, byte_t *data)
+{
+    switch (type) {
+    case ekDTYPE_BOOL:
+        if (*(bool_t*)data != 0 && *(bool_t*)data != 1)
+        {
+            log_printf("Error reading boolean.");
+            *(bool_t*)data = FALSE;
+        }
+        break;
+
+    case ekDTYPE_REAL32:
+        if (dbind != NULL)
+            *(real32_t*)data = _dbind_real32(dbind, *(real32_t*)data);
+        break;
+
+    case ekDTYPE_REAL64:
+        if (dbind != NULL)
+            *(real64_t*)data = _dbind_real64(dbind, *(real64_t*)data);
+        break;
+
+    case ekDTYPE_INT8:
+    case ekDTYPE_INT16:
+    case ekDTYPE_INT32:
+    case ekDTYPE_INT64:
+    case ekDTYPE_UINT8:
+    case ekDTYPE_UINT16:
+    case ekDTYPE_UINT32:
+    case ekDTYPE_UINT64:
+    case ekDTYPE_ENUM:
+    case ekDTYPE_STRING:
+    case ekDTYPE_STRING_PTR:
+    case ekDTYPE_ARRAY:
+    case ekDTYPE_ARRPTR:
+    case ekDTYPE_OBJECT:
+    case ekDTYPE_OBJECT_PTR:
+    case ekDTYPE_OBJECT_OPAQUE:
+    case ekDTYPE_UNKNOWN:
+        break;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static bool_t i_read_plan(Stream *stm, byte_t *object, const ArrSt(i_Op) *plan)
+{
+    bool_t ok = TRUE;
+    arrst_foreach_const(op, plan, i_Op)
+        switch (op->code) {
+        case i_ekOP_RUN:
+            stm_read(stm, object + op->offset, (uint32_t)op->size);
+            ok &= (bool_t)(stm_state(stm) == ekSTOK);
+            break;
+
+        case i_ekOP_FIX:
+            i_fix_value(op->member, op->member->type, object + op->offset);
+            break;
+
+        case i_ekOP_VALUE:
+            ok &= i_read_value(stm, op->member, op->member->type, i_subtype_str(op->member), object + op->offset);
+            break;
+
+        cassert_default();
+        }
+    arrst_end();
+    return ok;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_write_plan(Stream *stm, const byte_t *object, const ArrSt(i_Op) *plan)
+{
+    arrst_foreach_const(op, plan, i_Op)
+        switch (op->code) {
+        case i_ekOP_RUN:
+            stm_write(stm, object + op->offset, (uint32_t)op->size);
+            break;
+
+        case i_ekOP_FIX:
+            break;
+
+        case i_ekOP_VALUE:
+            i_write_value(stm, op->member, op->member->type, i_subtype_str(op->member), (const void*)(object + op->offset));
+            break;
+
+        cassert_default();
+        }
+    arrst_end();
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Arrays of raw elements are transferred in blocks, not element by element */
+static bool_t i_read_block(Stream *stm, Array *array, uint32_t n, const uint32_t esize, const dtype_t type, const ArrSt(i_Op) *plan)
+{
+    uint32_t chunk = PLAN_BLOCK / esize;
+    if (chunk == 0)
+        chunk = 1;
+
+    while (n > 0)
+    {
+        uint32_t i, m = n < chunk ? n : chunk;
+        byte_t *data = array_insert(array, UINT32_MAX, m);
+        stm_read(stm, data, m * esize);
+
+        /* Partially read elements are not left in the array */
+        if (stm_state(stm) != ekSTOK)
+        {
+            array_delete(array, array_size(array) - m, m, NULL);
+            return FALSE;
+        }
+
+        if (plan != NULL)
+        {
+            for (i = 0; i < m; ++i, data += esize)
+            {
+                arrst_foreach_const(op, plan, i_Op)
+                    if (op->code == i_ekOP_FIX)
+                        i_fix_value(op->member, op->member->type, data + op->offset);
+                arrst_end();
+            }
+        }
+        else if (type == ekDTYPE_BOOL)
+        {
+            for (i = 0; i < m; ++i, data += esize)
+                i_fix_value(NULL, type, data);
+        }
+
+        n -= m;
+    }
+
+    return TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_write_block(Stream *stm, const byte_t *data, uint32_t n, const uint32_t esize)
+{
+    uint32_t chunk = PLAN_BLOCK / esize;
+    if (chunk == 0)
+        chunk = 1;
+
+    while (n > 0)
+    {
+        uint32_t m = n < chunk ? n : chunk;
+        stm_write(stm, data, m * esize);
+        data += m * esize;
+        n -= m;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
 static bool_t i_read_array(Stream *stm, dtype_t type, const char_t *subtype, Array *array)
 {
     bool_t ok = TRUE;
     uint32_t i, n = stm_read_u32(stm);
+    uint32_t esize = array_esize(array);
+    if (stm_get_read_endian(stm) == osbs_endian())
+    {
+        if (i_pod_size(type) == esize)
+            return i_read_block(stm, array, n, esize, type, NULL);
+
+        if (type == ekDTYPE_OBJECT)
+        {
+            StBind *stbind = i_find_stbind(subtype, NULL);
+            const ArrSt(i_Op) *plan = NULL;
+            cassert_msg(stbind != NULL, "DBind: Unknown struct type.");
+            plan = i_plan(stbind);
+            if (stbind->pod == TRUE && stbind->size == esize)
+                return i_read_block(stm, array, n, esize, type, plan);
+
+            for (i = 0; i < n; ++i)
+            {
+                byte_t *obj = array_insert(array, UINT32_MAX, 1);
+                bmem_set_zero(obj, stbind->size);
+                i_init_object(obj, stbind, stbind->size);
+                ok &= i_read_plan(stm, obj, plan);
+            }
+
+            return ok;
+        }
+    }
+
     for (i = 0; i < n; ++i)
     {
         byte_t *obj = array_insert(array, UINT32_MAX, 1);
@@ -1663,13 +2185,16 @@ static bool_t i_read_arrpt(Stream *stm, const char_t *type, Array *array)
 
 /*---------------------------------------------------------------------------*/
 
-static bool_t i_read_object(Stream *stm, const char_t *type, void *object)
+static bool_t i_read_stbind(Stream *stm, StBind *stbind, void *object)
 {
     bool_t ok = TRUE;
-    if (object != NULL)
+    cassert_no_null(stbind);
+    if (stm_get_read_endian(stm) == osbs_endian())
+    {
+        ok = i_read_plan(stm, (byte_t*)object, i_plan(stbind));
+    }
+    else
     {
-        StBind *stbind = i_find_stbind(type, NULL);
-        cassert_msg(stbind != NULL, "DBind: Unknown struct type.");
         arrst_foreach(member, stbind->members, DBind)
             dtype_t mtype = member->type;
             const char_t *mstype = i_subtype_str(member);
@@ -1683,6 +2208,21 @@ static bool_t i_read_object(Stream *stm, const char_t *type, void *object)
 
 /*---------------------------------------------------------------------------*/
 
+static bool_t i_read_object(Stream *stm, const char_t *type, void *object)
+{
+    bool_t ok = TRUE;
+    if (object != NULL)
+    {
+        StBind *stbind = i_find_stbind(type, NULL);
+        cassert_msg(stbind != NULL, "DBind: Unknown struct type.");
+        ok = i_read_stbind(stm, stbind, object);
+    }
+
+    return ok;
+}
+
+/*---------------------------------------------------------------------------*/
+
 static void i_read_opaque(Stream *stm, const char_t *type, void **data)
 {
     StBind *stbind = i_find_stbind(type, NULL);
@@ -1812,6 +2352,8 @@ static bool_t i_read_value(Stream *stm, DBind *dbind, dtype_t type, const char_t
         return i_read_arrpt(stm, subtype, *(Array**)data);
 
     case ekDTYPE_OBJECT:
+        if (dbind != NULL)
+            return i_read_stbind(stm, dbind->attr.object.stbind, data);
         return i_read_object(stm, subtype, data);
 
     case ekDTYPE_OBJECT_PTR:
@@ -1983,12 +2525,15 @@ void *dbind_read_imp(Stream *stm, const char_t *type)
 
 /*---------------------------------------------------------------------------*/
 
-static void i_write_object(Stream *stm, const void *object, const char_t *type)
+static void i_write_stbind(Stream *stm, StBind *stbind, const void *object)
 {
-    if (object != NULL)
+    cassert_no_null(stbind);
+    if (stm_get_write_endian(stm) == osbs_endian())
+    {
+        i_write_plan(stm, (const byte_t*)object, i_plan(stbind));
+    }
+    else
     {
-        StBind *stbind = i_find_stbind(type, NULL);
-        cassert_msg(stbind != NULL, "DBind: Unknown struct type.");
         arrst_foreach(member, stbind->members, DBind)
             dtype_t mtype = member->type;
             const char_t *mstype = i_subtype_str(member);
@@ -2000,6 +2545,18 @@ static void i_write_object(Stream *stm, const void *object, const char_t *type)
 
 /*---------------------------------------------------------------------------*/
 
+static void i_write_object(Stream *stm, const void *object, const char_t *type)
+{
+    if (object != NULL)
+    {
+        StBind *stbind = i_find_stbind(type, NULL);
+        cassert_msg(stbind != NULL, "DBind: Unknown struct type.");
+        i_write_stbind(stm, stbind, object);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
 static void i_write_opaque(Stream *stm, const void *object, const char_t *type)
 {
     if (object != NULL)
@@ -2058,8 +2615,31 @@ static void i_write_array(Stream *stm, const Array *array, const char_t *type)
         dtype_t atype = i_data_type(type, &subtype, NULL);
         const char_t *stype = subtype != NULL ? tc(subtype) : NULL;
         stm_write_u32(stm, n);
-        for (i = 0; i < n; ++i, data += es)
-            i_write_value(stm, NULL, atype, stype, (const void*)data);
+        if (stm_get_write_endian(stm) == osbs_endian() && i_pod_size(atype) == es)
+        {
+            i_write_block(stm, data, n, es);
+        }
+        else if (stm_get_write_endian(stm) == osbs_endian() && atype == ekDTYPE_OBJECT)
+        {
+            StBind *stbind = i_find_stbind(stype, NULL);
+            const ArrSt(i_Op) *plan = NULL;
+            cassert_msg(stbind != NULL, "DBind: Unknown struct type.");
+            plan = i_plan(stbind);
+            if (stbind->pod == TRUE && stbind->size == es)
+            {
+                i_write_block(stm, data, n, es);
+            }
+            else
+            {
+                for (i = 0; i < n; ++i, data += es)
+                    i_write_plan(stm, data, plan);
+            }
+        }
+        else
+        {
+            for (i = 0; i < n; ++i, data += es)
+                i_write_value(stm, NULL, atype, stype, (const void*)data);
+        }
         str_destopt(&subtype);
     }
     else
@@ -2168,7 +2748,10 @@ static void i_write_value(Stream *stm, DBind *dbind, dtype_t type, const char_t
                 i_write_arrpt(stm, (Array*)data, subtype);
             break;
         case ekDTYPE_OBJECT:
-            i_write_object(stm, data, subtype);
+            if (dbind != NULL)
+                i_write_stbind(stm, dbind->attr.object.stbind, data);
+            else
+                i_write_object(stm, data, subtype);
             break;
         case ekDTYPE_OBJECT_PTR:
             i_write_object(stm, *(const void**)data, subtype);
@@ -2193,9 +2776,140 @@ void dbind_write_imp(Stream *stm, const void *data, const char_t *type)
 
 /*---------------------------------------------------------------------------*/
 
-static DBind *i_find_by_name(ArrSt(DBind) *members, const char_t *name)
+/*
+ * Minimal perfect hash of member names (hash and displace). Names fall in
+ * 'n' buckets by i_hash(name, 0). Each bucket, largest first, searches a
+ * seed that sends all its names to free slots of the 'n' slot table. Single
+ * name buckets store the slot directly as a negative displacement.
+ */
+static void i_mph(StBind *stbind)
 {
-    arrst_foreach(member, members, DBind)
+    uint32_t i, n = arrst_size(stbind->members, DBind);
+    cassert(stbind->hashed == FALSE);
+    stbind->hashed = TRUE;
+    if (n > 0)
+    {
+        const DBind *members = arrst_all_const(stbind->members, DBind);
+        uint32_t *bucket = heap_new_n(n, uint32_t);
+        uint32_t *count = heap_new_n0(n, uint32_t);
+        uint32_t *pos = heap_new_n(n, uint32_t);
+        uint32_t *tmp = heap_new_n(n, uint32_t);
+        uint32_t size = 0, next = 0;
+        bool_t ok = TRUE;
+
+        stbind->nslots = n;
+        stbind->disp = heap_new_n0(n, int32_t);
+        stbind->slots = heap_new_n0(n, DBind*);
+
+        for (i = 0; i < n; ++i)
+        {
+            bucket[i] = i_hash(tc(members[i].name), 0) % n;
+            count[bucket[i]] += 1;
+        }
+
+        for (i = 0; i < n; ++i)
+        {
+            if (count[i] > size)
+                size = count[i];
+        }
+
+        for (; size > 1 && ok == TRUE; --size)
+        {
+            uint32_t b;
+            for (b = 0; b < n && ok == TRUE; ++b)
+            {
+                uint32_t seed;
+                if (count[b] != size)
+                    continue;
+
+                for (seed = 1; seed < 0x100000; ++seed)
+                {
+                    uint32_t j, m = 0;
+                    for (i = 0; i < n; ++i)
+                    {
+                        if (bucket[i] == b)
+                        {
+                            uint32_t slot = i_hash(tc(members[i].name), seed) % n;
+                            if (stbind->slots[slot] != NULL)
+                                break;
+
+                            for (j = 0; j < m; ++j)
+                            {
+                                if (pos[j] == slot)
+                                    break;
+                            }
+
+                            if (j < m)
+                                break;
+
+                            tmp[m] = i;
+                            pos[m++] = slot;
+                        }
+                    }
+
+                    if (i == n)
+                    {
+                        for (j = 0; j < m; ++j)
+                            stbind->slots[pos[j]] = (DBind*)&members[tmp[j]];
+                        stbind->disp[b] = (int32_t)seed;
+                        break;
+                    }
+                }
+
+                if (seed == 0x100000)
+                    ok = FALSE;
+            }
+        }
+
+        for (i = 0; i < n && ok == TRUE; ++i)
+        {
+            if (count[bucket[i]] == 1)
+            {
+                while (stbind->slots[next] != NULL)
+                    next += 1;
+                stbind->slots[next] = (DBind*)&members[i];
+                stbind->disp[bucket[i]] = -(int32_t)next - 1;
+            }
+        }
+
+        heap_delete_n(&bucket, n, uint32_t);
+        heap_delete_n(&count, n, uint32_t);
+        heap_delete_n(&pos, n, uint32_t);
+        heap_delete_n(&tmp, n, uint32_t);
+
+        /* Degenerate names (duplicated?) keep the linear search */
+        if (ok == FALSE)
+        {
+            i_remove_mph(stbind);
+            stbind->hashed = TRUE;
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static DBind *i_find_by_name(StBind *stbind, const char_t *name)
+{
+    cassert_no_null(stbind);
+    if (stbind->members == NULL)
+        return NULL;
+
+    cassert(stbind->hashed == TRUE);
+    if (stbind->disp != NULL)
+    {
+        int32_t disp = stbind->disp[i_hash(name, 0) % stbind->nslots];
+        if (disp != 0)
+        {
+            uint32_t slot = disp < 0 ? (uint32_t)(-disp - 1) : i_hash(name, (uint32_t)disp) % stbind->nslots;
+            DBind *member = stbind->slots[slot];
+            if (str_equ_c(tc(member->name), name) == TRUE)
+                return member;
+        }
+
+        return NULL;
+    }
+
+    arrst_foreach(member, stbind->members, DBind)
         if (str_equ_c(tc(member->name), name) == TRUE)
             return member;
     arrst_end();
@@ -2209,7 +2923,7 @@ static DBind *i_member(const char_t *type, const char_t *name)
     StBind *stbind = i_find_stbind(type, NULL);
     if (stbind == NULL)
         return NULL;
-    return i_find_by_name(stbind->members, name);
+    return i_find_by_name(stbind, name);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -2602,6 +3316,7 @@ DBind *_dbind_member(const char_t *type, const char_t *name)
     return i_member(type, name);
 }
 
+
 /*---------------------------------------------------------------------------*/
 
 dtype_t _dbind_member_type(const DBind *dbind)
@@ -12,10 +12,14 @@
 
 #include "event.h"
 #include "event.inl"
+#include "bmutex.h"
 #include "cassert.h"
 #include "heap.h"
+#include "log.h"
 #include "strings.h"
 
+#define LISTENER_CHUNK  64
+
 struct _event_t
 {
     uint32_t type;
@@ -33,6 +37,7 @@ struct _event_t
     EventHandler member_event_handler;
 };
 
+/* 'event.member_event_handler' is set once. listener_pass_event() restores it after each call */
 struct _listener_t
 {
     void *object;
@@ -40,17 +45,115 @@ struct _listener_t
     FPtr_event_handler func_event_handler;
     EventHandler member_event_handler;
     Event event;
+    Listener *next;
+};
+
+typedef struct i_chunk_t i_Chunk;
+typedef struct i_pool_t i_Pool;
+
+struct i_chunk_t
+{
+    i_Chunk *next;
+    Listener listeners[LISTENER_CHUNK];
 };
 
+/* Listeners are recycled through 'free'. Chunks return to the heap in _event_finish() */
+struct i_pool_t
+{
+    Mutex *mutex;
+    i_Chunk *chunks;
+    Listener *free;
+    uint32_t live;
+};
+
+static i_Pool i_POOL;
+
+/*---------------------------------------------------------------------------*/
+
+void _event_start(void)
+{
+    cassert(i_POOL.mutex == NULL);
+    i_POOL.mutex = bmutex_create();
+    i_POOL.chunks = NULL;
+    i_POOL.free = NULL;
+    i_POOL.live = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void _event_finish(void)
+{
+    cassert_no_null(i_POOL.mutex);
+    /* With leaks, chunks are kept and reported by the heap auditor ('ListenerPool') */
+    if (i_POOL.live == 0)
+    {
+        while (i_POOL.chunks != NULL)
+        {
+            i_Chunk *next = i_POOL.chunks->next;
+            heap_free((byte_t**)&i_POOL.chunks, (uint32_t)sizeof(i_Chunk), "ListenerPool");
+            i_POOL.chunks = next;
+        }
+    }
+    else
+    {
+        log_printf("'Listener' leaks: %u", i_POOL.live);
+    }
+
+    i_POOL.free = NULL;
+    bmutex_close(&i_POOL.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static Listener *i_pool_get(void)
+{
+    Listener *listener = NULL;
+    cassert_no_null(i_POOL.mutex);
+    bmutex_lock(i_POOL.mutex);
+    if (i_POOL.free == NULL)
+    {
+        i_Chunk *chunk = (i_Chunk*)heap_malloc((uint32_t)sizeof(i_Chunk), "ListenerPool");
+        uint32_t i;
+        chunk->next = i_POOL.chunks;
+        i_POOL.chunks = chunk;
+        for (i = 0; i < LISTENER_CHUNK; ++i)
+            chunk->listeners[i].next = i + 1 < LISTENER_CHUNK ? &chunk->listeners[i + 1] : NULL;
+        i_POOL.free = chunk->listeners;
+    }
+
+    listener = i_POOL.free;
+    i_POOL.free = listener->next;
+    i_POOL.live += 1;
+    bmutex_unlock(i_POOL.mutex);
+    return listener;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_pool_release(Listener **listener)
+{
+    cassert_no_null(listener);
+    cassert_no_null(*listener);
+    bmutex_lock(i_POOL.mutex);
+    cassert(i_POOL.live > 0);
+    (*listener)->next = i_POOL.free;
+    i_POOL.free = *listener;
+    i_POOL.live -= 1;
+    bmutex_unlock(i_POOL.mutex);
+    *listener = NULL;
+}
+
 /*---------------------------------------------------------------------------*/
 
 static Listener *i_create_listener(void *object, FPtr_release func_release, FPtr_event_handler func_event_handler, EventHandler member_event_handler)
 {
-    Listener *listener = heap_new(Listener);
+    Listener *listener = i_pool_get();
     listener->object = object;
     listener->func_release = func_release;
     listener->func_event_handler = func_event_handler;
     listener->member_event_handler = member_event_handler;
+    listener->event.member_event_handler = member_event_handler;
+    listener->next = NULL;
     return listener;
 }
 
@@ -95,7 +198,7 @@ void listener_destroy(Listener **listener)
     {
         if ((*listener)->func_release != NULL)
             (*listener)->func_release(&(*listener)->object);
-        heap_delete(listener, Listener);
+        i_pool_release(listener);
     }
 }
 
@@ -130,7 +233,6 @@ void listener_event_imp(Listener *listener, const uint32_t type, void *sender, v
     listener->event.sender = sender;
     listener->event.params = params;
     listener->event.result = result;
-    listener->event.member_event_handler = listener->member_event_handler;
     #if defined (__ASSERTS__)
     listener->event.sender_type = sender_type;
     listener->event.params_type = params_type;
@@ -178,6 +280,18 @@ void listener_pass_event_imp(Listener *listener, Event *event, void *sender, con
 
 /*---------------------------------------------------------------------------*/
 
+#if defined(__ASSERTS__)
+/* Type names are literals from the macros, usually merged by the linker: compare the address first */
+static __INLINE bool_t i_type_equ(const char_t *type1, const char_t *type2)
+{
+    if (type1 == type2)
+        return TRUE;
+    return str_equ_c(type1, type2);
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+
 uint32_t event_type(const Event *event)
 {
     cassert_no_null(event);
@@ -192,7 +306,7 @@ void *event_sender_imp(Event *event, const char_t *type)
     #if defined(__ASSERTS__)
     if (type != NULL)
     {
-        cassert(str_equ_c(type, event->sender_type) == TRUE);
+        cassert(i_type_equ(type, event->sender_type) == TRUE);
     }
     #else
     unref(type);
@@ -208,7 +322,7 @@ void *event_params_imp(Event *event, const char_t *type)
     #if defined(__ASSERTS__)
     if (type != NULL)
     {
-        cassert(str_equ_c(type, event->params_type) == TRUE);
+        cassert(i_type_equ(type, event->params_type) == TRUE);
     }
     #else
     unref(type);
@@ -224,7 +338,7 @@ void *event_result_imp(Event *event, const char_t *type)
     #if defined(__ASSERTS__)
     if (type != NULL)
     {
-        cassert(str_equ_c(type, event->result_type) == TRUE);
+        cassert(i_type_equ(type, event->result_type) == TRUE);
     }
     #else
     unref(type);
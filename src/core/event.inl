@@ -14,6 +14,10 @@
 
 __EXTERN_C
 
+void _event_start(void);
+
+void _event_finish(void);
+
 Listener *listener_copy(const Listener *listener);
 
 void listener_retain(Listener *listener, FPtr_retain func_retain, FPtr_release func_release);
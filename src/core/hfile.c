@@ -12,17 +12,39 @@
 
 #include "hfile.h"
 #include "hfile.inl"
+#include "arrpt.h"
 #include "arrst.h"
 #include "bfile.h"
+#include "bhash.h"
+#include "bmem.h"
+#include "bmutex.h"
 #include "bstd.h"
+#include "bthread.h"
 #include "buffer.h"
 #include "cassert.h"
 #include "date.h"
 #include "event.h"
+#include "heap.h"
 #include "ptr.h"
 #include "stream.h"
 #include "strings.h"
 
+#define SYNC_MAX_THREADS    64
+#define WALK_MAX_THREADS    64
+#define HASH_CHUNK          0x100000
+#define MANIFEST_MAGIC      0x4E4D4E46
+#define MANIFEST_VERSION    2
+
+typedef struct i_copy_t i_Copy;
+typedef struct i_mentry_t i_MEntry;
+typedef struct i_chunk_t i_Chunk;
+typedef struct i_hash_t i_Hash;
+typedef struct i_syncopts_t i_SyncOpts;
+typedef struct i_sync_t i_Sync;
+typedef struct i_wentry_t i_WEntry;
+typedef struct i_wnode_t i_WNode;
+typedef struct i_walk_t i_Walk;
+
 enum i_flag_t
 {
     i_ekDIR_FORBIDDEN           = 1,
@@ -31,6 +53,14 @@ enum i_flag_t
     i_ekHIDDEN_SUBDIRS          = 4
 };
 
+enum i_cflag_t
+{
+    i_ekCOPY                    = 0,
+    i_ekHASH_SRC                = 1,
+    i_ekHASH_DEST               = 2,
+    i_ekNO_HASH                 = 3
+};
+
 /*---------------------------------------------------------------------------*/
 
 bool_t hfile_dir(const char_t *pathname)
@@ -128,6 +158,118 @@ bool_t hfile_dir_destroy(const char_t *pathname, ferror_t *error)
     return ok;
 }
 
+/* Only files with the i_ekCOPY flag are copied. The rest are kept for the manifest */
+struct i_copy_t
+{
+    String *from;
+    String *to;
+    uint64_t size;
+    uint64_t smtime;
+    uint64_t dmtime;
+    uint64_t shash;
+    uint64_t dhash;
+    uint32_t schunk;
+    uint32_t dchunk;
+    uint32_t flags;
+};
+
+/* Manifest record. 'hash' is the content of 'path' (source) and its copy */
+struct i_mentry_t
+{
+    String *path;
+    uint64_t size;
+    uint64_t smtime;
+    uint64_t dmtime;
+    uint64_t hash;
+};
+
+/* A block of HASH_CHUNK bytes (or less), hashed by any worker */
+struct i_chunk_t
+{
+    const char_t *pathname;
+    uint64_t offset;
+    uint32_t size;
+    bool_t ok;
+    uint64_t hash;
+};
+
+struct i_syncopts_t
+{
+    bool_t recursive;
+    bool_t remove_in_dest;
+    const char_t **except;
+    uint32_t except_size;
+    const ArrSt(i_MEntry) *manifest;
+};
+
+/* Copies are taken in order by the workers from a shared counter */
+struct i_sync_t
+{
+    Mutex *mutex;
+    i_Copy *copies;
+    uint32_t ncopies;
+    uint32_t next;
+    bool_t manifest;
+    bool_t ok;
+    ferror_t error;
+};
+
+/* Same for chunks */
+struct i_hash_t
+{
+    Mutex *mutex;
+    i_Chunk *chunks;
+    uint32_t nchunks;
+    uint32_t next;
+};
+
+/* Directory entry, kept only by the ordered walker */
+struct i_wentry_t
+{
+    String *name;
+    i_WNode *subdir;
+};
+
+/* Directory to be listed by any worker */
+struct i_wnode_t
+{
+    String *pathname;
+    uint32_t nameoff;
+    uint32_t depth;
+    i_WNode *parent;
+    uint32_t pending;
+    bool_t listed;
+    bool_t skip;
+    ArrSt(i_WEntry) *entries;
+};
+
+/*
+ * Nodes and flags are guarded by 'mutex'. Listener calls by 'evmutex'.
+ * 'work' is posted once per queued dir and 'nthreads' times at the end.
+ * 'listed' once per ordered dir listed.
+ */
+struct i_walk_t
+{
+    Mutex *mutex;
+    Mutex *evmutex;
+    Semaphore *work;
+    Semaphore *listed;
+    Listener *listener;
+    uint32_t flags;
+    bool_t ordered;
+    ArrPt(i_WNode) *queue;
+    uint32_t nthreads;
+    uint32_t active;
+    bool_t stop;
+    ferror_t error;
+};
+
+DeclSt(i_Copy);
+DeclSt(i_MEntry);
+DeclSt(i_Chunk);
+DeclSt(i_WEntry);
+DeclPt(i_WNode);
+
 /*---------------------------------------------------------------------------*/
 
 static int i_cmp_entry(const DirEntry *entry1, const DirEntry *entry2)
@@ -234,12 +376,344 @@ static bool_t i_except(const char_t *name, const char_t **except, const uint32_t
 
 /*---------------------------------------------------------------------------*/
 
-bool_t hfile_dir_sync(const char_t *src, const char_t *dest, const bool_t recursive, const bool_t remove_in_dest, const char_t **except, const uint32_t except_size, ferror_t *error)
+/* Same order as date_cmp(), second resolution */
+static uint64_t i_date_key(const Date *date)
+{
+    cassert_no_null(date);
+    return ((uint64_t)(uint16_t)date->year << 40)
+        | ((uint64_t)date->month << 32)
+        | ((uint64_t)date->mday << 24)
+        | ((uint64_t)date->hour << 16)
+        | ((uint64_t)date->minute << 8)
+        | (uint64_t)date->second;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_remove_mentry(i_MEntry *entry)
+{
+    cassert_no_null(entry);
+    str_destroy(&entry->path);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int i_cmp_mentry(const i_MEntry *entry1, const i_MEntry *entry2)
+{
+    cassert_no_null(entry1);
+    cassert_no_null(entry2);
+    return str_cmp(entry1->path, tc(entry2->path));
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int i_cmp_mentry_path(const i_MEntry *entry, const char_t *path)
+{
+    cassert_no_null(entry);
+    return str_cmp(entry->path, path);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Strings can't be bigger than the remaining bytes of the manifest. NULL if damaged */
+static String *i_manifest_str(Stream *stm, uint64_t *left)
+{
+    String *str = NULL;
+    uint32_t size = 0;
+    cassert_no_null(left);
+    size = stm_read_u32(stm);
+    if (stm_state(stm) != ekSTOK || size == 0 || size > *left)
+        return NULL;
+
+    str = str_reserve(size - 1);
+    stm_read(stm, (byte_t*)tcc(str), size);
+    tcc(str)[size - 1] = '\0';
+    *left -= size;
+    return str;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * Missing or damaged manifests are empty: all files will be hashed again.
+ * Also the manifests of another destination, the copies are not the same.
+ * A file modified in the same second the manifest was created can't be
+ * told apart by its date, so its mtime is dropped and it will be rehashed.
+ */
+static ArrSt(i_MEntry) *i_manifest_read(const char_t *pathname, const char_t *dest)
+{
+    ArrSt(i_MEntry) *manifest = arrst_create(i_MEntry);
+    uint64_t left = 0;
+    Stream *stm = NULL;
+    if (bfile_lstat(pathname, NULL, &left, NULL, NULL) == TRUE)
+        stm = stm_from_file(pathname, NULL);
+
+    if (stm != NULL)
+    {
+        if (stm_read_u32(stm) == MANIFEST_MAGIC && stm_read_u32(stm) == MANIFEST_VERSION)
+        {
+            uint64_t stamp = stm_read_u64(stm);
+            String *mdest = i_manifest_str(stm, &left);
+            if (mdest != NULL && str_equ(mdest, dest) == TRUE)
+            {
+                uint32_t i, n = stm_read_u32(stm);
+                for (i = 0; i < n && stm_state(stm) == ekSTOK; ++i)
+                {
+                    String *path = i_manifest_str(stm, &left);
+                    i_MEntry *entry = NULL;
+                    if (path == NULL)
+                        break;
+
+                    entry = arrst_new(manifest, i_MEntry);
+                    entry->path = path;
+                    entry->size = stm_read_u64(stm);
+                    entry->smtime = stm_read_u64(stm);
+                    entry->dmtime = stm_read_u64(stm);
+                    entry->hash = stm_read_u64(stm);
+                    if (entry->smtime >= stamp)
+                        entry->smtime = 0;
+                    if (entry->dmtime >= stamp)
+                        entry->dmtime = 0;
+                }
+
+                if (i < n || stm_state(stm) != ekSTOK)
+                    arrst_clear(manifest, i_remove_mentry, i_MEntry);
+            }
+
+            str_destopt(&mdest);
+        }
+
+        stm_close(&stm);
+    }
+
+    arrst_sort(manifest, i_cmp_mentry, i_MEntry);
+    return manifest;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_manifest_write(const char_t *pathname, const char_t *dest, const ArrSt(i_MEntry) *manifest)
+{
+    Stream *stm = stm_to_file(pathname, NULL);
+    if (stm != NULL)
+    {
+        Date date = date_system();
+        uint32_t size = str_len_c(dest) + 1;
+        stm_write_u32(stm, MANIFEST_MAGIC);
+        stm_write_u32(stm, MANIFEST_VERSION);
+        stm_write_u64(stm, i_date_key(&date));
+        stm_write_u32(stm, size);
+        stm_write(stm, (const byte_t*)dest, size);
+        stm_write_u32(stm, arrst_size(manifest, i_MEntry));
+        arrst_foreach_const(entry, manifest, i_MEntry)
+            str_write(stm, entry->path);
+            stm_write_u64(stm, entry->size);
+            stm_write_u64(stm, entry->smtime);
+            stm_write_u64(stm, entry->dmtime);
+            stm_write_u64(stm, entry->hash);
+        arrst_end();
+        stm_close(&stm);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Sides whose (size, mtime) still match the manifest are not hashed again */
+static void i_manifest_check(const ArrSt(i_MEntry) *manifest, i_Copy *copy)
+{
+    const i_MEntry *entry = NULL;
+    cassert_no_null(copy);
+    entry = arrst_bsearch_const(manifest, i_cmp_mentry_path, tc(copy->from), NULL, i_MEntry, char_t);
+
+    if (entry != NULL && entry->size == copy->size && entry->smtime == copy->smtime)
+        copy->shash = entry->hash;
+    else
+        BIT_SET(copy->flags, i_ekHASH_SRC);
+
+    if (BIT_TEST(copy->flags, i_ekCOPY) == FALSE)
+    {
+        if (entry != NULL && entry->size == copy->size && entry->dmtime == copy->dmtime)
+            copy->dhash = entry->hash;
+        else
+            BIT_SET(copy->flags, i_ekHASH_DEST);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_add_chunks(ArrSt(i_Chunk) *chunks, const char_t *pathname, const uint64_t size)
+{
+    uint32_t first = arrst_size(chunks, i_Chunk);
+    uint64_t offset = 0;
+    while (offset < size)
+    {
+        i_Chunk *chunk = arrst_new(chunks, i_Chunk);
+        chunk->pathname = pathname;
+        chunk->offset = offset;
+        chunk->size = (uint32_t)(size - offset < HASH_CHUNK ? size - offset : HASH_CHUNK);
+        chunk->ok = FALSE;
+        chunk->hash = 0;
+        offset += chunk->size;
+    }
+
+    return first;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* The file hash combines the chunk hashes, so large files are hashed in parallel */
+static bool_t i_file_hash(const i_Chunk *chunks, const uint32_t first, const uint64_t size, uint64_t *hash)
+{
+    uint64_t n = (size + HASH_CHUNK - 1) / HASH_CHUNK, i;
+    cassert_no_null(hash);
+    *hash = size;
+    for (i = 0; i < n; ++i)
+    {
+        if (chunks[first + i].ok == FALSE)
+            return FALSE;
+        *hash = bhash_from_block64((const byte_t*)&chunks[first + i].hash, sizeof(uint64_t), *hash);
+    }
+
+    return TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_hash_main(i_Hash *hash)
+{
+    byte_t *buffer = heap_new_n(HASH_CHUNK, byte_t);
+    cassert_no_null(hash);
+    for (;;)
+    {
+        i_Chunk *chunk = NULL;
+        File *file = NULL;
+        bmutex_lock(hash->mutex);
+        if (hash->next < hash->nchunks)
+            chunk = &hash->chunks[hash->next++];
+        bmutex_unlock(hash->mutex);
+
+        if (chunk == NULL)
+            break;
+
+        file = bfile_open(chunk->pathname, ekREAD, NULL);
+        if (file != NULL)
+        {
+            uint32_t rsize = 0;
+            if (chunk->offset == 0 || bfile_seek(file, (int64_t)chunk->offset, ekSEEKSET, NULL) == TRUE)
+            {
+                while (rsize < chunk->size)
+                {
+                    uint32_t r = 0;
+                    if (bfile_read(file, buffer + rsize, chunk->size - rsize, &r, NULL) == FALSE || r == 0)
+                        break;
+                    rsize += r;
+                }
+            }
+
+            if (rsize == chunk->size)
+            {
+                chunk->hash = bhash_from_block64(buffer, chunk->size, 0);
+                chunk->ok = TRUE;
+            }
+
+            bfile_close(&file);
+        }
+    }
+
+    heap_delete_n(&buffer, HASH_CHUNK, byte_t);
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* The calling thread is also a worker */
+static void i_pool(FPtr_thread_main func_main, void *data, const uint32_t nthreads)
+{
+    Thread *threads[SYNC_MAX_THREADS];
+    uint32_t nth = nthreads < SYNC_MAX_THREADS ? nthreads : SYNC_MAX_THREADS, i;
+    for (i = 1; i < nth; ++i)
+        threads[i] = bthread_create_imp(func_main, data);
+
+    func_main(data);
+
+    for (i = 1; i < nth; ++i)
+    {
+        if (threads[i] != NULL)
+        {
+            bthread_wait(threads[i]);
+            bthread_close(&threads[i]);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Hashes the pending sides. Different content (or unreadable) --> Copy. FALSE if all matched the manifest */
+static bool_t i_hash_copies(i_Copy *copies, const uint32_t ncopies, const uint32_t nthreads)
+{
+    ArrSt(i_Chunk) *chunks = arrst_create(i_Chunk);
+    bool_t changes = FALSE;
+    uint32_t i;
+    for (i = 0; i < ncopies; ++i)
+    {
+        if (BIT_TEST(copies[i].flags, i_ekHASH_SRC) == TRUE)
+            copies[i].schunk = i_add_chunks(chunks, tc(copies[i].from), copies[i].size);
+        if (BIT_TEST(copies[i].flags, i_ekHASH_DEST) == TRUE)
+            copies[i].dchunk = i_add_chunks(chunks, tc(copies[i].to), copies[i].size);
+    }
+
+    if (arrst_size(chunks, i_Chunk) > 0)
+    {
+        i_Hash hash;
+        uint32_t nth = nthreads;
+        hash.mutex = bmutex_create();
+        hash.chunks = arrst_all(chunks, i_Chunk);
+        hash.nchunks = arrst_size(chunks, i_Chunk);
+        hash.next = 0;
+        if (nth > hash.nchunks)
+            nth = hash.nchunks;
+        if (nth > 1)
+            heap_start_mt();
+        i_pool((FPtr_thread_main)i_hash_main, &hash, nth);
+        if (nth > 1)
+            heap_end_mt();
+        bmutex_close(&hash.mutex);
+    }
+
+    for (i = 0; i < ncopies; ++i)
+    {
+        const i_Chunk *all = arrst_all_const(chunks, i_Chunk);
+        i_Copy *copy = &copies[i];
+        if (BIT_TEST(copy->flags, i_ekHASH_SRC) == TRUE && i_file_hash(all, copy->schunk, copy->size, &copy->shash) == FALSE)
+        {
+            BIT_SET(copy->flags, i_ekNO_HASH);
+            BIT_SET(copy->flags, i_ekCOPY);
+        }
+
+        if (BIT_TEST(copy->flags, i_ekHASH_DEST) == TRUE && i_file_hash(all, copy->dchunk, copy->size, &copy->dhash) == FALSE)
+            BIT_SET(copy->flags, i_ekCOPY);
+
+        if (BIT_TEST(copy->flags, i_ekCOPY) == FALSE && copy->shash != copy->dhash)
+            BIT_SET(copy->flags, i_ekCOPY);
+
+        if (copy->flags != 0)
+            changes = TRUE;
+    }
+
+    arrst_destroy(&chunks, NULL, i_Chunk);
+    return changes;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Files are listed and compared first. Then copied by a pool of workers */
+static bool_t i_sync_dir(const char_t *src, const char_t *dest, const i_SyncOpts *opts, ArrSt(i_Copy) *copies, ferror_t *error)
 {
     ArrSt(DirEntry) *dir1, *dir2;
     const DirEntry *files1, *files2;
     uint32_t n1, n2, i1 = 0, i2 = 0;
     bool_t ok = TRUE;
+    cassert_no_null(opts);
     if (!hfile_dir(src))
     {
         ptr_assign(error, ekFNOPATH);
@@ -259,78 +733,70 @@ bool_t hfile_dir_sync(const char_t *src, const char_t *dest, const bool_t recurs
     n1 = arrst_size(dir1, DirEntry);
     n2 = arrst_size(dir2, DirEntry);
 
-    // Two dirs with entries
-    while (i1 < n1 && i2 < n2 && ok)
+    // Both lists are sorted by name
+    while ((i1 < n1 || i2 < n2) && ok)
     {
-        int cmp = str_cmp(files1[i1].name, tc(files2[i2].name));
+        int cmp = 0;
+        if (i1 == n1)
+            cmp = 1;
+        else if (i2 == n2)
+            cmp = -1;
+        else
+            cmp = str_cmp(files1[i1].name, tc(files2[i2].name));
 
-        // Entry with the same name in both dirs
-        if (cmp == 0)
+        // Entry in src (and maybe in dest)
+        if (cmp <= 0)
         {
-            if (i_except(tc(files1[i1].name), except, except_size) == FALSE)
+            const char_t *name = tc(files1[i1].name);
+            if (i_except(name, opts->except, opts->except_size) == FALSE)
             {
                 if (files1[i1].type == ekDIRECTORY)
                 {
-                    if (recursive == TRUE)
+                    if (opts->recursive == TRUE)
                     {
-                        String *path1 = str_cpath("%s/%s", src, tc(files1[i1].name));
-                        String *path2 = str_cpath("%s/%s", src, tc(files2[i2].name));
-                        ok = hfile_dir_sync(tc(path1), tc(path2), recursive, remove_in_dest, except, except_size, error);
+                        String *path1 = str_cpath("%s/%s", src, name);
+                        String *path2 = str_cpath("%s/%s", dest, name);
+                        ok = i_sync_dir(tc(path1), tc(path2), opts, copies, error);
                         str_destroy(&path1);
                         str_destroy(&path2);
                     }
                 }
-                // This is a file
-                else
-                {
-                    // Source file is more recent --> Copy
-                    if (date_cmp(&files1[i1].date, &files2[i2].date) > 0)
-                    {
-                        String *path = str_cpath("%s/%s", src, tc(files1[i1].name));
-                        ok = hfile_copy(tc(path), dest, error);
-                        str_destroy(&path);
-                    }
-                }
-            }
-
-            i1 += 1;
-            i2 += 1;
-        }
-
-        // Entry exists in src, but not in dest
-        else if (cmp < 0)
-        {
-            if (i_except(tc(files1[i1].name), except, except_size) == FALSE)
-            {
-                if (files1[i1].type == ekDIRECTORY)
+                // New file or source file is more recent --> Copy
+                else if (opts->manifest == NULL)
                 {
-                    if (recursive == TRUE)
+                    if (cmp < 0 || date_cmp(&files1[i1].date, &files2[i2].date) > 0)
                     {
-                        String *path1 = str_cpath("%s/%s", src, tc(files1[i1].name));
-                        String *path2 = str_cpath("%s/%s", src, tc(files2[i2].name));
-                        ok = hfile_dir_create(tc(path2), error);
-                        if (ok == TRUE)
-                            ok = hfile_dir_sync(tc(path1), tc(path2), recursive, remove_in_dest, except, except_size, error);
-                        str_destroy(&path1);
-                        str_destroy(&path2);
+                        i_Copy *copy = arrst_new0(copies, i_Copy);
+                        copy->from = str_cpath("%s/%s", src, name);
+                        copy->to = str_cpath("%s/%s", dest, name);
+                        BIT_SET(copy->flags, i_ekCOPY);
                     }
                 }
-                // This is a file
+                // New file or different size --> Copy. Else, compare the content
                 else
                 {
-                    String *path = str_cpath("%s/%s", src, tc(files1[i1].name));
-                    ok = hfile_copy(tc(path), dest, error);
-                    str_destroy(&path);
+                    i_Copy *copy = arrst_new0(copies, i_Copy);
+                    copy->from = str_cpath("%s/%s", src, name);
+                    copy->to = str_cpath("%s/%s", dest, name);
+                    copy->size = files1[i1].size;
+                    copy->smtime = i_date_key(&files1[i1].date);
+                    if (cmp < 0 || files2[i2].type != ekARCHIVE || files2[i2].size != files1[i1].size)
+                        BIT_SET(copy->flags, i_ekCOPY);
+                    else
+                        copy->dmtime = i_date_key(&files2[i2].date);
+                    i_manifest_check(opts->manifest, copy);
                 }
             }
 
             i1 += 1;
+            if (cmp == 0)
+                i2 += 1;
         }
 
         // Entry exists in dest, but not in src
         else
         {
-            if (remove_in_dest == TRUE && i_except(tc(files2[i2].name), except, except_size) == FALSE)
+            if (opts->remove_in_dest == TRUE && i_except(tc(files2[i2].name), opts->except, opts->except_size) == FALSE)
             {
                 String *path = str_cpath("%s/%s", dest, tc(files2[i2].name));
 
@@ -346,54 +812,160 @@ bool_t hfile_dir_sync(const char_t *src, const char_t *dest, const bool_t recurs
         }
     }
 
-    // Remaining entries in src
-    while (i1 < n1 && ok)
+    arrst_destroy(&dir1, hfile_dir_entry_remove, DirEntry);
+    arrst_destroy(&dir2, hfile_dir_entry_remove, DirEntry);
+    return ok;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_remove_copy(i_Copy *copy)
+{
+    cassert_no_null(copy);
+    str_destroy(&copy->from);
+    str_destroy(&copy->to);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_sync_main(i_Sync *sync)
+{
+    cassert_no_null(sync);
+    for (;;)
     {
-        if (i_except(tc(files1[i1].name), except, except_size) == FALSE)
+        i_Copy *copy = NULL;
+        ferror_t err = ekFOK;
+        bmutex_lock(sync->mutex);
+        while (sync->next < sync->ncopies && BIT_TEST(sync->copies[sync->next].flags, i_ekCOPY) == FALSE)
+            sync->next += 1;
+        if (sync->ok == TRUE && sync->next < sync->ncopies)
+            copy = &sync->copies[sync->next++];
+        bmutex_unlock(sync->mutex);
+
+        if (copy == NULL)
+            break;
+
+        /* In-kernel copy, without user space buffers */
+        if (bfile_copy(tc(copy->from), tc(copy->to), &err) == TRUE)
         {
-            if (files1[i1].type == ekDIRECTORY)
-            {
-                if (recursive == TRUE)
-                {
-                    String *path1 = str_cpath("%s/%s", src, tc(files1[i1].name));
-                    String *path2 = str_cpath("%s/%s", src, tc(files2[i2].name));
-                    ok = hfile_dir_sync(tc(path1), tc(path2), recursive, remove_in_dest, except, except_size, error);
-                    str_destroy(&path1);
-                    str_destroy(&path2);
-                }
-            }
-            // This is a file
-            else
+            Date date;
+            if (sync->manifest == TRUE && bfile_lstat(tc(copy->to), NULL, NULL, &date, NULL) == TRUE)
+                copy->dmtime = i_date_key(&date);
+        }
+        else
+        {
+            bmutex_lock(sync->mutex);
+            if (sync->ok == TRUE)
             {
-                String *path = str_cpath("%s/%s", src, tc(files1[i1].name));
-                ok = hfile_copy(tc(path), dest, error);
-                str_destroy(&path);
+                sync->ok = FALSE;
+                sync->error = err;
             }
+            bmutex_unlock(sync->mutex);
         }
+    }
 
-        i1 += 1;
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool_t hfile_dir_sync(const char_t *src, const char_t *dest, const bool_t recursive, const bool_t remove_in_dest, const char_t **except, const uint32_t except_size, ferror_t *error)
+{
+    return hfile_dir_sync_parallel(src, dest, recursive, remove_in_dest, except, except_size, NULL, 1, error);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool_t hfile_dir_sync_parallel(const char_t *src, const char_t *dest, const bool_t recursive, const bool_t remove_in_dest, const char_t **except, const uint32_t except_size, const char_t *manifest, const uint32_t nthreads, ferror_t *error)
+{
+    ArrSt(i_Copy) *copies = arrst_create(i_Copy);
+    ArrSt(i_MEntry) *entries = NULL;
+    uint64_t stamp = 0;
+    i_SyncOpts opts;
+    uint32_t ncopies = 0;
+    bool_t changes = FALSE;
+    bool_t ok = TRUE;
+    cassert(nthreads > 0);
+
+    if (manifest != NULL)
+    {
+        Date date = date_system();
+        stamp = i_date_key(&date);
+        entries = i_manifest_read(manifest, dest);
     }
 
-    // Remaining entries in dest
-    while (i2 < n2 && remove_in_dest && ok)
+    opts.recursive = recursive;
+    opts.remove_in_dest = remove_in_dest;
+    opts.except = except;
+    opts.except_size = except_size;
+    opts.manifest = entries;
+    ok = i_sync_dir(src, dest, &opts, copies, error);
+
+    if (ok == TRUE && entries != NULL)
     {
-        if (i_except(tc(files2[i2].name), except, except_size) == FALSE)
-        {
-            String *path = str_cpath("%s/%s", dest, tc(files2[i2].name));
+        changes = i_hash_copies(arrst_all(copies, i_Copy), arrst_size(copies, i_Copy), nthreads);
+        if (arrst_size(copies, i_Copy) != arrst_size(entries, i_MEntry))
+            changes = TRUE;
+    }
 
-            if (files2[i2].type == ekDIRECTORY)
-                ok = hfile_dir_destroy(tc(path), error);
-            else
-                ok = bfile_delete(tc(path), error);
+    if (ok == TRUE)
+    {
+        arrst_foreach_const(copy, copies, i_Copy)
+            if (BIT_TEST(copy->flags, i_ekCOPY) == TRUE)
+                ncopies += 1;
+        arrst_end();
+    }
+
+    if (ncopies > 0)
+    {
+        i_Sync sync;
+        uint32_t nth;
+        sync.mutex = bmutex_create();
+        sync.copies = arrst_all(copies, i_Copy);
+        sync.ncopies = arrst_size(copies, i_Copy);
+        sync.next = 0;
+        sync.manifest = (bool_t)(entries != NULL);
+        sync.ok = TRUE;
+        sync.error = ekFOK;
+        nth = nthreads < ncopies ? nthreads : ncopies;
+        i_pool((FPtr_thread_main)i_sync_main, &sync, nth);
+        bmutex_close(&sync.mutex);
+        ok = sync.ok;
+        if (ok == FALSE)
+            ptr_assign(error, sync.error);
+    }
 
-            str_destroy(&path);
+    /*
+     * The manifest is a cache. Not updated after errors, the old one is still valid.
+     * Files modified after 'stamp' might have changed while hashed: not trusted.
+     * Our own copies are trusted if written before the manifest (next second).
+     */
+    if (entries != NULL)
+    {
+        if (ok == TRUE && changes == TRUE)
+        {
+            arrst_clear(entries, i_remove_mentry, i_MEntry);
+            arrst_foreach_const(copy, copies, i_Copy)
+                if (BIT_TEST(copy->flags, i_ekNO_HASH) == FALSE)
+                {
+                    i_MEntry *entry = arrst_new(entries, i_MEntry);
+                    entry->path = str_copy(copy->from);
+                    entry->size = copy->size;
+                    entry->smtime = copy->smtime < stamp ? copy->smtime : 0;
+                    if (BIT_TEST(copy->flags, i_ekCOPY) == TRUE)
+                        entry->dmtime = copy->dmtime;
+                    else
+                        entry->dmtime = copy->dmtime < stamp ? copy->dmtime : 0;
+                    entry->hash = copy->shash;
+                }
+            arrst_end();
+            i_manifest_write(manifest, dest, entries);
         }
 
-        i2 += 1;
+        arrst_destroy(&entries, i_remove_mentry, i_MEntry);
     }
 
-    arrst_destroy(&dir1, hfile_dir_entry_remove, DirEntry);
-    arrst_destroy(&dir2, hfile_dir_entry_remove, DirEntry);
+    arrst_destroy(&copies, i_remove_copy, i_Copy);
 
     if (ok == TRUE)
         ptr_assign(error, ekFOK);
@@ -436,6 +1008,67 @@ bool_t hfile_is_uptodate(const char_t *src, const char_t *dest)
 
 /*---------------------------------------------------------------------------*/
 
+bool_t hfile_is_uptodate_manifest(const char_t *src, const char_t *dest, const char_t *manifest)
+{
+    file_type_t stype, dtype;
+    uint64_t ssize, dsize;
+    Date sdate, ddate, date;
+    ArrSt(i_MEntry) *entries = NULL;
+    i_MEntry *entry = NULL;
+    i_Copy copy;
+    uint64_t stamp;
+    uint32_t pos;
+    cassert_no_null(manifest);
+    if (bfile_lstat(src, &stype, &ssize, &sdate, NULL) == FALSE)
+        return TRUE;
+    if (bfile_lstat(dest, &dtype, &dsize, &ddate, NULL) == FALSE)
+        return FALSE;
+    if (stype != ekARCHIVE || dtype != ekARCHIVE)
+        return hfile_is_uptodate(src, dest);
+    if (ssize != dsize)
+        return FALSE;
+
+    date = date_system();
+    stamp = i_date_key(&date);
+    entries = i_manifest_read(manifest, dest);
+    bmem_zero(&copy, i_Copy);
+    copy.from = str_c(src);
+    copy.to = str_c(dest);
+    copy.size = ssize;
+    copy.smtime = i_date_key(&sdate);
+    copy.dmtime = i_date_key(&ddate);
+    i_manifest_check(entries, &copy);
+
+    if (copy.flags != 0)
+    {
+        i_hash_copies(&copy, 1, 1);
+
+        /* Record the new hash. Entries of other files are kept */
+        if (BIT_TEST(copy.flags, i_ekNO_HASH) == FALSE)
+        {
+            entry = arrst_bsearch(entries, i_cmp_mentry_path, src, &pos, i_MEntry, char_t);
+            if (entry == NULL)
+            {
+                entry = arrst_insert_n(entries, pos, 1, i_MEntry);
+                entry->path = str_c(src);
+            }
+
+            entry->size = copy.size;
+            entry->smtime = copy.smtime < stamp ? copy.smtime : 0;
+            entry->dmtime = (BIT_TEST(copy.flags, i_ekCOPY) == FALSE && copy.dmtime < stamp) ? copy.dmtime : 0;
+            entry->hash = copy.shash;
+            i_manifest_write(manifest, dest, entries);
+        }
+    }
+
+    str_destroy(&copy.from);
+    str_destroy(&copy.to);
+    arrst_destroy(&entries, i_remove_mentry, i_MEntry);
+    return (bool_t)(BIT_TEST(copy.flags, i_ekCOPY) == FALSE);
+}
+
+/*---------------------------------------------------------------------------*/
+
 static bool_t i_read_entire_file(const char_t *pathname, byte_t *file_data, const uint32_t file_size, ferror_t *error)
 {
     File *file = NULL;
@@ -638,9 +1271,8 @@ static bool_t i_process_whole_directory(Listener *listener, const char_t *pathna
         char_t filename[512];
         file_type_t file_type;
         ferror_t file_error = ekFOK;
-        uint64_t file_size;
 
-        while (continue_process && bfile_dir_get(dir, filename, 512, &file_type, &file_size, NULL, &file_error) == TRUE)
+        while (continue_process && bfile_dir_get(dir, filename, 512, &file_type, NULL, NULL, &file_error) == TRUE)
         {
             switch (file_type)
             {
@@ -741,6 +1373,455 @@ bool_t hfile_dir_loop(const char_t *pathname, Listener *listener, const bool_t s
 
 /*---------------------------------------------------------------------------*/
 
+static i_WNode *i_wnode(i_WNode *parent, const char_t *pathname, const char_t *name)
+{
+    i_WNode *node = heap_new0(i_WNode);
+    if (parent != NULL)
+    {
+        node->pathname = str_printf("%s%c%s", pathname, DIR_SEPARATOR, name);
+        node->nameoff = str_len(node->pathname) - str_len_c(name);
+        node->depth = parent->depth + 1;
+    }
+    else
+    {
+        node->pathname = str_c(pathname);
+    }
+
+    node->parent = parent;
+    node->pending = 1;
+    return node;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_remove_wentry(i_WEntry *entry)
+{
+    cassert_no_null(entry);
+    str_destroy(&entry->name);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_wnode_destroy(i_WNode **node)
+{
+    cassert_no_null(node);
+    cassert_no_null(*node);
+    str_destroy(&(*node)->pathname);
+    if ((*node)->entries != NULL)
+        arrst_destroy(&(*node)->entries, i_remove_wentry, i_WEntry);
+    heap_delete(node, i_WNode);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int i_cmp_wentry(const i_WEntry *entry1, const i_WEntry *entry2)
+{
+    cassert_no_null(entry1);
+    cassert_no_null(entry2);
+    return str_cmp(entry1->name, tc(entry2->name));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Listener calls are never concurrent. FALSE from ekEFILE stops the walk */
+static bool_t i_walk_event(i_Walk *walk, const uint32_t type, const char_t *filename, const char_t *pathname, const uint32_t depth)
+{
+    EvFileDir params;
+    bool_t result = TRUE;
+    cassert_no_null(walk);
+    params.filename = filename;
+    params.pathname = pathname;
+    params.depth = depth;
+    bmutex_lock(walk->evmutex);
+    if (type == ekEEXIT)
+        listener_event(walk->listener, ekEEXIT, NULL, &params, NULL, void, EvFileDir, void);
+    else
+        listener_event(walk->listener, type, NULL, &params, &result, void, EvFileDir, bool_t);
+    bmutex_unlock(walk->evmutex);
+    return result;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_walk_stop(i_Walk *walk, const ferror_t error)
+{
+    cassert_no_null(walk);
+    bmutex_lock(walk->mutex);
+    if (walk->stop == FALSE && error != ekFOK)
+        walk->error = error;
+    walk->stop = TRUE;
+    bmutex_unlock(walk->mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static bool_t i_walk_stopped(i_Walk *walk)
+{
+    bool_t stop;
+    cassert_no_null(walk);
+    bmutex_lock(walk->mutex);
+    stop = walk->stop;
+    bmutex_unlock(walk->mutex);
+    return stop;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Unordered. A finished dir releases its parent, up to the first unfinished */
+static void i_walk_done(i_Walk *walk, i_WNode *node)
+{
+    cassert_no_null(walk);
+    while (node != NULL)
+    {
+        i_WNode *parent = node->parent;
+        bmutex_lock(walk->mutex);
+        cassert(node->pending > 0);
+        node->pending -= 1;
+        if (node->pending > 0)
+            node = NULL;
+        bmutex_unlock(walk->mutex);
+
+        if (node == NULL)
+            break;
+
+        if (parent != NULL && i_walk_stopped(walk) == FALSE)
+            i_walk_event(walk, ekEEXIT, tc(node->pathname) + node->nameoff, tc(node->pathname), node->depth - 1);
+
+        /* The root is released by the caller */
+        if (parent != NULL)
+            i_wnode_destroy(&node);
+
+        node = parent;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * Reads a directory. Unordered walks send the events at once, while reading.
+ * Ordered walks keep the sorted entries for the caller thread.
+ */
+static void i_walk_list(i_Walk *walk, i_WNode *node)
+{
+    ArrSt(i_WEntry) *entries = NULL;
+    Dir *dir = NULL;
+    ferror_t error = ekFOK;
+    bool_t skip;
+    cassert_no_null(walk);
+    cassert_no_null(node);
+
+    /* The parent stays alive until its subdirs are listed */
+    bmutex_lock(walk->mutex);
+    if (node->parent != NULL && node->parent->skip == TRUE)
+        node->skip = TRUE;
+    skip = (bool_t)(node->skip || walk->stop);
+    bmutex_unlock(walk->mutex);
+
+    if (walk->ordered == TRUE)
+        entries = arrst_create(i_WEntry);
+
+    if (skip == FALSE)
+        dir = bfile_dir_open(tc(node->pathname), &error);
+
+    if (dir != NULL)
+    {
+        char_t filename[512];
+        file_type_t type;
+        ferror_t ferror = ekFOK;
+
+        /* The type comes from the directory entry, no stat needed */
+        while (i_walk_stopped(walk) == FALSE && bfile_dir_get(dir, filename, 512, &type, NULL, NULL, &ferror) == TRUE)
+        {
+            if (type == ekARCHIVE)
+            {
+                if (filename[0] == '.' && BIT_TEST(walk->flags, i_ekHIDDEN_FILES) == FALSE)
+                    continue;
+
+                if (entries != NULL)
+                {
+                    i_WEntry *entry = arrst_new(entries, i_WEntry);
+                    entry->name = str_c(filename);
+                    entry->subdir = NULL;
+                }
+                else
+                {
+                    String *fullname = str_printf("%s%c%s", tc(node->pathname), DIR_SEPARATOR, filename);
+                    if (i_walk_event(walk, ekEFILE, filename, tc(fullname), node->depth) == FALSE)
+                        i_walk_stop(walk, ekFOK);
+                    str_destroy(&fullname);
+                }
+            }
+            else if (type == ekDIRECTORY)
+            {
+                if (str_equ_c(filename, ".") == TRUE || str_equ_c(filename, "..") == TRUE)
+                    continue;
+
+                if (filename[0] == '.' && BIT_TEST(walk->flags, i_ekHIDDEN_SUBDIRS) == FALSE)
+                    continue;
+
+                if (BIT_TEST(walk->flags, i_ekDIR_ENTRY) == FALSE)
+                    continue;
+
+                if (entries != NULL)
+                {
+                    i_WEntry *entry = arrst_new(entries, i_WEntry);
+                    entry->name = str_c(filename);
+                    entry->subdir = i_wnode(node, tc(node->pathname), filename);
+                }
+                else
+                {
+                    i_WNode *subdir = i_wnode(node, tc(node->pathname), filename);
+                    if (i_walk_event(walk, ekEENTRY, filename, tc(subdir->pathname), node->depth) == TRUE)
+                    {
+                        bmutex_lock(walk->mutex);
+                        node->pending += 1;
+                        arrpt_append(walk->queue, subdir, i_WNode);
+                        bmutex_unlock(walk->mutex);
+                        bsem_post(walk->work);
+                    }
+                    else
+                    {
+                        i_wnode_destroy(&subdir);
+                    }
+                }
+            }
+        }
+
+        if (ferror != ekFOK && ferror != ekFNOFILES)
+            error = ferror;
+
+        bfile_dir_close(&dir);
+    }
+
+    if (error != ekFOK)
+        i_walk_stop(walk, error);
+
+    if (entries != NULL)
+    {
+        const i_WEntry *entry;
+        uint32_t i, n, nsubdirs = 0;
+        arrst_sort(entries, i_cmp_wentry, i_WEntry);
+        entry = arrst_all_const(entries, i_WEntry);
+        n = arrst_size(entries, i_WEntry);
+        bmutex_lock(walk->mutex);
+        node->entries = entries;
+        node->listed = TRUE;
+
+        /* Reverse order, the first subdir is taken first */
+        for (i = n; i > 0; --i)
+        {
+            if (entry[i - 1].subdir != NULL)
+            {
+                arrpt_append(walk->queue, entry[i - 1].subdir, i_WNode);
+                nsubdirs += 1;
+            }
+        }
+
+        bmutex_unlock(walk->mutex);
+        for (i = 0; i < nsubdirs; ++i)
+            bsem_post(walk->work);
+        bsem_post(walk->listed);
+    }
+    else
+    {
+        i_walk_done(walk, node);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Takes a pending directory (the last one queued) and lists it. FALSE if the queue is empty */
+static bool_t i_walk_job(i_Walk *walk)
+{
+    i_WNode *node = NULL;
+    bool_t done = FALSE;
+    cassert_no_null(walk);
+    bmutex_lock(walk->mutex);
+    if (arrpt_size(walk->queue, i_WNode) > 0)
+    {
+        node = arrpt_last(walk->queue, i_WNode);
+        arrpt_pop(walk->queue, NULL, i_WNode);
+        walk->active += 1;
+    }
+    bmutex_unlock(walk->mutex);
+
+    if (node == NULL)
+        return FALSE;
+
+    i_walk_list(walk, node);
+    bmutex_lock(walk->mutex);
+    walk->active -= 1;
+    done = (bool_t)(walk->active == 0 && arrpt_size(walk->queue, i_WNode) == 0);
+    bmutex_unlock(walk->mutex);
+
+    /* No dir queued or being listed: wakes every idle worker to exit */
+    if (done == TRUE)
+    {
+        uint32_t i;
+        for (i = 0; i < walk->nthreads; ++i)
+            bsem_post(walk->work);
+    }
+
+    return TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Idle workers block until a dir is queued or the walk ends */
+static uint32_t i_walk_main(i_Walk *walk)
+{
+    cassert_no_null(walk);
+    for (;;)
+    {
+        bsem_wait(walk->work, UINT32_MAX);
+        if (i_walk_job(walk) == FALSE)
+        {
+            bool_t done;
+            bmutex_lock(walk->mutex);
+            done = (bool_t)(walk->active == 0 && arrpt_size(walk->queue, i_WNode) == 0);
+            bmutex_unlock(walk->mutex);
+            if (done == TRUE)
+                break;
+        }
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Ordered. Sends the events of a listed subtree in depth-first order and frees it */
+static void i_walk_emit(i_Walk *walk, i_WNode *node, const bool_t silent)
+{
+    const i_WEntry *entry;
+    uint32_t i, n;
+    cassert_no_null(walk);
+    cassert_no_null(node);
+
+    /* Meanwhile, the caller thread also works */
+    for (;;)
+    {
+        bool_t listed;
+        bmutex_lock(walk->mutex);
+        listed = node->listed;
+        bmutex_unlock(walk->mutex);
+        if (listed == TRUE)
+            break;
+        if (i_walk_job(walk) == FALSE)
+            bsem_wait(walk->listed, UINT32_MAX);
+    }
+
+    entry = arrst_all_const(node->entries, i_WEntry);
+    n = arrst_size(node->entries, i_WEntry);
+    for (i = 0; i < n; ++i)
+    {
+        bool_t send = (bool_t)(silent == FALSE && i_walk_stopped(walk) == FALSE);
+        if (entry[i].subdir == NULL)
+        {
+            if (send == TRUE)
+            {
+                String *fullname = str_printf("%s%c%s", tc(node->pathname), DIR_SEPARATOR, tc(entry[i].name));
+                if (i_walk_event(walk, ekEFILE, tc(entry[i].name), tc(fullname), node->depth) == FALSE)
+                    i_walk_stop(walk, ekFOK);
+                str_destroy(&fullname);
+            }
+        }
+        else
+        {
+            i_WNode *subdir = entry[i].subdir;
+            if (send == TRUE)
+                send = i_walk_event(walk, ekEENTRY, tc(entry[i].name), tc(subdir->pathname), node->depth);
+
+            if (send == FALSE)
+            {
+                bmutex_lock(walk->mutex);
+                subdir->skip = TRUE;
+                bmutex_unlock(walk->mutex);
+            }
+
+            i_walk_emit(walk, subdir, (bool_t)!send);
+
+            if (send == TRUE && i_walk_stopped(walk) == FALSE)
+                i_walk_event(walk, ekEEXIT, tc(entry[i].name), tc(subdir->pathname), node->depth);
+
+            i_wnode_destroy(&subdir);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool_t hfile_dir_walk(const char_t *pathname, Listener *listener, const bool_t subdirs, const bool_t hiddens, const bool_t ordered, const uint32_t nthreads, ferror_t *error)
+{
+    Thread *threads[WALK_MAX_THREADS];
+    i_WNode *root = NULL;
+    i_Walk walk;
+    uint32_t nth, i;
+    cassert(nthreads > 0);
+    walk.flags = 0;
+    if (subdirs == TRUE)
+        BIT_SET(walk.flags, i_ekDIR_ENTRY);
+
+    if (hiddens == TRUE)
+    {
+        BIT_SET(walk.flags, i_ekHIDDEN_FILES);
+        if (subdirs == TRUE)
+            BIT_SET(walk.flags, i_ekHIDDEN_SUBDIRS);
+    }
+
+    walk.mutex = bmutex_create();
+    walk.evmutex = bmutex_create();
+    walk.work = bsem_create(1);
+    walk.listed = bsem_create(0);
+    walk.listener = listener;
+    walk.ordered = ordered;
+    walk.queue = arrpt_create(i_WNode);
+    walk.active = 0;
+    walk.stop = FALSE;
+    walk.error = ekFOK;
+    root = i_wnode(NULL, pathname, NULL);
+    arrpt_append(walk.queue, root, i_WNode);
+
+    nth = nthreads < WALK_MAX_THREADS ? nthreads : WALK_MAX_THREADS;
+    walk.nthreads = nth;
+    if (nth > 1)
+        heap_start_mt();
+
+    for (i = 1; i < nth; ++i)
+        threads[i] = bthread_create(i_walk_main, &walk, i_Walk);
+
+    /* The calling thread works too, or sends the ordered events */
+    if (ordered == TRUE)
+        i_walk_emit(&walk, root, FALSE);
+    else
+        i_walk_main(&walk);
+
+    for (i = 1; i < nth; ++i)
+    {
+        if (threads[i] != NULL)
+        {
+            bthread_wait(threads[i]);
+            bthread_close(&threads[i]);
+        }
+    }
+
+    if (nth > 1)
+        heap_end_mt();
+
+    cassert(arrpt_size(walk.queue, i_WNode) == 0);
+    i_wnode_destroy(&root);
+    arrpt_destroy(&walk.queue, NULL, i_WNode);
+    bmutex_close(&walk.mutex);
+    bmutex_close(&walk.evmutex);
+    bsem_close(&walk.work);
+    bsem_close(&walk.listed);
+    listener_destroy(&listener);
+    ptr_assign(error, walk.error);
+    return (bool_t)(walk.error == ekFOK);
+}
+
+/*---------------------------------------------------------------------------*/
+
 String *hfile_appdata(const char_t *filename)
 {
     char_t appdata[512];
@@ -29,10 +29,14 @@ Date hfile_date(const char_t *pathname, const bool_t recursive);
 
 bool_t hfile_dir_sync(const char_t *src, const char_t *dest, const bool_t recursive, const bool_t remove_in_dest, const char_t **except, const uint32_t except_size, ferror_t *error);
 
+bool_t hfile_dir_sync_parallel(const char_t *src, const char_t *dest, const bool_t recursive, const bool_t remove_in_dest, const char_t **except, const uint32_t except_size, const char_t *manifest, const uint32_t nthreads, ferror_t *error);
+
 bool_t hfile_exists(const char_t *pathname, file_type_t *file_type);
 
 bool_t hfile_is_uptodate(const char_t *src, const char_t *dest);
 
+bool_t hfile_is_uptodate_manifest(const char_t *src, const char_t *dest, const char_t *manifest);
+
 bool_t hfile_copy(const char_t *from, const char_t *to, ferror_t *error);
 
 Buffer *hfile_buffer(const char_t *pathname, ferror_t *error);
@@ -47,6 +51,8 @@ bool_t hfile_from_data(const char_t *pathname, const byte_t *data, const uint32_
 
 bool_t hfile_dir_loop(const char_t *pathname, Listener *listener, const bool_t subdirs, const bool_t hiddens, ferror_t *error);
 
+bool_t hfile_dir_walk(const char_t *pathname, Listener *listener, const bool_t subdirs, const bool_t hiddens, const bool_t ordered, const uint32_t nthreads, ferror_t *error);
+
 String *hfile_appdata(const char_t *filename);
 
 String *hfile_home_dir(const char_t *path);
@@ -12,6 +12,8 @@
 
 #include "lex.inl"
 #include "stream.inl"
+#include "bmem.h"
+#include "bsimd.inl"
 #include "cassert.h"
 #include "heap.h"
 #include "ptr.h"
@@ -23,6 +25,17 @@
 #define VALID_CHAR      1
 #define STORE_CHAR      2
 
+/* ASCII classes of the in-buffer scanner */
+#define cSLOW           0
+#define cSINGLE         1
+#define cSPACE          2
+#define cIDENT          3
+#define cZERO           4
+#define cDIGIT          5
+#define cPERIOD         6
+#define cSLASH          7
+#define cQUOTE          8
+
 typedef struct _lexopts_t LexOpts;
 
 typedef enum _state_t
@@ -70,6 +83,24 @@ struct _lexscn_t
     char_t *lexeme;
 };
 
+static const byte_t i_CLASS[256] = {
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 2, 2, 2, 1, 1,     /* 0x00 */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     /* 0x10 */
+    2, 1, 8, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 6, 7,     /* 0x20  !"#$%&'()*+,-./ */
+    4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 1, 1, 1, 1, 1, 1,     /* 0x30 0123456789:;<=>? */
+    1, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,     /* 0x40 @ABCDEFGHIJKLMNO */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 1, 1, 1, 1, 3,     /* 0x50 PQRSTUVWXYZ[\]^_ */
+    1, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,     /* 0x60 `abcdefghijklmno */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 1, 1, 1, 1, 1,     /* 0x70 pqrstuvwxyz{|}~ */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     /* UTF8 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
 /*---------------------------------------------------------------------------*/
 
 LexScn *lexscn_create(void)
@@ -138,7 +169,7 @@ void lexscn_comments(LexScn *lex, const bool_t activate)
 static uint32_t i_get_char(LexScn *lex, Stream *stm)
 {
     uint32_t col = stm_col(stm);
-    uint32_t row = stm_col(stm);
+    uint32_t row = stm_row(stm);
     uint32_t code = stm_read_char(stm);
     cassert_no_null(lex);
     
@@ -763,6 +794,183 @@ static state_t i_EXP1(const uint32_t code, ltoken_t *token, uint8_t *charst)
 
 /*---------------------------------------------------------------------------*/
 
+static void i_set_lexeme(LexScn *lex, const char_t *data, const uint32_t size)
+{
+    cassert_no_null(lex);
+    if (size + 1 > lex->lexsize)
+    {
+        uint32_t lexsize = lex->lexsize * 2;
+        while (size + 1 > lexsize)
+            lexsize *= 2;
+        lex->lexeme = (char_t*)heap_realloc((byte_t*)lex->lexeme, lex->lexsize, lexsize, "LexLexeme");
+        lex->lexsize = lexsize;
+    }
+
+    bmem_copy((byte_t*)lex->lexeme, (const byte_t*)data, size);
+    lex->lexi = size;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint32_t i_run(const char_t *data, const uint32_t size, uint32_t i, const byte_t cfrom, const byte_t cto)
+{
+    while (i < size && i_CLASS[(byte_t)data[i]] >= cfrom && i_CLASS[(byte_t)data[i]] <= cto)
+        i += 1;
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE bool_t i_is_letter(const char_t c)
+{
+    return (bool_t)(i_CLASS[(byte_t)c] == cIDENT && c != '_');
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * Scans the next token straight in the stream read cache, without decoding chars.
+ * Only ASCII tokens fully contained in the cache (lookahead included). Anything
+ * else (UTF8, escapes, exponents, cache boundaries, ...) goes to the state machine.
+ */
+static bool_t i_cache_token(LexScn *lex, Stream *stm, ltoken_t *token)
+{
+    uint32_t size, i = 1, col, row;
+    const char_t *data = (const char_t*)_stm_read_cache(stm, &size);
+    cassert_no_null(lex);
+    cassert_no_null(token);
+
+    if (size < 2)
+        return FALSE;
+
+    col = lex->tcol;
+    row = lex->trow;
+    /*
+     * The lookahead char must be ASCII and in the cache ('i < size'). '\0' (EOF) or
+     * a bad UTF8 lookahead changes the token in the state machine.
+     */
+    switch (i_CLASS[(byte_t)data[0]]) {
+    case cSINGLE:
+        i_START((uint32_t)(byte_t)data[0], token);
+        break;
+
+    case cSPACE:
+        i = i_run(data, size, 1, cSPACE, cSPACE);
+        if (i == size || i_CLASS[(byte_t)data[i]] == cSLOW)
+            return FALSE;
+        *token = ekTSPACE;
+        break;
+
+    case cIDENT:
+        i = bsimd_ident(data + 1, size - 1) + 1;
+        if (i == size || i_CLASS[(byte_t)data[i]] == cSLOW)
+            return FALSE;
+        *token = ekTIDENT;
+        break;
+
+    case cZERO:
+    case cDIGIT:
+        if (data[0] == '0' && (data[1] == 'x' || data[1] == 'X'))
+        {
+            i = 2;
+            while (i < size && ((data[i] >= '0' && data[i] <= '9') || (data[i] >= 'a' && data[i] <= 'f') || (data[i] >= 'A' && data[i] <= 'F')))
+                i += 1;
+            *token = ekTHEX;
+        }
+        else
+        {
+            i = i_run(data, size, 1, cZERO, cDIGIT);
+            *token = ekTINTEGER;
+            if (i < size && data[i] == '.')
+            {
+                i = i_run(data, size, i + 1, cZERO, cDIGIT);
+                *token = ekTREAL;
+            }
+        }
+
+        /* Exponents and malformed numbers */
+        if (i == size || i_CLASS[(byte_t)data[i]] == cSLOW || i_is_letter(data[i]) == TRUE)
+            return FALSE;
+        break;
+
+    case cPERIOD:
+        if ((data[1] >= '0' && data[1] <= '9') || i_CLASS[(byte_t)data[1]] == cSLOW)
+            return FALSE;
+        *token = ekTPERIOD;
+        break;
+
+    case cSLASH:
+        if (data[1] == '/')
+        {
+            i = bsimd_ascii(data + 2, size - 2, '\n') + 2;
+            if (i == size || data[i] != '\n')
+                return FALSE;
+            i += 1;
+            *token = ekTSLCOM;
+        }
+        else if (data[1] == '*')
+        {
+            i = bsimd_find(data + 2, size - 2, "*/", 2) + 4;
+            if (i > size || bsimd_ascii(data, i, '\0') != i)
+                return FALSE;
+            *token = ekTMLCOM;
+        }
+        else if (i_CLASS[(byte_t)data[1]] != cSLOW)
+        {
+            *token = ekTSLASH;
+        }
+        else
+        {
+            return FALSE;
+        }
+        break;
+
+    case cQUOTE:
+        /* Escapes, control chars and UTF8 go to the state machine */
+        i = bsimd_json_plain(data + 1, size - 1) + 1;
+        if (i == size || data[i] != '\"' || bsimd_ascii(data + 1, i - 1, '\"') != i - 1)
+            return FALSE;
+        i += 1;
+        *token = ekTSTRING;
+        break;
+
+    default:
+        cassert(i_CLASS[(byte_t)data[0]] == cSLOW);
+        return FALSE;
+    }
+
+    /* Only comments and new lines can break the line */
+    if (*token == ekTEOL || *token == ekTSLCOM)
+    {
+        col = 1;
+        row += 1;
+    }
+    else if (*token == ekTMLCOM)
+    {
+        uint32_t j = 0, eol = UINT32_MAX;
+        for (;;)
+        {
+            j += bsimd_chr2(data + j, i - j, '\n', '\n');
+            if (j == i)
+                break;
+            eol = j++;
+            row += 1;
+        }
+
+        col = eol != UINT32_MAX ? i - eol : col + i;
+    }
+    else
+    {
+        col += i;
+    }
+
+    i_set_lexeme(lex, data, i);
+    _stm_skip_cache(stm, i, col, row);
+    return TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+
 ltoken_t lexscn_token(LexScn *lex, Stream *stm)
 {
     ltoken_t token = ENUM_MAX(ltoken_t);
@@ -776,8 +984,12 @@ ltoken_t lexscn_token(LexScn *lex, Stream *stm)
     lex->tcol = stm_col(stm);
     lex->trow = stm_row(stm);
     lex->lexi = 0;
-    code = i_get_char(lex, stm);
-    for (;;)
+    if (i_cache_token(lex, stm, &token) == TRUE)
+        state = stEND;
+    else
+        code = i_get_char(lex, stm);
+
+    while (state != stEND)
     {
         uint8_t charst = VALID_CHAR;
         if (code == 0)
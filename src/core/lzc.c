@@ -0,0 +1,301 @@
+/*
+ * NAppGUI Cross-platform C SDK
+ * 2015-2022 Francisco Garcia Collado
+ * MIT Licence
+ * https://nappgui.com/en/legal/license.html
+ *
+ * File: lzc.c
+ *
+ */
+
+/* LZ4-format block compressor */
+
+#include "lzc.inl"
+#include "bmem.h"
+#include "cassert.h"
+
+/*
+ * Blocks are independent and follow the LZ4 block format:
+ * [token][literal length+][literals][offset16][match length+] ...
+ * The last sequence only has literals. Matches are at least 4 bytes,
+ * the last 5 bytes are always literals and no match starts in the last 12.
+ */
+#define i_HASH_LOG          12
+#define i_MINMATCH          4
+#define i_MFLIMIT           12
+#define i_LASTLITERALS      5
+#define i_MAX_OFFSET        65535
+#define i_SKIP_TRIGGER      6
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint32_t i_read32(const byte_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint32_t i_hash(const uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - i_HASH_LOG);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Loads before stores: compilers merge it into a single 64-bit move */
+static __INLINE void i_copy8(byte_t *dest, const byte_t *src)
+{
+    byte_t b0 = src[0], b1 = src[1], b2 = src[2], b3 = src[3];
+    byte_t b4 = src[4], b5 = src[5], b6 = src[6], b7 = src[7];
+    dest[0] = b0; dest[1] = b1; dest[2] = b2; dest[3] = b3;
+    dest[4] = b4; dest[5] = b5; dest[6] = b6; dest[7] = b7;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static byte_t *i_write_len(byte_t *op, uint32_t len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+
+    *op++ = (byte_t)len;
+    return op;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static byte_t *i_literals(byte_t *op, const byte_t *oend, const byte_t *anchor, const byte_t *end, const uint32_t len, byte_t **token)
+{
+    *token = op++;
+    if (len >= 15)
+    {
+        **token = (byte_t)(15 << 4);
+        op = i_write_len(op, len - 15);
+    }
+    else
+    {
+        **token = (byte_t)(len << 4);
+    }
+
+    /* Short runs away from both ends: 16 bytes in two moves */
+    if (len <= 16 && end - anchor >= 16 && oend - op >= 16)
+    {
+        i_copy8(op, anchor);
+        i_copy8(op + 8, anchor + 8);
+    }
+    else if (len > 0)
+    {
+        bmem_copy(op, anchor, len);
+    }
+
+    return op + len;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t lzc_bound(const uint32_t size)
+{
+    return size + size / 255 + 16;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t lzc_compress(const byte_t *src, const uint32_t size, byte_t *dest)
+{
+    const byte_t *ip = src;
+    const byte_t *anchor = src;
+    const byte_t *end = src + size;
+    byte_t *op = dest;
+    const byte_t *oend = dest + lzc_bound(size);
+    byte_t *token = NULL;
+    cassert_no_null(src);
+    cassert_no_null(dest);
+
+    if (size > i_MFLIMIT)
+    {
+        uint32_t table[1 << i_HASH_LOG];
+        const byte_t *mflimit = end - i_MFLIMIT;
+        const byte_t *matchlimit = end - i_LASTLITERALS;
+        bmem_set_zero((byte_t*)table, sizeof(table));
+        ip += 1;
+
+        for (;;)
+        {
+            const byte_t *match = NULL;
+            const byte_t *mstart = NULL;
+            uint32_t step = 1;
+            uint32_t attempts = 1 << i_SKIP_TRIGGER;
+            uint32_t len;
+
+            /* Find a match. Step grows on incompressible data */
+            for (;;)
+            {
+                uint32_t seq = i_read32(ip);
+                uint32_t h = i_hash(seq);
+                match = src + table[h];
+                table[h] = (uint32_t)(ip - src);
+                if (ip - match <= i_MAX_OFFSET && i_read32(match) == seq)
+                    break;
+
+                ip += step;
+                step = attempts++ >> i_SKIP_TRIGGER;
+                if (ip > mflimit)
+                    goto last_literals;
+            }
+
+            while (ip > anchor && match > src && ip[-1] == match[-1])
+            {
+                ip -= 1;
+                match -= 1;
+            }
+
+            op = i_literals(op, oend, anchor, end, (uint32_t)(ip - anchor), &token);
+            *op++ = (byte_t)((ip - match) & 0xFF);
+            *op++ = (byte_t)((ip - match) >> 8);
+
+            ip += i_MINMATCH;
+            match += i_MINMATCH;
+            mstart = ip;
+            while (ip + 4 <= matchlimit && i_read32(ip) == i_read32(match))
+            {
+                ip += 4;
+                match += 4;
+            }
+
+            while (ip < matchlimit && *ip == *match)
+            {
+                ip += 1;
+                match += 1;
+            }
+
+            len = (uint32_t)(ip - mstart);
+            if (len >= 15)
+            {
+                *token |= 15;
+                op = i_write_len(op, len - 15);
+            }
+            else
+            {
+                *token |= (byte_t)len;
+            }
+
+            anchor = ip;
+            if (ip > mflimit)
+                break;
+
+            table[i_hash(i_read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+        }
+    }
+
+last_literals:
+    op = i_literals(op, oend, anchor, end, (uint32_t)(end - anchor), &token);
+    cassert((uint32_t)(op - dest) <= lzc_bound(size));
+    return (uint32_t)(op - dest);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE bool_t i_read_len(const byte_t **ip, const byte_t *iend, uint32_t *len)
+{
+    byte_t b;
+    do
+    {
+        if (*ip >= iend)
+            return FALSE;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Safe decoder: never reads or writes out of bounds on corrupt input */
+bool_t lzc_decompress(const byte_t *src, const uint32_t size, byte_t *dest, const uint32_t dsize, uint32_t *written)
+{
+    const byte_t *ip = src;
+    const byte_t *iend = src + size;
+    byte_t *op = dest;
+    byte_t *oend = dest + dsize;
+    cassert_no_null(src);
+    cassert_no_null(dest);
+    cassert_no_null(written);
+
+    while (ip < iend)
+    {
+        uint32_t token = *ip++;
+        uint32_t len = token >> 4;
+        uint32_t offset;
+        const byte_t *match;
+
+        if (len == 15 && i_read_len(&ip, iend, &len) == FALSE)
+            return FALSE;
+
+        if (len > (uint32_t)(iend - ip) || len > (uint32_t)(oend - op))
+            return FALSE;
+
+        /* Far from the ends: copy in 8-byte chunks, overrun is rewritten later */
+        if (len <= 16 && (uint32_t)(iend - ip) >= 16 + 8 && (uint32_t)(oend - op) >= 16 + 8)
+        {
+            i_copy8(op, ip);
+            i_copy8(op + 8, ip + 8);
+            ip += len;
+            op += len;
+        }
+        else if (len > 0)
+        {
+            bmem_copy(op, ip, len);
+            ip += len;
+            op += len;
+        }
+
+        /* Last sequence */
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return FALSE;
+
+        offset = (uint32_t)ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dest))
+            return FALSE;
+
+        len = token & 15;
+        if (len == 15 && i_read_len(&ip, iend, &len) == FALSE)
+            return FALSE;
+
+        len += i_MINMATCH;
+        if (len > (uint32_t)(oend - op))
+            return FALSE;
+
+        match = op - offset;
+        if (offset >= 8 && (uint32_t)(oend - op) >= len + 8)
+        {
+            /* Each 8-byte chunk is already decoded, even if regions overlap */
+            byte_t *mend = op + len;
+            do
+            {
+                i_copy8(op, match);
+                op += 8;
+                match += 8;
+            } while (op < mend);
+            op = mend;
+        }
+        else
+        {
+            while (len > 0)
+            {
+                *op++ = *match++;
+                len -= 1;
+            }
+        }
+    }
+
+    *written = (uint32_t)(op - dest);
+    return TRUE;
+}
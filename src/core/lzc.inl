@@ -0,0 +1,25 @@
+/*
+ * NAppGUI Cross-platform C SDK
+ * 2015-2022 Francisco Garcia Collado
+ * MIT Licence
+ * https://nappgui.com/en/legal/license.html
+ *
+ * File: lzc.inl
+ *
+ */
+
+/* LZ4-format block compressor */
+
+#include "core.ixx"
+
+__EXTERN_C
+
+uint32_t lzc_bound(const uint32_t size);
+
+uint32_t lzc_compress(const byte_t *src, const uint32_t size, byte_t *dest);
+
+bool_t lzc_decompress(const byte_t *src, const uint32_t size, byte_t *dest, const uint32_t dsize, uint32_t *written);
+
+__END_C
+
+#define LZC_BLOCK           0x10000
@@ -14,13 +14,17 @@
 #include "arrpt.h"
 #include "arrst.h"
 #include "bmem.h"
+#include "bsimd.inl"
 #include "cassert.h"
 #include "heap.h"
 #include "stream.h"
+#include "strings.h"
 #include "unicode.h"
 
 typedef struct _ntoken_t NToken;
 typedef struct _trans_t Trans;
+typedef struct _dstate_t DState;
+typedef struct _dfa_t DFA;
 
 typedef enum _symbol_t
 {
@@ -29,7 +33,8 @@ typedef enum _symbol_t
     ekCONCAT,
     ekCLOSURE,
     ekLEFT_PAR,
-    ekRIGH_PAR
+    ekRIGH_PAR,
+    ekGROUP
 } symbol_t;
 
 struct _ntoken_t
@@ -46,17 +51,62 @@ struct _trans_t
     uint32_t extra;
 };
 
+/* A DFA state is a sorted set of NFA states, stored in 'sets' */
+struct _dstate_t
+{
+    uint32_t offset;
+    uint32_t size;
+    bool_t accept;
+    uint32_t moffset;
+    uint32_t msize;
+};
+
+/* Lazy DFA. Transitions are computed on demand (subset construction) and cached */
+struct _dfa_t
+{
+    uint32_t nclasses;
+    uint32_t *bounds;
+    uint32_t ascii[128];
+    ArrSt(uint32_t) *sets;
+    ArrSt(DState) *states;
+    ArrSt(uint32_t) *trans;
+    ArrSt(uint32_t) *matches;
+    uint32_t *hash;
+    uint32_t hsize;
+    uint32_t limit;
+    bool_t first[256];
+    uint32_t nfirst;
+    char_t first2[2];
+};
+
 struct _nfa_t
 {
     ArrSt(Trans) *ttable;
     ArrSt(uint32_t) *current;
     ArrSt(uint32_t) *temp;
+    uint32_t *marks;
+    uint32_t mark;
+    uint32_t ngroups;
+    String *prefix;
+    String *literal;
+    uint32_t *accepts;
+    uint32_t npatterns;
+    DFA *dfa;
 };
 
 #define MIN_UNICODE 5
 #define MAX_UNICODE 1114112
+/* Epsilon transition that saves the position in capture 'extra' */
+#define TAG_SYMBOL (UINT32_MAX - 1)
+#define DFA_DEAD 0
+#define DFA_START 1
+#define DFA_UNKNOWN UINT32_MAX
+/* Cache limit (transitions + sets), in 32bit words. Plus some words per NFA state */
+#define DFA_CACHE_WORDS 0x40000
+#define DFA_CACHE_NFA 128
 DeclSt(NToken);
 DeclSt(Trans);
+DeclSt(DState);
 DeclSt(symbol_t);
 
 /*---------------------------------------------------------------------------*/
@@ -110,6 +160,10 @@ static void i_write_tokens(Stream *stm, const ArrSt(NToken) *tokens)
             stm_write_char(stm, token->from);
             break;
 
+        case ekGROUP:
+            stm_printf(stm, "{%d}", token->from);
+            break;
+
         cassert_default();
         }
     arrst_end();
@@ -124,7 +178,11 @@ static void i_write_nfa(Stream *stm, const NFA *nfa)
 {
     cassert_no_null(nfa);
     arrst_foreach(trans, nfa->ttable, Trans)
-        if (trans->symbol != UINT32_MAX)
+        if (trans->symbol == TAG_SYMBOL)
+        {
+            stm_printf(stm, "%d [ε%s%d] --> %d\n", trans_i, trans->extra % 2 == 0 ? "(" : ")", trans->extra / 2, trans->state);
+        }
+        else if (trans->symbol != UINT32_MAX)
         {
             if (trans->extra == 0)
             {
@@ -223,27 +281,52 @@ NFA *nfa_string(const char_t *str)
 
 /*---------------------------------------------------------------------------*/
 
+static void i_dfa_destroy(DFA **dfa)
+{
+    cassert_no_null(dfa);
+    cassert_no_null(*dfa);
+    heap_delete_n(&(*dfa)->bounds, (*dfa)->nclasses, uint32_t);
+    heap_delete_n(&(*dfa)->hash, (*dfa)->hsize, uint32_t);
+    arrst_destroy(&(*dfa)->sets, NULL, uint32_t);
+    arrst_destroy(&(*dfa)->states, NULL, DState);
+    arrst_destroy(&(*dfa)->trans, NULL, uint32_t);
+    arrst_destroy(&(*dfa)->matches, NULL, uint32_t);
+    heap_delete(dfa, DFA);
+}
+
+/*---------------------------------------------------------------------------*/
+
 void nfa_destroy(NFA **nfa)
 {
     cassert_no_null(nfa);
     cassert_no_null(*nfa);
-    arrst_destroy(&(*nfa)->ttable, NULL, Trans);
+    if ((*nfa)->dfa != NULL)
+        i_dfa_destroy(&(*nfa)->dfa);
+
     if ((*nfa)->current != NULL)
     {
         arrst_destroy(&(*nfa)->current, NULL, uint32_t);
         arrst_destroy(&(*nfa)->temp, NULL, uint32_t);
+        heap_delete_n(&(*nfa)->marks, arrst_size((*nfa)->ttable, Trans), uint32_t);
     }
     else
     {
         cassert((*nfa)->temp == NULL);
     }
 
+    str_destopt(&(*nfa)->prefix);
+    str_destopt(&(*nfa)->literal);
+    if ((*nfa)->accepts != NULL)
+        heap_delete_n(&(*nfa)->accepts, (*nfa)->npatterns, uint32_t);
+
+    arrst_destroy(&(*nfa)->ttable, NULL, Trans);
+
     heap_delete(nfa, NFA);
 }
 
 /*---------------------------------------------------------------------------*/
 
-static ArrSt(NToken) *i_tokens_unix_regex(const char_t *regex)
+static ArrSt(NToken) *i_tokens_unix_regex(const char_t *regex, uint32_t *ngroups)
 {
     bool_t ok = TRUE;
     ArrSt(NToken) *tokens = arrst_create(NToken);
@@ -302,8 +385,11 @@ static ArrSt(NToken) *i_tokens_unix_regex(const char_t *regex)
             }
 
             case '(':
+                /* Capture groups are numbered from 1, in opening order */
+                *ngroups += 1;
                 token.symbol = ekLEFT_PAR;
                 token.from = '(';
+                token.to = *ngroups;
                 arrst_append(opens, token, NToken);
                 break;
 
@@ -473,6 +559,14 @@ static void i_regex_to_infix(ArrSt(NToken) **tokens)
                 else
                 {
                     cassert((token->from == ']' && top.from == '[') || (token->from == ')' && top.from == '('));
+                    if (top.from == '(')
+                    {
+                        NToken group;
+                        group.symbol = ekGROUP;
+                        group.from = top.to;
+                        group.to = top.to;
+                        arrst_append(output, group, NToken);
+                    }
                     break;
                 }
             }
@@ -684,6 +778,55 @@ static void i_nfa_closure(NFA *nfa1)
 
 /*---------------------------------------------------------------------------*/
 
+static void i_nfa_group(NFA *nfa1, const uint32_t group)
+{  
+    register uint32_t n1;
+    register Trans *trans = NULL;
+    cassert_no_null(nfa1);
+    n1 = arrst_size(nfa1->ttable, Trans);
+
+    /* 1) Move one position all states in nfa1 (the new '0' state)  */
+    i_offset(nfa1->ttable, 1);
+
+    /* 2) Prepends a new '0' state that saves the group start */
+    trans = arrst_prepend_n(nfa1->ttable, 1, Trans);
+    trans->state = 1;
+    trans->symbol = TAG_SYMBOL;
+    trans->extra = 2 * group;
+
+    /* 3) Adds an epsilon-transition from nfa1-'last' to the group end */
+    trans = arrst_last(nfa1->ttable, Trans);
+    cassert(i_is_last(trans) == TRUE);
+    trans->symbol = UINT32_MAX;
+
+    /* Base, Union and Concat NFA */
+    if (trans->state == UINT32_MAX)
+    {
+        trans->state = n1 + 1;
+        trans->extra = UINT32_MAX;
+    }
+    /* Closure NFA */
+    else
+    {
+        cassert(trans->extra == UINT32_MAX);
+        trans->extra = n1 + 1;
+    }
+
+    /* 4) Adds the group end, that saves the position */
+    trans = arrst_new(nfa1->ttable, Trans);
+    trans->state = n1 + 2;
+    trans->symbol = TAG_SYMBOL;
+    trans->extra = 2 * group + 1;
+
+    /* 5) Add the last state (accept) */
+    trans = arrst_new(nfa1->ttable, Trans);
+    trans->state = UINT32_MAX;
+    trans->symbol = 0;
+    trans->extra = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
 static NFA *i_infix_to_NFA(const ArrSt(NToken) *tokens)
 {
     ArrPt(NFA) *stack = arrpt_create(NFA);
@@ -731,6 +874,18 @@ static NFA *i_infix_to_NFA(const ArrSt(NToken) *tokens)
             break;
         }
 
+        case ekGROUP:
+        {
+            /* Empty groups '()' have no NFA */
+            NFA *nfa1 = arrpt_size(stack, NFA) > 0 ? arrpt_last(stack, NFA) : NULL;
+            if (nfa1 != NULL)
+            {
+                i_nfa_group(nfa1, token->from);
+                cassert(i_check_nfa(nfa1) == TRUE);
+            }
+            break;
+        }
+
         case ekLEFT_PAR:
         case ekRIGH_PAR:
         cassert_default();
@@ -746,15 +901,76 @@ static NFA *i_infix_to_NFA(const ArrSt(NToken) *tokens)
 
 /*---------------------------------------------------------------------------*/
 
+/*
+ * Literal runs out of parentheses, not followed by '*'. Any match contains
+ * the longest one and starts with the first one, if it's the first token.
+ */
+static void i_literals(const ArrSt(NToken) *tokens, String **prefix, String **literal)
+{
+    uint32_t i, n = arrst_size(tokens, NToken), depth = 0;
+    const NToken *token = arrst_all_const(tokens, NToken);
+    char_t *run = heap_new_n(4 * n + 1, char_t);
+    uint32_t size = 0, best = 0, begin = 0, bbegin = 0;
+
+    for (i = 0; i <= n; ++i)
+    {
+        bool_t lit = FALSE;
+        if (i < n && depth == 0 && token[i].symbol == ekCHAR && token[i].from == token[i].to)
+            lit = (bool_t)(i + 1 == n || token[i + 1].symbol != ekCLOSURE);
+
+        if (lit == TRUE)
+        {
+            if (size == 0)
+                begin = i;
+            size += unicode_to_char(token[i].from, run + size, ekUTF8);
+        }
+        else
+        {
+            if (size > 0)
+            {
+                if (begin == 0)
+                    *prefix = str_cn(run, size);
+
+                if (size > best)
+                {
+                    str_destopt(literal);
+                    *literal = str_cn(run, size);
+                    best = size;
+                    bbegin = begin;
+                }
+
+                size = 0;
+            }
+
+            if (i < n && token[i].symbol == ekLEFT_PAR)
+                depth += 1;
+            else if (i < n && token[i].symbol == ekRIGH_PAR)
+                depth -= 1;
+        }
+    }
+
+    /* The prefix is already searched */
+    if (*literal != NULL && bbegin == 0)
+        str_destroy(literal);
+
+    heap_delete_n(&run, 4 * n + 1, char_t);
+}
+
+/*---------------------------------------------------------------------------*/
+
 NFA *nfa_regex(const char_t *regex, const bool_t verbose)
 {
-    ArrSt(NToken) *tokens = i_tokens_unix_regex(regex);
+    uint32_t ngroups = 0;
+    String *prefix = NULL, *literal = NULL;
+    ArrSt(NToken) *tokens = i_tokens_unix_regex(regex, &ngroups);
     NFA *nfa = NULL;
 
     /* Bad composed regex */
     if (tokens == NULL)
         return NULL;
 
+    i_literals(tokens, &prefix, &literal);
+
     if (verbose == TRUE)
     {
         stm_writef(kSTDOUT, "Tokens: ");
@@ -778,6 +994,9 @@ NFA *nfa_regex(const char_t *regex, const bool_t verbose)
     nfa = i_infix_to_NFA(tokens);
     arrst_destroy(&tokens, NULL, NToken);
     cassert(i_check_nfa(nfa) == TRUE);
+    nfa->ngroups = ngroups;
+    nfa->prefix = prefix;
+    nfa->literal = literal;
 
     if (verbose == TRUE)
     {
@@ -791,29 +1010,49 @@ NFA *nfa_regex(const char_t *regex, const bool_t verbose)
 
 /*---------------------------------------------------------------------------*/
 
+/* 'marks' avoids duplicates. The set is sorted once the closure is complete */
 static void i_add_state(ArrSt(uint32_t) *states, const uint32_t state)
 {
-    arrst_foreach(cstate, states, uint32_t)
-        if (*cstate == state)
-            return;
+    arrst_append(states, state, uint32_t);
+}
+
+/*---------------------------------------------------------------------------*/
 
-        if (*cstate > state)
+/* Closures come almost sorted (states are visited in order), insertion sort */
+static void i_sort_states(ArrSt(uint32_t) *states)
+{
+    uint32_t *state = arrst_all(states, uint32_t);
+    uint32_t i, n = arrst_size(states, uint32_t);
+    for (i = 1; i < n; ++i)
+    {
+        uint32_t s = state[i], j = i;
+        while (j > 0 && state[j - 1] > s)
         {
-            arrst_insert(states, cstate_i, state, uint32_t);
-            return;
+            state[j] = state[j - 1];
+            j -= 1;
         }
-    arrst_end();
 
-    arrst_append(states, state, uint32_t);
+        state[j] = s;
+    }
 }
 
 /*---------------------------------------------------------------------------*/
 
-static void i_add_closure(const ArrSt(Trans) *ttable, ArrSt(uint32_t) *states, const uint32_t state)
+/* 'marks' avoids revisiting states in epsilon loops, like '(a*)*' */
+static void i_add_closure(const Trans *ttable, const uint32_t ntrans, ArrSt(uint32_t) *states, uint32_t *marks, const uint32_t mark, const uint32_t state)
 {
-    const Trans *trans = arrst_get_const(ttable, state, Trans);
+    const Trans *trans = ttable + state;
+    cassert(state < ntrans);
 
-    if (trans->symbol != UINT32_MAX)
+    if (marks[state] == mark)
+        return;
+
+    marks[state] = mark;
+    if (trans->symbol == TAG_SYMBOL)
+    {
+        i_add_closure(ttable, ntrans, states, marks, mark, trans->state);
+    }
+    else if (trans->symbol != UINT32_MAX)
     {
         i_add_state(states, state);
     }
@@ -822,20 +1061,35 @@ static void i_add_closure(const ArrSt(Trans) *ttable, ArrSt(uint32_t) *states, c
         cassert(trans->state != UINT32_MAX);
      
         /* Closure last state (accept) */
-        if (state == arrst_size(ttable, Trans) - 1)
+        if (state == ntrans - 1)
             i_add_state(states, state);
 
-        i_add_closure(ttable, states, trans->state);
+        i_add_closure(ttable, ntrans, states, marks, mark, trans->state);
 
         /* Two epsilons */
         if (trans->extra != UINT32_MAX)
-            i_add_closure(ttable, states, trans->extra);
+            i_add_closure(ttable, ntrans, states, marks, mark, trans->extra);
     }
 }
 
 /*---------------------------------------------------------------------------*/
 
-void nfa_start(NFA *nfa)
+static uint32_t i_new_mark(NFA *nfa)
+{
+    cassert_no_null(nfa);
+    if (nfa->mark == UINT32_MAX)
+    {
+        bmem_zero_n(nfa->marks, arrst_size(nfa->ttable, Trans), uint32_t);
+        nfa->mark = 0;
+    }
+
+    nfa->mark += 1;
+    return nfa->mark;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_init_sets(NFA *nfa)
 {
     cassert_no_null(nfa);
     if (nfa->current == NULL)
@@ -843,27 +1097,48 @@ void nfa_start(NFA *nfa)
         cassert(nfa->temp == NULL);
         nfa->current = arrst_create(uint32_t);
         nfa->temp = arrst_create(uint32_t);
+        nfa->marks = heap_new_n0(arrst_size(nfa->ttable, Trans), uint32_t);
+        nfa->mark = 0;
     }
-    else
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* NFA states reached from 'states' with 'codepoint' */
+static void i_step(NFA *nfa, const uint32_t *states, const uint32_t n, const uint32_t codepoint, ArrSt(uint32_t) *next)
+{
+    const Trans *ttable = arrst_all_const(nfa->ttable, Trans);
+    uint32_t ntrans = arrst_size(nfa->ttable, Trans);
+    uint32_t i, mark = i_new_mark(nfa);
+    arrst_clear(next, NULL, uint32_t);
+    for (i = 0; i < n; ++i)
     {
-        arrst_clear(nfa->current, NULL, uint32_t);
+        const Trans *trans = ttable + states[i];
+        /* The accept state [0-0] has no target */
+        if (codepoint >= trans->symbol && codepoint <= trans->extra && trans->state != UINT32_MAX)
+            i_add_closure(ttable, ntrans, next, nfa->marks, mark, trans->state);
     }
 
-    i_add_closure(nfa->ttable, nfa->current, 0);
+    i_sort_states(next);
 }
 
 /*---------------------------------------------------------------------------*/
 
-bool_t nfa_next(NFA *nfa, const uint32_t codepoint)
+void nfa_start(NFA *nfa)
 {
     cassert_no_null(nfa);
-    arrst_clear(nfa->temp, NULL, uint32_t);
-    arrst_foreach(state, nfa->current, uint32_t)
-        const Trans *trans = arrst_get(nfa->ttable, *state, Trans);
-        if (codepoint >= trans->symbol && codepoint <= trans->extra)
-            i_add_closure(nfa->ttable, nfa->temp, trans->state);
-    arrst_end();
+    i_init_sets(nfa);
+    arrst_clear(nfa->current, NULL, uint32_t);
+    i_add_closure(arrst_all_const(nfa->ttable, Trans), arrst_size(nfa->ttable, Trans), nfa->current, nfa->marks, i_new_mark(nfa), 0);
+    i_sort_states(nfa->current);
+}
 
+/*---------------------------------------------------------------------------*/
+
+bool_t nfa_next(NFA *nfa, const uint32_t codepoint)
+{
+    cassert_no_null(nfa);
+    i_step(nfa, arrst_all(nfa->current, uint32_t), arrst_size(nfa->current, uint32_t), codepoint, nfa->temp);
     bmem_swap_type(&nfa->current, &nfa->temp, ArrSt(uint32_t)*);
     return (bool_t)(arrst_size(nfa->current, uint32_t) > 0);
 }
@@ -882,3 +1157,912 @@ bool_t nfa_accept(NFA *nfa)
     return FALSE;
 }
 
+/*---------------------------------------------------------------------------*/
+
+static int i_cmp_u32(const uint32_t *u1, const uint32_t *u2)
+{
+    return (*u1 > *u2) - (*u1 < *u2);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Codepoint classes. Two codepoints in the same class have the same transitions */
+static void i_dfa_classes(const NFA *nfa, DFA *dfa)
+{
+    ArrSt(uint32_t) *points = arrst_create(uint32_t);
+    uint32_t i, c, n = 0;
+    const uint32_t *point = NULL;
+    arrst_append(points, 0, uint32_t);
+    arrst_foreach_const(trans, nfa->ttable, Trans)
+        if (trans->symbol != UINT32_MAX && trans->symbol != TAG_SYMBOL)
+        {
+            arrst_append(points, trans->symbol, uint32_t);
+            if (trans->extra < UINT32_MAX)
+                arrst_append(points, trans->extra + 1, uint32_t);
+        }
+    arrst_end();
+
+    arrst_sort(points, i_cmp_u32, uint32_t);
+    point = arrst_all(points, uint32_t);
+    for (i = 0; i < arrst_size(points, uint32_t); ++i)
+    {
+        if (i == 0 || point[i] != point[i - 1])
+            n += 1;
+    }
+
+    dfa->nclasses = n;
+    dfa->bounds = heap_new_n(n, uint32_t);
+    n = 0;
+    for (i = 0; i < arrst_size(points, uint32_t); ++i)
+    {
+        if (i == 0 || point[i] != point[i - 1])
+            dfa->bounds[n++] = point[i];
+    }
+
+    for (c = 0, i = 0; c < 128; ++c)
+    {
+        while (i + 1 < n && dfa->bounds[i + 1] <= c)
+            i += 1;
+        dfa->ascii[c] = i;
+    }
+
+    arrst_destroy(&points, NULL, uint32_t);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint32_t i_dfa_class(const DFA *dfa, const uint32_t codepoint)
+{
+    uint32_t lo = 0, hi = dfa->nclasses;
+    if (codepoint < 128)
+        return dfa->ascii[codepoint];
+
+    /* Last bound <= codepoint */
+    while (hi - lo > 1)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (dfa->bounds[mid] <= codepoint)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_set_hash(const uint32_t *states, const uint32_t n)
+{
+    uint32_t i, hash = 2166136261u;
+    for (i = 0; i < n; ++i)
+        hash = (hash ^ states[i]) * 16777619u;
+    return hash;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_dfa_rehash(DFA *dfa, const uint32_t hsize)
+{
+    const DState *state = NULL;
+    const uint32_t *sets = NULL;
+    uint32_t i, n;
+    if (dfa->hash != NULL)
+        heap_delete_n(&dfa->hash, dfa->hsize, uint32_t);
+
+    dfa->hsize = hsize;
+    dfa->hash = heap_new_n(hsize, uint32_t);
+    bmem_set1((byte_t*)dfa->hash, hsize * sizeof32(uint32_t), 0xFF);
+    state = arrst_all_const(dfa->states, DState);
+    sets = arrst_all_const(dfa->sets, uint32_t);
+    n = arrst_size(dfa->states, DState);
+    for (i = 0; i < n; ++i)
+    {
+        uint32_t h = i_set_hash(sets + state[i].offset, state[i].size) & (hsize - 1);
+        while (dfa->hash[h] != UINT32_MAX)
+            h = (h + 1) & (hsize - 1);
+        dfa->hash[h] = i;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* DFA state for a set of NFA states. DFA_UNKNOWN if it's new and the cache is full */
+static uint32_t i_dfa_state(DFA *dfa, const uint32_t *states, const uint32_t n, const uint32_t accept)
+{
+    uint32_t h = i_set_hash(states, n) & (dfa->hsize - 1);
+    uint32_t id;
+    DState *state = NULL;
+    uint32_t *trans = NULL;
+
+    while (dfa->hash[h] != UINT32_MAX)
+    {
+        const DState *cstate = arrst_get_const(dfa->states, dfa->hash[h], DState);
+        if (cstate->size == n && bmem_cmp((const byte_t*)arrst_get_const(dfa->sets, cstate->offset, uint32_t), (const byte_t*)states, n * sizeof32(uint32_t)) == 0)
+            return dfa->hash[h];
+        h = (h + 1) & (dfa->hsize - 1);
+    }
+
+    if (arrst_size(dfa->trans, uint32_t) + arrst_size(dfa->sets, uint32_t) + dfa->nclasses + n > dfa->limit)
+        return DFA_UNKNOWN;
+
+    id = arrst_size(dfa->states, DState);
+    state = arrst_new(dfa->states, DState);
+    state->offset = arrst_size(dfa->sets, uint32_t);
+    state->size = n;
+    state->accept = FALSE;
+    state->moffset = UINT32_MAX;
+    state->msize = 0;
+    if (n > 0)
+    {
+        uint32_t *set = arrst_new_n(dfa->sets, n, uint32_t);
+        bmem_copy_n(set, states, n, uint32_t);
+        /* Sets are sorted, accept is the last NFA state */
+        state->accept = (bool_t)(states[n - 1] == accept);
+    }
+
+    trans = arrst_new_n(dfa->trans, dfa->nclasses, uint32_t);
+    bmem_set1((byte_t*)trans, dfa->nclasses * sizeof32(uint32_t), 0xFF);
+    dfa->hash[h] = id;
+    if ((id + 1) * 2 > dfa->hsize)
+        i_dfa_rehash(dfa, dfa->hsize * 2);
+
+    return id;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static DFA *i_dfa_create(NFA *nfa)
+{
+    DFA *dfa = heap_new0(DFA);
+    uint32_t accept = arrst_size(nfa->ttable, Trans) - 1;
+    uint32_t dead, start, i;
+    i_init_sets(nfa);
+    i_dfa_classes(nfa, dfa);
+    dfa->sets = arrst_create(uint32_t);
+    dfa->states = arrst_create(DState);
+    dfa->trans = arrst_create(uint32_t);
+    dfa->matches = arrst_create(uint32_t);
+    dfa->limit = DFA_CACHE_WORDS + DFA_CACHE_NFA * arrst_size(nfa->ttable, Trans);
+    i_dfa_rehash(dfa, 64);
+    dead = i_dfa_state(dfa, NULL, 0, accept);
+    nfa_start(nfa);
+    start = i_dfa_state(dfa, arrst_all(nfa->current, uint32_t), arrst_size(nfa->current, uint32_t), accept);
+    cassert(dead == DFA_DEAD);
+    cassert(start == DFA_START);
+    unref(dead);
+    unref(start);
+
+    /* The dead state never leaves */
+    for (i = 0; i < dfa->nclasses; ++i)
+        *arrst_get(dfa->trans, i, uint32_t) = DFA_DEAD;
+
+    return dfa;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Subset construction of one transition. DFA_UNKNOWN if the cache is full */
+static uint32_t i_dfa_next(NFA *nfa, const uint32_t id, const uint32_t cclass)
+{
+    DFA *dfa = nfa->dfa;
+    const DState *state = arrst_get_const(dfa->states, id, DState);
+    uint32_t next;
+    i_step(nfa, arrst_get_const(dfa->sets, state->offset, uint32_t), state->size, dfa->bounds[cclass], nfa->temp);
+    next = i_dfa_state(dfa, arrst_all(nfa->temp, uint32_t), arrst_size(nfa->temp, uint32_t), arrst_size(nfa->ttable, Trans) - 1);
+    if (next != DFA_UNKNOWN)
+        *arrst_get(dfa->trans, id * dfa->nclasses + cclass, uint32_t) = next;
+    return next;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Bytes that can start a match. UTF8 continuation bytes never do */
+static void i_dfa_first(NFA *nfa)
+{
+    DFA *dfa = nfa->dfa;
+    bool_t empty = arrst_get_const(dfa->states, DFA_START, DState)->accept;
+    bool_t *live = heap_new_n(dfa->nclasses, bool_t);
+    bool_t utf8 = FALSE;
+    uint32_t c;
+
+    for (c = 0; c < dfa->nclasses; ++c)
+    {
+        /* DFA_UNKNOWN (full cache) is considered alive */
+        live[c] = (bool_t)(empty == TRUE || i_dfa_next(nfa, DFA_START, c) != DFA_DEAD);
+        if (live[c] == TRUE && (c + 1 == dfa->nclasses || dfa->bounds[c + 1] > 128))
+            utf8 = TRUE;
+    }
+
+    dfa->nfirst = 0;
+    for (c = 0; c < 256; ++c)
+    {
+        if (c < 128)
+            dfa->first[c] = live[dfa->ascii[c]];
+        else if (c < 0xC0)
+            dfa->first[c] = FALSE;
+        else
+            dfa->first[c] = utf8;
+
+        if (dfa->first[c] == TRUE)
+        {
+            if (dfa->nfirst < 2)
+                dfa->first2[dfa->nfirst] = (char_t)c;
+            dfa->nfirst += 1;
+        }
+    }
+
+    heap_delete_n(&live, dfa->nclasses, bool_t);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static DFA *i_dfa(NFA *nfa)
+{
+    cassert_no_null(nfa);
+    if (nfa->dfa == NULL)
+    {
+        nfa->dfa = i_dfa_create(nfa);
+        i_dfa_first(nfa);
+    }
+
+    return nfa->dfa;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* The rest of 'str' is simulated in the NFA from DFA state 'id' */
+static bool_t i_nfa_match(NFA *nfa, const uint32_t id, const char_t *str)
+{
+    const DState *state = arrst_get_const(nfa->dfa->states, id, DState);
+    uint32_t codepoint = unicode_to_u32(str, ekUTF8);
+    uint32_t *set = NULL;
+    arrst_clear(nfa->current, NULL, uint32_t);
+    set = arrst_new_n(nfa->current, state->size, uint32_t);
+    bmem_copy_n(set, arrst_get_const(nfa->dfa->sets, state->offset, uint32_t), state->size, uint32_t);
+    while (codepoint != 0)
+    {
+        if (nfa_next(nfa, codepoint) == FALSE)
+            return FALSE;
+
+        str = unicode_next(str, ekUTF8);
+        codepoint = unicode_to_u32(str, ekUTF8);
+    }
+
+    return nfa_accept(nfa);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool_t nfa_match(NFA *nfa, const char_t *str)
+{
+    register const byte_t *s = (const byte_t*)str;
+    register const uint32_t *trans = NULL;
+    register uint32_t id = DFA_START;
+    DFA *dfa = NULL;
+    cassert_no_null(nfa);
+    cassert_no_null(str);
+
+    dfa = i_dfa(nfa);
+    trans = arrst_all_const(dfa->trans, uint32_t);
+    for (;;)
+    {
+        const byte_t *next = NULL;
+        uint32_t cclass, nid;
+
+        if (*s < 0x80)
+        {
+            if (*s == 0)
+                break;
+
+            cclass = dfa->ascii[*s];
+            next = s + 1;
+        }
+        else
+        {
+            uint32_t codepoint = unicode_to_u32((const char_t*)s, ekUTF8);
+            cclass = i_dfa_class(dfa, codepoint);
+            next = (const byte_t*)unicode_next((const char_t*)s, ekUTF8);
+        }
+
+        nid = trans[id * dfa->nclasses + cclass];
+        if (nid == DFA_UNKNOWN)
+        {
+            nid = i_dfa_next(nfa, id, cclass);
+            if (nid == DFA_UNKNOWN)
+                return i_nfa_match(nfa, id, (const char_t*)s);
+
+            /* The table may have been reallocated */
+            trans = arrst_all_const(dfa->trans, uint32_t);
+        }
+
+        if (nid == DFA_DEAD)
+            return FALSE;
+
+        id = nid;
+        s = next;
+    }
+
+    return arrst_get_const(dfa->states, id, DState)->accept;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t nfa_groups(const NFA *nfa)
+{
+    cassert_no_null(nfa);
+    return nfa->ngroups;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Bytes of the next UTF8 character, 0 if it's cut at the end of buffer */
+static __INLINE uint32_t i_utf8(const byte_t *str, const uint32_t size, uint32_t *codepoint)
+{
+    uint32_t i, n, cp;
+    byte_t c = str[0];
+    if (c < 0x80)
+    {
+        *codepoint = c;
+        return 1;
+    }
+
+    if (c >= 0xF0)
+    {
+        n = 4;
+        cp = c & 0x07;
+    }
+    else if (c >= 0xE0)
+    {
+        n = 3;
+        cp = c & 0x0F;
+    }
+    else if (c >= 0xC0)
+    {
+        n = 2;
+        cp = c & 0x1F;
+    }
+    else
+    {
+        /* Invalid lead byte, taken as Latin1 */
+        *codepoint = c;
+        return 1;
+    }
+
+    if (n > size)
+        return 0;
+
+    for (i = 1; i < n; ++i)
+        cp = (cp << 6) | (str[i] & 0x3F);
+
+    *codepoint = cp;
+    return n;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_nfa_longest(NFA *nfa, const uint32_t id, const byte_t *str, const uint32_t size, uint32_t pos, const bool_t last, uint32_t end, bool_t *more)
+{
+    const DState *state = arrst_get_const(nfa->dfa->states, id, DState);
+    uint32_t *set = NULL;
+    arrst_clear(nfa->current, NULL, uint32_t);
+    set = arrst_new_n(nfa->current, state->size, uint32_t);
+    bmem_copy_n(set, arrst_get_const(nfa->dfa->sets, state->offset, uint32_t), state->size, uint32_t);
+    while (pos < size)
+    {
+        uint32_t codepoint, n = i_utf8(str + pos, size - pos, &codepoint);
+        if (n == 0)
+            break;
+
+        if (nfa_next(nfa, codepoint) == FALSE)
+            return end;
+
+        pos += n;
+        if (nfa_accept(nfa) == TRUE)
+            end = pos;
+    }
+
+    *more = (bool_t)(last == FALSE);
+    return end;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * End of the longest match starting at 'pos' (UINT32_MAX if none).
+ * If not 'last', 'more' is set when the match could go on after 'size'.
+ */
+static uint32_t i_longest(NFA *nfa, const byte_t *str, const uint32_t size, uint32_t pos, const bool_t last, bool_t *more)
+{
+    DFA *dfa = nfa->dfa;
+    const uint32_t *trans = arrst_all_const(dfa->trans, uint32_t);
+    const DState *states = arrst_all_const(dfa->states, DState);
+    uint32_t id = DFA_START;
+    uint32_t end = states[DFA_START].accept == TRUE ? pos : UINT32_MAX;
+
+    *more = FALSE;
+    while (pos < size)
+    {
+        uint32_t codepoint, nid, n = i_utf8(str + pos, size - pos, &codepoint);
+        if (n == 0)
+            break;
+
+        nid = trans[id * dfa->nclasses + i_dfa_class(dfa, codepoint)];
+        if (nid == DFA_UNKNOWN)
+        {
+            nid = i_dfa_next(nfa, id, i_dfa_class(dfa, codepoint));
+            if (nid == DFA_UNKNOWN)
+                return i_nfa_longest(nfa, id, str, size, pos, last, end, more);
+
+            trans = arrst_all_const(dfa->trans, uint32_t);
+            states = arrst_all_const(dfa->states, DState);
+        }
+
+        if (nid == DFA_DEAD)
+            return end;
+
+        id = nid;
+        pos += n;
+        if (states[id].accept == TRUE)
+            end = pos;
+    }
+
+    *more = (bool_t)(last == FALSE);
+    return end;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Next position that can start a match, 'size' if none */
+static uint32_t i_candidate(const NFA *nfa, const byte_t *str, const uint32_t size, uint32_t pos)
+{
+    const DFA *dfa = nfa->dfa;
+    if (nfa->prefix != NULL)
+    {
+        return pos + bsimd_find((const char_t*)str + pos, size - pos, tc(nfa->prefix), str_len(nfa->prefix));
+    }
+    else if (dfa->nfirst <= 2)
+    {
+        if (dfa->nfirst == 0)
+            return size;
+        return pos + bsimd_chr2((const char_t*)str + pos, size - pos, dfa->first2[0], dfa->first2[dfa->nfirst - 1]);
+    }
+    else
+    {
+        while (pos < size && dfa->first[str[pos]] == FALSE)
+            pos += 1;
+        return pos;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool_t nfa_search(NFA *nfa, const char_t *str, const uint32_t size, const uint32_t from, const bool_t last, uint32_t *start, uint32_t *end)
+{
+    const byte_t *data = (const byte_t*)str;
+    uint32_t pos = from;
+    cassert_no_null(str);
+    cassert_no_null(start);
+    cassert_no_null(end);
+    cassert(from <= size);
+    i_dfa(nfa);
+
+    /* Every match contains the literal (only known for the whole input) */
+    if (last == TRUE && nfa->literal != NULL)
+    {
+        if (bsimd_find(str + pos, size - pos, tc(nfa->literal), str_len(nfa->literal)) == size - pos)
+        {
+            *start = size;
+            return FALSE;
+        }
+    }
+
+    for (;;)
+    {
+        bool_t more = FALSE;
+        uint32_t mend;
+        pos = i_candidate(nfa, data, size, pos);
+
+        if (pos == size)
+        {
+            if (last == FALSE)
+            {
+                /* A prefix could be cut at the end of buffer */
+                if (nfa->prefix != NULL)
+                {
+                    uint32_t keep = str_len(nfa->prefix) - 1;
+                    pos = size > from + keep ? size - keep : from;
+                    while (pos > from && (data[pos] & 0xC0) == 0x80)
+                        pos -= 1;
+                }
+
+                *start = pos;
+                return FALSE;
+            }
+
+            /* Empty match at the end */
+            if (arrst_get_const(nfa->dfa->states, DFA_START, DState)->accept == TRUE)
+            {
+                *start = size;
+                *end = size;
+                return TRUE;
+            }
+
+            *start = size;
+            return FALSE;
+        }
+
+        mend = i_longest(nfa, data, size, pos, last, &more);
+        if (more == TRUE)
+        {
+            *start = pos;
+            return FALSE;
+        }
+
+        if (mend != UINT32_MAX)
+        {
+            *start = pos;
+            *end = mend;
+            return TRUE;
+        }
+
+        /* Next character */
+        {
+            uint32_t codepoint, n = i_utf8(data + pos, size - pos, &codepoint);
+            pos += n > 0 ? n : size - pos;
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+typedef struct _threads_t Threads;
+struct _threads_t
+{
+    uint32_t size;
+    uint32_t *states;
+    uint32_t *caps;
+};
+
+/*---------------------------------------------------------------------------*/
+
+/* Thread priority is the order of arrival: first epsilon before the second */
+static void i_add_thread(NFA *nfa, Threads *threads, const uint32_t ncaps, const uint32_t mark, const uint32_t state, uint32_t *caps, const uint32_t pos)
+{
+    const Trans *trans = arrst_get_const(nfa->ttable, state, Trans);
+
+    if (nfa->marks[state] == mark)
+        return;
+
+    nfa->marks[state] = mark;
+    if (trans->symbol == TAG_SYMBOL)
+    {
+        uint32_t old = caps[trans->extra];
+        caps[trans->extra] = pos;
+        i_add_thread(nfa, threads, ncaps, mark, trans->state, caps, pos);
+        caps[trans->extra] = old;
+    }
+    else
+    {
+        bool_t epsilon = (bool_t)(trans->symbol == UINT32_MAX);
+        if (epsilon == FALSE || state == arrst_size(nfa->ttable, Trans) - 1)
+        {
+            threads->states[threads->size] = state;
+            bmem_copy_n(threads->caps + threads->size * ncaps, caps, ncaps, uint32_t);
+            threads->size += 1;
+        }
+
+        if (epsilon == TRUE)
+        {
+            i_add_thread(nfa, threads, ncaps, mark, trans->state, caps, pos);
+            if (trans->extra != UINT32_MAX)
+                i_add_thread(nfa, threads, ncaps, mark, trans->extra, caps, pos);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Pike VM over a known match [start, end) */
+void nfa_captures(NFA *nfa, const char_t *str, const uint32_t start, const uint32_t end, uint32_t *caps)
+{
+    const byte_t *data = (const byte_t*)str;
+    uint32_t nstates, ncaps, accept, pos = start;
+    Threads threads[2];
+    Threads *clist = &threads[0], *nlist = &threads[1];
+    uint32_t *work = NULL;
+    cassert_no_null(nfa);
+    cassert_no_null(caps);
+    i_init_sets(nfa);
+    nstates = arrst_size(nfa->ttable, Trans);
+    ncaps = 2 * (nfa->ngroups + 1);
+    accept = nstates - 1;
+    threads[0].states = heap_new_n(nstates, uint32_t);
+    threads[0].caps = heap_new_n(nstates * ncaps, uint32_t);
+    threads[1].states = heap_new_n(nstates, uint32_t);
+    threads[1].caps = heap_new_n(nstates * ncaps, uint32_t);
+    work = heap_new_n(ncaps, uint32_t);
+    bmem_set1((byte_t*)work, ncaps * sizeof32(uint32_t), 0xFF);
+    bmem_set1((byte_t*)caps, ncaps * sizeof32(uint32_t), 0xFF);
+    clist->size = 0;
+    i_add_thread(nfa, clist, ncaps, i_new_mark(nfa), 0, work, pos);
+
+    for (;;)
+    {
+        uint32_t i, codepoint, n, mark;
+        if (pos >= end)
+        {
+            for (i = 0; i < clist->size; ++i)
+            {
+                if (clist->states[i] == accept)
+                {
+                    bmem_copy_n(caps, clist->caps + i * ncaps, ncaps, uint32_t);
+                    break;
+                }
+            }
+            break;
+        }
+
+        n = i_utf8(data + pos, end - pos, &codepoint);
+        cassert(n > 0);
+        mark = i_new_mark(nfa);
+        nlist->size = 0;
+        for (i = 0; i < clist->size; ++i)
+        {
+            const Trans *trans = arrst_get_const(nfa->ttable, clist->states[i], Trans);
+            if (codepoint >= trans->symbol && codepoint <= trans->extra && trans->state != UINT32_MAX)
+            {
+                bmem_copy_n(work, clist->caps + i * ncaps, ncaps, uint32_t);
+                i_add_thread(nfa, nlist, ncaps, mark, trans->state, work, pos + n);
+            }
+        }
+
+        pos += n;
+        bmem_swap_type(&clist, &nlist, Threads*);
+    }
+
+    caps[0] = start;
+    caps[1] = end;
+    heap_delete_n(&threads[0].states, nstates, uint32_t);
+    heap_delete_n(&threads[0].caps, nstates * ncaps, uint32_t);
+    heap_delete_n(&threads[1].states, nstates, uint32_t);
+    heap_delete_n(&threads[1].caps, nstates * ncaps, uint32_t);
+    heap_delete_n(&work, ncaps, uint32_t);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* The closure last state (accept with epsilons) is moved to a plain accept state */
+static void i_plain_accept(NFA *nfa)
+{
+    uint32_t n = arrst_size(nfa->ttable, Trans);
+    Trans *trans = arrst_last(nfa->ttable, Trans);
+    cassert(i_is_last(trans) == TRUE);
+    if (trans->state != UINT32_MAX)
+    {
+        trans->extra = n;
+        trans = arrst_new(nfa->ttable, Trans);
+        trans->state = UINT32_MAX;
+        trans->symbol = 0;
+        trans->extra = 0;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * One NFA for all patterns. A chain of 'n' epsilon states goes to the
+ * start of each pattern, and each pattern keeps its own accept state.
+ */
+NFA *nfa_set(const char_t **patterns, const uint32_t n)
+{
+    ArrPt(NFA) *nfas = arrpt_create(NFA);
+    NFA *set = NULL;
+    uint32_t i, size = n;
+    cassert_no_null(patterns);
+    cassert(n > 0);
+    for (i = 0; i < n; ++i)
+    {
+        NFA *nfa = nfa_regex(patterns[i], FALSE);
+        if (nfa == NULL)
+            break;
+
+        i_plain_accept(nfa);
+        size += arrst_size(nfa->ttable, Trans);
+        arrpt_append(nfas, nfa, NFA);
+    }
+
+    if (i == n)
+    {
+        Trans *trans = NULL;
+        uint32_t offset = n;
+        set = heap_new0(NFA);
+        set->ttable = arrst_create(Trans);
+        set->npatterns = n;
+        set->accepts = heap_new_n(n, uint32_t);
+        trans = arrst_new_n(set->ttable, size, Trans);
+        for (i = 0; i < n; ++i)
+        {
+            const NFA *nfa = arrpt_get_const(nfas, i, NFA);
+            const Trans *src = arrst_all_const(nfa->ttable, Trans);
+            uint32_t j, m = arrst_size(nfa->ttable, Trans);
+
+            trans[i].state = offset;
+            trans[i].symbol = UINT32_MAX;
+            trans[i].extra = i + 1 < n ? i + 1 : UINT32_MAX;
+
+            for (j = 0; j < m; ++j)
+            {
+                Trans *dest = trans + offset + j;
+                *dest = src[j];
+                if (dest->state != UINT32_MAX)
+                    dest->state += offset;
+                if (dest->symbol == UINT32_MAX && dest->extra != UINT32_MAX)
+                    dest->extra += offset;
+            }
+
+            offset += m;
+            set->accepts[i] = offset - 1;
+        }
+
+        cassert(offset == size);
+    }
+
+    arrpt_destroy(&nfas, nfa_destroy, NFA);
+    return set;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t nfa_set_size(const NFA *nfa)
+{
+    cassert_no_null(nfa);
+    cassert(nfa->accepts != NULL);
+    return nfa->npatterns;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Patterns accepted in 'states' (sorted), appended to 'matches' (if any) */
+static uint32_t i_set_accepts(const NFA *nfa, const uint32_t *states, const uint32_t n, ArrSt(uint32_t) *matches)
+{
+    uint32_t i, pattern = 0, count = 0;
+    for (i = 0; i < n; ++i)
+    {
+        /* Only accept states have no target */
+        if (arrst_get_const(nfa->ttable, states[i], Trans)->state == UINT32_MAX)
+        {
+            while (nfa->accepts[pattern] != states[i])
+            {
+                pattern += 1;
+                cassert(pattern < nfa->npatterns);
+            }
+
+            if (matches != NULL)
+                arrst_append(matches, pattern, uint32_t);
+            count += 1;
+        }
+    }
+
+    return count;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Full cache. The DFA is built again from scratch and 'id' is added to it */
+static uint32_t i_dfa_flush(NFA *nfa, const uint32_t id)
+{
+    const DState *state = arrst_get_const(nfa->dfa->states, id, DState);
+    uint32_t n = state->size;
+    uint32_t *set = heap_new_n(n, uint32_t);
+    uint32_t *current = NULL;
+    cassert(id != DFA_DEAD);
+    bmem_copy_n(set, arrst_get_const(nfa->dfa->sets, state->offset, uint32_t), n, uint32_t);
+    i_dfa_destroy(&nfa->dfa);
+    i_dfa(nfa);
+    arrst_clear(nfa->current, NULL, uint32_t);
+    current = arrst_new_n(nfa->current, n, uint32_t);
+    bmem_copy_n(current, set, n, uint32_t);
+    heap_delete_n(&set, n, uint32_t);
+    return i_dfa_state(nfa->dfa, current, n, arrst_size(nfa->ttable, Trans) - 1);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* The rest of 'str' is simulated in the NFA from 'nfa->current' */
+static uint32_t i_nfa_set(NFA *nfa, const char_t *str, ArrSt(uint32_t) *matches)
+{
+    uint32_t codepoint = unicode_to_u32(str, ekUTF8);
+    while (codepoint != 0)
+    {
+        if (nfa_next(nfa, codepoint) == FALSE)
+            break;
+
+        str = unicode_next(str, ekUTF8);
+        codepoint = unicode_to_u32(str, ekUTF8);
+    }
+
+    return i_set_accepts(nfa, arrst_all(nfa->current, uint32_t), arrst_size(nfa->current, uint32_t), matches);
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t nfa_set_match(NFA *nfa, const char_t *str, ArrSt(uint32_t) *matches)
+{
+    register const byte_t *s = (const byte_t*)str;
+    register const uint32_t *trans = NULL;
+    register uint32_t id = DFA_START;
+    DFA *dfa = NULL;
+    DState *state = NULL;
+    cassert_no_null(nfa);
+    cassert_no_null(str);
+    cassert(nfa->accepts != NULL);
+
+    if (matches != NULL)
+        arrst_clear(matches, NULL, uint32_t);
+
+    dfa = i_dfa(nfa);
+    trans = arrst_all_const(dfa->trans, uint32_t);
+    for (;;)
+    {
+        const byte_t *next = NULL;
+        uint32_t cclass, nid;
+
+        if (*s < 0x80)
+        {
+            if (*s == 0)
+                break;
+
+            cclass = dfa->ascii[*s];
+            next = s + 1;
+        }
+        else
+        {
+            uint32_t codepoint = unicode_to_u32((const char_t*)s, ekUTF8);
+            cclass = i_dfa_class(dfa, codepoint);
+            next = (const byte_t*)unicode_next((const char_t*)s, ekUTF8);
+        }
+
+        nid = trans[id * dfa->nclasses + cclass];
+        if (nid == DFA_UNKNOWN)
+        {
+            nid = i_dfa_next(nfa, id, cclass);
+            if (nid == DFA_UNKNOWN)
+            {
+                id = i_dfa_flush(nfa, id);
+                dfa = nfa->dfa;
+                if (id != DFA_UNKNOWN)
+                    nid = i_dfa_next(nfa, id, cclass);
+
+                /* A single state doesn't fit in the cache */
+                if (nid == DFA_UNKNOWN)
+                    return i_nfa_set(nfa, (const char_t*)s, matches);
+            }
+
+            /* The table may have been reallocated */
+            trans = arrst_all_const(dfa->trans, uint32_t);
+        }
+
+        if (nid == DFA_DEAD)
+            return 0;
+
+        id = nid;
+        s = next;
+    }
+
+    /* Accepted patterns are computed once per DFA state */
+    state = arrst_get(dfa->states, id, DState);
+    if (state->moffset == UINT32_MAX)
+    {
+        state->moffset = arrst_size(dfa->matches, uint32_t);
+        state->msize = i_set_accepts(nfa, arrst_get_const(dfa->sets, state->offset, uint32_t), state->size, dfa->matches);
+    }
+
+    if (matches != NULL && state->msize > 0)
+    {
+        uint32_t *dest = arrst_new_n(matches, state->msize, uint32_t);
+        bmem_copy_n(dest, arrst_get_const(dfa->matches, state->moffset, uint32_t), state->msize, uint32_t);
+    }
+
+    return state->msize;
+}
@@ -26,5 +26,19 @@ bool_t nfa_next(NFA *nfa, const uint32_t codepoint);
 
 bool_t nfa_accept(NFA *nfa);
 
+bool_t nfa_match(NFA *nfa, const char_t *str);
+
+uint32_t nfa_groups(const NFA *nfa);
+
+bool_t nfa_search(NFA *nfa, const char_t *str, const uint32_t size, const uint32_t from, const bool_t last, uint32_t *start, uint32_t *end);
+
+void nfa_captures(NFA *nfa, const char_t *str, const uint32_t start, const uint32_t end, uint32_t *caps);
+
+NFA *nfa_set(const char_t **patterns, const uint32_t n);
+
+uint32_t nfa_set_size(const NFA *nfa);
+
+uint32_t nfa_set_match(NFA *nfa, const char_t *str, ArrSt(uint32_t) *matches);
+
 __END_C
 
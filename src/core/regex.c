@@ -12,7 +12,13 @@
 
 #include "regex.h"
 #include "nfa.inl"
-#include "unicode.h"
+#include "arrst.h"
+#include "bmem.h"
+#include "cassert.h"
+#include "heap.h"
+#include "ptr.h"
+#include "stream.h"
+#include "stream.inl"
 
 //RegEx *regex = regex_create("000_OCR_OK_01_.*\\.png");
 //bool_t ok1 = regex_match(regex, "000_OCR_OK_01_001.png");
@@ -50,17 +56,202 @@ void regex_destroy(RegEx **regex)
 
 bool_t regex_match(const RegEx *regex, const char_t *str)
 {
-    uint32_t codepoint;
-    nfa_start((NFA*)regex);
-    codepoint = unicode_to_u32(str, ekUTF8);
-    while(codepoint != 0)
+    return nfa_match((NFA*)regex, str);
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t regex_groups(const RegEx *regex)
+{
+    return nfa_groups((const NFA*)regex);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool_t regex_search(const RegEx *regex, const char_t *str, const uint32_t size, uint32_t *start, uint32_t *end)
+{
+    uint32_t mstart, mend;
+    if (nfa_search((NFA*)regex, str, size, 0, TRUE, &mstart, &mend) == TRUE)
     {
-        if (nfa_next((NFA*)regex, codepoint) == FALSE)
-            return FALSE;
+        ptr_assign(start, mstart);
+        ptr_assign(end, mend);
+        return TRUE;
+    }
 
-        str = unicode_next(str, ekUTF8);
-        codepoint = unicode_to_u32(str, ekUTF8);
+    return FALSE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool_t regex_captures(const RegEx *regex, const char_t *str, const uint32_t size, uint32_t *caps)
+{
+    uint32_t start, end;
+    if (nfa_search((NFA*)regex, str, size, 0, TRUE, &start, &end) == TRUE)
+    {
+        nfa_captures((NFA*)regex, str, start, end, caps);
+        return TRUE;
     }
 
-    return nfa_accept((NFA*)regex);
+    return FALSE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Position after an empty match */
+static uint32_t i_next_pos(const char_t *str, const uint32_t size, const uint32_t pos)
+{
+    uint32_t next = pos + 1;
+    while (next < size && ((byte_t)str[next] & 0xC0) == 0x80)
+        next += 1;
+    return next;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_find_all(NFA *nfa, const char_t *str, const uint32_t size, const bool_t last, const uint32_t offset, ArrSt(uint32_t) *matches, uint32_t *keep)
+{
+    uint32_t pos = 0, start, end, n = 0;
+    while (pos <= size)
+    {
+        if (nfa_search(nfa, str, size, pos, last, &start, &end) == FALSE)
+        {
+            *keep = start;
+            return n;
+        }
+
+        arrst_append(matches, offset + start, uint32_t);
+        arrst_append(matches, offset + end, uint32_t);
+        n += 1;
+        pos = end > start ? end : i_next_pos(str, size, end);
+    }
+
+    *keep = size;
+    return n;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t regex_find_all(const RegEx *regex, const char_t *str, const uint32_t size, ArrSt(uint32_t) *matches)
+{
+    uint32_t keep;
+    return i_find_all((NFA*)regex, str, size, TRUE, 0, matches, &keep);
+}
+
+/*---------------------------------------------------------------------------*/
+
+#define STM_BLOCK 0x10000
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * Streams are processed by blocks. Mapped and memory streams are used in place.
+ * The tail of a block that could start a match is kept until the next one.
+ * Blocks grow with the kept tail, so long matches are not rescanned too often.
+ */
+uint32_t regex_find_stm(const RegEx *regex, Stream *stm, ArrSt(uint32_t) *matches)
+{
+    Stream *carry = NULL;
+    byte_t *block = NULL;
+    uint32_t bsize = 0, offset = 0, n = 0;
+    cassert_no_null(stm);
+
+    for (;;)
+    {
+        const char_t *data = NULL;
+        uint32_t size = _stm_buffered(stm) == TRUE ? stm_buffer_size(stm) : 0;
+        uint32_t keep;
+
+        if (size > 0)
+        {
+            data = (const char_t*)stm_buffer(stm);
+            stm_skip(stm, size);
+        }
+        else
+        {
+            uint32_t csize = carry != NULL ? stm_buffer_size(carry) : 0;
+            uint32_t rsize = csize > STM_BLOCK ? csize : STM_BLOCK;
+            if (rsize > bsize)
+            {
+                if (block != NULL)
+                    heap_delete_n(&block, bsize, byte_t);
+                block = heap_new_n(rsize, byte_t);
+                bsize = rsize;
+            }
+
+            size = stm_read(stm, block, rsize);
+            data = (const char_t*)block;
+            if (size == 0)
+                break;
+        }
+
+        if (carry != NULL)
+        {
+            stm_write(carry, (const byte_t*)data, size);
+            data = (const char_t*)stm_buffer(carry);
+            size = stm_buffer_size(carry);
+        }
+
+        n += i_find_all((NFA*)regex, data, size, FALSE, offset, matches, &keep);
+        offset += keep;
+
+        /* The tail is copied, as 'data' can be 'carry' itself */
+        if (keep < size)
+        {
+            Stream *tail = stm_memory(size - keep);
+            stm_write(tail, (const byte_t*)data + keep, size - keep);
+            if (carry != NULL)
+                stm_close(&carry);
+            carry = tail;
+        }
+        else if (carry != NULL)
+        {
+            stm_close(&carry);
+        }
+    }
+
+    if (carry != NULL)
+    {
+        uint32_t keep;
+        n += i_find_all((NFA*)regex, (const char_t*)stm_buffer(carry), stm_buffer_size(carry), TRUE, offset, matches, &keep);
+        stm_close(&carry);
+    }
+    else
+    {
+        /* Empty match at the end of stream */
+        uint32_t keep;
+        n += i_find_all((NFA*)regex, "", 0, TRUE, offset, matches, &keep);
+    }
+
+    if (block != NULL)
+        heap_delete_n(&block, bsize, byte_t);
+
+    return n;
+}
+
+/*---------------------------------------------------------------------------*/
+
+RegExSet *regex_set_create(const char_t **patterns, const uint32_t n)
+{
+    return (RegExSet*)nfa_set(patterns, n);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void regex_set_destroy(RegExSet **set)
+{
+    nfa_destroy((NFA**)set);
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t regex_set_size(const RegExSet *set)
+{
+    return nfa_set_size((const NFA*)set);
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t regex_set_match(const RegExSet *set, const char_t *str, ArrSt(uint32_t) *matches)
+{
+    return nfa_set_match((NFA*)set, str, matches);
 }
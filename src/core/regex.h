@@ -21,4 +21,22 @@ void regex_destroy(RegEx **regex);
 
 bool_t regex_match(const RegEx *regex, const char_t *str);
 
+uint32_t regex_groups(const RegEx *regex);
+
+bool_t regex_search(const RegEx *regex, const char_t *str, const uint32_t size, uint32_t *start, uint32_t *end);
+
+bool_t regex_captures(const RegEx *regex, const char_t *str, const uint32_t size, uint32_t *caps);
+
+uint32_t regex_find_all(const RegEx *regex, const char_t *str, const uint32_t size, ArrSt(uint32_t) *matches);
+
+uint32_t regex_find_stm(const RegEx *regex, Stream *stm, ArrSt(uint32_t) *matches);
+
+RegExSet *regex_set_create(const char_t **patterns, const uint32_t n);
+
+void regex_set_destroy(RegExSet **set);
+
+uint32_t regex_set_size(const RegExSet *set);
+
+uint32_t regex_set_match(const RegExSet *set, const char_t *str, ArrSt(uint32_t) *matches);
+
 __END_C
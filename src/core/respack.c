@@ -16,37 +16,87 @@
 #include "arrpt.h"
 #include "arrst.h"
 #include "bfile.h"
-#include "buffer.h"
+#include "bmutex.h"
 #include "core.inl"
 #include "cassert.h"
 #include "heap.h"
-#include "hfile.h"
+#include "lzc.inl"
 #include "ptr.h"
-#include "stream.h"
 #include "strings.h"
 
+/* Same layout in resgen.c */
+#define PACK_MAGIC          0x5345524E
+#define PACK_VERSION        3
+
 typedef struct i_resource_t i_Resource;
+typedef struct i_header_t i_Header;
+typedef struct i_entry_t i_Entry;
 
 enum i_type_t
 {
     i_ekTYPE_EMBEDDED   = 0,
-    i_ekTYPE_PACKED     = 1
+    i_ekTYPE_PACKED     = 1,
+    i_ekTYPE_LINKED     = 2
 };
 
+/* 'zsize' > 0: 'data' is lz compressed, inflated on first use ('inflated', 'size' bytes) */
 struct i_resource_t
 {
     uint32_t type;
     const byte_t *data;
     uint32_t size;
+    uint32_t zsize;
+    byte_t *inflated;
     void *object;
     FPtr_destroy func_destroy;
 };
 
+/*
+ * Packed file, mapped in memory:
+ *  Header
+ *  Locale names (nlocales C strings)
+ *  Resource types (nresources uint32_t)
+ *  Table: nresources rows of (nlocales + 1) entries. Global first, then each locale (offset 0 --> global)
+ *  Data: C strings and files. Raw files of one page or more are page-aligned
+ */
+struct i_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t page;
+    uint32_t nlocales;
+    uint32_t nresources;
+    uint32_t locales;
+    uint32_t types;
+    uint32_t table;
+    uint32_t reserved[8];
+};
+
+/* 'zsize' > 0: lz compressed, 'zsize' bytes in file, 'size' once inflated */
+struct i_entry_t
+{
+    uint32_t offset;
+    uint32_t size;
+    uint32_t zsize;
+};
+
+/*
+ * Packed resources are read from 'data' (the map or the linked blob). 'resources' only keeps their objects.
+ * Packs are shared by threads: 'mutex' guards the objects and inflated data, created on first use.
+ */
 struct _respack
 {
     enum i_type_t type;
     String *name;
-    Buffer *buffer;
+    Mutex *mutex;
+    byte_t *map;
+    uint32_t map_size;
+    const byte_t *data;
+    const uint32_t *types;
+    const i_Entry *table;
+    uint32_t nresources;
+    uint32_t ncols;
+    uint32_t col;
     ArrSt(i_Resource) *resources;
 };
 
@@ -59,12 +109,15 @@ static void i_init_resource(
                         const uint32_t type, 
                         const byte_t *data,
                         const uint32_t size,
+                        const uint32_t zsize,
                         void **object)
 {
     cassert_no_null(resource);
     resource->type = type;
     resource->data = data;
     resource->size = size;
+    resource->zsize = zsize;
+    resource->inflated = NULL;
     resource->object = ptr_dget(object, void);
     resource->func_destroy = NULL;
 }
@@ -79,16 +132,19 @@ static void i_remove_resource(i_Resource *resource)
         cassert_no_nullf(resource->func_destroy);
         resource->func_destroy(&resource->object);
     }
+
+    if (resource->inflated != NULL)
+        heap_free(&resource->inflated, resource->size, "ResPackInflated");
 }
 
 /*---------------------------------------------------------------------------*/
 
-static ResPack *i_create_respack(const enum i_type_t type, String **name, Buffer **buffer, ArrSt(i_Resource) **resources)
+static ResPack *i_create_respack(const enum i_type_t type, String **name, ArrSt(i_Resource) **resources)
 {
-    ResPack *pack = heap_new(ResPack);
+    ResPack *pack = heap_new0(ResPack);
     pack->type = type;
     pack->name = ptr_dget_no_null(name, String);
-    pack->buffer = ptr_dget(buffer, Buffer);
+    pack->mutex = bmutex_create();
     pack->resources = ptr_dget_no_null(resources, ArrSt(i_Resource));
     return pack;
 }
@@ -100,11 +156,12 @@ void respack_destroy(ResPack **pack)
     cassert_no_null(pack);
     cassert_no_null(*pack);
     str_destroy(&(*pack)->name);
+    bmutex_close(&(*pack)->mutex);
     arrst_destroy(&(*pack)->resources, i_remove_resource, i_Resource);
     if ((*pack)->type == i_ekTYPE_PACKED)
-        buffer_destroy(&(*pack)->buffer);
+        bfile_unmap(&(*pack)->map, (*pack)->map_size);
     else
-        cassert((*pack)->buffer == NULL);
+        cassert((*pack)->map == NULL);
     heap_delete(pack, ResPack);
 }
 
@@ -113,68 +170,101 @@ void respack_destroy(ResPack **pack)
 ResPack *respack_embedded(const char_t *name)
 {
     String *lname = str_c(name);
-    Buffer *buffer = NULL;
     ArrSt(i_Resource) *resources = arrst_create(i_Resource);
-    return i_create_respack(i_ekTYPE_EMBEDDED, &lname, &buffer, &resources);
+    return i_create_respack(i_ekTYPE_EMBEDDED, &lname, &resources);
 }
 
 /*---------------------------------------------------------------------------*/
 
-static void i_load_object(Stream *stream, const byte_t **data, uint32_t *size, const uint32_t type)
+/*
+ * Only the header, locales and table are read. The data is not touched until used.
+ * Every offset and size is checked here, once. FALSE if the pack is damaged.
+ */
+static bool_t i_read_pack(ResPack *pack, const byte_t *data, const uint64_t size, const char_t *locale)
 {
-    /* String */
-    if (type == 0)
-    {
-        uint32_t strsize = stm_read_u32(stream);
-        *data = stm_buffer(stream);
-        *size = 0;
-        stm_skip(stream, strsize + 1);
-    }
-    /* Other file */
-    else
+    const i_Header *header = (const i_Header*)data;
+    const uint32_t *types = NULL;
+    const i_Entry *table = NULL;
+    uint64_t ncols, nentries, pos, i;
+    uint32_t col = 0;
+    cassert_no_null(pack);
+    cassert_no_null(data);
+    if (size < sizeof(i_Header) || header->magic != PACK_MAGIC || header->version != PACK_VERSION)
+        return FALSE;
+
+    ncols = (uint64_t)header->nlocales + 1;
+    nentries = (uint64_t)header->nresources * ncols;
+    if (header->types % sizeof(uint32_t) != 0 || header->table % sizeof(uint32_t) != 0)
+        return FALSE;
+
+    if (header->locales > size)
+        return FALSE;
+
+    if (header->types + (uint64_t)header->nresources * sizeof(uint32_t) > size)
+        return FALSE;
+
+    if (header->table + nentries * sizeof(i_Entry) > size)
+        return FALSE;
+
+    /* Locale names are C strings, terminated inside the pack */
+    pos = header->locales;
+    for (i = 0; i < header->nlocales; ++i)
     {
-        *size = stm_read_u32(stream);
-        *data = stm_buffer(stream);
-        stm_skip(stream, *size);
-    }
-}
+        const char_t *name = (const char_t*)(data + pos);
+        while (pos < size && data[pos] != 0)
+            pos += 1;
 
-/*---------------------------------------------------------------------------*/
+        if (pos == size)
+            return FALSE;
 
-static void i_load_resource(Stream *stream, const uint32_t locale_code, i_Resource *resource)
-{
-    uint32_t type;
-    const byte_t *data = NULL;
-    uint32_t size;
-    void *object = NULL;
-    register uint32_t i, num_localized;
-    type = stm_read_u32(stream);
-    i_load_object(stream, &data, &size, type);
-    num_localized = stm_read_u32(stream);
-    for (i = 0; i < num_localized; ++i)
+        if (col == 0 && str_equ_c(locale, name) == TRUE)
+            col = (uint32_t)i + 1;
+
+        pos += 1;
+    }
+
+    /* Global entries are mandatory. Texts are never compressed and end in zero */
+    types = (const uint32_t*)(data + header->types);
+    table = (const i_Entry*)(data + header->table);
+    for (i = 0; i < nentries; ++i)
     {
-        register uint32_t lcode = stm_read_u32(stream);
-        if (lcode == locale_code)
+        const i_Entry *entry = table + i;
+        uint32_t bytes = entry->zsize > 0 ? entry->zsize : entry->size;
+        if (entry->offset == 0)
         {
-            i_load_object(stream, &data, &size, type);
-        }
-        else
-        {
-            const byte_t *jump_data = NULL;
-            uint32_t jump_size;
-            i_load_object(stream, &jump_data, &jump_size, type);
+            if (i % ncols == 0)
+                return FALSE;
+            continue;
         }
+
+        if ((uint64_t)entry->offset + bytes > size)
+            return FALSE;
+
+        if (types[i / ncols] == 0 && (entry->zsize > 0 || entry->size == 0 || data[entry->offset + entry->size - 1] != 0))
+            return FALSE;
     }
 
-    i_init_resource(resource, type, data, size, &object);
+    pack->data = data;
+    pack->nresources = header->nresources;
+    pack->types = types;
+    pack->table = table;
+    pack->ncols = (uint32_t)ncols;
+    pack->col = col;
+
+    /* One slot per resource, never resized while threads are using the pack */
+    if (pack->nresources > 0)
+        arrst_new_n0(pack->resources, pack->nresources, i_Resource);
+
+    return TRUE;
 }
 
 /*---------------------------------------------------------------------------*/
 
-static Buffer *i_load_pack(ArrSt(i_Resource) *resources, const char_t *name, const char_t *locale)
+static void i_map_pack(ResPack *pack, const char_t *locale)
 {
     String *resfile = NULL;
-    Buffer *buffer = NULL;
+    File *file = NULL;
+    uint64_t size = 0;
 
     {
         String *path;
@@ -182,54 +272,37 @@ static Buffer *i_load_pack(ArrSt(i_Resource) *resources, const char_t *name, con
         bfile_dir_exec(pathname, 512);
         str_split_pathname(pathname, &path, NULL);
         #if defined (__WINDOWS__)
-        resfile = str_printf("%s%cres%c%s.res", tc(path), DIR_SEPARATOR, DIR_SEPARATOR, name);
+        resfile = str_printf("%s%cres%c%s.res", tc(path), DIR_SEPARATOR, DIR_SEPARATOR, tc(pack->name));
         #elif defined (__MACOS__)
-        resfile = str_printf("%s%c..%cresources%c%s.res", tc(path), DIR_SEPARATOR, DIR_SEPARATOR, DIR_SEPARATOR, name);
+        resfile = str_printf("%s%c..%cresources%c%s.res", tc(path), DIR_SEPARATOR, DIR_SEPARATOR, DIR_SEPARATOR, tc(pack->name));
         #elif defined (__IOS__)
         cassert(FALSE);
-        resfile = str_printf("%s%c..%cresources%c%s.res", tc(path), DIR_SEPARATOR, DIR_SEPARATOR, DIR_SEPARATOR, name);
+        resfile = str_printf("%s%c..%cresources%c%s.res", tc(path), DIR_SEPARATOR, DIR_SEPARATOR, DIR_SEPARATOR, tc(pack->name));
         #elif defined (__LINUX__)
-        resfile = str_printf("%s%cres%c%s.res", tc(path), DIR_SEPARATOR, DIR_SEPARATOR, name);
+        resfile = str_printf("%s%cres%c%s.res", tc(path), DIR_SEPARATOR, DIR_SEPARATOR, tc(pack->name));
         #endif
         str_destroy(&path);
     }
 
-    buffer = hfile_buffer(tc(resfile), NULL);
-    if (buffer != NULL)
+    file = bfile_open(tc(resfile), ekREAD, NULL);
+    if (file != NULL)
     {
-        uint32_t locale_code = UINT32_MAX;
-        Stream *stream = stm_from_block(buffer_data(buffer), buffer_size(buffer));
-        register uint32_t num_resources;
-        register uint32_t i, num_locales = stm_read_u32(stream);
-        for (i = 0; i < num_locales; ++i)
-        {
-            uint32_t locale_size = stm_read_u32(stream);
-            if (locale_code == UINT32_MAX)
-            {
-                const char_t *locale_name = (const char_t*)stm_buffer(stream);
-                if (str_equ_c(locale, locale_name) == TRUE)
-                    locale_code = i;
-            }
-
-            stm_skip(stream, locale_size);
-        }
+        if (bfile_fstat(file, NULL, &size, NULL, NULL) == TRUE && size >= sizeof(i_Header) && size < 0xFFFFFFFF)
+            pack->map = bfile_map(file, 0, (uint32_t)size, FALSE, NULL);
 
-        num_resources = stm_read_u32(stream);
-        for (i = 0; i < num_resources; ++i)
-        {
-            i_Resource *resource = arrst_new(resources, i_Resource);
-            i_load_resource(stream, locale_code, resource);
-        }
-
-        stm_close(&stream);
+        /* The map outlives the file handle */
+        bfile_close(&file);
     }
-    else
+
+    if (pack->map != NULL)
     {
-        cassert_fatal_msg(FALSE, "Resource pack can't be loaded.");
+        pack->map_size = (uint32_t)size;
+        if (i_read_pack(pack, pack->map, size, locale) == FALSE)
+            bfile_unmap(&pack->map, pack->map_size);
     }
 
+    cassert_fatal_msg(pack->map != NULL, "Resource pack can't be loaded.");
     str_destroy(&resfile);
-    return buffer;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -238,8 +311,21 @@ ResPack *respack_packed(const char_t *name, const char_t *locale)
 {
     String *lname = str_c(name);
     ArrSt(i_Resource) *resources = arrst_create(i_Resource);
-    Buffer *buffer = i_load_pack(resources, name, locale);
-    return i_create_respack(i_ekTYPE_PACKED, &lname, &buffer, &resources);
+    ResPack *pack = i_create_respack(i_ekTYPE_PACKED, &lname, &resources);
+    i_map_pack(pack, locale);
+    return pack;
+}
+
+/*---------------------------------------------------------------------------*/
+
+ResPack *respack_linked(const char_t *name, const byte_t *data, const uint32_t size, const char_t *locale)
+{
+    String *lname = str_c(name);
+    ArrSt(i_Resource) *resources = arrst_create(i_Resource);
+    ResPack *pack = i_create_respack(i_ekTYPE_LINKED, &lname, &resources);
+    i_read_pack(pack, data, size, locale);
+    cassert_fatal_msg(pack->data != NULL, "Resource pack can't be loaded.");
+    return pack;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -251,7 +337,7 @@ void respack_add_msg(ResPack *pack, const char_t *msg)
     cassert_no_null(pack);
     cassert(pack->type == i_ekTYPE_EMBEDDED);
     resource = arrst_new(pack->resources, i_Resource);
-    i_init_resource(resource, 0, (const byte_t*)msg, UINT32_MAX, &object);
+    i_init_resource(resource, 0, (const byte_t*)msg, UINT32_MAX, 0, &object);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -263,7 +349,20 @@ void respack_add_cdata(ResPack *pack, const uint32_t type, const byte_t *data, c
     cassert_no_null(pack);
     cassert(pack->type == i_ekTYPE_EMBEDDED);
     resource = arrst_new(pack->resources, i_Resource);
-    i_init_resource(resource, type, data, data_size, &object);
+    i_init_resource(resource, type, data, data_size, 0, &object);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void respack_add_lzdata(ResPack *pack, const uint32_t type, const byte_t *data, const uint32_t data_size, const uint32_t size)
+{
+    i_Resource *resource;
+    void *object = NULL;
+    cassert_no_null(pack);
+    cassert(pack->type == i_ekTYPE_EMBEDDED);
+    cassert(data_size > 0 && size > 0);
+    resource = arrst_new(pack->resources, i_Resource);
+    i_init_resource(resource, type, data, size, data_size, &object);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -295,52 +394,159 @@ static __INLINE uint32_t i_index(ResId id, const String *name)
 
 /*---------------------------------------------------------------------------*/
 
-const char_t *respack_text(const ResPack *pack, const ResId id)
+/* Packed: direct access to the table, no search (text size is 0, as embedded) */
+static const byte_t *i_data(const ResPack *pack, const uint32_t index, uint32_t *type, uint32_t *size, uint32_t *zsize)
 {
-    i_Resource *resource = NULL;
     cassert_no_null(pack);
-    resource = arrst_get(pack->resources, i_index(id, pack->name), i_Resource);
-    cassert_no_null(resource);
-    cassert(resource->type == 0);
-    return (const char_t*)resource->data;
+    cassert_no_null(type);
+    cassert_no_null(size);
+    cassert_no_null(zsize);
+    if (pack->data != NULL)
+    {
+        const i_Entry *row = NULL, *entry = NULL;
+        cassert(index < pack->nresources);
+        row = pack->table + index * pack->ncols;
+        entry = row + pack->col;
+        if (entry->offset == 0)
+            entry = row;
+        *type = pack->types[index];
+        *size = *type == 0 ? 0 : entry->size;
+        *zsize = entry->zsize;
+        return pack->data + entry->offset;
+    }
+    else
+    {
+        const i_Resource *resource = arrst_get_const(pack->resources, index, i_Resource);
+        cassert_no_null(resource);
+        *type = resource->type;
+        *size = resource->size;
+        *zsize = resource->zsize;
+        return resource->data;
+    }
 }
 
 /*---------------------------------------------------------------------------*/
 
-const byte_t *respack_file(const ResPack *pack, const ResId id, uint32_t *size)
+/* Packed: the slots (objects and inflated data) are created at load, empty */
+static i_Resource *i_slot(const ResPack *pack, const uint32_t index)
 {
-    i_Resource *resource = NULL;
     cassert_no_null(pack);
-    resource = arrst_get(pack->resources, i_index(id, pack->name), i_Resource);
-    cassert_no_null(resource);
-    cassert(resource->type == 2);
-    ptr_assign(size, resource->size);
-    return resource->data;
+    cassert(pack->data == NULL || index < pack->nresources);
+    return arrst_get(pack->resources, index, i_Resource);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void *respack_object_imp(const ResPack *pack, const ResId id, FPtr_create_from_data func_create, FPtr_destroy func_destroy)
+/* NULL if the compressed data is damaged */
+static byte_t *i_inflate(const byte_t *data, const uint32_t zsize, const uint32_t size)
 {
-    i_Resource *resource = NULL;
-    cassert_no_null(pack);
-    resource = arrst_get(pack->resources, i_index(id, pack->name), i_Resource);
-    cassert_no_null(resource);
+    byte_t *inflated = heap_malloc(size, "ResPackInflated");
+    uint32_t written = 0;
+    if (lzc_decompress(data, zsize, inflated, size, &written) == FALSE || written != size)
+        heap_free(&inflated, size, "ResPackInflated");
+    return inflated;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Compressed files are inflated once and kept while the pack lives */
+static const byte_t *i_file(const ResPack *pack, const uint32_t index, uint32_t *type, uint32_t *size)
+{
+    uint32_t zsize;
+    const byte_t *data = i_data(pack, index, type, size, &zsize);
+    if (zsize > 0)
+    {
+        i_Resource *resource = i_slot(pack, index);
+        bmutex_lock(pack->mutex);
+        if (resource->inflated == NULL)
+        {
+            resource->inflated = i_inflate(data, zsize, *size);
+            resource->size = *size;
+        }
+
+        data = resource->inflated;
+        bmutex_unlock(pack->mutex);
+        if (data == NULL)
+            *size = 0;
+    }
+
+    return data;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* The object is the cache. Compressed data is inflated only to create it. NULL if damaged */
+static void *i_object(const ResPack *pack, const uint32_t index, FPtr_create_from_data func_create, FPtr_destroy func_destroy)
+{
+    i_Resource *resource = i_slot(pack, index);
+    void *object = NULL;
+    bmutex_lock(pack->mutex);
     if (resource->object == NULL)
     {
+        uint32_t type, size, zsize;
+        const byte_t *data = i_data(pack, index, &type, &size, &zsize);
         cassert_no_nullf(func_create);
         cassert_no_nullf(func_destroy);
         cassert(resource->func_destroy == NULL);
-        resource->object = func_create(resource->data, resource->size);
-        resource->func_destroy = func_destroy;
+        if (zsize > 0 && resource->inflated == NULL)
+        {
+            byte_t *inflated = i_inflate(data, zsize, size);
+            if (inflated != NULL)
+            {
+                resource->object = func_create(inflated, size);
+                heap_free(&inflated, size, "ResPackInflated");
+            }
+        }
+        else
+        {
+            resource->object = func_create(zsize > 0 ? resource->inflated : data, size);
+        }
+
+        if (resource->object != NULL)
+            resource->func_destroy = func_destroy;
     }
 
-    return resource->object;     
+    object = resource->object;
+    bmutex_unlock(pack->mutex);
+    return object;
+}
+
+/*---------------------------------------------------------------------------*/
+
+const char_t *respack_text(const ResPack *pack, const ResId id)
+{
+    uint32_t type, size;
+    const byte_t *data = NULL;
+    cassert_no_null(pack);
+    data = i_file(pack, i_index(id, pack->name), &type, &size);
+    cassert(type == 0);
+    return (const char_t*)data;
 }
 
 /*---------------------------------------------------------------------------*/
 
-static __INLINE i_Resource *i_resource(const ArrPt(ResPack) *packs, const ResId id, bool_t *is_resid)
+const byte_t *respack_file(const ResPack *pack, const ResId id, uint32_t *size)
+{
+    uint32_t type, lsize;
+    const byte_t *data = NULL;
+    cassert_no_null(pack);
+    data = i_file(pack, i_index(id, pack->name), &type, &lsize);
+    cassert(type == 2);
+    ptr_assign(size, lsize);
+    return data;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void *respack_object_imp(const ResPack *pack, const ResId id, FPtr_create_from_data func_create, FPtr_destroy func_destroy)
+{
+    cassert_no_null(pack);
+    return i_object(pack, i_index(id, pack->name), func_create, func_destroy);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE const ResPack *i_pack(const ArrPt(ResPack) *packs, const ResId id, uint32_t *index, bool_t *is_resid)
 {
     const char_t *idr = i_magic(id);
     const char_t *packid = NULL;
@@ -356,9 +562,8 @@ static __INLINE i_Resource *i_resource(const ArrPt(ResPack) *packs, const ResId
         arrpt_foreach_const(pack, packs, ResPack)
             if (str_cmp_cn(tc(pack->name), idr, (uint32_t)(packid - idr)) == 0)
             {
-                uint32_t idx;
-                idx = str_to_u32(packid + 2, 10, NULL);
-                return arrst_get(pack->resources, idx, i_Resource);
+                *index = str_to_u32(packid + 2, 10, NULL);
+                return pack;
             }
         arrpt_end();
     }
@@ -369,11 +574,14 @@ static __INLINE i_Resource *i_resource(const ArrPt(ResPack) *packs, const ResId
 
 const char_t *respack_atext(const ArrPt(ResPack) *packs, const ResId id, bool_t *is_resid)
 {
-    const i_Resource *resource = i_resource(packs, id, is_resid);
-    if (resource != NULL)
+    uint32_t index;
+    const ResPack *pack = i_pack(packs, id, &index, is_resid);
+    if (pack != NULL)
     {
-        cassert(resource->type == 0);
-        return (const char_t*)resource->data;
+        uint32_t type, size;
+        const byte_t *data = i_file(pack, index, &type, &size);
+        cassert(type == 0);
+        return (const char_t*)data;
     }
     else
     {
@@ -385,12 +593,15 @@ const char_t *respack_atext(const ArrPt(ResPack) *packs, const ResId id, bool_t
 
 const byte_t *respack_afile(const ArrPt(ResPack) *packs, const ResId id, uint32_t *size, bool_t *is_resid)
 {
-    i_Resource *resource = i_resource(packs, id, is_resid);
-    if (resource != NULL)
+    uint32_t index;
+    const ResPack *pack = i_pack(packs, id, &index, is_resid);
+    if (pack != NULL)
     {
-        cassert(resource->type == 2);
-        ptr_assign(size, resource->size);
-        return resource->data;
+        uint32_t type, lsize;
+        const byte_t *data = i_file(pack, index, &type, &lsize);
+        cassert(type == 2);
+        ptr_assign(size, lsize);
+        return data;
     }
 
     ptr_assign(size, 0);
@@ -401,20 +612,10 @@ const byte_t *respack_afile(const ArrPt(ResPack) *packs, const ResId id, uint32_
 
 void *respack_aobj_imp(const ArrPt(ResPack) *packs, const ResId id, FPtr_create_from_data func_create, FPtr_destroy func_destroy, bool_t *is_resid)
 {
-    i_Resource *resource = i_resource(packs, id, is_resid);
-    if (resource != NULL)
-    {
-        if (resource->object == NULL)
-        {
-            cassert_no_nullf(func_create);
-            cassert_no_nullf(func_destroy);
-            cassert(resource->func_destroy == NULL);
-            resource->object = func_create(resource->data, resource->size);
-            resource->func_destroy = func_destroy;
-        }
-
-        return resource->object;     
-    }
+    uint32_t index;
+    const ResPack *pack = i_pack(packs, id, &index, is_resid);
+    if (pack != NULL)
+        return i_object(pack, index, func_create, func_destroy);
 
     return NULL;
 }
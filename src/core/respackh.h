@@ -18,10 +18,14 @@ ResPack *respack_embedded(const char_t *name);
 
 ResPack *respack_packed(const char_t *name, const char_t *locale);
 
+ResPack *respack_linked(const char_t *name, const byte_t *data, const uint32_t size, const char_t *locale);
+
 void respack_add_msg(ResPack *pack, const char_t *msg);
 
 void respack_add_cdata(ResPack *pack, const uint32_t type, const byte_t *data, const uint32_t data_size);
 
+void respack_add_lzdata(ResPack *pack, const uint32_t type, const byte_t *data, const uint32_t data_size, const uint32_t size);
+
 __END_C
 
     
\ No newline at end of file
@@ -15,12 +15,17 @@
 #include "lex.inl"
 #include "core.inl"
 #include "bfile.h"
+#include "bconv.inl"
+#include "bsimd.inl"
 #include "bmem.h"
+#include "bmutex.h"
 #include "bstd.h"
 #include "bsocket.h"
+#include "bthread.h"
 #include "cassert.h"
 #include "heap.h"
 #include "log.h"
+#include "lzc.inl"
 #include "osbs.h"
 #include "ptr.h"
 #include "strings.h"
@@ -46,6 +51,11 @@
 #define SOCK_WRITE_CACHE	512
 #define STD_CACHE           2048
 #define PIPE_CACHE          2048
+#define MMAP_WINDOW         0x10000000
+#define ASYNC_CACHE         0x40000
+#define LZ_MAX_THREADS      16
+#define LZ_THREAD_BLOCKS    4
+#define LZ_HEADER           8
 Stream *kSTDIN = NULL;
 Stream *kSTDOUT = NULL;
 Stream *kSTDERR = NULL;
@@ -61,12 +71,19 @@ typedef enum i_type_t
     i_ekTOSTDOUT        = 5,
     i_ekTOSTDERR        = 6,
     i_ekFROMSTDIN       = 7,
+    i_ekFROMMMAP        = 8,
+    i_ekTOFILEASYNC     = 9,
+    i_ekTOLZ            = 10,
+    i_ekFROMLZ          = 11,
 
     i_ekDEVNULL         = 0xFF
 } type_t;
 
 typedef struct i_file_t i_File;
 typedef struct i_socket_t i_Socket;
+typedef struct i_lzjob_t i_LzJob;
+typedef struct i_lztask_t i_LzTask;
+typedef struct i_filter_t i_Filter;
 typedef struct i_buffer_t i_Buffer;
 
 struct i_buffer_t
@@ -82,6 +99,16 @@ struct i_file_t
 {
     File *file;
     ferror_t file_err;
+    uint64_t map_size;
+    uint64_t map_offset;
+    Thread *writer;
+    Semaphore *todo;
+    Semaphore *done;
+    bool_t busy;
+    const byte_t *async_data;
+    uint32_t async_size;
+    uint32_t async_ret;
+    ferror_t async_err;
 };
 
 struct i_socket_t
@@ -90,10 +117,34 @@ struct i_socket_t
     serror_t sock_err;
 };
 
+struct i_lzjob_t
+{
+    const byte_t *src;
+    uint32_t size;
+    byte_t *dest;
+    uint32_t csize;
+};
+
+struct i_lztask_t
+{
+    i_LzJob *jobs;
+    uint32_t num_jobs;
+};
+
+struct i_filter_t
+{
+    Stream *stm;
+    uint32_t nthreads;
+    byte_t *block;
+    uint32_t block_size;
+    i_LzJob *jobs;
+};
+
 typedef union i_channel_t
 {
     i_File file;
     i_Socket sock;
+    i_Filter filt;
 } i_Channel;
 
 struct _stream_t
@@ -127,9 +178,13 @@ static void i_from_mem_fill_cache(Stream*, const uint32_t size);
 static void i_file_fill_cache(Stream*, const uint32_t size);
 //static void i_sock_fill_cache(Stream*, const uint32_t size);
 static void i_stdin_fill_cache(Stream*, const uint32_t size);
+static void i_mmap_fill_cache(Stream*, const uint32_t size);
+static void i_lz_fill_cache(Stream*, const uint32_t size);
 
 typedef void(*i_FPtr_write)(Stream*, const byte_t *data, const uint32_t size);
 static void i_file_write(Stream*, const byte_t *data, const uint32_t size);
+static void i_file_async_write(Stream*, const byte_t *data, const uint32_t size);
+static void i_lz_write(Stream*, const byte_t *data, const uint32_t size);
 static void i_sock_write(Stream*, const byte_t *data, const uint32_t size);
 static void i_stdout_write(Stream*, const byte_t *data, const uint32_t size);
 static void i_stderr_write(Stream*, const byte_t *data, const uint32_t size);
@@ -142,7 +197,11 @@ static const i_FPtr_cache i_FUNC_FILL[] = {
                                             NULL,      				/* i_ekSOCKET */
                                             NULL,                   /* i_ekTOSTDOUT */
                                             NULL,                   /* i_ekTOSTDERR */
-                                            i_stdin_fill_cache };   /* i_ekFROMSTDIN */
+                                            i_stdin_fill_cache,     /* i_ekFROMSTDIN */
+                                            i_mmap_fill_cache,      /* i_ekFROMMMAP */
+                                            NULL,                   /* i_ekTOFILEASYNC */
+                                            NULL,                   /* i_ekTOLZ */
+                                            i_lz_fill_cache };      /* i_ekFROMLZ */
 
 static const i_FPtr_write i_FUNC_WRITE[] = {
                                             NULL,                   /* i_ekTOMEMORY */
@@ -152,7 +211,11 @@ static const i_FPtr_write i_FUNC_WRITE[] = {
                                             i_sock_write,           /* i_ekSOCKET */
                                             i_stdout_write,         /* i_ekTOSTDOUT */
                                             i_stderr_write,         /* i_ekTOSTDERR */
-                                            NULL };                 /* i_ekFROMSTDIN */
+                                            NULL,                   /* i_ekFROMSTDIN */
+                                            NULL,                   /* i_ekFROMMMAP */
+                                            i_file_async_write,     /* i_ekTOFILEASYNC */
+                                            i_lz_write,             /* i_ekTOLZ */
+                                            NULL };                 /* i_ekFROMLZ */
 
 /*---------------------------------------------------------------------------*/
 
@@ -243,8 +306,23 @@ static void i_close_channel(i_Channel *channel, const type_t type)
 {
     switch (type)
     {
+        case i_ekTOFILEASYNC:
+            /* The writer is idle (stm_flush). A NULL buffer ends it */
+            if (channel->file.writer != NULL)
+            {
+                channel->file.async_data = NULL;
+                bsem_post(channel->file.todo);
+                bthread_wait(channel->file.writer);
+                bthread_close(&channel->file.writer);
+            }
+            bsem_close(&channel->file.todo);
+            bsem_close(&channel->file.done);
+            bfile_close(&channel->file.file);
+            break;
+
         case i_ekTOFILE:
         case i_ekFROMFILE:
+        case i_ekFROMMMAP:
             bfile_close(&channel->file.file);
             break;
 
@@ -252,6 +330,18 @@ static void i_close_channel(i_Channel *channel, const type_t type)
             bsocket_close(&channel->sock.socket);
             break;
 
+        case i_ekTOLZ:
+        {
+            byte_t end[LZ_HEADER] = {0, 0, 0, 0, 0, 0, 0, 0};
+            stm_write(channel->filt.stm, end, LZ_HEADER);
+            heap_delete_n(&channel->filt.jobs, channel->filt.nthreads * LZ_THREAD_BLOCKS, i_LzJob);
+        }
+        /* fall through */
+        case i_ekFROMLZ:
+            heap_free(&channel->filt.block, channel->filt.block_size, "StreamLzBlock");
+            stm_close(&channel->filt.stm);
+            break;
+
         case i_ekFROMMEMORY:
         case i_ekTOMEMORY:
         case i_ekTOSTDOUT:
@@ -271,6 +361,17 @@ void stm_close(Stream **stm)
     cassert_no_null(stm);
     cassert_no_null(*stm);
     stm_flush(*stm);
+    if ((*stm)->type == i_ekTOFILEASYNC && BIT_TEST((*stm)->state, BROKEN_BIT) == TRUE)
+        log_printf("Error writing to file (async stream). Check 'stm_state' after 'stm_flush'.");
+
+    if ((*stm)->type == i_ekFROMMMAP && (*stm)->buffer1.data != NULL)
+    {
+        bfile_unmap(&(*stm)->buffer1.data, (*stm)->buffer1.size);
+        (*stm)->buffer1.size = 0;
+        (*stm)->buffer1.roffset = 0;
+        (*stm)->buffer1.woffset = 0;
+    }
+
     i_remove_buffer(&(*stm)->buffer1, "StreamBuffer1");
     i_remove_buffer(&(*stm)->buffer2, "StreamBuffer2");
     i_remove_buffer(&(*stm)->textline, "StreamTextLine");
@@ -342,6 +443,45 @@ Stream *stm_from_file(const char_t *pathname, ferror_t *error)
 
 /*---------------------------------------------------------------------------*/
 
+Stream *stm_from_mmap(const char_t *pathname, ferror_t *error)
+{
+    ferror_t lerror;
+    uint64_t size = 0;
+    File *file = bfile_open(pathname, ekREAD, &lerror);
+    if (file != NULL && bfile_fstat(file, NULL, &size, NULL, &lerror) == FALSE)
+        bfile_close(&file);
+
+    ptr_assign(error, lerror);
+    if (file != NULL)
+    {
+        Stream *stm = i_create_stream(i_ekFROMMMAP);
+        i_init_buffer(&stm->buffer1, 0, "StreamBuffer1");
+        stm->buffer1.dynamic_alloc = FALSE;
+        stm->input = &stm->buffer1;
+        stm->channel.file.file = file;
+        stm->channel.file.file_err = ekFOK;
+        stm->channel.file.map_size = size;
+        stm->channel.file.map_offset = 0;
+
+        /* Map the first window now, so 'stm_buffer' is ready before any read */
+        if (size > 0)
+        {
+            i_mmap_fill_cache(stm, 0);
+            ptr_assign(error, stm->channel.file.file_err);
+            if (stm->channel.file.file_err != ekFOK)
+                stm_close(&stm);
+        }
+
+        return stm;
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
 static Stream *i_to_file(File *file, const ferror_t lerror, ferror_t *error)
 {
     ptr_assign(error, lerror);
@@ -371,6 +511,76 @@ Stream *stm_to_file(const char_t *pathname, ferror_t *error)
 
 /*---------------------------------------------------------------------------*/
 
+Stream *stm_to_file_async(const char_t *pathname, ferror_t *error)
+{
+    ferror_t lerror;
+    File *file = bfile_create(pathname, &lerror);
+    ptr_assign(error, lerror);
+    if (file != NULL)
+    {
+        Stream *stm = i_create_stream(i_ekTOFILEASYNC);
+        i_init_buffer(&stm->buffer1, ASYNC_CACHE, "StreamBuffer1");
+        i_init_buffer(&stm->buffer2, ASYNC_CACHE, "StreamBuffer2");
+        stm->output = &stm->buffer1;
+        stm->channel.file.file = file;
+        stm->channel.file.file_err = ekFOK;
+        stm->channel.file.writer = NULL;
+        stm->channel.file.todo = bsem_create(0);
+        stm->channel.file.done = bsem_create(0);
+        stm->channel.file.busy = FALSE;
+        return stm;
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static const byte_t i_LZ_MAGIC[4] = {'N', 'L', 'Z', '1'};
+
+/*---------------------------------------------------------------------------*/
+
+Stream *stm_to_lz(Stream *stm, const uint32_t nthreads)
+{
+    Stream *lz = i_create_stream(i_ekTOLZ);
+    uint32_t nblocks;
+    cassert_no_null(stm);
+    cassert(nthreads > 0);
+    lz->channel.filt.stm = stm;
+    lz->channel.filt.nthreads = nthreads < LZ_MAX_THREADS ? nthreads : LZ_MAX_THREADS;
+    nblocks = lz->channel.filt.nthreads * LZ_THREAD_BLOCKS;
+    lz->channel.filt.block_size = nblocks * lzc_bound(LZC_BLOCK);
+    lz->channel.filt.block = heap_malloc(lz->channel.filt.block_size, "StreamLzBlock");
+    lz->channel.filt.jobs = heap_new_n(nblocks, i_LzJob);
+    i_init_buffer(&lz->buffer1, nblocks * LZC_BLOCK, "StreamBuffer1");
+    lz->output = &lz->buffer1;
+    stm_write(stm, i_LZ_MAGIC, sizeof(i_LZ_MAGIC));
+    return lz;
+}
+
+/*---------------------------------------------------------------------------*/
+
+Stream *stm_from_lz(Stream *stm)
+{
+    Stream *lz = i_create_stream(i_ekFROMLZ);
+    byte_t magic[sizeof(i_LZ_MAGIC)];
+    cassert_no_null(stm);
+    lz->channel.filt.stm = stm;
+    lz->channel.filt.nthreads = 1;
+    lz->channel.filt.block_size = lzc_bound(LZC_BLOCK);
+    lz->channel.filt.block = heap_malloc(lz->channel.filt.block_size, "StreamLzBlock");
+    lz->channel.filt.jobs = NULL;
+    i_init_buffer(&lz->buffer1, LZC_BLOCK, "StreamBuffer1");
+    lz->input = &lz->buffer1;
+    if (stm_read(stm, magic, sizeof(magic)) != sizeof(magic) || bmem_cmp(magic, i_LZ_MAGIC, sizeof(magic)) != 0)
+        BIT_SET(lz->state, CORRUPTION_BIT);
+    return lz;
+}
+
+/*---------------------------------------------------------------------------*/
+
 Stream *stm_append_file(const char_t *pathname, ferror_t *error)
 {
     ferror_t lerror;
@@ -667,7 +877,7 @@ sstate_t stm_state(const Stream *stm)
 ferror_t stm_file_err(const Stream *stm)
 {
     cassert_no_null(stm);
-    cassert(stm->type == i_ekTOFILE || stm->type == i_ekFROMFILE);
+    cassert(stm->type == i_ekTOFILE || stm->type == i_ekFROMFILE || stm->type == i_ekFROMMMAP || stm->type == i_ekTOFILEASYNC);
     return stm->channel.file.file_err;
 }
 
@@ -702,7 +912,7 @@ String *stm_str(const Stream *stm)
 const byte_t *stm_buffer(const Stream *stm)
 {
     cassert_no_null(stm);
-    cassert(stm->type == i_ekTOMEMORY || stm->type == i_ekFROMMEMORY);
+    cassert(stm->type == i_ekTOMEMORY || stm->type == i_ekFROMMEMORY || stm->type == i_ekFROMMMAP);
     cassert(stm->buffer1.woffset >= stm->buffer1.roffset);
     if (stm->buffer1.woffset > stm->buffer1.roffset)
         return stm->buffer1.data + stm->buffer1.roffset;
@@ -715,7 +925,7 @@ const byte_t *stm_buffer(const Stream *stm)
 uint32_t stm_buffer_size(const Stream *stm)
 {
     cassert_no_null(stm);
-    cassert(stm->type == i_ekTOMEMORY);
+    cassert(stm->type == i_ekTOMEMORY || stm->type == i_ekFROMMEMORY || stm->type == i_ekFROMMMAP);
     cassert(stm->buffer1.woffset >= stm->buffer1.roffset);
     return stm->buffer1.woffset - stm->buffer1.roffset;
 }
@@ -726,7 +936,7 @@ static void i_file_write(Stream *stm, const byte_t *data, const uint32_t size)
 {
     uint32_t num_written = 0;
     cassert_no_null(stm);
-    cassert(stm->type == i_ekTOFILE);
+    cassert(stm->type == i_ekTOFILE || stm->type == i_ekTOFILEASYNC);
     if (bfile_write(stm->channel.file.file, data, size, &num_written, &stm->channel.file.file_err) == TRUE)
     {
         if ((uint32_t)num_written != size)
@@ -740,6 +950,197 @@ static void i_file_write(Stream *stm, const byte_t *data, const uint32_t size)
 
 /*---------------------------------------------------------------------------*/
 
+/*
+ * Writer thread. It lives as long as the stream and only touches the 'async_*'
+ * fields of the channel, between a 'todo' post and its 'done' post.
+ */
+static uint32_t i_async_main(Stream *stm)
+{
+    i_File *file = &stm->channel.file;
+    for (;;)
+    {
+        uint32_t num_written = 0;
+        bsem_wait(file->todo, UINT32_MAX);
+        if (file->async_data == NULL)
+            break;
+
+        file->async_ret = 1;
+        if (bfile_write(file->file, file->async_data, file->async_size, &num_written, &file->async_err) == TRUE)
+        {
+            if (num_written == file->async_size)
+                file->async_ret = 0;
+        }
+
+        bsem_post(file->done);
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_async_wait(Stream *stm)
+{
+    i_File *file = &stm->channel.file;
+    if (file->busy == TRUE)
+    {
+        bsem_wait(file->done, UINT32_MAX);
+        file->busy = FALSE;
+        if (file->async_ret != 0)
+        {
+            file->file_err = file->async_err;
+            BIT_SET(stm->state, BROKEN_BIT);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * A full cache buffer is handed to the writer thread and the stream continues
+ * in the other one. At most one write is in flight, so memory is bounded by
+ * the two buffers. Any other data (too big for cache) is written in place.
+ */
+static void i_file_async_write(Stream *stm, const byte_t *data, const uint32_t size)
+{
+    i_File *file = NULL;
+    cassert_no_null(stm);
+    cassert(stm->type == i_ekTOFILEASYNC);
+    file = &stm->channel.file;
+    i_async_wait(stm);
+    if (!IS_OK(stm->state))
+        return;
+
+    /* The writer is started on first use. Without it, data is written in place */
+    if (file->writer == NULL)
+        file->writer = bthread_create(i_async_main, stm, Stream);
+
+    if (data == stm->output->data && file->writer != NULL)
+    {
+        file->async_data = data;
+        file->async_size = size;
+        file->async_err = ekFOK;
+        file->busy = TRUE;
+        bsem_post(file->todo);
+        stm->output = stm->output == &stm->buffer1 ? &stm->buffer2 : &stm->buffer1;
+        cassert(stm->output->woffset == 0);
+        return;
+    }
+
+    i_file_write(stm, data, size);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_lz_main(i_LzTask *task)
+{
+    uint32_t i;
+    cassert_no_null(task);
+    for (i = 0; i < task->num_jobs; ++i)
+    {
+        i_LzJob *job = &task->jobs[i];
+        job->csize = lzc_compress(job->src, job->size, job->dest);
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_lz_header(byte_t *header, const uint32_t size, const uint32_t csize)
+{
+    header[0] = (byte_t)(size & 0xFF);
+    header[1] = (byte_t)((size >> 8) & 0xFF);
+    header[2] = (byte_t)((size >> 16) & 0xFF);
+    header[3] = (byte_t)(size >> 24);
+    header[4] = (byte_t)(csize & 0xFF);
+    header[5] = (byte_t)((csize >> 8) & 0xFF);
+    header[6] = (byte_t)((csize >> 16) & 0xFF);
+    header[7] = (byte_t)(csize >> 24);
+}
+
+/*
+ * Data is split in independent blocks of LZC_BLOCK bytes. Each thread
+ * compresses a consecutive run of up to LZ_THREAD_BLOCKS blocks and the
+ * result is written in order, so the output doesn't depend on 'nthreads'.
+ * Blocks that don't shrink are stored raw (csize == size).
+ */
+static void i_lz_write(Stream *stm, const byte_t *data, const uint32_t size)
+{
+    i_Filter *filt = NULL;
+    uint32_t bound = lzc_bound(LZC_BLOCK);
+    uint32_t remain = size;
+    cassert_no_null(stm);
+    cassert(stm->type == i_ekTOLZ);
+    filt = &stm->channel.filt;
+
+    while (remain > 0)
+    {
+        Thread *threads[LZ_MAX_THREADS];
+        i_LzTask tasks[LZ_MAX_THREADS];
+        uint32_t nblocks = 0, ntasks = 0, i;
+
+        while (remain > 0 && nblocks < filt->nthreads * LZ_THREAD_BLOCKS)
+        {
+            i_LzJob *job = &filt->jobs[nblocks];
+            job->src = data;
+            job->size = remain < LZC_BLOCK ? remain : LZC_BLOCK;
+            job->dest = filt->block + nblocks * bound;
+            data += job->size;
+            remain -= job->size;
+            nblocks += 1;
+        }
+
+        for (i = 0; i < nblocks; i += LZ_THREAD_BLOCKS)
+        {
+            tasks[ntasks].jobs = &filt->jobs[i];
+            tasks[ntasks].num_jobs = nblocks - i < LZ_THREAD_BLOCKS ? nblocks - i : LZ_THREAD_BLOCKS;
+            threads[ntasks] = NULL;
+            if (ntasks > 0)
+                threads[ntasks] = bthread_create(i_lz_main, &tasks[ntasks], i_LzTask);
+            ntasks += 1;
+        }
+
+        /* The calling thread takes the first task and any the OS couldn't start */
+        for (i = 0; i < ntasks; ++i)
+        {
+            if (threads[i] == NULL)
+                i_lz_main(&tasks[i]);
+        }
+
+        for (i = 0; i < ntasks; ++i)
+        {
+            if (threads[i] != NULL)
+            {
+                bthread_wait(threads[i]);
+                bthread_close(&threads[i]);
+            }
+        }
+
+        for (i = 0; i < nblocks; ++i)
+        {
+            const i_LzJob *job = &filt->jobs[i];
+            byte_t header[LZ_HEADER];
+            if (job->csize < job->size)
+            {
+                i_lz_header(header, job->size, job->csize);
+                stm_write(filt->stm, header, LZ_HEADER);
+                stm_write(filt->stm, job->dest, job->csize);
+            }
+            else
+            {
+                i_lz_header(header, job->size, job->size);
+                stm_write(filt->stm, header, LZ_HEADER);
+                stm_write(filt->stm, job->src, job->size);
+            }
+        }
+    }
+
+    if (stm_state(filt->stm) != ekSTOK)
+        BIT_SET(stm->state, BROKEN_BIT);
+}
+
+/*---------------------------------------------------------------------------*/
+
 static void i_sock_write(Stream *stm, const byte_t *data, const uint32_t size)
 {
     uint32_t num_written = 0;
@@ -890,7 +1291,11 @@ static void i_write(Stream *stm, const byte_t *data, const uint32_t size, const
     {
         // No space in buffer
         if (output->woffset + size > output->size)
+        {
             i_need_buffer_space(stm, stm->output, size);
+            // Async file streams switch to the other buffer
+            output = stm->output;
+        }
 
         // No space in buffer after request
         // So big for cache --> Direct writting to channel
@@ -965,12 +1370,28 @@ void stm_write(Stream *stm, const byte_t *data, const uint32_t size)
 
 static void i_write_utf16(Stream *stm, const char_t *str)
 {
-    uint32_t codepoint = unicode_to_u32(str, ekUTF8);
+    const char_t *end = str + str_len_c(str);
     cassert_no_null(stm);
-    while (IS_OK(stm->state) && codepoint != 0)
+    while (IS_OK(stm->state) && str < end)
     {
         char_t utf16[4];
-        uint32_t bytes;
+        uint32_t codepoint, bytes;
+
+        /* ASCII runs are widened in blocks when no byte swap is needed */
+        if (REV_OUT(stm->state) == FALSE)
+        {
+            char_t block[512];
+            uint32_t size = (uint32_t)(end - str);
+            uint32_t n = bsimd_ascii_utf16(block, str, size < 256 ? size : 256);
+            if (n > 0)
+            {
+                i_write(stm, (const byte_t*)block, n * 2, FALSE);
+                str += n;
+                continue;
+            }
+        }
+
+        codepoint = unicode_to_u32(str, ekUTF8);
         bytes = unicode_to_char(codepoint, utf16, ekUTF16);
         if (bytes == 2)
         {
@@ -984,7 +1405,6 @@ static void i_write_utf16(Stream *stm, const char_t *str)
         }
 
         str = unicode_next(str, ekUTF8);
-        codepoint = unicode_to_u32(str, ekUTF8);
     }
 }
 
@@ -992,13 +1412,27 @@ static void i_write_utf16(Stream *stm, const char_t *str)
 
 static void i_write_utf32(Stream *stm, const char_t *str)
 {
-    uint32_t codepoint = unicode_to_u32(str, ekUTF8);
+    const char_t *end = str + str_len_c(str);
     cassert_no_null(stm);
-    while (IS_OK(stm->state) && codepoint != 0)
+    while (IS_OK(stm->state) && str < end)
     {
+        uint32_t codepoint;
+        if (REV_OUT(stm->state) == FALSE)
+        {
+            char_t block[1024];
+            uint32_t size = (uint32_t)(end - str);
+            uint32_t n = bsimd_ascii_utf32(block, str, size < 256 ? size : 256);
+            if (n > 0)
+            {
+                i_write(stm, (const byte_t*)block, n * 4, FALSE);
+                str += n;
+                continue;
+            }
+        }
+
+        codepoint = unicode_to_u32(str, ekUTF8);
         i_write(stm, (const byte_t*)&codepoint, 4, BIT_TEST(stm->state, WRITE_ENDIAN_BIT));
         str = unicode_next(str, ekUTF8);
-        codepoint = unicode_to_u32(str, ekUTF8);
     }
 }
 
@@ -1235,6 +1669,15 @@ void stm_write_r64(Stream *stm, const real64_t value)
 
 /*---------------------------------------------------------------------------*/
 
+void stm_write_r64_text(Stream *stm, const real64_t value)
+{
+    char_t str[BCONV_DTOA_SIZE];
+    bconv_dtoa(value, str, sizeof(str));
+    stm_writef(stm, str);
+}
+
+/*---------------------------------------------------------------------------*/
+
 static void i_from_mem_fill_cache(Stream *stm, const uint32_t size)
 {
     cassert_no_null(stm);
@@ -1288,6 +1731,52 @@ static void i_file_fill_cache(Stream *stm, const uint32_t size)
 
 /*---------------------------------------------------------------------------*/
 
+/* Slides the window over the file mapping. No data is copied */
+static void i_mmap_fill_cache(Stream *stm, const uint32_t size)
+{
+    i_Buffer *input;
+    i_File *file;
+    cassert_no_null(stm);
+    cassert(stm->type == i_ekFROMMMAP);
+    input = stm->input;
+    file = &stm->channel.file;
+    cassert_no_null(input);
+    cassert(input->woffset == input->roffset);
+    unref(size);
+
+    if (input->data != NULL)
+    {
+        file->map_offset += input->size;
+        bfile_unmap(&input->data, input->size);
+    }
+
+    input->size = 0;
+    input->woffset = 0;
+    input->roffset = 0;
+
+    if (file->map_offset < file->map_size)
+    {
+        uint64_t remain = file->map_size - file->map_offset;
+        uint32_t wsize = remain > MMAP_WINDOW ? MMAP_WINDOW : (uint32_t)remain;
+        input->data = bfile_map(file->file, file->map_offset, wsize, TRUE, &file->file_err);
+        if (input->data != NULL)
+        {
+            input->size = wsize;
+            input->woffset = wsize;
+        }
+        else
+        {
+            BIT_SET(stm->state, BROKEN_BIT);
+        }
+    }
+    else
+    {
+        BIT_SET(stm->state, END_BIT);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
 static void i_read_from_socket(Stream *stm, byte_t *data, const uint32_t size)
 {
     uint32_t nreaded;
@@ -1338,6 +1827,78 @@ static void i_stdin_fill_cache(Stream *stm, const uint32_t size)
 
 /*---------------------------------------------------------------------------*/
 
+static __INLINE uint32_t i_lz_u32(const byte_t *data)
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_lz_fill_cache(Stream *stm, const uint32_t size)
+{
+    i_Buffer *input;
+    i_Filter *filt;
+    byte_t header[LZ_HEADER];
+    uint32_t nreaded, bsize, csize;
+    cassert_no_null(stm);
+    cassert(stm->type == i_ekFROMLZ);
+    input = stm->input;
+    filt = &stm->channel.filt;
+    cassert_no_null(input);
+    cassert(input->woffset == input->roffset);
+    unref(size);
+    input->woffset = 0;
+    input->roffset = 0;
+
+    nreaded = stm_read(filt->stm, header, LZ_HEADER);
+    if (nreaded != LZ_HEADER)
+    {
+        if (nreaded == 0 && stm_state(filt->stm) == ekSTEND)
+            BIT_SET(stm->state, END_BIT);
+        else
+            BIT_SET(stm->state, CORRUPTION_BIT);
+        return;
+    }
+
+    bsize = i_lz_u32(header);
+    csize = i_lz_u32(header + 4);
+    if (bsize == 0)
+    {
+        BIT_SET(stm->state, END_BIT);
+        return;
+    }
+
+    if (bsize > input->size || csize > bsize)
+    {
+        BIT_SET(stm->state, CORRUPTION_BIT);
+        return;
+    }
+
+    if (csize == bsize)
+    {
+        if (stm_read(filt->stm, input->data, bsize) != bsize)
+        {
+            BIT_SET(stm->state, CORRUPTION_BIT);
+            return;
+        }
+    }
+    else
+    {
+        uint32_t written = 0;
+        if (stm_read(filt->stm, filt->block, csize) != csize
+            || lzc_decompress(filt->block, csize, input->data, bsize, &written) == FALSE
+            || written != bsize)
+        {
+            BIT_SET(stm->state, CORRUPTION_BIT);
+            return;
+        }
+    }
+
+    input->woffset = bsize;
+}
+
+/*---------------------------------------------------------------------------*/
+
 static uint32_t i_read(Stream *stm, byte_t *data, const uint32_t size, const bool_t reverse)
 {
     uint32_t readed = 0;
@@ -1508,6 +2069,18 @@ static uint32_t i_read_utf8(Stream *stm)
 {
     byte_t value0 = 0;
 
+    /* ASCII straight from the read cache */
+    if (stm->input != NULL && stm->input->roffset < stm->input->woffset && stm->restore.woffset == stm->restore.roffset)
+    {
+        value0 = stm->input->data[stm->input->roffset];
+        if (value0 < 0x80)
+        {
+            stm->input->roffset += 1;
+            stm->read_offset += 1;
+            return (uint32_t)value0;
+        }
+    }
+
     i_read(stm, &value0, 1, FALSE);
 
     /* One byte UTF-8 0xxx xxxx */
@@ -1609,6 +2182,68 @@ static void i_char_to_cache(Stream *stm, const uint32_t code)
 
 /*---------------------------------------------------------------------------*/
 
+/*
+ * Moves the ASCII run at the head of the read cache straight to the text line,
+ * skipping the per-codepoint path. Stops before '\n', '\0' or any non-ASCII char.
+ * UTF16 streams are narrowed on the fly when no byte swap is needed.
+ */
+static void i_ascii_to_cache(Stream *stm)
+{
+    i_Buffer *input, *line;
+    const char_t *st;
+    uint32_t n, unit;
+    cassert_no_null(stm);
+    input = stm->input;
+    if (input == NULL || !IS_OK(stm->state))
+        return;
+
+    if (BIT_TEST(stm->state, READ_UTF8_BIT) == TRUE)
+        unit = 1;
+    else if (BIT_TEST(stm->state, READ_UTF16_BIT) == TRUE && REV_IN(stm->state) == FALSE)
+        unit = 2;
+    else
+        return;
+
+    if (stm->restore.woffset > stm->restore.roffset)
+        return;
+
+    st = (const char_t*)(input->data + input->roffset);
+    n = (input->woffset - input->roffset) / unit;
+    if (unit == 1)
+        n = bsimd_ascii(st, n, '\n');
+    else if (n > 1024)
+        n = 1024;
+
+    if (n == 0)
+        return;
+
+    line = &stm->textline;
+    if (line->roffset + n + 4 > line->size)
+    {
+        uint32_t size = line->size > 0 ? line->size * 2 : 256;
+        while (line->roffset + n + 4 > size)
+            size *= 2;
+
+        if (line->size == 0)
+            line->data = heap_malloc(size, "StreamTextLine");
+        else
+            line->data = heap_realloc(line->data, line->size, size, "StreamTextLine");
+        line->size = size;
+    }
+
+    if (unit == 1)
+        bmem_copy(line->data + line->roffset, (const byte_t*)st, n);
+    else
+        n = bsimd_utf16_ascii((char_t*)(line->data + line->roffset), st, n, '\n');
+
+    line->roffset += n;
+    input->roffset += n * unit;
+    stm->read_offset += n * unit;
+    stm->col += n;
+}
+
+/*---------------------------------------------------------------------------*/
+
 uint32_t stm_read_char(Stream *stm)
 {
     uint32_t code = 0;
@@ -1678,11 +2313,13 @@ const char_t *stm_read_line(Stream *stm)
 
     line = &stm->textline;
     line->roffset = 0;
+    i_ascii_to_cache(stm);
     code = stm_read_char(stm);
     while (code != '\n' && code != 0)
     {
         if (unicode_valid(code))
             i_char_to_cache(stm, code);
+        i_ascii_to_cache(stm);
         code = stm_read_char(stm);
     }
 
@@ -1811,7 +2448,7 @@ static real64_t i_read_r64(Stream *stm)
 
     if (tok == ekTINTEGER || tok == ekTREAL)
     {
-        real64_t number = str_to_r64(stm_token_lexeme(stm, NULL), NULL);
+        real64_t number = str_to_r64_fast(stm_token_lexeme(stm, NULL), NULL);
 
         if (minus == TRUE)
             return - number;
@@ -2071,6 +2708,13 @@ void stm_flush(Stream *stm)
             i_FUNC_WRITE[stm->type](stm, output->data, output->woffset);
             output->woffset = 0;
         }
+
+        // Barrier: wait until all data is on file
+        if (stm->type == i_ekTOFILEASYNC)
+            i_async_wait(stm);
+
+        if (stm->type == i_ekTOLZ)
+            stm_flush(stm->channel.filt.stm);
     }
 }
 
@@ -2165,6 +2809,14 @@ bool_t _stm_memory(const Stream *stm)
 
 /*---------------------------------------------------------------------------*/
 
+bool_t _stm_buffered(const Stream *stm)
+{
+    cassert_no_null(stm);
+    return (bool_t)(stm->type == i_ekTOMEMORY || stm->type == i_ekFROMMEMORY || stm->type == i_ekFROMMMAP);
+}
+
+/*---------------------------------------------------------------------------*/
+
 uint32_t _stm_get_roffset(const Stream *stm)
 {
     cassert_no_null(stm);
@@ -2183,3 +2835,37 @@ void _stm_set_roffset(Stream *stm, const uint32_t offset)
     stm->buffer1.roffset = offset;
     stm->read_offset -= (offset - roffset);
 }
+
+/*---------------------------------------------------------------------------*/
+
+/* Unread UTF8 bytes of the read cache. NULL if they can't be scanned in place */
+const byte_t *_stm_read_cache(const Stream *stm, uint32_t *size)
+{
+    const i_Buffer *input;
+    cassert_no_null(stm);
+    cassert_no_null(size);
+    input = stm->input;
+    *size = 0;
+    if (input == NULL || !IS_OK(stm->state) || BIT_TEST(stm->state, READ_UTF8_BIT) == FALSE)
+        return NULL;
+
+    /* Restored chars must be read first */
+    if (stm->restore.woffset > stm->restore.roffset)
+        return NULL;
+
+    *size = input->woffset - input->roffset;
+    return input->data + input->roffset;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void _stm_skip_cache(Stream *stm, const uint32_t size, const uint32_t col, const uint32_t row)
+{
+    cassert_no_null(stm);
+    cassert_no_null(stm->input);
+    cassert(stm->input->roffset + size <= stm->input->woffset);
+    stm->input->roffset += size;
+    stm->read_offset += size;
+    stm->col = col;
+    stm->row = row;
+}
@@ -21,12 +21,20 @@ Stream *stm_memory(const uint32_t size);
 
 Stream *stm_from_file(const char_t *pathname, ferror_t *error);
 
+Stream *stm_from_mmap(const char_t *pathname, ferror_t *error);
+
 Stream *stm_to_file(const char_t *pathname, ferror_t *error);
 
+Stream *stm_to_file_async(const char_t *pathname, ferror_t *error);
+
 Stream *stm_append_file(const char_t *pathname, ferror_t *error);
 
 Stream *stm_socket(Socket *socket);
 
+Stream *stm_to_lz(Stream *stm, const uint32_t nthreads);
+
+Stream *stm_from_lz(Stream *stm);
+
 void stm_close(Stream **stm);
 
 
@@ -111,6 +119,8 @@ void stm_write_r32(Stream *stm, const real32_t value);
 
 void stm_write_r64(Stream *stm, const real64_t value);
 
+void stm_write_r64_text(Stream *stm, const real64_t value);
+
 
 uint32_t stm_read(Stream *stm, byte_t *data, const uint32_t size);
 
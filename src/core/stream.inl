@@ -26,9 +26,15 @@ void _stm_restore_row(Stream *stm, const uint32_t row);
 
 bool_t _stm_memory(const Stream *stm);
 
+bool_t _stm_buffered(const Stream *stm);
+
 uint32_t _stm_get_roffset(const Stream *stm);
 
 void _stm_set_roffset(Stream *stm, const uint32_t offset);
 
+const byte_t *_stm_read_cache(const Stream *stm, uint32_t *size);
+
+void _stm_skip_cache(Stream *stm, const uint32_t size, const uint32_t col, const uint32_t row);
+
 __END_C
     
@@ -14,6 +14,8 @@
 #include "arrpt.h"
 #include "core.inl"
 #include "blib.inl"
+#include "bconv.inl"
+#include "bsimd.inl"
 #include "bmem.h"
 #include "bstd.h"
 #include "cassert.h"
@@ -753,17 +755,11 @@ bool_t str_equ_cn(const char_t *str1, const char_t *str2, const uint32_t n)
 
 bool_t str_equ_nocase(const char_t *str1, const char_t *str2)
 {
-    for (;; ++str1, ++str2)
-    {
-        if (*str1 == '\0')
-            return *str2 == '\0';
-
-        if (*str2 == '\0')
-            return *str1 == '\0';
-
-        if (unicode_tolower((uint32_t)*str1) != unicode_tolower((uint32_t)*str2))
-            return FALSE;
-    }
+    uint32_t l1 = blib_strlen(str1);
+    uint32_t l2 = blib_strlen(str2);
+    if (l1 != l2)
+        return FALSE;
+    return bsimd_equ_nocase(str1, str2, l1);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -829,63 +825,52 @@ bool_t str_equ_end(const char_t *str, const char_t *end)
 
 void str_upper(String *str)
 {
-    register char_t *data = NULL, *end_data = NULL;
     cassert_no_null(str);
-    data = i_DATA(str);
-    end_data = i_DATA(str) + i_SIZE(str);
-    for (; data < end_data; ++data)
-        *data = (char_t)unicode_toupper((uint32_t)(*data));
+    bsimd_upper(i_DATA(str), i_DATA(str), i_SIZE(str));
 }
 
 /*---------------------------------------------------------------------------*/
 
 void str_lower(String *str)
 {
-    register char_t *data = NULL, *end_data = NULL;
     cassert_no_null(str);
-    data = i_DATA(str);
-    end_data = i_DATA(str) + i_SIZE(str);
-    for (; data < end_data; ++data)
-        *data = (char_t)unicode_tolower((uint32_t)(*data));
+    bsimd_lower(i_DATA(str), i_DATA(str), i_SIZE(str));
 }
 
 /*---------------------------------------------------------------------------*/
 
 void str_upper_c(char_t *dest, const uint32_t size, const char_t *str)
 {
-    register char_t *end_dest = dest + size - 1;
-    cassert_no_null(str);
-    for (; dest < end_dest && *str != '\0'; ++dest, ++str)
-        *dest = (char_t)unicode_toupper((uint32_t)(*str));
-    *dest = '\0';
+    uint32_t n = blib_strlen(str);
+    cassert_no_null(dest);
+    cassert(size > 0);
+    if (n > size - 1)
+        n = size - 1;
+    bsimd_upper(dest, str, n);
+    dest[n] = '\0';
 }
 
 /*---------------------------------------------------------------------------*/
 
 void str_lower_c(char_t *dest, const uint32_t size, const char_t *str)
 {
-    register char_t *end_dest = dest + size - 1;
-    cassert_no_null(str);
-    for (; dest < end_dest && *str != '\0'; ++dest, ++str)
-        *dest = (char_t)unicode_tolower((uint32_t)(*str));
-    *dest = '\0';
+    uint32_t n = blib_strlen(str);
+    cassert_no_null(dest);
+    cassert(size > 0);
+    if (n > size - 1)
+        n = size - 1;
+    bsimd_lower(dest, str, n);
+    dest[n] = '\0';
 }
 
 /*---------------------------------------------------------------------------*/
 
 void str_subs(String *str, const char_t replace, const char_t with)
 {
-    register char_t *data = NULL, *end_data = NULL;
     cassert_no_null(str);
     cassert(unicode_isascii((uint32_t)replace) == TRUE);
     cassert(unicode_isascii((uint32_t)with) == TRUE);
-    data = i_DATA(str);
-    end_data = i_DATA(str) + i_SIZE(str);
-    for (; data < end_data; ++data)
-    {
-        if (*data == replace)
-            *data = with;
-    }
+    bsimd_subs(i_DATA(str), i_SIZE(str), replace, with);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -1298,3 +1283,10 @@ real64_t str_to_r64(const char_t *str, bool_t *error)
 {
     return blib_strtod(str, NULL, error);
 }
+
+/*---------------------------------------------------------------------------*/
+
+real64_t str_to_r64_fast(const char_t *str, bool_t *error)
+{
+    return bconv_strtod(str, NULL, error);
+}
@@ -144,4 +144,6 @@ real32_t str_to_r32(const char_t *str, bool_t *error);
 
 real64_t str_to_r64(const char_t *str, bool_t *error);
 
+real64_t str_to_r64_fast(const char_t *str, bool_t *error);
+
 __END_C
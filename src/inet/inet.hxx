@@ -28,10 +28,27 @@ typedef enum _ierror_t
     ekIOK
 } ierror_t;
 
+typedef enum _jsonev_t
+{
+    ekJSON_BEGIN_OBJECT = 1,
+    ekJSON_END_OBJECT,
+    ekJSON_BEGIN_ARRAY,
+    ekJSON_END_ARRAY,
+    ekJSON_KEY,
+    ekJSON_STRING,
+    ekJSON_NUMBER,
+    ekJSON_TRUE,
+    ekJSON_FALSE,
+    ekJSON_NULL,
+    ekJSON_EOF,
+    ekJSON_ERROR
+} jsonev_t;
+
 typedef struct _url_t Url;
 typedef struct _http_t Http;
 typedef struct _json_t Json;
 typedef struct _jsonopts_t JsonOpts;
+typedef struct _jsonreader_t JsonReader;
 
 struct _jsonopts_t
 {
@@ -18,10 +18,15 @@
 #include "bmem.h"
 #include "bstd.h"
 #include "base64.h"
+#include "bsimd.inl"
+#include "bmutex.h"
+#include "bthread.h"
 #include "cassert.h"
 #include "heap.h"
 #include "log.h"
+#include "ptr.h"
 #include "stream.h"
+#include "stream.inl"
 #include "strings.h"
 #include "unicode.h"
 
@@ -41,20 +46,116 @@ typedef enum _jtoken_t
     i_ekUNKNOWN
 } jtoken_t;
 
+typedef enum _jstate_t
+{
+    i_stVALUE,
+    i_stCOLON,
+    i_stKEY,
+    i_stFIRST_MEMBER,
+    i_stMEMBER,
+    i_stFIRST_ELEM,
+    i_stELEM,
+    i_stEND,
+    i_stSTOP
+} jstate_t;
+
+typedef struct i_doc_t i_Doc;
 typedef struct i_parser_t i_Parser;
 
+/*
+ * Two-stage (structural index) input. A window of the input is copied and
+ * indexed in a single SIMD pass (stage one). Tokens are then taken on demand
+ * from the index (stage two), reading only the bytes of the token being delivered.
+ * Strings are unescaped in place in the window. 'input' (the read cache of a
+ * memory stream or a block of lines) is never modified.
+ * 'offset': 'input' position of the window.
+ * 'row', 'col': position of 'rcpos' input byte, computed only when required.
+ */
+struct i_doc_t
+{
+    Stream *stm;
+    const char_t *input;
+    char_t *data;
+    uint32_t *index;
+    uint32_t isize;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t nindex;
+    uint32_t next;
+    uint32_t rcpos;
+    uint32_t row;
+    uint32_t col;
+    bool_t end;
+};
+
 struct i_parser_t 
 {
     Stream *stm;
+    i_Doc *doc;
     jtoken_t token;
     bool_t minus;
+    bool_t hold;
+    bool_t eof;
     uint32_t col;
     uint32_t row;
+    uint32_t pos;
     uint32_t lexsize;
     const char_t *lexeme;
     char_t number[128];
 };
 
+#define READER_MAX_DEPTH    256
+#define DOC_WINDOW          0x10000
+#define LINES_CHUNK         0x100000
+#define LINES_BLOCK         0x4000
+#define LINES_MAX_THREADS   64
+#define WRITER_SIZE         0x2000
+
+typedef struct i_lchunk_t i_LChunk;
+typedef struct i_lines_t i_Lines;
+typedef struct i_writer_t i_Writer;
+
+/* A run of complete lines, parsed by any worker into its own array */
+struct i_lchunk_t
+{
+    const char_t *data;
+    uint32_t size;
+    Array *objs;
+    uint32_t errors;
+};
+
+/* Chunks are taken in order by the workers from a shared counter */
+struct i_lines_t
+{
+    Mutex *mutex;
+    i_LChunk *chunks;
+    uint32_t nchunks;
+    uint32_t next;
+    const char_t *type;
+    const char_t *arrtype;
+};
+
+/* Output is batched here (UTF8) and sent to the stream in large blocks */
+struct i_writer_t
+{
+    Stream *stm;
+    bool_t utf8;
+    uint32_t size;
+    char_t data[WRITER_SIZE + 1];
+};
+
+/* Pull parser state. Only the open containers are kept, never the values */
+struct _jsonreader_t
+{
+    i_Parser parser;
+    i_Doc doc;
+    jsonev_t event;
+    jstate_t state;
+    uint32_t depth;
+    char_t stack[READER_MAX_DEPTH];
+};
+
 /*---------------------------------------------------------------------------*/
 
 #define obj_member(obj, offset, type) *((type*)((byte_t*)(obj) + (offset)))
@@ -62,8 +163,50 @@ static void *i_create_type(i_Parser *parser, const char_t *type);
 static bool_t i_jump_value(i_Parser *parser);
 static bool_t i_parse_object(i_Parser *parser, const char_t *subtype, void *object);
 static bool_t i_parse_value(i_Parser *parser, DBind *dbind, dtype_t type, const char_t *subtype, void *object);
-static void i_write_type(Stream *stm, dtype_t type, const char_t *subtype, const void *data, const bool_t inarray);
-static void i_write_object(Stream *stm, const void *object, const char_t *type, const bool_t inarray);
+static void i_write_type(i_Writer *writer, dtype_t type, const char_t *subtype, const void *data, const bool_t inarray);
+static void i_write_object(i_Writer *writer, const void *object, const char_t *type, const bool_t inarray);
+static uint32_t i_string_end(const char_t *str, const uint32_t size);
+static uint32_t i_scalar_end(const char_t *str, const uint32_t size);
+
+/*---------------------------------------------------------------------------*/
+
+/* Row and column (as the stream lexer, starting in 1) after 'size' bytes */
+static void i_advance(const char_t *data, const uint32_t size, uint32_t *row, uint32_t *col)
+{
+    uint32_t i = 0;
+    cassert_no_null(row);
+    cassert_no_null(col);
+    for (;;)
+    {
+        uint32_t n = bsimd_chr2(data + i, size - i, '\n', '\n');
+        if (i + n >= size)
+        {
+            *col += bsimd_utf8_nchars(data + i, size - i);
+            break;
+        }
+
+        *row += 1;
+        *col = 1;
+        i += n + 1;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* 'pos' in the current window. Positions are never required backwards */
+static void i_doc_position(i_Doc *doc, const uint32_t pos, uint32_t *row, uint32_t *col)
+{
+    uint32_t offset = 0;
+    cassert_no_null(doc);
+    cassert_no_null(row);
+    cassert_no_null(col);
+    offset = doc->offset + pos;
+    cassert(offset >= doc->rcpos);
+    i_advance(doc->input + doc->rcpos, offset - doc->rcpos, &doc->row, &doc->col);
+    doc->rcpos = offset;
+    *row = doc->row;
+    *col = doc->col;
+}
 
 /*---------------------------------------------------------------------------*/
 
@@ -73,10 +216,14 @@ static bool_t i_error(const bool_t cond, const bool_t fatal, i_Parser *parser, c
 
     if (cond == FALSE)
     {
+        uint32_t row = parser->row, col = parser->col;
+        if (parser->doc != NULL)
+            i_doc_position(parser->doc, parser->pos, &row, &col);
+
         if (parser->lexeme != NULL && parser->lexsize < 128)
-            log_printf("JSON(%d:%d)-%s (%s).", parser->row, parser->col, errmsg, parser->lexeme);
+            log_printf("JSON(%d:%d)-%s (%s).", row, col, errmsg, parser->lexeme);
         else
-            log_printf("JSON(%d:%d)-%s.", parser->row, parser->col, errmsg);
+            log_printf("JSON(%d:%d)-%s.", row, col, errmsg);
     }
 
     if (cond == FALSE && fatal == TRUE)
@@ -87,13 +234,520 @@ static bool_t i_error(const bool_t cond, const bool_t fatal, i_Parser *parser, c
 
 /*---------------------------------------------------------------------------*/
 
+static void i_doc_fill(i_Doc *doc)
+{
+    uint32_t from, keep, remain, n;
+    cassert_no_null(doc);
+
+    /* Unconsumed tokens are moved to the beginning of the window */
+    from = doc->next < doc->nindex ? doc->index[doc->next] : doc->size;
+    keep = doc->size - from;
+    if (keep > 0)
+        bmem_move((byte_t*)doc->data, (const byte_t*)doc->data + from, keep);
+    doc->offset += from;
+
+    /* Big token (string) bigger than the window */
+    if (keep > doc->capacity / 2)
+    {
+        uint32_t capacity = doc->capacity * 2;
+        doc->data = heap_realloc_n(doc->data, doc->capacity, capacity, char_t);
+        heap_delete_n(&doc->index, doc->capacity, uint32_t);
+        doc->index = heap_new_n(capacity, uint32_t);
+        doc->capacity = capacity;
+    }
+
+    remain = doc->isize - doc->offset - keep;
+    n = remain < doc->capacity - keep ? remain : doc->capacity - keep;
+    if (n > 0)
+        bmem_copy((byte_t*)doc->data + keep, (const byte_t*)doc->input + doc->offset + keep, n);
+    doc->size = keep + n;
+    doc->end = (bool_t)(n == remain);
+    doc->nindex = 0;
+    doc->next = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_doc_index(i_Doc *doc)
+{
+    cassert_no_null(doc);
+    doc->nindex = bsimd_json_index(doc->data, doc->size, doc->index);
+    doc->next = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Unread bytes of the stream cache. Nothing is read from the stream until the doc is removed */
+static void i_doc_init(i_Doc *doc, Stream *stm)
+{
+    const byte_t *input = NULL;
+    uint32_t size = 0;
+    cassert_no_null(doc);
+    input = _stm_read_cache(stm, &size);
+    cassert_no_null(input);
+    doc->stm = stm;
+    doc->input = (const char_t*)input;
+    doc->isize = size;
+    doc->offset = 0;
+    doc->capacity = DOC_WINDOW;
+    doc->data = heap_new_n(doc->capacity, char_t);
+    doc->index = heap_new_n(doc->capacity, uint32_t);
+    doc->size = 0;
+    doc->nindex = 0;
+    doc->next = 0;
+    doc->row = stm_row(stm);
+    doc->col = stm_col(stm);
+    doc->end = FALSE;
+
+    /* UTF8 BOM */
+    while (doc->isize - doc->offset >= 3 && input[doc->offset] == 0xEF && input[doc->offset + 1] == 0xBB && input[doc->offset + 2] == 0xBF)
+        doc->offset += 3;
+
+    doc->rcpos = doc->offset;
+    i_doc_fill(doc);
+    i_doc_index(doc);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Whole input already in memory. It's copied, as strings are unescaped in place */
+static void i_doc_load(i_Doc *doc, const char_t *data, const uint32_t size)
+{
+    cassert_no_null(doc);
+    if (size > doc->capacity)
+    {
+        if (doc->data != NULL)
+        {
+            heap_delete_n(&doc->data, doc->capacity, char_t);
+            heap_delete_n(&doc->index, doc->capacity, uint32_t);
+        }
+
+        doc->capacity = size;
+        doc->data = heap_new_n(doc->capacity, char_t);
+        doc->index = heap_new_n(doc->capacity, uint32_t);
+    }
+
+    if (size > 0)
+        bmem_copy((byte_t*)doc->data, (const byte_t*)data, size);
+    doc->stm = NULL;
+    doc->input = data;
+    doc->isize = size;
+    doc->offset = 0;
+    doc->size = size;
+    doc->rcpos = 0;
+    doc->row = 1;
+    doc->col = 1;
+    doc->end = TRUE;
+    i_doc_index(doc);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Stream input: bytes until the end of the last delivered token are skipped in its read cache */
+static void i_doc_remove(i_Doc *doc)
+{
+    cassert_no_null(doc);
+    if (doc->stm != NULL)
+    {
+        uint32_t pos = doc->offset, row, col;
+        if (doc->next > 0)
+        {
+            /* The window might be modified (unescaped strings), 'input' not */
+            const char_t *token = NULL;
+            pos += doc->index[doc->next - 1];
+            token = doc->input + pos;
+            if (*token == '\"')
+                pos += i_string_end(token, doc->isize - pos) + 1;
+            else if (*token == '{' || *token == '}' || *token == '[' || *token == ']' || *token == ',' || *token == ':')
+                pos += 1;
+            else
+                pos += i_scalar_end(token, doc->isize - pos);
+
+            if (pos > doc->isize)
+                pos = doc->isize;
+        }
+
+        i_doc_position(doc, pos - doc->offset, &row, &col);
+        _stm_skip_cache(doc->stm, doc->rcpos, col, row);
+    }
+
+    if (doc->data != NULL)
+    {
+        heap_delete_n(&doc->data, doc->capacity, char_t);
+        heap_delete_n(&doc->index, doc->capacity, uint32_t);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* The last token of the window might be cut, so is never delivered before a refill */
+static bool_t i_doc_next(i_Doc *doc, uint32_t *pos)
+{
+    cassert_no_null(doc);
+    cassert_no_null(pos);
+    while (doc->next + 1 >= doc->nindex && doc->end == FALSE)
+    {
+        i_doc_fill(doc);
+        i_doc_index(doc);
+    }
+
+    if (doc->next < doc->nindex)
+    {
+        *pos = doc->index[doc->next];
+        doc->next += 1;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_hex4(const char_t *hex)
+{
+    uint32_t i, code = 0;
+    for (i = 0; i < 4; ++i)
+    {
+        char_t c = hex[i];
+        code <<= 4;
+        if (c >= '0' && c <= '9')
+            code |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f')
+            code |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            code |= (uint32_t)(c - 'A' + 10);
+        else
+            return UINT32_MAX;
+    }
+
+    return code;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* 'src' points to the first backslash. 'dest' might be 'src' (in place). Returns the end of 'dest' */
+static char_t *i_doc_unescape(char_t *dest, const char_t *src, const char_t *end)
+{
+    while (src < end)
+    {
+        uint32_t code;
+        if (*src != '\\')
+        {
+            *dest++ = *src++;
+            continue;
+        }
+
+        if (src + 1 >= end)
+            return NULL;
+
+        switch (src[1]) {
+        case '\"':
+        case '\\':
+        case '/':
+        case '\'':
+        case '?':
+            *dest++ = src[1];
+            src += 2;
+            continue;
+        case 'b':
+            *dest++ = 0x08;
+            src += 2;
+            continue;
+        case 'f':
+            *dest++ = 0x0C;
+            src += 2;
+            continue;
+        case 'n':
+            *dest++ = 0x0A;
+            src += 2;
+            continue;
+        case 'r':
+            *dest++ = 0x0D;
+            src += 2;
+            continue;
+        case 't':
+            *dest++ = 0x09;
+            src += 2;
+            continue;
+        case 'u':
+            break;
+        default:
+            return NULL;
+        }
+
+        if (src + 6 > end)
+            return NULL;
+
+        code = i_hex4(src + 2);
+        if (code == UINT32_MAX)
+            return NULL;
+
+        src += 6;
+
+        /* UTF16 surrogate pair */
+        if (code >= 0xD800 && code <= 0xDBFF)
+        {
+            uint32_t low = UINT32_MAX;
+            if (src + 6 <= end && src[0] == '\\' && src[1] == 'u')
+                low = i_hex4(src + 2);
+
+            if (low >= 0xDC00 && low <= 0xDFFF)
+            {
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                src += 6;
+            }
+            else
+            {
+                code = 0xFFFD;
+            }
+        }
+        else if (code >= 0xDC00 && code <= 0xDFFF)
+        {
+            code = 0xFFFD;
+        }
+
+        /* An escape is never shorter than its UTF8 sequence */
+        dest += unicode_to_char(code, dest, ekUTF8);
+    }
+
+    return dest;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Closing quote of a string. 'size' if not closed */
+static uint32_t i_string_end(const char_t *str, const uint32_t size)
+{
+    uint32_t i = 0;
+    cassert(str[0] == '\"');
+    for (;;)
+    {
+        if (i + 1 >= size)
+            return size;
+
+        i += 1 + bsimd_chr2(str + i + 1, size - i - 1, '\"', '\\');
+        if (i >= size)
+            return size;
+
+        if (str[i] == '\"')
+            return i;
+
+        /* Escaped char */
+        i += 1;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_scalar_end(const char_t *str, const uint32_t size)
+{
+    uint32_t n = 0;
+    for (; n < size; ++n)
+    {
+        char_t c = str[n];
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',' || c == ':' || c == '\"'
+            || c == '[' || c == ']' || c == '{' || c == '}')
+            break;
+    }
+
+    return n;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static jtoken_t i_doc_string(i_Parser *parser, char_t *str, const uint32_t size)
+{
+    uint32_t i = 0;
+    cassert_no_null(parser);
+    i = i_string_end(str, size);
+    if (i == size)
+        return i_ekUNKNOWN;
+
+    parser->lexeme = str + 1;
+    parser->lexsize = i - 1;
+
+    {
+        uint32_t bslash = bsimd_chr2(str + 1, i - 1, '\\', '\\');
+        if (bslash < i - 1)
+        {
+            char_t *end = i_doc_unescape(str + 1 + bslash, str + 1 + bslash, str + i);
+            if (end == NULL)
+                return i_ekUNKNOWN;
+            parser->lexsize = (uint32_t)(end - (str + 1));
+        }
+    }
+
+    str[parser->lexsize + 1] = '\0';
+    return i_ekSTRING;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Json number grammar: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? */
+static bool_t i_doc_is_number(const char_t *str, const uint32_t size)
+{
+    uint32_t i = 0, n;
+
+    if (i < size && str[i] == '-')
+        i += 1;
+
+    n = i;
+    while (i < size && str[i] >= '0' && str[i] <= '9')
+        i += 1;
+
+    if (i == n || (str[n] == '0' && i - n > 1))
+        return FALSE;
+
+    if (i < size && str[i] == '.')
+    {
+        n = ++i;
+        while (i < size && str[i] >= '0' && str[i] <= '9')
+            i += 1;
+
+        if (i == n)
+            return FALSE;
+    }
+
+    if (i < size && (str[i] == 'e' || str[i] == 'E'))
+    {
+        i += 1;
+        if (i < size && (str[i] == '+' || str[i] == '-'))
+            i += 1;
+
+        n = i;
+        while (i < size && str[i] >= '0' && str[i] <= '9')
+            i += 1;
+
+        if (i == n)
+            return FALSE;
+    }
+
+    return (bool_t)(i == size);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static jtoken_t i_doc_scalar(i_Parser *parser, const char_t *str, const uint32_t size)
+{
+    uint32_t n = i_scalar_end(str, size);
+    cassert_no_null(parser);
+
+    if (n == 4 && bmem_cmp((const byte_t*)str, (const byte_t*)"true", 4) == 0)
+    {
+        parser->lexeme = "true";
+        parser->lexsize = 4;
+        return i_ekTRUE;
+    }
+
+    if (n == 5 && bmem_cmp((const byte_t*)str, (const byte_t*)"false", 5) == 0)
+    {
+        parser->lexeme = "false";
+        parser->lexsize = 5;
+        return i_ekFALSE;
+    }
+
+    if (n == 4 && bmem_cmp((const byte_t*)str, (const byte_t*)"null", 4) == 0)
+    {
+        parser->lexeme = "null";
+        parser->lexsize = 4;
+        return i_ekNULL;
+    }
+
+    /* Unknown tokens are also copied, for error messages */
+    {
+        uint32_t len = n < sizeof(parser->number) - 1 ? n : sizeof(parser->number) - 1;
+        if (len > 0)
+            bmem_copy((byte_t*)parser->number, (const byte_t*)str, len);
+        parser->number[len] = '\0';
+        parser->lexeme = parser->number;
+        parser->lexsize = len;
+    }
+
+    if (i_doc_is_number(str, n) == TRUE)
+        return i_ekNUMBER;
+
+    return i_ekUNKNOWN;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_doc_token(i_Parser *parser)
+{
+    i_Doc *doc = NULL;
+    uint32_t pos = 0;
+    cassert_no_null(parser);
+    doc = parser->doc;
+
+    if (i_doc_next(doc, &pos) == FALSE)
+    {
+        parser->eof = TRUE;
+        parser->token = i_ekUNKNOWN;
+        parser->pos = doc->size;
+        parser->lexeme = "";
+        parser->lexsize = 0;
+        return;
+    }
+
+    parser->pos = pos;
+    parser->lexsize = 1;
+    switch (doc->data[pos]) {
+    case '{':
+        parser->token = i_ekOPEN_OBJECT;
+        parser->lexeme = "{";
+        break;
+    case '}':
+        parser->token = i_ekCLOSE_OBJECT;
+        parser->lexeme = "}";
+        break;
+    case '[':
+        parser->token = i_ekOPEN_ARRAY;
+        parser->lexeme = "[";
+        break;
+    case ']':
+        parser->token = i_ekCLOSE_ARRAY;
+        parser->lexeme = "]";
+        break;
+    case ',':
+        parser->token = i_ekCOMMA;
+        parser->lexeme = ",";
+        break;
+    case ':':
+        parser->token = i_ekCOLON;
+        parser->lexeme = ":";
+        break;
+    case '\"':
+        parser->token = i_doc_string(parser, doc->data + pos, doc->size - pos);
+        break;
+    default:
+        parser->token = i_doc_scalar(parser, doc->data + pos, doc->size - pos);
+        break;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
 static void i_new_token(i_Parser *parser)
 {
     ltoken_t token;
     cassert_no_null(parser);
+
+    /* Lookahead: the current token is delivered again */
+    if (parser->hold == TRUE)
+    {
+        parser->hold = FALSE;
+        return;
+    }
+
+    if (parser->doc != NULL)
+    {
+        i_doc_token(parser);
+        return;
+    }
+
     token = stm_read_token(parser->stm);
-    parser->row = stm_token_col(parser->stm);
-    parser->col = stm_token_row(parser->stm);
+    parser->eof = (bool_t)(token == ekTEOF);
+    parser->row = stm_token_row(parser->stm);
+    parser->col = stm_token_col(parser->stm);
     parser->lexeme = stm_token_lexeme(parser->stm, &parser->lexsize);
     switch (token) {
     case ekTIDENT:
@@ -389,6 +1043,21 @@ static bool_t i_parse_arrptr(i_Parser *parser, const char_t *subtype, Array *arr
 
 /*---------------------------------------------------------------------------*/
 
+/* DBind text filters drop the exponent ('5e4' -> 54): these numbers are parsed first, then clamped */
+static bool_t i_exponent(const char_t *number)
+{
+    cassert_no_null(number);
+    for (; *number != '\0'; ++number)
+    {
+        if (*number == 'e' || *number == 'E')
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*---------------------------------------------------------------------------*/
+
 static bool_t i_parse_value(i_Parser *parser, DBind *dbind, dtype_t type, const char_t *subtype, void *object)
 {
     i_new_token(parser);
@@ -507,7 +1176,7 @@ static bool_t i_parse_value(i_Parser *parser, DBind *dbind, dtype_t type, const
         }
 
         case ekDTYPE_REAL32:
-            if (dbind != NULL)
+            if (dbind != NULL && i_exponent(parser->number) == FALSE)
             {
                 *((real32_t*)object) = _dbind_string_to_real32(dbind, *((real32_t*)object), parser->number);
                 return TRUE;
@@ -515,13 +1184,16 @@ static bool_t i_parse_value(i_Parser *parser, DBind *dbind, dtype_t type, const
             else
             {
                 bool_t err;
-                *((real32_t*)object) = str_to_r32(parser->number, &err);
+                real32_t value = str_to_r32(parser->number, &err);
+                if (dbind != NULL)
+                    value = _dbind_real32(dbind, value);
+                *((real32_t*)object) = value;
                 return i_error(!err, FALSE, parser, "Cannot cast to real32_t");
             }
             break;
 
         case ekDTYPE_REAL64:
-            if (dbind != NULL)
+            if (dbind != NULL && i_exponent(parser->number) == FALSE)
             {
                 *((real64_t*)object) = _dbind_string_to_real64(dbind, *((real64_t*)object), parser->number);
                 return TRUE;
@@ -529,7 +1201,10 @@ static bool_t i_parse_value(i_Parser *parser, DBind *dbind, dtype_t type, const
             else
             {
                 bool_t err;
-                *((real64_t*)object) = str_to_r64(parser->number, &err);
+                real64_t value = str_to_r64_fast(parser->number, &err);
+                if (dbind != NULL)
+                    value = _dbind_real64(dbind, value);
+                *((real64_t*)object) = value;
                 return i_error(!err, FALSE, parser, "Cannot cast to real64_t");
             }
             break;
@@ -638,7 +1313,7 @@ static bool_t i_parse_value(i_Parser *parser, DBind *dbind, dtype_t type, const
         case ekDTYPE_REAL64:
         {
             bool_t err;
-            *((real64_t*)object) = str_to_r64(parser->lexeme, &err);
+            *((real64_t*)object) = str_to_r64_fast(parser->lexeme, &err);
             return i_error(!err, FALSE, parser, "Cannot cast to real64_t");
         }
 
@@ -959,66 +1634,1078 @@ static void *i_create_type(i_Parser *parser, const char_t *type)
 
 /*---------------------------------------------------------------------------*/
 
-void *json_read_imp(Stream *stm, const JsonOpts *opts, const char_t *type)
-{
+/*
+ * UTF8 memory streams use the structural index, scanning the read cache in place.
+ * Otherwise, the stream lexer. It never reads beyond the last token (sockets, more data).
+ */
+static void i_parser_init(i_Parser *parser, Stream *stm, i_Doc *doc)
+{
+    uint32_t size = 0;
+    cassert_no_null(parser);
+    parser->stm = stm;
+    if (_stm_buffered(stm) == TRUE && _stm_read_cache(stm, &size) != NULL)
+    {
+        i_doc_init(doc, stm);
+        parser->doc = doc;
+    }
+    else
+    {
+        stm_token_escapes(stm, TRUE);
+        stm_skip_bom(stm);
+        parser->doc = NULL;
+    }
+
+    parser->col = 0;
+    parser->row = 0;
+    parser->pos = 0;
+    parser->lexeme = NULL;
+    parser->lexsize = 0;
+    parser->minus = FALSE;
+    parser->hold = FALSE;
+    parser->eof = FALSE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void *json_read_imp(Stream *stm, const JsonOpts *opts, const char_t *type)
+{
     i_Parser parser;
+    i_Doc doc;
     void *obj = NULL;
     unref(opts);
-    parser.stm = stm;
-    stm_token_escapes(parser.stm, TRUE);
-    stm_skip_bom(parser.stm);
+    i_parser_init(&parser, stm, &doc);
+    obj = i_create_type(&parser, type);
+    if (parser.doc != NULL)
+        i_doc_remove(parser.doc);
+    return obj;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Unescaped quotes of a line */
+static bool_t i_odd_quotes(const char_t *line, const uint32_t size)
+{
+    bool_t odd = FALSE;
+    uint32_t i = 0;
+    for (;;)
+    {
+        i += bsimd_chr2(line + i, size - i, '\"', '\\');
+        if (i >= size)
+            break;
+
+        if (line[i] == '\"')
+            odd = !odd;
+        else
+            i += 1;
+
+        i += 1;
+    }
+
+    return odd;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_parse_block(i_Parser *parser, const char_t *data, uint32_t size, const char_t *type, Array *objs)
+{
+    i_Doc *doc = NULL;
+    uint32_t errors = 0;
+    cassert_no_null(parser);
+    doc = parser->doc;
+    i_doc_load(doc, data, size);
+    while (doc->next < doc->nindex)
+    {
+        uint32_t start = doc->index[doc->next];
+        void *obj = i_create_type(parser, type);
+        if (obj != NULL)
+        {
+            void **elem = (void**)array_insert(objs, UINT32_MAX, 1);
+            *elem = obj;
+        }
+        else
+        {
+            /* 'data', not the doc copy, as unescaped strings may contain new lines */
+            uint32_t eol = start + bsimd_chr2(data + start, size - start, '\n', '\n');
+            errors += 1;
+            if (eol + 1 >= size)
+                break;
+
+            parser->hold = FALSE;
+            parser->minus = FALSE;
+
+            /*
+             * An unclosed string spoils the index of the following lines and a
+             * parser that went beyond the line has consumed tokens of the next.
+             * In both cases, the index is rebuilt from the next line.
+             */
+            if (i_odd_quotes(data + start, eol - start) == TRUE || (doc->next > 0 && doc->index[doc->next - 1] > eol))
+            {
+                data += eol + 1;
+                size -= eol + 1;
+                i_doc_load(doc, data, size);
+            }
+            else
+            {
+                while (doc->next < doc->nindex && doc->index[doc->next] <= eol)
+                    doc->next += 1;
+            }
+        }
+    }
+
+    return errors;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* One value per line. A line with errors is logged, skipped and counted. Small blocks bound the cost of rebuilding the index */
+static uint32_t i_parse_lines(i_Doc *doc, const char_t *data, const uint32_t size, const char_t *type, Array *objs)
+{
+    i_Parser parser;
+    uint32_t pos = 0, errors = 0;
+    parser.stm = NULL;
+    parser.doc = doc;
     parser.col = 0;
     parser.row = 0;
+    parser.pos = 0;
     parser.lexeme = NULL;
     parser.lexsize = 0;
     parser.minus = FALSE;
-    obj = i_create_type(&parser, type);
+    parser.hold = FALSE;
+    parser.eof = FALSE;
+
+    while (pos < size)
+    {
+        uint32_t end = pos + LINES_BLOCK;
+        if (end < size)
+            end += bsimd_chr2(data + end, size - end, '\n', '\n') + 1;
+        if (end > size)
+            end = size;
+        errors += i_parse_block(&parser, data + pos, end - pos, type, objs);
+        pos = end;
+    }
+
+    return errors;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_lines_main(i_Lines *lines)
+{
+    i_Doc doc;
+    cassert_no_null(lines);
+    bmem_zero(&doc, i_Doc);
+    for (;;)
+    {
+        i_LChunk *chunk = NULL;
+        bmutex_lock(lines->mutex);
+        if (lines->next < lines->nchunks)
+            chunk = &lines->chunks[lines->next++];
+        bmutex_unlock(lines->mutex);
+
+        if (chunk == NULL)
+            break;
+
+        chunk->objs = (Array*)dbind_create_imp(lines->arrtype);
+        chunk->errors = i_parse_lines(&doc, chunk->data, chunk->size, lines->type, chunk->objs);
+    }
+
+    i_doc_remove(&doc);
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* 'data' ends at a new line. Split in chunks of LINES_CHUNK bytes (at least), parsed in parallel */
+static uint32_t i_read_lines(const char_t *data, const uint32_t size, const uint32_t nthreads, const char_t *type, const char_t *arrtype, Array *objs)
+{
+    Thread *threads[LINES_MAX_THREADS];
+    i_Lines lines;
+    uint32_t maxchunks = size / LINES_CHUNK + 1;
+    uint32_t pos = 0, nth, i, errors = 0;
+
+    lines.mutex = bmutex_create();
+    lines.chunks = heap_new_n(maxchunks, i_LChunk);
+    lines.nchunks = 0;
+    lines.next = 0;
+    lines.type = type;
+    lines.arrtype = arrtype;
+    while (pos < size)
+    {
+        uint32_t end = pos + LINES_CHUNK;
+        i_LChunk *chunk = &lines.chunks[lines.nchunks++];
+        if (end < size)
+            end += bsimd_chr2(data + end, size - end, '\n', '\n') + 1;
+        if (end > size)
+            end = size;
+        chunk->data = data + pos;
+        chunk->size = end - pos;
+        chunk->objs = NULL;
+        chunk->errors = 0;
+        pos = end;
+    }
+
+    cassert(lines.nchunks <= maxchunks);
+    nth = nthreads < LINES_MAX_THREADS ? nthreads : LINES_MAX_THREADS;
+    if (nth > lines.nchunks)
+        nth = lines.nchunks;
+
+    /* The calling thread is also a worker */
+    for (i = 1; i < nth; ++i)
+        threads[i] = bthread_create(i_lines_main, &lines, i_Lines);
+
+    i_lines_main(&lines);
+
+    for (i = 1; i < nth; ++i)
+    {
+        if (threads[i] != NULL)
+        {
+            bthread_wait(threads[i]);
+            bthread_close(&threads[i]);
+        }
+    }
+
+    /* Merge in file order. Objects are moved, not copied */
+    for (i = 0; i < lines.nchunks; ++i)
+    {
+        Array *chunk = lines.chunks[i].objs;
+        uint32_t n = array_size(chunk);
+        errors += lines.chunks[i].errors;
+        if (n > 0)
+        {
+            byte_t *dest = array_insert(objs, UINT32_MAX, n);
+            bmem_copy(dest, array_all(chunk), n * (uint32_t)sizeof(void*));
+            array_delete(chunk, 0, n, NULL);
+        }
+
+        dbind_destroy_imp((byte_t**)&chunk, arrtype);
+    }
+
+    heap_delete_n(&lines.chunks, maxchunks, i_LChunk);
+    bmutex_close(&lines.mutex);
+    return errors;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_last_line(const char_t *data, const uint32_t size)
+{
+    uint32_t i = size;
+    while (i > 0 && data[i - 1] != '\n')
+        i -= 1;
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Lines are split in the stream buffer. Other streams (files, sockets, ...) are read first into memory */
+static Stream *i_lines_block(Stream *stm)
+{
+    Stream *block = stm_memory(LINES_CHUNK);
+    byte_t buffer[4096];
+    uint32_t size;
+    cassert_no_null(stm);
+    while ((size = stm_read(stm, buffer, sizeof(buffer))) > 0)
+        stm_write(block, buffer, size);
+    return block;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void *json_read_lines_parallel_imp(Stream *stm, const JsonOpts *opts, const uint32_t nthreads, uint32_t *errors, const char_t *type)
+{
+    i_Doc doc;
+    Stream *block = NULL;
+    Stream *input = stm;
+    Stream *carry = NULL;
+    String *arrtype = str_printf("ArrPt(%s)", type);
+    Array *objs = (Array*)dbind_create_imp(tc(arrtype));
+    uint32_t nerrors = 0;
+    cassert_no_null(stm);
+    cassert(nthreads > 0);
+    unref(opts);
+    bmem_zero(&doc, i_Doc);
+    heap_start_mt();
+
+    if (_stm_buffered(stm) == FALSE)
+    {
+        block = i_lines_block(stm);
+        input = block;
+    }
+
+    /* Lines split between two mapped windows are parsed apart (carry) */
+    for (;;)
+    {
+        uint32_t size = stm_buffer_size(input);
+        const char_t *data = NULL;
+        uint32_t body;
+
+        /* Next window */
+        if (size == 0)
+        {
+            byte_t c;
+            if (stm_read(input, &c, 1) == 0)
+                break;
+            if (carry == NULL)
+                carry = stm_memory(256);
+            stm_write(carry, &c, 1);
+            continue;
+        }
+
+        data = (const char_t*)stm_buffer(input);
+        if (carry != NULL)
+        {
+            uint32_t eol = bsimd_chr2(data, size, '\n', '\n');
+            uint32_t n = eol < size ? eol + 1 : size;
+            stm_write(carry, (const byte_t*)data, n);
+            stm_skip(input, n);
+            if (eol < size)
+            {
+                nerrors += i_parse_lines(&doc, (const char_t*)stm_buffer(carry), stm_buffer_size(carry), type, objs);
+                stm_close(&carry);
+            }
+            continue;
+        }
+
+        body = i_last_line(data, size);
+        if (body > 0)
+        {
+            nerrors += i_read_lines(data, body, nthreads, type, tc(arrtype), objs);
+            stm_skip(input, body);
+        }
+
+        if (body < size)
+        {
+            carry = stm_memory(size - body);
+            stm_write(carry, (const byte_t*)data + body, size - body);
+            stm_skip(input, size - body);
+        }
+    }
+
+    if (carry != NULL)
+    {
+        nerrors += i_parse_lines(&doc, (const char_t*)stm_buffer(carry), stm_buffer_size(carry), type, objs);
+        stm_close(&carry);
+    }
+
+    heap_end_mt();
+    i_doc_remove(&doc);
+    str_destroy(&arrtype);
+    if (block != NULL)
+        stm_close(&block);
+    ptr_assign(errors, nerrors);
+    return objs;
+}
+
+/*---------------------------------------------------------------------------*/
+
+JsonReader *json_reader(Stream *stm)
+{
+    JsonReader *reader = heap_new0(JsonReader);
+    cassert_no_null(stm);
+    i_parser_init(&reader->parser, stm, &reader->doc);
+    reader->event = ekJSON_EOF;
+    reader->state = i_stVALUE;
+    reader->depth = 0;
+    return reader;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void json_reader_destroy(JsonReader **reader)
+{
+    cassert_no_null(reader);
+    cassert_no_null(*reader);
+    if ((*reader)->parser.doc != NULL)
+        i_doc_remove((*reader)->parser.doc);
+    heap_delete(reader, JsonReader);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static jsonev_t i_reader_error(JsonReader *reader, const char_t *errmsg)
+{
+    i_error(FALSE, TRUE, &reader->parser, errmsg);
+    reader->state = i_stSTOP;
+    reader->event = ekJSON_ERROR;
+    return ekJSON_ERROR;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_reader_after_value(JsonReader *reader)
+{
+    if (reader->depth == 0)
+        reader->state = i_stEND;
+    else if (reader->stack[reader->depth - 1] == '{')
+        reader->state = i_stMEMBER;
+    else
+        reader->state = i_stELEM;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static jsonev_t i_reader_event(JsonReader *reader, const jsonev_t event)
+{
+    reader->event = event;
+    return event;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static jsonev_t i_reader_open(JsonReader *reader, const char_t container, const jstate_t state, const jsonev_t event)
+{
+    if (reader->depth == READER_MAX_DEPTH)
+        return i_reader_error(reader, "Json nesting too deep");
+    reader->stack[reader->depth++] = container;
+    reader->state = state;
+    return i_reader_event(reader, event);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static jsonev_t i_reader_close(JsonReader *reader, const jsonev_t event)
+{
+    cassert(reader->depth > 0);
+    reader->depth -= 1;
+    i_reader_after_value(reader);
+    return i_reader_event(reader, event);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Value whose first token is already read */
+static jsonev_t i_reader_value(JsonReader *reader)
+{
+    switch (reader->parser.token) {
+    case i_ekTRUE:
+        i_reader_after_value(reader);
+        return i_reader_event(reader, ekJSON_TRUE);
+    case i_ekFALSE:
+        i_reader_after_value(reader);
+        return i_reader_event(reader, ekJSON_FALSE);
+    case i_ekNULL:
+        i_reader_after_value(reader);
+        return i_reader_event(reader, ekJSON_NULL);
+    case i_ekNUMBER:
+        i_reader_after_value(reader);
+        return i_reader_event(reader, ekJSON_NUMBER);
+    case i_ekSTRING:
+        i_reader_after_value(reader);
+        return i_reader_event(reader, ekJSON_STRING);
+    case i_ekOPEN_OBJECT:
+        return i_reader_open(reader, '{', i_stFIRST_MEMBER, ekJSON_BEGIN_OBJECT);
+    case i_ekOPEN_ARRAY:
+        return i_reader_open(reader, '[', i_stFIRST_ELEM, ekJSON_BEGIN_ARRAY);
+    case i_ekCLOSE_ARRAY:
+    case i_ekCLOSE_OBJECT:
+    case i_ekCOMMA:
+    case i_ekCOLON:
+    case i_ekUNKNOWN:
+        break;
+    cassert_default();
+    }
+
+    return i_reader_error(reader, "Json value expected");
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* The member name stays in the lexer buffer: its ':' is read on the next call */
+static jsonev_t i_reader_key(JsonReader *reader)
+{
+    if (reader->parser.token != i_ekSTRING)
+        return i_reader_error(reader, "Expected Json 'string' (member name)");
+    reader->state = i_stCOLON;
+    return i_reader_event(reader, ekJSON_KEY);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static bool_t i_reader_colon(JsonReader *reader)
+{
+    i_new_token(&reader->parser);
+    if (reader->parser.token != i_ekCOLON)
+    {
+        i_reader_error(reader, "Expected Json ':' (object member)");
+        return FALSE;
+    }
+
+    reader->state = i_stVALUE;
+    return TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+jsonev_t json_reader_next(JsonReader *reader)
+{
+    i_Parser *parser = NULL;
+    cassert_no_null(reader);
+    parser = &reader->parser;
+    switch (reader->state) {
+    case i_stVALUE:
+        i_new_token(parser);
+        return i_reader_value(reader);
+
+    case i_stCOLON:
+        if (i_reader_colon(reader) == FALSE)
+            return ekJSON_ERROR;
+        i_new_token(parser);
+        return i_reader_value(reader);
+
+    case i_stKEY:
+        i_new_token(parser);
+        return i_reader_key(reader);
+
+    case i_stFIRST_MEMBER:
+        i_new_token(parser);
+        if (parser->token == i_ekCLOSE_OBJECT)
+            return i_reader_close(reader, ekJSON_END_OBJECT);
+        return i_reader_key(reader);
+
+    case i_stMEMBER:
+        i_new_token(parser);
+        if (parser->token == i_ekCLOSE_OBJECT)
+            return i_reader_close(reader, ekJSON_END_OBJECT);
+        if (parser->token != i_ekCOMMA)
+            return i_reader_error(reader, "Comma expected in object");
+        i_new_token(parser);
+        return i_reader_key(reader);
+
+    case i_stFIRST_ELEM:
+        i_new_token(parser);
+        if (parser->token == i_ekCLOSE_ARRAY)
+            return i_reader_close(reader, ekJSON_END_ARRAY);
+        return i_reader_value(reader);
+
+    case i_stELEM:
+        i_new_token(parser);
+        if (parser->token == i_ekCLOSE_ARRAY)
+            return i_reader_close(reader, ekJSON_END_ARRAY);
+        if (parser->token != i_ekCOMMA)
+            return i_reader_error(reader, "Comma expected in array");
+        i_new_token(parser);
+        return i_reader_value(reader);
+
+    case i_stEND:
+        /* Several top-level values can follow one another (Json Lines) */
+        i_new_token(parser);
+        if (parser->eof == TRUE)
+        {
+            reader->state = i_stSTOP;
+            return i_reader_event(reader, ekJSON_EOF);
+        }
+        return i_reader_value(reader);
+
+    case i_stSTOP:
+        return reader->event;
+
+    cassert_default();
+    }
+
+    return i_reader_error(reader, "Fatal Json parsing error");
+}
+
+/*---------------------------------------------------------------------------*/
+
+const char_t *json_reader_lexeme(const JsonReader *reader, uint32_t *size)
+{
+    cassert_no_null(reader);
+    switch (reader->event) {
+    case ekJSON_KEY:
+    case ekJSON_STRING:
+        ptr_assign(size, reader->parser.lexsize);
+        return reader->parser.lexeme;
+
+    case ekJSON_NUMBER:
+        ptr_assign(size, str_len_c(reader->parser.number));
+        return reader->parser.number;
+
+    case ekJSON_TRUE:
+    case ekJSON_FALSE:
+    case ekJSON_NULL:
+        ptr_assign(size, reader->parser.lexsize);
+        return reader->parser.lexeme;
+
+    case ekJSON_BEGIN_OBJECT:
+    case ekJSON_END_OBJECT:
+    case ekJSON_BEGIN_ARRAY:
+    case ekJSON_END_ARRAY:
+    case ekJSON_EOF:
+    case ekJSON_ERROR:
+        break;
+    cassert_default();
+    }
+
+    ptr_assign(size, 0);
+    return "";
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t json_reader_depth(const JsonReader *reader)
+{
+    cassert_no_null(reader);
+    return reader->depth;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Peek the next element or member of the current container (the token is held) */
+bool_t json_reader_more(JsonReader *reader)
+{
+    i_Parser *parser = NULL;
+    cassert_no_null(reader);
+    parser = &reader->parser;
+    switch (reader->state) {
+    case i_stFIRST_ELEM:
+        i_new_token(parser);
+        parser->hold = TRUE;
+        if (parser->token == i_ekCLOSE_ARRAY)
+            return FALSE;
+        reader->state = i_stVALUE;
+        return TRUE;
+
+    case i_stELEM:
+        i_new_token(parser);
+        if (parser->token == i_ekCOMMA)
+        {
+            reader->state = i_stVALUE;
+            return TRUE;
+        }
+
+        parser->hold = TRUE;
+        return FALSE;
+
+    case i_stFIRST_MEMBER:
+        i_new_token(parser);
+        parser->hold = TRUE;
+        return (bool_t)(parser->token != i_ekCLOSE_OBJECT);
+
+    case i_stMEMBER:
+        i_new_token(parser);
+        if (parser->token == i_ekCOMMA)
+        {
+            reader->state = i_stKEY;
+            return TRUE;
+        }
+
+        parser->hold = TRUE;
+        return FALSE;
+
+    case i_stVALUE:
+    case i_stCOLON:
+    case i_stKEY:
+        return TRUE;
+
+    case i_stEND:
+        i_new_token(parser);
+        parser->hold = TRUE;
+        return (bool_t)(parser->eof == FALSE);
+
+    case i_stSTOP:
+        return FALSE;
+
+    cassert_default();
+    }
+
+    return FALSE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Move to a state where the next token starts a value */
+static bool_t i_reader_to_value(JsonReader *reader)
+{
+    switch (reader->state) {
+    case i_stVALUE:
+        return TRUE;
+
+    case i_stCOLON:
+        return i_reader_colon(reader);
+
+    case i_stFIRST_ELEM:
+    case i_stELEM:
+    case i_stEND:
+        if (json_reader_more(reader) == FALSE)
+            return FALSE;
+        if (reader->state == i_stEND)
+            reader->state = i_stVALUE;
+        cassert(reader->state == i_stVALUE);
+        return TRUE;
+
+    case i_stKEY:
+    case i_stFIRST_MEMBER:
+    case i_stMEMBER:
+    case i_stSTOP:
+        return FALSE;
+
+    cassert_default();
+    }
+
+    return FALSE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool_t json_reader_skip(JsonReader *reader)
+{
+    cassert_no_null(reader);
+
+    /* Skip the rest of the container just opened */
+    if (reader->event == ekJSON_BEGIN_OBJECT || reader->event == ekJSON_BEGIN_ARRAY)
+    {
+        uint32_t depth = reader->depth;
+        if (reader->state == i_stFIRST_MEMBER || reader->state == i_stFIRST_ELEM)
+        {
+            while (reader->depth >= depth)
+            {
+                jsonev_t event = json_reader_next(reader);
+                if (event == ekJSON_ERROR || event == ekJSON_EOF)
+                    return FALSE;
+            }
+
+            return TRUE;
+        }
+    }
+
+    if (i_reader_to_value(reader) == FALSE)
+        return FALSE;
+
+    if (i_jump_value(&reader->parser) == FALSE)
+    {
+        i_reader_error(reader, "Error skipping Json value");
+        return FALSE;
+    }
+
+    i_reader_after_value(reader);
+    return TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void *json_reader_read_imp(JsonReader *reader, const char_t *type)
+{
+    void *obj = NULL;
+    cassert_no_null(reader);
+    if (i_reader_to_value(reader) == TRUE)
+    {
+        obj = i_create_type(&reader->parser, type);
+        if (obj != NULL)
+            i_reader_after_value(reader);
+        else
+            i_reader_error(reader, "Error reading Json value");
+    }
+
     return obj;
 }
 
 /*---------------------------------------------------------------------------*/
 
-static void i_write_string(Stream *stm, const String *str)
+static void i_flush(i_Writer *writer)
+{
+    cassert_no_null(writer);
+    if (writer->size > 0)
+    {
+        if (writer->utf8 == TRUE)
+        {
+            stm_write(writer->stm, (const byte_t*)writer->data, writer->size);
+        }
+        else
+        {
+            /* stm_writef converts to the stream encoding */
+            writer->data[writer->size] = '\0';
+            stm_writef(writer->stm, writer->data);
+        }
+
+        writer->size = 0;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_put(i_Writer *writer, const char_t *str, uint32_t size)
+{
+    cassert_no_null(writer);
+    while (writer->size + size > WRITER_SIZE)
+    {
+        uint32_t n = WRITER_SIZE - writer->size;
+        /* Never split an UTF8 sequence, stm_writef would break it */
+        if (writer->utf8 == FALSE)
+        {
+            while (n > 0 && ((byte_t)str[n] & 0xC0) == 0x80)
+                n -= 1;
+        }
+
+        if (n > 0)
+            bmem_copy((byte_t*)writer->data + writer->size, (const byte_t*)str, n);
+        writer->size += n;
+        str += n;
+        size -= n;
+        i_flush(writer);
+    }
+
+    if (size > 0)
+        bmem_copy((byte_t*)writer->data + writer->size, (const byte_t*)str, size);
+    writer->size += size;
+}
+
+/*---------------------------------------------------------------------------*/
+
+#define i_putl(writer, literal) i_put(writer, literal, sizeof(literal) - 1)
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE void i_putc(i_Writer *writer, const char_t c)
+{
+    cassert_no_null(writer);
+    if (writer->size == WRITER_SIZE)
+        i_flush(writer);
+    writer->data[writer->size++] = c;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static const char_t i_DIGITS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/*---------------------------------------------------------------------------*/
+
+/* Two digits per step, from the end of the buffer. Returns the first digit */
+static char_t *i_u64_digits(uint64_t value, char_t *end)
+{
+    while (value >= 100)
+    {
+        uint32_t d = (uint32_t)(value % 100) * 2;
+        value /= 100;
+        *--end = i_DIGITS[d + 1];
+        *--end = i_DIGITS[d];
+    }
+
+    if (value >= 10)
+    {
+        uint32_t d = (uint32_t)value * 2;
+        *--end = i_DIGITS[d + 1];
+        *--end = i_DIGITS[d];
+    }
+    else
+    {
+        *--end = (char_t)('0' + value);
+    }
+
+    return end;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_put_u64(i_Writer *writer, const uint64_t value)
+{
+    char_t buffer[24];
+    char_t *end = buffer + sizeof(buffer);
+    char_t *str = i_u64_digits(value, end);
+    i_put(writer, str, (uint32_t)(end - str));
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_put_i64(i_Writer *writer, const int64_t value)
+{
+    if (value < 0)
+    {
+        i_putc(writer, '-');
+        i_put_u64(writer, (uint64_t)0 - (uint64_t)value);
+    }
+    else
+    {
+        i_put_u64(writer, (uint64_t)value);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * Same output as printf("%f"): exact decimal value rounded half to even
+ * at six digits. value = m * 2^e, we compute (m * 10^6) >> -e in 128 bits.
+ * Huge values, NaN and infinities are left to the C library.
+ */
+static void i_put_real(i_Writer *writer, const real64_t value)
+{
+    uint64_t bits, m, q;
+    uint32_t exp;
+    bmem_copy((byte_t*)&bits, (const byte_t*)&value, sizeof(bits));
+    exp = (uint32_t)(bits >> 52) & 0x7FF;
+    m = bits & 0xFFFFFFFFFFFFF;
+
+    /* value >= 2^44 overflows q */
+    if (exp > 1023 + 43)
+    {
+        char_t buffer[512];
+        uint32_t n = bstd_sprintf(buffer, sizeof(buffer), "%f", value);
+        i_put(writer, buffer, n);
+        return;
+    }
+
+    if (exp != 0)
+        m |= (uint64_t)1 << 52;
+    else
+        exp = 1;
+
+    {
+        /* P = m * 10^6 (up to 73 bits), s >= 9 */
+        uint32_t s = 1075 - exp;
+        uint64_t mh = (m >> 32) * 1000000;
+        uint64_t ml = (m & 0xFFFFFFFF) * 1000000;
+        uint64_t lo = ml + (mh << 32);
+        uint64_t hi = (mh >> 32) + (lo < ml ? 1 : 0);
+        bool_t up = FALSE;
+
+        if (s < 64)
+        {
+            uint64_t r = lo & (((uint64_t)1 << s) - 1);
+            uint64_t half = (uint64_t)1 << (s - 1);
+            q = (lo >> s) | (hi << (64 - s));
+            up = (bool_t)(r > half || (r == half && (q & 1) == 1));
+        }
+        else if (s == 64)
+        {
+            uint64_t half = (uint64_t)1 << 63;
+            q = hi;
+            up = (bool_t)(lo > half || (lo == half && (q & 1) == 1));
+        }
+        else if (s < 74)
+        {
+            uint64_t rh = hi & (((uint64_t)1 << (s - 64)) - 1);
+            uint64_t hh = (uint64_t)1 << (s - 65);
+            q = hi >> (s - 64);
+            if (rh > hh || (rh == hh && lo > 0))
+                up = TRUE;
+            else if (rh == hh && lo == 0)
+                up = (bool_t)((q & 1) == 1);
+        }
+        else
+        {
+            /* P < 2^73 <= 2^(s-1) */
+            q = 0;
+        }
+
+        if (up == TRUE)
+            q += 1;
+    }
+
+    {
+        char_t buffer[32];
+        char_t *end = buffer + sizeof(buffer);
+        uint32_t frac = (uint32_t)(q % 1000000);
+        char_t *str = end - 6;
+        uint32_t i;
+        for (i = 0; i < 6; ++i)
+        {
+            str[5 - i] = (char_t)('0' + frac % 10);
+            frac /= 10;
+        }
+
+        *--str = '.';
+        str = i_u64_digits(q / 1000000, str);
+        if ((bits >> 63) != 0)
+            *--str = '-';
+        i_put(writer, str, (uint32_t)(end - str));
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_write_string(i_Writer *writer, const String *str)
 {
     if (str != NULL)
     {
         const char_t *cstr = tc(str);
-        uint32_t cp = unicode_to_u32(cstr, ekUTF8);
-        stm_writef(stm, "\"");
-        while (cp != 0)
-        {
-            if (cp == '"')
-                stm_writef(stm, "\\\"");
-            else if (cp == '\\')
-                stm_writef(stm, "\\\\");
-            //else if (cp == '/')
-            //  stm_writef(stm, "\\/");
-            else if (cp == '\b')
-                stm_writef(stm, "\\b");
-            else if (cp == '\f')
-                stm_writef(stm, "\\f");
-            else if (cp == '\n')
-                stm_writef(stm, "\\n");
-            else if (cp == '\r')
-                stm_writef(stm, "\\r");
-            else if (cp == '\t')
-                stm_writef(stm, "\\t");
-            else if (cp >= 32)
-                stm_write_char(stm, cp);
-            cstr = unicode_next(cstr, ekUTF8);
-            cp = unicode_to_u32(cstr, ekUTF8);
-        }
-        stm_writef(stm, "\"");
+        /* Not str_len(), reserved strings can be shorter than their buffer */
+        uint32_t size = str_len_c(cstr);
+        i_putc(writer, '"');
+        for (;;)
+        {
+            /* Runs of plain text are copied as is */
+            uint32_t n = bsimd_json_plain(cstr, size);
+            if (n > 0)
+                i_put(writer, cstr, n);
+
+            if (n == size)
+                break;
+
+            switch (cstr[n]) {
+            case '"':
+                i_putl(writer, "\\\"");
+                break;
+            case '\\':
+                i_putl(writer, "\\\\");
+                break;
+            case '\b':
+                i_putl(writer, "\\b");
+                break;
+            case '\f':
+                i_putl(writer, "\\f");
+                break;
+            case '\n':
+                i_putl(writer, "\\n");
+                break;
+            case '\r':
+                i_putl(writer, "\\r");
+                break;
+            case '\t':
+                i_putl(writer, "\\t");
+                break;
+            /* Other control characters are not written */
+            default:
+                break;
+            }
+
+            cstr += n + 1;
+            size -= n + 1;
+        }
+        i_putc(writer, '"');
     }
     else
     {
-        stm_writef(stm, "null");
+        i_putl(writer, "null");
     }    
 }
 
 /*---------------------------------------------------------------------------*/
 
-static void i_write_array(Stream *stm, const Array *array, const char_t *type)
+/* OBJECT and ENUM subtypes are the type name itself, no need to allocate it */
+static dtype_t i_elem_type(const char_t *type, String **subtype, const char_t **stype)
+{
+    dtype_t atype = _dbind_type(type, NULL, NULL);
+    cassert_no_null(subtype);
+    cassert_no_null(stype);
+    if (atype == ekDTYPE_OBJECT || atype == ekDTYPE_ENUM)
+    {
+        *stype = type;
+    }
+    else if (atype == ekDTYPE_OBJECT_PTR)
+    {
+        _dbind_type(type, subtype, NULL);
+        *stype = *subtype != NULL ? tc(*subtype) : NULL;
+    }
+    else
+    {
+        *stype = NULL;
+    }
+
+    return atype;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_write_array(i_Writer *writer, const Array *array, const char_t *type)
 {
     if (array != NULL)
     {
@@ -1026,53 +2713,53 @@ static void i_write_array(Stream *stm, const Array *array, const char_t *type)
         uint32_t i, n = array_size(array);
         uint32_t es = array_esize(array);
         String *subtype = NULL;
-        dtype_t atype = _dbind_type(type, &subtype, NULL);
-        const char_t *stype = subtype != NULL ? tc(subtype) : NULL;
-        stm_writef(stm, "[ ");
+        const char_t *stype = NULL;
+        dtype_t atype = i_elem_type(type, &subtype, &stype);
+        i_putl(writer, "[ ");
         for (i = 0; i < n; ++i, data += es)
         {
-            i_write_type(stm, atype, stype, (const void*)data, TRUE);
+            i_write_type(writer, atype, stype, (const void*)data, TRUE);
             if (i < n - 1)
-                stm_writef(stm, ", ");
+                i_putl(writer, ", ");
         }
-        stm_writef(stm, " ]");
+        i_putl(writer, " ]");
         str_destopt(&subtype);
     }
     else
     {
-        stm_writef(stm, "null");
+        i_putl(writer, "null");
     }
 }
 
 /*---------------------------------------------------------------------------*/
 
-static void i_write_arrpt(Stream *stm, const Array *array, const char_t *type)
+static void i_write_arrpt(i_Writer *writer, const Array *array, const char_t *type)
 {
     if (array != NULL)
     {
         const byte_t *data = array_all(array);
         uint32_t i, n = array_size(array);
         String *subtype = NULL;
-        dtype_t atype = _dbind_type(type, &subtype, NULL);
-        const char_t *stype = subtype != NULL ? tc(subtype) : NULL;
-        stm_writef(stm, "[ ");
+        const char_t *stype = NULL;
+        dtype_t atype = i_elem_type(type, &subtype, &stype);
+        i_putl(writer, "[ ");
         if (atype == ekDTYPE_STRING)
         {
             for (i = 0; i < n; ++i, data += sizeof(void*))
             {
-                stm_writef(stm, "\n");
-                i_write_string(stm, *(String**)data);
+                i_putc(writer, '\n');
+                i_write_string(writer, *(String**)data);
                 if (i < n - 1)
-                    stm_writef(stm, ", ");
+                    i_putl(writer, ", ");
             }
         }
         else if (atype == ekDTYPE_OBJECT)
         {
             for (i = 0; i < n; ++i, data += sizeof(void*))
             {
-                i_write_object(stm, *(const void**)data, stype, TRUE);
+                i_write_object(writer, *(const void**)data, stype, TRUE);
                 if (i < n - 1)
-                    stm_writef(stm, ", ");
+                    i_putl(writer, ", ");
             }
         }
         else
@@ -1080,12 +2767,12 @@ static void i_write_arrpt(Stream *stm, const Array *array, const char_t *type)
             cassert_msg(FALSE, "Json: Invalid ArrPt type.");
         }
 
-        stm_writef(stm, " ]");
+        i_putl(writer, " ]");
         str_destopt(&subtype);
     }
     else
     {
-        stm_writef(stm, "null");
+        i_putl(writer, "null");
     }
 }
 
@@ -1095,7 +2782,7 @@ static void i_write_arrpt(Stream *stm, const Array *array, const char_t *type)
 
 /*---------------------------------------------------------------------------*/
 
-static void i_write_object(Stream *stm, const void *object, const char_t *type, const bool_t inarray)
+static void i_write_object(i_Writer *writer, const void *object, const char_t *type, const bool_t inarray)
 {
     if (object != NULL)
     {
@@ -1106,9 +2793,9 @@ static void i_write_object(Stream *stm, const void *object, const char_t *type,
         cassert_msg(ok == TRUE, "Json: Unknown struct type.");
         unref(ok);
 
-        stm_writef(stm, "{");
+        i_putc(writer, '{');
         if (inarray == TRUE)
-            stm_writef(stm, "\n");
+            i_putc(writer, '\n');
 
         for (i = 0; i < n; ++i)
         {
@@ -1119,26 +2806,28 @@ static void i_write_object(Stream *stm, const void *object, const char_t *type,
             ok = _dbind_member_i(type, i, &mname, &moffset, &mtype, &mstype);
             cassert_msg(ok == TRUE, "Json: Unknown struct member.");
             if (i_with_nl(mtype) == TRUE || i_with_nl(ptype) == TRUE)
-                stm_writef(stm, "\n");
-            stm_printf(stm, "\n\"%s\" : ", mname);
-            i_write_type(stm, mtype, mstype, (const void*)((byte_t*)object + moffset), FALSE);
+                i_putc(writer, '\n');
+            i_putl(writer, "\n\"");
+            i_put(writer, mname, str_len_c(mname));
+            i_putl(writer, "\" : ");
+            i_write_type(writer, mtype, mstype, (const void*)((byte_t*)object + moffset), FALSE);
             if (i < n - 1)
-                stm_writef(stm, ", ");
+                i_putl(writer, ", ");
             ptype = mtype;
             //if (i_with_nl(mtype) == TRUE)
             //    stm_writef(stm, "\n");
         }
-        stm_writef(stm, " }");
+        i_putl(writer, " }");
     }
     else
     {
-        stm_writef(stm, "null");
+        i_putl(writer, "null");
     }
 }
 
 /*---------------------------------------------------------------------------*/
 
-static void i_write_type(Stream *stm, dtype_t type, const char_t *subtype, const void *data, const bool_t inarray)
+static void i_write_type(i_Writer *writer, dtype_t type, const char_t *subtype, const void *data, const bool_t inarray)
 {
     cassert_no_null(data);
     switch (type)
@@ -1146,77 +2835,77 @@ static void i_write_type(Stream *stm, dtype_t type, const char_t *subtype, const
         case ekDTYPE_BOOL:
             if (*(bool_t*)data == TRUE)
             {
-                stm_writef(stm, "true");
+                i_putl(writer, "true");
             }
             else
             {
                 cassert(*(bool_t*)data == FALSE);
-                stm_writef(stm, "false");
+                i_putl(writer, "false");
             }
             break;
 
         case ekDTYPE_INT8:
-            stm_printf(stm, "%d", *(int8_t*)data);
+            i_put_i64(writer, (int64_t)*(int8_t*)data);
             break;
 
         case ekDTYPE_INT16:
-            stm_printf(stm, "%d", *(int16_t*)data);
+            i_put_i64(writer, (int64_t)*(int16_t*)data);
             break;
 
         case ekDTYPE_INT32:
-            stm_printf(stm, "%d", *(int32_t*)data);
+            i_put_i64(writer, (int64_t)*(int32_t*)data);
             break;
 
         case ekDTYPE_INT64:
-            stm_printf(stm, "%" PRId64, *(int64_t*)data);
+            i_put_i64(writer, *(int64_t*)data);
             break;
 
         case ekDTYPE_UINT8:
-            stm_printf(stm, "%u", *(uint8_t*)data);
+            i_put_u64(writer, (uint64_t)*(uint8_t*)data);
             break;
 
         case ekDTYPE_UINT16:
-            stm_printf(stm, "%u", *(uint16_t*)data);
+            i_put_u64(writer, (uint64_t)*(uint16_t*)data);
             break;
 
         case ekDTYPE_UINT32:
-            stm_printf(stm, "%u", *(uint32_t*)data);
+            i_put_u64(writer, (uint64_t)*(uint32_t*)data);
             break;
 
         case ekDTYPE_UINT64:
-            stm_printf(stm, "%" PRIu64, *(uint64_t*)data);
+            i_put_u64(writer, *(uint64_t*)data);
             break;
 
         case ekDTYPE_REAL32:
-            stm_printf(stm, "%f", *(real32_t*)data);
+            i_put_real(writer, (real64_t)*(real32_t*)data);
             break;
 
         case ekDTYPE_REAL64:
-            stm_printf(stm, "%f", *(real64_t*)data);
+            i_put_real(writer, *(real64_t*)data);
             break;
         case ekDTYPE_ENUM:
-            stm_printf(stm, "%u", *(enum_t*)data);
+            i_put_u64(writer, (uint64_t)(uint32_t)*(enum_t*)data);
             break;
 
         case ekDTYPE_STRING:
         case ekDTYPE_STRING_PTR:
-            i_write_string(stm, *(String**)data);
+            i_write_string(writer, *(String**)data);
             break;
 
         case ekDTYPE_ARRAY:
-            i_write_array(stm, *(Array**)data, subtype);
+            i_write_array(writer, *(Array**)data, subtype);
             break;
 
         case ekDTYPE_ARRPTR:
-            i_write_arrpt(stm, *(Array**)data, subtype);
+            i_write_arrpt(writer, *(Array**)data, subtype);
             break;
 
         case ekDTYPE_OBJECT:
-            i_write_object(stm, data, subtype, inarray);
+            i_write_object(writer, data, subtype, inarray);
             break;
 
         case ekDTYPE_OBJECT_PTR:
-            i_write_object(stm, *(const void**)data, subtype, inarray);
+            i_write_object(writer, *(const void**)data, subtype, inarray);
             break;
 
         case ekDTYPE_OBJECT_OPAQUE:
@@ -1229,11 +2918,16 @@ static void i_write_type(Stream *stm, dtype_t type, const char_t *subtype, const
 
 void json_write_imp(Stream *stm, const void *data, const JsonOpts *opts, const char_t *type)
 {
+    i_Writer writer;
     String *subtype = NULL;
     dtype_t dtype = _dbind_type(type, &subtype, NULL);
     unref(opts);
-    i_write_type(stm, dtype, subtype != NULL ? tc(subtype) : NULL, data, FALSE);
-    stm_writef(stm, "\n");
+    writer.stm = stm;
+    writer.utf8 = (bool_t)(stm_get_write_utf(stm) == ekUTF8);
+    writer.size = 0;
+    i_write_type(&writer, dtype, subtype != NULL ? tc(subtype) : NULL, data, FALSE);
+    i_putc(&writer, '\n');
+    i_flush(&writer);
     str_destopt(&subtype);
 }
 
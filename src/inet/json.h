@@ -17,17 +17,39 @@ __EXTERN_C
 
 void *json_read_imp(Stream *stm, const JsonOpts *opts, const char_t *type);
 
+void *json_read_lines_parallel_imp(Stream *stm, const JsonOpts *opts, const uint32_t nthreads, uint32_t *errors, const char_t *type);
+
 void json_write_imp(Stream *stm, const void *data, const JsonOpts *opts, const char_t *type);
 
 void json_destroy_imp(void **data, const char_t *type);
 
 void json_destopt_imp(void **data, const char_t *type);
 
+JsonReader *json_reader(Stream *stm);
+
+void json_reader_destroy(JsonReader **reader);
+
+jsonev_t json_reader_next(JsonReader *reader);
+
+const char_t *json_reader_lexeme(const JsonReader *reader, uint32_t *size);
+
+uint32_t json_reader_depth(const JsonReader *reader);
+
+bool_t json_reader_more(JsonReader *reader);
+
+bool_t json_reader_skip(JsonReader *reader);
+
+void *json_reader_read_imp(JsonReader *reader, const char_t *type);
+
 __END_C
 
 #define json_read(stm, opts, type)\
     (type*)json_read_imp(stm, opts, (const char_t*)#type)
 
+/* One value per line. Lines with errors are logged and skipped. 'errors' (can be NULL) receives their number */
+#define json_read_lines_parallel(stm, opts, nthreads, errors, type)\
+    (ArrPt(type)*)json_read_lines_parallel_imp(stm, opts, nthreads, errors, (const char_t*)#type)
+
 #define json_write(stm, data, opts, type)\
     ((void)((const type*)data == data),\
     json_write_imp(stm, (const void*)data, opts, (const char_t*)#type))
@@ -39,3 +61,6 @@ __END_C
 #define json_destopt(data, type)\
     ((void)((type**)data == data),\
     json_destopt_imp((void**)data, (const char_t*)#type))
+
+#define json_reader_read(reader, type)\
+    (type*)json_reader_read_imp(reader, (const char_t*)#type)
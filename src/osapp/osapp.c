@@ -18,6 +18,8 @@
 
 #include "arrpt.h"
 #include "bfile.h"
+#include "bmem.h"
+#include "bmutex.h"
 #include "bthread.h"
 #include "bstd.h"
 #include "core.h"
@@ -33,13 +35,21 @@
 #include "log.h"
 #include "osgui.h"
 #include "osguictx.h"
+#include "osbs.h"
 #include "obj.inl"
 #include "ptr.h"
 #include "strings.h"
 
 typedef struct i_task_t i_Task;
+typedef struct i_queue_t i_Queue;
+typedef struct i_worker_t i_Worker;
+typedef struct i_pool_t i_Pool;
 typedef struct i_app_t i_App;
 
+#define i_TASK_PRIOS        3
+#define i_MAX_WORKERS       64
+#define i_IDLE_EXIT         1000
+
 typedef enum _icon_t
 {
     i_ekICON_ASSERT         = 0,
@@ -52,6 +62,7 @@ typedef enum _task_state_t
     i_ekSTATE_RUNNING       = 0,
     i_ekSTATE_WAITING       = 1,
     i_ekSTATE_FINISH        = 2,
+    i_ekSTATE_CANCEL        = 3,
 
     i_ekSTATE_ASSERT        = 6,
     i_ekSTATE_ERROR         = 7,
@@ -60,17 +71,56 @@ typedef enum _task_state_t
     i_ekSTATE_DEBUG_BREAK   = 9
 } tstate_t;
 
+/* 'state' and 'rvalue' are shared with the workers (pool mutex). 'mstate' is the main thread copy */
 struct i_task_t
 {
     OSApp *osapp;
-    Thread *thread;
     void *data;
     real64_t updtime;
     real64_t lastupd;
     FPtr_task_main func_main;
     FPtr_task_update func_update;
     FPtr_task_end func_end;
+    task_prio_t prio;
     tstate_t state;
+    tstate_t mstate;
+    uint32_t rvalue;
+};
+
+/* Ring of pending tasks */
+struct i_queue_t
+{
+    i_Task **tasks;
+    uint32_t head;
+    uint32_t size;
+    uint32_t capacity;
+};
+
+/* Each worker takes from its own queues (oldest first) and steals from the others (newest first) */
+struct i_worker_t
+{
+    i_Pool *pool;
+    Thread *thread;
+    Mutex *mutex;
+    i_Queue queues[i_TASK_PRIOS];
+    bool_t alive;
+};
+
+/*
+ * Workers are started on demand, one per core, and leave after 'i_IDLE_EXIT' idle milliseconds.
+ * 'pending': queued tasks not taken yet. A worker never leaves while there are pending tasks.
+ * 'waiting': workers sleeping on 'sem'. Each new task wakes up one of them.
+ */
+struct i_pool_t
+{
+    Mutex *mutex;
+    Semaphore *sem;
+    i_Worker *workers;
+    uint32_t nworkers;
+    uint32_t next;
+    uint32_t pending;
+    uint32_t waiting;
+    bool_t quit;
 };
 
 struct i_app_t
@@ -89,6 +139,8 @@ struct i_app_t
     FPtr_call func_async_call;
     String *locale;
     ArrPt(i_Task) *scheduler;
+    ArrPt(i_Task) *incoming;
+    i_Pool *pool;
 };
 
 DeclSt(i_Task);
@@ -100,18 +152,336 @@ static void i_destroy_task(i_Task **task)
 {
     cassert_no_null(task);
     cassert_no_null(*task);
-    bthread_close(&(*task)->thread);
     heap_delete(task, i_Task);
 }
 
 /*---------------------------------------------------------------------------*/
 
+static void i_queue_push(i_Queue *queue, i_Task *task)
+{
+    cassert_no_null(queue);
+    if (queue->size == queue->capacity)
+    {
+        uint32_t capacity = queue->capacity > 0 ? queue->capacity * 2 : 16;
+        i_Task **tasks = heap_new_n(capacity, i_Task*);
+        uint32_t i;
+        for (i = 0; i < queue->size; ++i)
+            tasks[i] = queue->tasks[(queue->head + i) % queue->capacity];
+
+        if (queue->tasks != NULL)
+            heap_delete_n(&queue->tasks, queue->capacity, i_Task*);
+
+        queue->tasks = tasks;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+
+    queue->tasks[(queue->head + queue->size) % queue->capacity] = task;
+    queue->size += 1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static i_Task *i_queue_pop(i_Queue *queue, const bool_t oldest)
+{
+    i_Task *task = NULL;
+    cassert_no_null(queue);
+    if (queue->size > 0)
+    {
+        if (oldest == TRUE)
+        {
+            task = queue->tasks[queue->head];
+            queue->head = (queue->head + 1) % queue->capacity;
+        }
+        else
+        {
+            task = queue->tasks[(queue->head + queue->size - 1) % queue->capacity];
+        }
+
+        queue->size -= 1;
+    }
+
+    return task;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Tasks with 'data' (or all) leave the queue. They will never reach a worker. Worker mutex is locked */
+static uint32_t i_queue_cancel(i_Pool *pool, i_Queue *queue, const void *data, const bool_t all)
+{
+    uint32_t i, n = 0;
+    cassert_no_null(pool);
+    cassert_no_null(queue);
+    bmutex_lock(pool->mutex);
+    for (i = 0; i < queue->size; ++i)
+    {
+        i_Task *task = queue->tasks[(queue->head + i) % queue->capacity];
+        if (all == TRUE || task->data == data)
+        {
+            task->state = i_ekSTATE_CANCEL;
+            n += 1;
+        }
+        else if (n > 0)
+        {
+            queue->tasks[(queue->head + i - n) % queue->capacity] = task;
+        }
+    }
+
+    cassert(pool->pending >= n);
+    pool->pending -= n;
+    bmutex_unlock(pool->mutex);
+    queue->size -= n;
+    return n;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_queue_remove(i_Queue *queue)
+{
+    cassert_no_null(queue);
+    cassert(queue->size == 0);
+    if (queue->tasks != NULL)
+        heap_delete_n(&queue->tasks, queue->capacity, i_Task*);
+}
+
+/*---------------------------------------------------------------------------*/
+
+// This function will run in a secondary thread
+// It should not call GUI functions
+static void i_run_task(i_Pool *pool, i_Task *task)
+{
+    uint32_t rvalue = UINT32_MAX;
+    void *data;
+    cassert_no_null(pool);
+    cassert_no_null(task);
+    data = osapp_begin_thread(task->osapp);
+    cassert_no_nullf(task->func_main);
+    rvalue = task->func_main(task->data);
+    osapp_end_thread(task->osapp, data);
+    bmutex_lock(pool->mutex);
+    task->rvalue = rvalue;
+    task->state = i_ekSTATE_FINISH;
+    bmutex_unlock(pool->mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Highest priority first: own queue, then steal from the others */
+static i_Task *i_pool_take(i_Pool *pool, i_Worker *worker)
+{
+    uint32_t id = (uint32_t)(worker - pool->workers);
+    uint32_t prio;
+    for (prio = i_TASK_PRIOS; prio > 0; --prio)
+    {
+        uint32_t i;
+        for (i = 0; i < pool->nworkers; ++i)
+        {
+            i_Worker *victim = &pool->workers[(id + i) % pool->nworkers];
+            i_Task *task = NULL;
+            bmutex_lock(victim->mutex);
+            task = i_queue_pop(&victim->queues[prio - 1], (bool_t)(victim == worker));
+            bmutex_unlock(victim->mutex);
+
+            if (task != NULL)
+            {
+                bmutex_lock(pool->mutex);
+                cassert(task->state == i_ekSTATE_WAITING);
+                cassert(pool->pending > 0);
+                task->state = i_ekSTATE_RUNNING;
+                pool->pending -= 1;
+                bmutex_unlock(pool->mutex);
+                return task;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint32_t i_worker_main(i_Worker *worker)
+{
+    i_Pool *pool = NULL;
+    bool_t idle = FALSE;
+    cassert_no_null(worker);
+    pool = worker->pool;
+    for (;;)
+    {
+        i_Task *task = i_pool_take(pool, worker);
+        if (task != NULL)
+        {
+            i_run_task(pool, task);
+            idle = FALSE;
+        }
+        else
+        {
+            bool_t leave = FALSE, wait = FALSE;
+            bmutex_lock(pool->mutex);
+            if (pool->quit == TRUE || (pool->pending == 0 && idle == TRUE))
+            {
+                worker->alive = FALSE;
+                leave = TRUE;
+            }
+            /* With pending tasks (being queued), the queues are checked again */
+            else if (pool->pending == 0)
+            {
+                pool->waiting += 1;
+                wait = TRUE;
+            }
+            bmutex_unlock(pool->mutex);
+
+            if (leave == TRUE)
+                break;
+
+            if (wait == TRUE)
+            {
+                idle = (bool_t)(bsem_wait(pool->sem, i_IDLE_EXIT) == FALSE);
+                if (idle == TRUE)
+                {
+                    bool_t woken = FALSE;
+                    bmutex_lock(pool->mutex);
+                    if (pool->waiting > 0)
+                        pool->waiting -= 1;
+                    else
+                        woken = TRUE;
+                    bmutex_unlock(pool->mutex);
+
+                    /* Timeout while a new task was waking it up: its post is consumed */
+                    if (woken == TRUE)
+                    {
+                        bsem_wait(pool->sem, UINT32_MAX);
+                        idle = FALSE;
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static i_Pool *i_create_pool(void)
+{
+    i_Pool *pool = heap_new0(i_Pool);
+    uint32_t i;
+    pool->nworkers = osbs_ncpus();
+    if (pool->nworkers == 0)
+        pool->nworkers = 1;
+    if (pool->nworkers > i_MAX_WORKERS)
+        pool->nworkers = i_MAX_WORKERS;
+    pool->mutex = bmutex_create();
+    pool->sem = bsem_create(0);
+    pool->workers = heap_new_n0(pool->nworkers, i_Worker);
+    for (i = 0; i < pool->nworkers; ++i)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].mutex = bmutex_create();
+    }
+
+    heap_start_mt();
+    return pool;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Queued tasks are dropped (cancelled). Running tasks are finished before leaving */
+static void i_destroy_pool(i_Pool **pool)
+{
+    uint32_t i, j;
+    cassert_no_null(pool);
+    cassert_no_null(*pool);
+    bmutex_lock((*pool)->mutex);
+    (*pool)->quit = TRUE;
+    bmutex_unlock((*pool)->mutex);
+
+    for (i = 0; i < (*pool)->nworkers; ++i)
+    {
+        i_Worker *worker = &(*pool)->workers[i];
+        bmutex_lock(worker->mutex);
+        for (j = 0; j < i_TASK_PRIOS; ++j)
+            i_queue_cancel(*pool, &worker->queues[j], NULL, TRUE);
+        bmutex_unlock(worker->mutex);
+    }
+
+    /* Wake up all the idle workers */
+    for (i = 0; i < (*pool)->nworkers; ++i)
+        bsem_post((*pool)->sem);
+
+    for (i = 0; i < (*pool)->nworkers; ++i)
+    {
+        i_Worker *worker = &(*pool)->workers[i];
+        if (worker->thread != NULL)
+        {
+            bthread_wait(worker->thread);
+            bthread_close(&worker->thread);
+        }
+
+        for (j = 0; j < i_TASK_PRIOS; ++j)
+            i_queue_remove(&worker->queues[j]);
+        bmutex_close(&worker->mutex);
+    }
+
+    heap_end_mt();
+    heap_delete_n(&(*pool)->workers, (*pool)->nworkers, i_Worker);
+    bsem_close(&(*pool)->sem);
+    bmutex_close(&(*pool)->mutex);
+    heap_delete(pool, i_Pool);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Round robin. Left (idle) workers are started again */
+static void i_pool_push(i_Pool *pool, i_Task *task)
+{
+    i_Worker *worker = NULL;
+    bool_t wake = FALSE;
+    cassert_no_null(pool);
+    cassert_no_null(task);
+    bmutex_lock(pool->mutex);
+    worker = &pool->workers[pool->next];
+    pool->next = (pool->next + 1) % pool->nworkers;
+    pool->pending += 1;
+    if (worker->alive == FALSE)
+    {
+        /* The thread has already returned */
+        if (worker->thread != NULL)
+        {
+            bthread_wait(worker->thread);
+            bthread_close(&worker->thread);
+        }
+
+        worker->alive = TRUE;
+        worker->thread = bthread_create(i_worker_main, worker, i_Worker);
+    }
+
+    if (pool->waiting > 0)
+    {
+        pool->waiting -= 1;
+        wake = TRUE;
+    }
+    bmutex_unlock(pool->mutex);
+
+    bmutex_lock(worker->mutex);
+    i_queue_push(&worker->queues[task->prio], task);
+    bmutex_unlock(worker->mutex);
+    if (wake == TRUE)
+        bsem_post(pool->sem);
+}
+
+/*---------------------------------------------------------------------------*/
+
 static void i_destroy_app(i_App **app)
 {    
     cassert_no_null(app);
     cassert_no_null(*app);
     cassert(arrpt_size((*app)->scheduler, i_Task) == 0);
 
+    /* Workers are stopped before any task or app data is released */
+    ptr_destopt(i_destroy_pool, &(*app)->pool, i_Pool);
+
     if ((*app)->appitem != NULL)
     {
         cassert_no_nullf((*app)->func_destroy);
@@ -122,6 +492,7 @@ static void i_destroy_app(i_App **app)
     ptr_destopt(clock_destroy, &(*app)->clock, Clock);
     ptr_destopt(clock_destroy, &(*app)->app_clock, Clock);
     str_destroy(&(*app)->locale);
+    arrpt_destroy(&(*app)->incoming, NULL, i_Task);
     arrpt_destroy(&(*app)->scheduler, i_destroy_task, i_Task);
     gui_context_destroy(&(*app)->native_gui);
     obj_delete(app, i_App);
@@ -151,38 +522,40 @@ static void i_terminate(const bool_t abnormal_terminate)
 
 /*---------------------------------------------------------------------------*/
 
-// This function will run in a secondary thread
-// It should not call GUI functions
-static uint32_t i_dispatch_task(i_Task *task)
-{
-    uint32_t rvalue = UINT32_MAX;
-    void *data;
-    cassert_no_null(task);
-    cassert(task->state == i_ekSTATE_WAITING);
-    task->state = i_ekSTATE_RUNNING;
-    data = osapp_begin_thread(task->osapp);
-    cassert_no_nullf(task->func_main);
-    rvalue = task->func_main(task->data);
-    task->state = i_ekSTATE_FINISH;
-    osapp_end_thread(task->osapp, data);
-    return rvalue;
-}
-
-/*---------------------------------------------------------------------------*/
-
 // This function runs in the MAIN thread
-static void i_scheduler_cycle(ArrPt(i_Task) *scheduler, const real64_t crtime)
+// Tasks created since the last cycle start in this one (not cancelled meanwhile)
+// All the tasks finished (or canceled) since the last cycle end in this one, in submission order
+static void i_scheduler_cycle(i_App *app, const real64_t crtime)
 {
-    i_Task *deleted_task = NULL;
+    ArrPt(i_Task) *ended = NULL;
+    uint32_t nended = 0;
+    cassert_no_null(app);
+    if (arrpt_size(app->scheduler, i_Task) == 0)
+        return;
 
-    arrpt_foreach(task, scheduler, i_Task)
-        if (task->state == i_ekSTATE_WAITING)
-        {
-            cassert(task->thread == NULL);
-            task->thread = bthread_create(i_dispatch_task, task, i_Task);
+    if (arrpt_size(app->incoming, i_Task) > 0)
+    {
+        if (app->pool == NULL)
+            app->pool = i_create_pool();
+
+        arrpt_foreach(task, app->incoming, i_Task)
+            if (task->state == i_ekSTATE_WAITING)
+                i_pool_push(app->pool, task);
+        arrpt_end();
+        arrpt_clear(app->incoming, NULL, i_Task);
+    }
+
+    cassert_no_null(app->pool);
+    bmutex_lock(app->pool->mutex);
+    arrpt_foreach(task, app->scheduler, i_Task)
+        if (task->mstate == i_ekSTATE_WAITING && task->state == i_ekSTATE_RUNNING)
             task->lastupd = crtime;
-        }
-        else if (task->state == i_ekSTATE_RUNNING)
+        task->mstate = task->state;
+    arrpt_end();
+    bmutex_unlock(app->pool->mutex);
+
+    arrpt_foreach(task, app->scheduler, i_Task)
+        if (task->mstate == i_ekSTATE_RUNNING)
         {
             if (task->func_update != NULL)
             {
@@ -193,23 +566,34 @@ static void i_scheduler_cycle(ArrPt(i_Task) *scheduler, const real64_t crtime)
                 }
             }
         }
-        else if (task->state == i_ekSTATE_FINISH)
+        else if (task->mstate == i_ekSTATE_FINISH || task->mstate == i_ekSTATE_CANCEL)
         {
-            if (deleted_task == NULL)
-            {
-                uint32_t rvalue = bthread_wait(task->thread);
-                if (task->func_end != NULL)
-                    task->func_end(task->data, rvalue);
-                deleted_task = task;
-            }
+            nended += 1;
         }
     arrpt_end();
 
-    if (deleted_task != NULL)
-    {
-        uint32_t index = arrpt_find(scheduler, deleted_task, i_Task);
-        arrpt_delete(scheduler, index, i_destroy_task, i_Task);
-    }
+    if (nended == 0)
+        return;
+
+    /* 'func_end' might add new tasks */
+    ended = app->scheduler;
+    app->scheduler = arrpt_create(i_Task);
+    arrpt_foreach(task, ended, i_Task)
+        if (task->mstate != i_ekSTATE_FINISH && task->mstate != i_ekSTATE_CANCEL)
+            arrpt_append(app->scheduler, task, i_Task);
+    arrpt_end();
+
+    arrpt_foreach(task, ended, i_Task)
+        if (task->mstate == i_ekSTATE_FINISH || task->mstate == i_ekSTATE_CANCEL)
+        {
+            i_Task *etask = task;
+            if (etask->func_end != NULL)
+                etask->func_end(etask->data, etask->mstate == i_ekSTATE_FINISH ? etask->rvalue : UINT32_MAX);
+            i_destroy_task(&etask);
+        }
+    arrpt_end();
+
+    arrpt_destroy(&ended, NULL, i_Task);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -222,7 +606,7 @@ static void i_OnTimerSignal(i_App *app)
     {
         if (app->state == i_ekSTATE_RUNNING)
         {
-            i_scheduler_cycle(app->scheduler, crtime);
+            i_scheduler_cycle(app, crtime);
             gui_update_transitions(prtime, crtime);
 
             if (app->func_update != NULL)
@@ -349,6 +733,8 @@ void osmain_imp(
     app->func_async_call = NULL;
     app->locale = str_c("");
     app->scheduler = arrpt_create(i_Task);
+    app->incoming = arrpt_create(i_Task);
+    app->pool = NULL;
     gui_context_set_current(app->native_gui);
 
     osapp_OnThemeChanged(app->osapp, listener(NULL, i_OnTheme, void));
@@ -371,20 +757,67 @@ void osapp_finish(void)
 /*---------------------------------------------------------------------------*/
 
 void osapp_task_imp(void *data, const real32_t updtime, FPtr_task_main func_task_main, FPtr_task_update func_task_update, FPtr_task_end func_task_end)
+{
+    osapp_task_prio_imp(data, updtime, ekTASK_NORMAL, func_task_main, func_task_update, func_task_end);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* The task reaches the workers in the next timer cycle. 'func_main' never starts before returning */
+void osapp_task_prio_imp(void *data, const real32_t updtime, const task_prio_t prio, FPtr_task_main func_task_main, FPtr_task_update func_task_update, FPtr_task_end func_task_end)
 {
     i_App *app = osapp_listener(i_App);
     i_Task *task = heap_new0(i_Task);
     cassert_no_null(app);
+    cassert_no_nullf(func_task_main);
+    cassert(prio == ekTASK_LOW || prio == ekTASK_NORMAL || prio == ekTASK_HIGH);
     task->osapp = app->osapp;
-    task->thread = NULL;
     task->data = data;
     task->updtime = updtime <= 0 && func_task_update ? .04 : updtime;
     task->lastupd = 0.;
     task->func_main = func_task_main;
     task->func_update = func_task_update;
     task->func_end = func_task_end;
+    task->prio = prio;
     task->state = i_ekSTATE_WAITING;
+    task->mstate = i_ekSTATE_WAITING;
+    task->rvalue = UINT32_MAX;
     arrpt_append(app->scheduler, task, i_Task);
+    arrpt_append(app->incoming, task, i_Task);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Only tasks not started yet. Their 'func_end' is called in the next cycle with UINT32_MAX */
+uint32_t osapp_task_cancel(void *data)
+{
+    i_App *app = osapp_listener(i_App);
+    uint32_t n = 0;
+    cassert_no_null(app);
+
+    /* Not pushed yet, the workers don't know them */
+    arrpt_foreach(task, app->incoming, i_Task)
+        if (task->data == data && task->state == i_ekSTATE_WAITING)
+        {
+            task->state = i_ekSTATE_CANCEL;
+            n += 1;
+        }
+    arrpt_end();
+
+    if (app->pool != NULL)
+    {
+        uint32_t i, j;
+        for (i = 0; i < app->pool->nworkers; ++i)
+        {
+            i_Worker *worker = &app->pool->workers[i];
+            bmutex_lock(worker->mutex);
+            for (j = 0; j < i_TASK_PRIOS; ++j)
+                n += i_queue_cancel(app->pool, &worker->queues[j], data, FALSE);
+            bmutex_unlock(worker->mutex);
+        }
+    }
+
+    return n;
 }
 
 /*---------------------------------------------------------------------------*/
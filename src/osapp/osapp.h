@@ -19,6 +19,10 @@ void osapp_finish(void);
 
 void osapp_task_imp(void *data, const real32_t updtime, FPtr_task_main func_task_main, FPtr_task_update func_task_update, FPtr_task_end func_task_end);
 
+void osapp_task_prio_imp(void *data, const real32_t updtime, const task_prio_t prio, FPtr_task_main func_task_main, FPtr_task_update func_task_update, FPtr_task_end func_task_end);
+
+uint32_t osapp_task_cancel(void *data);
+
 void osapp_menubar(Menu *menu, Window *window);
 
 void osapp_open_url(const char_t *url);
@@ -31,3 +35,10 @@ __END_C
     FUNC_CHECK_TASK_UPDATE(func_update, type),\
     FUNC_CHECK_TASK_END(func_end, type),\
     osapp_task_imp((void*)data, updtime, (FPtr_task_main)func_main, (FPtr_task_update)func_update, (FPtr_task_end)func_end))
+
+#define osapp_task_prio(data, updtime, prio, func_main, func_update, func_end, type)\
+    ((void)((type*)data == data),\
+    FUNC_CHECK_TASK_MAIN(func_main, type),\
+    FUNC_CHECK_TASK_UPDATE(func_update, type),\
+    FUNC_CHECK_TASK_END(func_end, type),\
+    osapp_task_prio_imp((void*)data, updtime, prio, (FPtr_task_main)func_main, (FPtr_task_update)func_update, (FPtr_task_end)func_end))
@@ -16,6 +16,13 @@
 
 #include "gui.hxx"
 
+typedef enum _task_prio_t
+{
+    ekTASK_LOW = 0,
+    ekTASK_NORMAL,
+    ekTASK_HIGH
+} task_prio_t;
+
 typedef uint32_t(*FPtr_task_main)(void *data);
 #define FUNC_CHECK_TASK_MAIN(func, type)\
     (void)((uint32_t(*)(type*))func == func)
@@ -53,7 +53,13 @@ bool_t bfile_seek(File *file, const int64_t offset, const file_seek_t whence, fe
 
 uint64_t bfile_pos(const File *file);
 
+byte_t *bfile_map(File *file, const uint64_t offset, const uint32_t size, const bool_t sequential, ferror_t *error);
+
+void bfile_unmap(byte_t **data, const uint32_t size);
+
 bool_t bfile_delete(const char_t *pathname, ferror_t *error);
 
+bool_t bfile_copy(const char_t *from, const char_t *to, ferror_t *error);
+
 __END_C
 
@@ -23,5 +23,13 @@ void bmutex_lock(Mutex *mutex);
 
 void bmutex_unlock(Mutex *mutex);
 
+Semaphore *bsem_create(const uint32_t count);
+
+void bsem_close(Semaphore **sem);
+
+void bsem_post(Semaphore *sem);
+
+bool_t bsem_wait(Semaphore *sem, const uint32_t timeout_ms);
+
 __END_C
 
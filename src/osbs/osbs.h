@@ -25,5 +25,7 @@ win_t osbs_windows(void);
 
 endian_t osbs_endian(void);
 
+uint32_t osbs_ncpus(void);
+
 __END_C
 
@@ -142,6 +142,7 @@ typedef struct _date_t Date;
 typedef struct _dir_t Dir;
 typedef struct _file_t File;
 typedef struct _mutex_t Mutex;
+typedef struct _semaphore_t Semaphore;
 typedef struct _process_t Proc;
 typedef struct _thread_t Thread;
 typedef struct _socket_t Socket;
@@ -20,6 +20,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -28,12 +29,17 @@
 
 #if defined (__MACOS__)
 #include <sys/syslimits.h>
+#include <copyfile.h>
 #endif
 
 #if defined (__LINUX__)
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <time.h>
 int lstat(const char *path, struct stat *buf);
+long syscall(long number, ...);
+struct tm *localtime_r(const time_t *timep, struct tm *result);
 
 #ifndef DTTOIF
 #define DTTOIF(dirtype) ((dirtype) << 12)
@@ -57,6 +63,19 @@ struct _dir_t
 
 /*---------------------------------------------------------------------------*/
 
+uint32_t bfile_dir_work(char_t *pathname, const uint32_t size)
+{
+    cassert_no_null(pathname);
+    cassert(size > 0);
+    if (getcwd((char*)pathname, (size_t)size) != NULL)
+        return (uint32_t)strlen((const char*)pathname) + 1;
+
+    pathname[0] = '\0';
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
 bool_t bfile_dir_create(const char_t *pathname, ferror_t *error)
 {
     int res = mkdir((const char*)pathname, (mode_t)(S_IRUSR | S_IWUSR | S_IXUSR));
@@ -208,9 +227,10 @@ static file_type_t i_file_type(const mode_t mode)
 
 static void i_file_date(time_t *rawtime, Date *date)
 {
-    /* Copy from btime_get_current_date() */
+    /* Copy from btime_get_current_date(). localtime() reloads the timezone on each call */
+    struct tm tinfo;
     struct tm *timeinfo;
-    timeinfo = localtime(rawtime);
+    timeinfo = localtime_r(rawtime, &tinfo);
     cassert_no_null(timeinfo);
     cassert_no_null(date);
     date->wday = (uint8_t)timeinfo->tm_wday;
@@ -607,6 +627,57 @@ uint64_t bfile_pos(const File *file)
 
 /*---------------------------------------------------------------------------*/
 
+byte_t *bfile_map(File *file, const uint64_t offset, const uint32_t size, const bool_t sequential, ferror_t *error)
+{
+    void *data = NULL;
+    cassert_no_null(file);
+    cassert(size > 0);
+    data = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, (int)(intptr_t)file, (off_t)offset);
+    if (data != MAP_FAILED)
+    {
+        #if defined (POSIX_MADV_SEQUENTIAL)
+        if (sequential == TRUE)
+            posix_madvise(data, (size_t)size, POSIX_MADV_SEQUENTIAL);
+        #else
+        unref(sequential);
+        #endif
+        ptr_assign(error, ekFOK);
+        return (byte_t*)data;
+    }
+    else
+    {
+        if (error != NULL)
+        {
+            switch (errno)
+            {
+                case EACCES:
+                    *error = ekFNOACCESS;
+                    break;
+                case ENOMEM:
+                case EOVERFLOW:
+                    *error = ekFBIG;
+                    break;
+                default:
+                    *error = ekFUNDEF;
+            }
+        }
+
+        return NULL;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void bfile_unmap(byte_t **data, const uint32_t size)
+{
+    cassert_no_null(data);
+    cassert_no_null(*data);
+    munmap((void*)*data, (size_t)size);
+    *data = NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+
 bool_t bfile_delete(const char_t *filepath, ferror_t *error)
 {
     int res = unlink((const char*)filepath);
@@ -644,3 +715,119 @@ bool_t bfile_delete(const char_t *filepath, ferror_t *error)
         return FALSE;
     }
 }
+
+/*---------------------------------------------------------------------------*/
+
+/* Copy inside the kernel, without user space buffers. Returns the copied bytes */
+static uint64_t i_kernel_copy(int fd1, int fd2, const uint64_t size)
+{
+    uint64_t copied = 0;
+#if defined (__LINUX__)
+    /* copy_file_range can reflink or copy server side. Old kernels: ENOSYS */
+#if defined (SYS_copy_file_range)
+    while (copied < size)
+    {
+        uint64_t n = size - copied;
+        long ret = syscall(SYS_copy_file_range, fd1, NULL, fd2, NULL, (size_t)(n < 0x40000000 ? n : 0x40000000), 0u);
+        if (ret <= 0)
+            break;
+        copied += (uint64_t)ret;
+    }
+#endif
+
+    /* Both file offsets have been moved, sendfile continues from there */
+    while (copied < size)
+    {
+        uint64_t n = size - copied;
+        ssize_t ret = sendfile(fd2, fd1, NULL, (size_t)(n < 0x40000000 ? n : 0x40000000));
+        if (ret <= 0)
+            break;
+        copied += (uint64_t)ret;
+    }
+
+#elif defined (__MACOS__)
+    if (fcopyfile(fd1, fd2, NULL, COPYFILE_DATA) == 0)
+    {
+        copied = size;
+    }
+    else
+    {
+        lseek(fd1, 0, SEEK_SET);
+        lseek(fd2, 0, SEEK_SET);
+    }
+
+#else
+    unref(fd1);
+    unref(fd2);
+    unref(size);
+#endif
+    return copied;
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool_t bfile_copy(const char_t *from, const char_t *to, ferror_t *error)
+{
+    File *file1 = NULL, *file2 = NULL;
+    uint64_t size = 0;
+    bool_t ok = FALSE;
+
+    file1 = bfile_open(from, ekREAD, error);
+    if (file1 == NULL)
+        return FALSE;
+
+    if (bfile_fstat(file1, NULL, &size, NULL, error) == TRUE)
+        file2 = bfile_create(to, error);
+
+    if (file2 != NULL)
+    {
+        int fd1 = (int)(intptr_t)file1;
+        int fd2 = (int)(intptr_t)file2;
+        uint64_t copied = i_kernel_copy(fd1, fd2, size);
+        ok = TRUE;
+
+        /* Not supported by the file systems. Through user space */
+        if (copied < size)
+        {
+            byte_t buffer[16384];
+            for (;;)
+            {
+                ssize_t rsize = read(fd1, (void*)buffer, sizeof(buffer));
+                ssize_t wsize = 0;
+                if (rsize == 0)
+                    break;
+
+                while (rsize > 0 && wsize < rsize)
+                {
+                    ssize_t n = write(fd2, (const void*)(buffer + wsize), (size_t)(rsize - wsize));
+                    if (n <= 0)
+                    {
+                        rsize = -1;
+                        break;
+                    }
+                    wsize += n;
+                }
+
+                if (rsize < 0)
+                {
+                    ok = FALSE;
+                    break;
+                }
+            }
+        }
+
+        if (ok == TRUE)
+        {
+            ptr_assign(error, ekFOK);
+        }
+        else
+        {
+            ptr_assign(error, ekFUNDEF);
+        }
+
+        bfile_close(&file2);
+    }
+
+    bfile_close(&file1);
+    return ok;
+}
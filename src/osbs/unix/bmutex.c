@@ -20,6 +20,17 @@
 #include "cassert.h"
 #include <stdlib.h>
 #include <pthread.h>
+#include <sys/time.h>
+
+/* macOS doesn't support unnamed POSIX semaphores */
+typedef struct i_sem_t i_Sem;
+
+struct i_sem_t
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t count;
+};
 
 /*---------------------------------------------------------------------------*/
 
@@ -72,3 +83,81 @@ void bmutex_unlock(Mutex *mutex)
 
 /*---------------------------------------------------------------------------*/
 
+Semaphore *bsem_create(const uint32_t count)
+{
+    i_Sem *sem;
+    int ret;
+    sem = (i_Sem*)malloc(sizeof(i_Sem));
+    ret = pthread_mutex_init(&sem->mutex, NULL);
+    cassert_unref(ret == 0, ret);
+    ret = pthread_cond_init(&sem->cond, NULL);
+    cassert_unref(ret == 0, ret);
+    sem->count = count;
+    _osbs_mutex_alloc();
+    return (Semaphore*)sem;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void bsem_close(Semaphore **sem)
+{
+    i_Sem *isem;
+    int ret;
+    cassert_no_null(sem);
+    cassert_no_null(*sem);
+    isem = *((i_Sem**)sem);
+    ret = pthread_cond_destroy(&isem->cond);
+    cassert_unref(ret == 0, ret);
+    ret = pthread_mutex_destroy(&isem->mutex);
+    cassert_unref(ret == 0, ret);
+    free(isem);
+    _osbs_mutex_dealloc();
+    *sem = NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void bsem_post(Semaphore *sem)
+{
+    i_Sem *isem = (i_Sem*)sem;
+    cassert_no_null(isem);
+    pthread_mutex_lock(&isem->mutex);
+    isem->count += 1;
+    pthread_cond_signal(&isem->cond);
+    pthread_mutex_unlock(&isem->mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool_t bsem_wait(Semaphore *sem, const uint32_t timeout_ms)
+{
+    i_Sem *isem = (i_Sem*)sem;
+    struct timespec limit;
+    bool_t ok = TRUE;
+    cassert_no_null(isem);
+    if (timeout_ms != UINT32_MAX)
+    {
+        struct timeval now;
+        uint64_t nsec;
+        gettimeofday(&now, NULL);
+        nsec = (uint64_t)now.tv_usec * 1000 + (uint64_t)(timeout_ms % 1000) * 1000000;
+        limit.tv_sec = now.tv_sec + (time_t)(timeout_ms / 1000) + (time_t)(nsec / 1000000000);
+        limit.tv_nsec = (long)(nsec % 1000000000);
+    }
+
+    pthread_mutex_lock(&isem->mutex);
+    while (isem->count == 0 && ok == TRUE)
+    {
+        if (timeout_ms == UINT32_MAX)
+            pthread_cond_wait(&isem->cond, &isem->mutex);
+        else if (pthread_cond_timedwait(&isem->cond, &isem->mutex, &limit) != 0)
+            ok = (bool_t)(isem->count > 0);
+    }
+
+    if (ok == TRUE)
+        isem->count -= 1;
+    pthread_mutex_unlock(&isem->mutex);
+    return ok;
+}
+
+/*---------------------------------------------------------------------------*/
@@ -17,6 +17,7 @@
 #endif
 
 #include "cassert.h"
+#include <unistd.h>
 
 static endian_t i_ENDIANNESS = ENUM_MAX(endian_t);
 union i_check_endianness {unsigned char bytes[4]; uint32_t value;};
@@ -63,4 +64,10 @@ endian_t osbs_endian(void)
     return i_ENDIANNESS;
 }
 
+/*---------------------------------------------------------------------------*/
 
+uint32_t osbs_ncpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t)n : 1;
+}
@@ -682,6 +682,46 @@ uint64_t bfile_pos(const File *file)
 
 /*---------------------------------------------------------------------------*/
 
+byte_t *bfile_map(File *file, const uint64_t offset, const uint32_t size, const bool_t sequential, ferror_t *error)
+{
+    HANDLE mapping = NULL;
+    LPVOID data = NULL;
+    cassert_no_null(file);
+    cassert(size > 0);
+    unref(sequential);
+    mapping = CreateFileMapping((HANDLE)file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping != NULL)
+    {
+        /* The view keeps the mapping object alive */
+        data = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)(offset & 0xFFFFFFFF), (SIZE_T)size);
+        CloseHandle(mapping);
+    }
+
+    if (data != NULL)
+    {
+        ptr_assign(error, ekFOK);
+        return (byte_t*)data;
+    }
+    else
+    {
+        i_file_error(error);
+        return NULL;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void bfile_unmap(byte_t **data, const uint32_t size)
+{
+    cassert_no_null(data);
+    cassert_no_null(*data);
+    unref(size);
+    UnmapViewOfFile((LPCVOID)*data);
+    *data = NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+
 bool_t bfile_delete(const char_t *pathname, ferror_t *error)
 {
     WCHAR pathnamew[MAX_PATH + 1];
@@ -705,3 +745,32 @@ bool_t bfile_delete(const char_t *pathname, ferror_t *error)
         return FALSE;
     }
 }
+
+/*---------------------------------------------------------------------------*/
+
+bool_t bfile_copy(const char_t *from, const char_t *to, ferror_t *error)
+{
+    WCHAR fromw[MAX_PATH + 1];
+    WCHAR tow[MAX_PATH + 1];
+    uint32_t num_bytes1 = unicode_convers(from, (char_t*)fromw, ekUTF8, ekUTF16, sizeof(fromw));
+    uint32_t num_bytes2 = unicode_convers(to, (char_t*)tow, ekUTF8, ekUTF16, sizeof(tow));
+    if (num_bytes1 < sizeof(fromw) && num_bytes2 < sizeof(tow))
+    {
+        /* The system copies in kernel, or server side in network volumes */
+        if (CopyFile(fromw, tow, FALSE) != 0)
+        {
+            ptr_assign(error, ekFOK);
+            return TRUE;
+        }
+        else
+        {
+            i_file_error(error);
+            return FALSE;
+        }
+    }
+    else
+    {
+        ptr_assign(error, ekFBIGNAME);
+        return FALSE;
+    }
+}
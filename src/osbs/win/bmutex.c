@@ -65,3 +65,46 @@ void bmutex_unlock(Mutex *mutex)
     cassert(ok != 0);
 }
 
+/*---------------------------------------------------------------------------*/
+
+Semaphore *bsem_create(const uint32_t count)
+{
+    HANDLE sem = CreateSemaphore(NULL, (LONG)count, 0x7FFFFFFF, NULL);
+    cassert_no_null(sem);
+    _osbs_mutex_alloc();
+    return (Semaphore*)sem;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void bsem_close(Semaphore **sem)
+{
+    BOOL ok;
+    cassert_no_null(sem);
+    cassert_no_null(*sem);
+    ok = CloseHandle((HANDLE)*sem);
+    cassert(ok != 0);
+    _osbs_mutex_dealloc();
+    *sem = NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void bsem_post(Semaphore *sem)
+{
+    BOOL ok = FALSE;
+    cassert_no_null(sem);
+    ok = ReleaseSemaphore((HANDLE)sem, 1, NULL);
+    cassert(ok != 0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool_t bsem_wait(Semaphore *sem, const uint32_t timeout_ms)
+{
+    DWORD dwWaitResult = 0;
+    cassert_no_null(sem);
+    dwWaitResult = WaitForSingleObject((HANDLE)sem, timeout_ms == UINT32_MAX ? INFINITE : (DWORD)timeout_ms);
+    cassert(dwWaitResult == WAIT_OBJECT_0 || dwWaitResult == WAIT_TIMEOUT);
+    return (bool_t)(dwWaitResult == WAIT_OBJECT_0);
+}
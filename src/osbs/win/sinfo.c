@@ -162,3 +162,12 @@ endian_t osbs_endian(void)
 
     return i_ENDIANNESS;
 }
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t osbs_ncpus(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (uint32_t)info.dwNumberOfProcessors : 1;
+}
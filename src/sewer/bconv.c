@@ -0,0 +1,611 @@
+/*
+ * NAppGUI Cross-platform C SDK
+ * 2015-2022 Francisco Garcia Collado
+ * MIT Licence
+ * https://nappgui.com/en/legal/license.html
+ *
+ * File: bconv.c
+ *
+ */
+
+/* Fast decimal <-> binary floating point conversion */
+
+#include "bconv.inl"
+#include "blib.inl"
+#include "cassert.h"
+#include "ptr.h"
+
+#include "nowarn.hxx"
+#include <float.h>
+#include "warn.hxx"
+
+#include "bconvtab.inl"
+
+typedef union _bits_t i_bits;
+
+union _bits_t
+{
+    real64_t d;
+    uint64_t u;
+};
+
+#if defined (__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 i_uint128;
+#endif
+
+#define i_MANTISSA_BITS     52
+#define i_EXPONENT_BIAS     1023
+#define i_POW5_BITCOUNT     125
+#define i_POW5_INV_BITCOUNT 125
+
+static const real64_t i_POW10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint64_t i_umul128(const uint64_t a, const uint64_t b, uint64_t *hi)
+{
+#if defined (__SIZEOF_INT128__)
+    i_uint128 r = (i_uint128)a * (i_uint128)b;
+    *hi = (uint64_t)(r >> 64);
+    return (uint64_t)r;
+#else
+    uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+    uint64_t p0 = a_lo * b_lo;
+    uint64_t p1 = a_lo * b_hi;
+    uint64_t p2 = a_hi * b_lo;
+    uint64_t p3 = a_hi * b_hi;
+    uint64_t mid = (p0 >> 32) + (p1 & 0xFFFFFFFF) + (p2 & 0xFFFFFFFF);
+    *hi = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+    return (mid << 32) | (p0 & 0xFFFFFFFF);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint32_t i_clz64(uint64_t v)
+{
+    cassert(v != 0);
+#if defined (__GNUC__)
+    return (uint32_t)__builtin_clzll(v);
+#else
+    {
+        uint32_t n = 0;
+        if ((v >> 32) == 0) { n += 32; v <<= 32; }
+        if ((v >> 48) == 0) { n += 16; v <<= 16; }
+        if ((v >> 56) == 0) { n += 8; v <<= 8; }
+        if ((v >> 60) == 0) { n += 4; v <<= 4; }
+        if ((v >> 62) == 0) { n += 2; v <<= 2; }
+        if ((v >> 63) == 0) { n += 1; }
+        return n;
+    }
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * Eisel-Lemire: w * 10^q rounded to nearest-even, w != 0.
+ * Returns FALSE if the result is subnormal, out of range or can't be decided
+ * with 128 bits of precision. The caller then falls back to the libc.
+ */
+static bool_t i_eisel_lemire(const uint64_t w, const int32_t q, uint64_t *bits)
+{
+    uint64_t wn, hi, lo, upperbit, mantissa;
+    uint32_t lz;
+    int32_t power2;
+    const uint64_t *pow5;
+
+    if (q < -342 || q > 308)
+        return FALSE;
+
+    lz = i_clz64(w);
+    wn = w << lz;
+    pow5 = i_POW5_128[q + 342];
+    lo = i_umul128(wn, pow5[0], &hi);
+
+    /* The lower bits of 'hi' are all ones: refine with the next 64 bits */
+    if ((hi & 0x1FF) == 0x1FF)
+    {
+        uint64_t hi2;
+        i_umul128(wn, pow5[1], &hi2);
+        lo += hi2;
+        if (hi2 > lo)
+            hi += 1;
+    }
+
+    if (lo == 0xFFFFFFFFFFFFFFFF && (q < -27 || q > 55))
+        return FALSE;
+
+    upperbit = hi >> 63;
+    mantissa = hi >> (upperbit + 64 - i_MANTISSA_BITS - 3);
+    power2 = (((152170 + 65536) * q) >> 16) + 63 + (int32_t)upperbit - (int32_t)lz + i_EXPONENT_BIAS;
+
+    if (power2 <= 0)
+        return FALSE;
+
+    /* Exactly halfway between two doubles: round to even */
+    if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1)
+    {
+        if ((mantissa << (upperbit + 64 - i_MANTISSA_BITS - 3)) == hi)
+            mantissa &= ~(uint64_t)1;
+    }
+
+    mantissa += (mantissa & 1);
+    mantissa >>= 1;
+    if (mantissa >= ((uint64_t)2 << i_MANTISSA_BITS))
+    {
+        mantissa = (uint64_t)1 << i_MANTISSA_BITS;
+        power2 += 1;
+    }
+
+    mantissa &= ~((uint64_t)1 << i_MANTISSA_BITS);
+    if (power2 >= 0x7FF)
+        return FALSE;
+
+    *bits = mantissa | ((uint64_t)power2 << i_MANTISSA_BITS);
+    return TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+real64_t bconv_strtod(const char_t *str, char_t **endptr, bool_t *err)
+{
+    register const char_t *p = str;
+    bool_t neg = FALSE;
+    bool_t any = FALSE;
+    uint64_t w = 0;
+    uint32_t ndigits = 0;
+    int32_t exp10 = 0;
+    i_bits value;
+
+    cassert_no_null(str);
+    while (*p == ' ' || (*p >= '\t' && *p <= '\r'))
+        p += 1;
+
+    if (*p == '-')
+    {
+        neg = TRUE;
+        p += 1;
+    }
+    else if (*p == '+')
+    {
+        p += 1;
+    }
+
+    /* Hexadecimal floats */
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        return blib_strtod(str, endptr, err);
+
+    /* More than 19 significant digits doesn't fit in 'w' */
+    for (; *p >= '0' && *p <= '9'; ++p)
+    {
+        any = TRUE;
+        if (w != 0 || *p != '0')
+        {
+            if (ndigits == 19)
+                return blib_strtod(str, endptr, err);
+            w = w * 10 + (uint64_t)(*p - '0');
+            ndigits += 1;
+        }
+    }
+
+    if (*p == '.')
+    {
+        for (++p; *p >= '0' && *p <= '9'; ++p)
+        {
+            any = TRUE;
+            if (w != 0 || *p != '0')
+            {
+                if (ndigits == 19)
+                    return blib_strtod(str, endptr, err);
+                w = w * 10 + (uint64_t)(*p - '0');
+                ndigits += 1;
+            }
+            exp10 -= 1;
+        }
+    }
+
+    /* inf, nan, hex floats or no number at all */
+    if (any == FALSE)
+        return blib_strtod(str, endptr, err);
+
+    if (*p == 'e' || *p == 'E')
+    {
+        register const char_t *e = p + 1;
+        bool_t eneg = FALSE;
+        int32_t ev = 0;
+
+        if (*e == '-')
+        {
+            eneg = TRUE;
+            e += 1;
+        }
+        else if (*e == '+')
+        {
+            e += 1;
+        }
+
+        if (*e >= '0' && *e <= '9')
+        {
+            for (; *e >= '0' && *e <= '9'; ++e)
+            {
+                if (ev < 100000)
+                    ev = ev * 10 + (int32_t)(*e - '0');
+            }
+
+            exp10 += eneg == TRUE ? -ev : ev;
+            p = e;
+        }
+    }
+
+    if (w == 0)
+    {
+        ptr_assign(endptr, (char_t*)p);
+        ptr_assign(err, FALSE);
+        return neg == TRUE ? -0.0 : 0.0;
+    }
+
+#if defined (FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    /* Clinger: both operands are exact doubles, so one IEEE operation is correctly rounded */
+    if (w <= ((uint64_t)1 << 53) && exp10 >= -22 && exp10 <= 22)
+    {
+        value.d = (real64_t)w;
+        if (exp10 < 0)
+            value.d /= i_POW10[-exp10];
+        else
+            value.d *= i_POW10[exp10];
+
+        ptr_assign(endptr, (char_t*)p);
+        ptr_assign(err, FALSE);
+        return neg == TRUE ? -value.d : value.d;
+    }
+#endif
+
+    if (i_eisel_lemire(w, exp10, &value.u) == TRUE)
+    {
+        ptr_assign(endptr, (char_t*)p);
+        ptr_assign(err, FALSE);
+        return neg == TRUE ? -value.d : value.d;
+    }
+
+    return blib_strtod(str, endptr, err);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint32_t i_pow5bits(const int32_t e)
+{
+    return (uint32_t)((((uint32_t)e) * 1217359) >> 19) + 1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint32_t i_log10_pow2(const int32_t e)
+{
+    return (((uint32_t)e) * 78913) >> 18;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint32_t i_log10_pow5(const int32_t e)
+{
+    return (((uint32_t)e) * 732923) >> 20;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE bool_t i_multiple_pow5(uint64_t v, const uint32_t p)
+{
+    uint32_t count = 0;
+    cassert(v != 0);
+    while (v % 5 == 0)
+    {
+        v /= 5;
+        count += 1;
+    }
+    return (bool_t)(count >= p);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE bool_t i_multiple_pow2(const uint64_t v, const uint32_t p)
+{
+    cassert(p < 64);
+    return (bool_t)((v & (((uint64_t)1 << p) - 1)) == 0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* (m * mul) >> j, with 'mul' a {low, high} 128-bit factor and 64 < j < 128 */
+static __INLINE uint64_t i_mul_shift64(const uint64_t m, const uint64_t *mul, const int32_t j)
+{
+    uint64_t high0, high1, sum;
+    uint64_t low1 = i_umul128(m, mul[1], &high1);
+    i_umul128(m, mul[0], &high0);
+    sum = high0 + low1;
+    if (sum < high0)
+        high1 += 1;
+    cassert(j > 64 && j < 128);
+    return (high1 << (128 - j)) | (sum >> (j - 64));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Ryu: shortest decimal 'digits' * 10^'exponent' that round-trips to the double */
+static void i_shortest(const uint64_t ieee_mantissa, const uint32_t ieee_exponent, uint64_t *digits, int32_t *exponent)
+{
+    int32_t e2, e10;
+    uint64_t m2, mv, vr, vp, vm, output;
+    uint32_t mm_shift, removed = 0;
+    bool_t accept_bounds;
+    bool_t vm_trailing_zeros = FALSE;
+    bool_t vr_trailing_zeros = FALSE;
+    uint8_t last_removed = 0;
+
+    if (ieee_exponent == 0)
+    {
+        e2 = 1 - i_EXPONENT_BIAS - i_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    }
+    else
+    {
+        e2 = (int32_t)ieee_exponent - i_EXPONENT_BIAS - i_MANTISSA_BITS - 2;
+        m2 = ((uint64_t)1 << i_MANTISSA_BITS) | ieee_mantissa;
+    }
+
+    accept_bounds = (bool_t)((m2 & 1) == 0);
+    mv = 4 * m2;
+    mm_shift = (ieee_mantissa != 0 || ieee_exponent <= 1) ? 1 : 0;
+
+    if (e2 >= 0)
+    {
+        uint32_t q = i_log10_pow2(e2) - (e2 > 3 ? 1 : 0);
+        int32_t k = i_POW5_INV_BITCOUNT + (int32_t)i_pow5bits((int32_t)q) - 1;
+        int32_t i = -e2 + (int32_t)q + k;
+        e10 = (int32_t)q;
+        vr = i_mul_shift64(4 * m2, i_POW5_INV_SPLIT[q], i);
+        vp = i_mul_shift64(4 * m2 + 2, i_POW5_INV_SPLIT[q], i);
+        vm = i_mul_shift64(4 * m2 - 1 - mm_shift, i_POW5_INV_SPLIT[q], i);
+        if (q <= 21)
+        {
+            if (mv % 5 == 0)
+                vr_trailing_zeros = i_multiple_pow5(mv, q);
+            else if (accept_bounds == TRUE)
+                vm_trailing_zeros = i_multiple_pow5(mv - 1 - mm_shift, q);
+            else
+                vp -= i_multiple_pow5(mv + 2, q) == TRUE ? 1 : 0;
+        }
+    }
+    else
+    {
+        uint32_t q = i_log10_pow5(-e2) - (-e2 > 1 ? 1 : 0);
+        int32_t i = -e2 - (int32_t)q;
+        int32_t k = (int32_t)i_pow5bits(i) - i_POW5_BITCOUNT;
+        int32_t j = (int32_t)q - k;
+        e10 = (int32_t)q + e2;
+        vr = i_mul_shift64(4 * m2, i_POW5_SPLIT[i], j);
+        vp = i_mul_shift64(4 * m2 + 2, i_POW5_SPLIT[i], j);
+        vm = i_mul_shift64(4 * m2 - 1 - mm_shift, i_POW5_SPLIT[i], j);
+        if (q <= 1)
+        {
+            vr_trailing_zeros = TRUE;
+            if (accept_bounds == TRUE)
+                vm_trailing_zeros = (bool_t)(mm_shift == 1);
+            else
+                vp -= 1;
+        }
+        else if (q < 63)
+        {
+            vr_trailing_zeros = i_multiple_pow2(mv, q);
+        }
+    }
+
+    if (vm_trailing_zeros == TRUE || vr_trailing_zeros == TRUE)
+    {
+        /* General case, rare */
+        while (vp / 10 > vm / 10)
+        {
+            vm_trailing_zeros &= (bool_t)(vm % 10 == 0);
+            vr_trailing_zeros &= (bool_t)(last_removed == 0);
+            last_removed = (uint8_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed += 1;
+        }
+
+        if (vm_trailing_zeros == TRUE)
+        {
+            while (vm % 10 == 0)
+            {
+                vr_trailing_zeros &= (bool_t)(last_removed == 0);
+                last_removed = (uint8_t)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed += 1;
+            }
+        }
+
+        /* Exactly halfway: round to even */
+        if (vr_trailing_zeros == TRUE && last_removed == 5 && vr % 2 == 0)
+            last_removed = 4;
+
+        output = vr;
+        if ((vr == vm && (accept_bounds == FALSE || vm_trailing_zeros == FALSE)) || last_removed >= 5)
+            output += 1;
+    }
+    else
+    {
+        /* Common case */
+        bool_t round_up = FALSE;
+        if (vp / 100 > vm / 100)
+        {
+            round_up = (bool_t)(vr % 100 >= 50);
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+
+        while (vp / 10 > vm / 10)
+        {
+            round_up = (bool_t)(vr % 10 >= 5);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed += 1;
+        }
+
+        output = vr;
+        if (vr == vm || round_up == TRUE)
+            output += 1;
+    }
+
+    *digits = output;
+    *exponent = e10 + (int32_t)removed;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Integers in [1, 2^53) don't need Ryu */
+static bool_t i_small_int(const uint64_t ieee_mantissa, const uint32_t ieee_exponent, uint64_t *digits, int32_t *exponent)
+{
+    uint64_t m2 = ((uint64_t)1 << i_MANTISSA_BITS) | ieee_mantissa;
+    int32_t e2 = (int32_t)ieee_exponent - i_EXPONENT_BIAS - i_MANTISSA_BITS;
+    uint64_t mask;
+
+    if (e2 > 0 || e2 < -52)
+        return FALSE;
+
+    mask = ((uint64_t)1 << -e2) - 1;
+    if ((m2 & mask) != 0)
+        return FALSE;
+
+    *digits = m2 >> -e2;
+    *exponent = 0;
+    while (*digits % 10 == 0)
+    {
+        *digits /= 10;
+        *exponent += 1;
+    }
+
+    return TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Fixed notation for decimal point positions in (-6, 21], scientific otherwise */
+static uint32_t i_format(uint64_t digits, const int32_t exponent, char_t *dest)
+{
+    char_t rdigits[20];
+    uint32_t ndigits = 0, n = 0, i;
+    int32_t dp;
+
+    do
+    {
+        rdigits[ndigits++] = (char_t)('0' + (digits % 10));
+        digits /= 10;
+    } while (digits != 0);
+
+    dp = (int32_t)ndigits + exponent;
+
+    if (dp > 0 && dp <= 21)
+    {
+        for (i = 0; i < ndigits; ++i)
+        {
+            if ((int32_t)i == dp)
+                dest[n++] = '.';
+            dest[n++] = rdigits[ndigits - 1 - i];
+        }
+
+        for (; (int32_t)i < dp; ++i)
+            dest[n++] = '0';
+    }
+    else if (dp <= 0 && dp > -6)
+    {
+        dest[n++] = '0';
+        dest[n++] = '.';
+        for (i = 0; (int32_t)i < -dp; ++i)
+            dest[n++] = '0';
+        for (i = 0; i < ndigits; ++i)
+            dest[n++] = rdigits[ndigits - 1 - i];
+    }
+    else
+    {
+        uint32_t e = (uint32_t)(dp > 0 ? dp - 1 : 1 - dp);
+        dest[n++] = rdigits[ndigits - 1];
+        if (ndigits > 1)
+        {
+            dest[n++] = '.';
+            for (i = 1; i < ndigits; ++i)
+                dest[n++] = rdigits[ndigits - 1 - i];
+        }
+
+        dest[n++] = 'e';
+        dest[n++] = dp > 0 ? '+' : '-';
+        if (e >= 100)
+            dest[n++] = (char_t)('0' + e / 100);
+        if (e >= 10)
+            dest[n++] = (char_t)('0' + (e / 10) % 10);
+        dest[n++] = (char_t)('0' + e % 10);
+    }
+
+    return n;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t bconv_dtoa(const real64_t value, char_t *dest, const uint32_t size)
+{
+    char_t str[BCONV_DTOA_SIZE];
+    uint32_t n = 0;
+    uint64_t ieee_mantissa;
+    uint32_t ieee_exponent;
+    i_bits bits;
+
+    cassert_no_null(dest);
+    cassert(size > 0);
+    bits.d = value;
+    ieee_mantissa = bits.u & (((uint64_t)1 << i_MANTISSA_BITS) - 1);
+    ieee_exponent = (uint32_t)((bits.u >> i_MANTISSA_BITS) & 0x7FF);
+
+    if ((bits.u >> 63) != 0 && (ieee_exponent != 0x7FF || ieee_mantissa == 0))
+        str[n++] = '-';
+
+    if (ieee_exponent == 0x7FF)
+    {
+        const char_t *sp = ieee_mantissa != 0 ? "nan" : "inf";
+        str[n++] = sp[0];
+        str[n++] = sp[1];
+        str[n++] = sp[2];
+    }
+    else if (ieee_exponent == 0 && ieee_mantissa == 0)
+    {
+        str[n++] = '0';
+    }
+    else
+    {
+        uint64_t digits;
+        int32_t exponent;
+        if (i_small_int(ieee_mantissa, ieee_exponent, &digits, &exponent) == FALSE)
+            i_shortest(ieee_mantissa, ieee_exponent, &digits, &exponent);
+        n += i_format(digits, exponent, str + n);
+    }
+
+    cassert(n < BCONV_DTOA_SIZE);
+    if (n >= size)
+        n = size - 1;
+
+    {
+        register uint32_t i;
+        for (i = 0; i < n; ++i)
+            dest[i] = str[i];
+        dest[n] = '\0';
+    }
+
+    return n;
+}
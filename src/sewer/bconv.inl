@@ -0,0 +1,23 @@
+/*
+ * NAppGUI Cross-platform C SDK
+ * 2015-2022 Francisco Garcia Collado
+ * MIT Licence
+ * https://nappgui.com/en/legal/license.html
+ *
+ * File: bconv.inl
+ *
+ */
+
+/* Fast decimal <-> binary floating point conversion */
+
+#include "sewer.hxx"
+
+__EXTERN_C
+
+real64_t bconv_strtod(const char_t *str, char_t **endptr, bool_t *err);
+
+uint32_t bconv_dtoa(const real64_t value, char_t *dest, const uint32_t size);
+
+__END_C
+
+#define BCONV_DTOA_SIZE     32
@@ -0,0 +1,981 @@
+/*
+ * NAppGUI Cross-platform C SDK
+ * 2015-2022 Francisco Garcia Collado
+ * MIT Licence
+ * https://nappgui.com/en/legal/license.html
+ *
+ * File: bsimd.c
+ *
+ */
+
+/* Vectorized byte-string primitives (SSE2/AVX2 with runtime dispatch) */
+
+#include "bsimd.inl"
+#include "cassert.h"
+
+#if defined (__x64__) || (defined (__x86__) && (defined (__SSE2__) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)))
+#define i_SSE2
+#endif
+
+#if defined (i_SSE2)
+    #if defined (_MSC_VER) && _MSC_VER >= 1700
+        #define i_AVX2
+        #define i_AVX2_FUNC
+    #elif defined (__clang__) || (defined (__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+        #define i_AVX2
+        #define i_AVX2_FUNC         __attribute__((__target__("avx2")))
+    #endif
+#endif
+
+#include "nowarn.hxx"
+#if defined (i_SSE2)
+#include <emmintrin.h>
+#if defined (_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+#if defined (i_AVX2)
+#include <immintrin.h>
+#endif
+#include "warn.hxx"
+
+/*---------------------------------------------------------------------------*/
+
+#if defined (i_AVX2)
+
+static int i_AVX2_STATE = -1;
+
+/*---------------------------------------------------------------------------*/
+
+static bool_t i_cpu_avx2(void)
+{
+#if defined (_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+        return FALSE;
+
+    /* OSXSAVE + AVX and the OS saves YMM state */
+    __cpuid(regs, 1);
+    if ((regs[2] & (1 << 27)) == 0 || (regs[2] & (1 << 28)) == 0)
+        return FALSE;
+
+    if ((_xgetbv(0) & 6) != 6)
+        return FALSE;
+
+    __cpuidex(regs, 7, 0);
+    return (bool_t)((regs[1] & (1 << 5)) != 0);
+#else
+    __builtin_cpu_init();
+    return (bool_t)(__builtin_cpu_supports("avx2") != 0);
+#endif
+}
+
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+bool_t bsimd_avx2(void)
+{
+#if defined (i_AVX2)
+    /* Benign race: every thread computes the same value */
+    if (i_AVX2_STATE == -1)
+        i_AVX2_STATE = i_cpu_avx2() == TRUE ? 1 : 0;
+    return (bool_t)(i_AVX2_STATE == 1);
+#else
+    return FALSE;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Index of the lowest set bit. 'mask' is never 0 */
+static __INLINE uint32_t i_ctz(const uint32_t mask)
+{
+#if defined (_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, (unsigned long)mask);
+    return (uint32_t)index;
+#elif defined (__GNUC__) || defined (__clang__)
+    return (uint32_t)__builtin_ctz(mask);
+#else
+    uint32_t i = 0;
+    while ((mask & (1u << i)) == 0)
+        i += 1;
+    return i;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * Json structural index (stage one of a two-stage parser). Each 64 byte
+ * block is reduced to bitmasks (quotes, backslashes, operators {}[]:, and
+ * whitespace). Then, with bit arithmetic: escaped quotes are removed, the
+ * in-string mask is the prefix-xor of quotes, and the index gets operators
+ * outside strings, opening quotes and the first byte of each scalar.
+ */
+typedef struct i_jstate_t i_JState;
+
+struct i_jstate_t
+{
+    uint64_t escaped;
+    uint64_t instring;
+    uint64_t scalar;
+};
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint64_t i_json_escaped(uint64_t bslash, i_JState *state)
+{
+    uint64_t escaped = state->escaped;
+    state->escaped = 0;
+
+    /* An escaped backslash does not escape */
+    bslash &= ~escaped;
+    while (bslash != 0)
+    {
+        uint32_t lo = (uint32_t)bslash;
+        uint32_t i = lo != 0 ? i_ctz(lo) : 32 + i_ctz((uint32_t)(bslash >> 32));
+        if (i == 63)
+        {
+            state->escaped = 1;
+            break;
+        }
+
+        escaped |= (uint64_t)1 << (i + 1);
+        bslash &= ~((uint64_t)3 << i);
+    }
+
+    return escaped;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint64_t i_prefix_xor(uint64_t mask)
+{
+    mask ^= mask << 1;
+    mask ^= mask << 2;
+    mask ^= mask << 4;
+    mask ^= mask << 8;
+    mask ^= mask << 16;
+    mask ^= mask << 32;
+    return mask;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE uint32_t i_json_block(uint64_t quote, const uint64_t bslash, const uint64_t op, const uint64_t ws, const uint32_t base, i_JState *state, uint32_t *index)
+{
+    uint64_t instring, scalar, starts, structural;
+    uint32_t n = 0, lo, hi;
+
+    if (bslash != 0 || state->escaped != 0)
+        quote &= ~i_json_escaped(bslash, state);
+
+    /* Includes the opening quote, excludes the closing one */
+    instring = i_prefix_xor(quote) ^ state->instring;
+    state->instring = (uint64_t)0 - (instring >> 63);
+
+    scalar = ~(op | ws | quote);
+    starts = scalar & ~((scalar << 1) | state->scalar);
+    state->scalar = scalar >> 63;
+
+    structural = (op | quote | starts) & ~(instring ^ quote);
+
+    lo = (uint32_t)structural;
+    hi = (uint32_t)(structural >> 32);
+    while (lo != 0)
+    {
+        index[n++] = base + i_ctz(lo);
+        lo &= lo - 1;
+    }
+
+    while (hi != 0)
+    {
+        index[n++] = base + 32 + i_ctz(hi);
+        hi &= hi - 1;
+    }
+
+    return n;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_json_masks(const char_t *data, uint64_t *quote, uint64_t *bslash, uint64_t *op, uint64_t *ws)
+{
+    uint32_t i;
+    *quote = 0;
+    *bslash = 0;
+    *op = 0;
+    *ws = 0;
+    for (i = 0; i < 64; ++i)
+    {
+        uint64_t bit = (uint64_t)1 << i;
+        switch (data[i]) {
+        case '"':
+            *quote |= bit;
+            break;
+        case '\\':
+            *bslash |= bit;
+            break;
+        case '{':
+        case '}':
+        case '[':
+        case ']':
+        case ':':
+        case ',':
+            *op |= bit;
+            break;
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+            *ws |= bit;
+            break;
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+#if defined (i_SSE2)
+
+static __INLINE void i_json_masks_sse2(const char_t *data, uint64_t *quote, uint64_t *bslash, uint64_t *op, uint64_t *ws)
+{
+    uint32_t i;
+    *quote = 0;
+    *bslash = 0;
+    *op = 0;
+    *ws = 0;
+    for (i = 0; i < 4; ++i)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i * 16));
+        /* '[' | 0x20 = '{' and ']' | 0x20 = '}' */
+        __m128i l = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i o = _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(l, _mm_set1_epi8('{')), _mm_cmpeq_epi8(l, _mm_set1_epi8('}'))),
+                        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')), _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+        __m128i w = _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+        uint32_t shift = i * 16;
+        *quote |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << shift;
+        *bslash |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << shift;
+        *op |= (uint64_t)(uint32_t)_mm_movemask_epi8(o) << shift;
+        *ws |= (uint64_t)(uint32_t)_mm_movemask_epi8(w) << shift;
+    }
+}
+
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+#if defined (i_AVX2)
+
+i_AVX2_FUNC static uint32_t i_case_avx2(char_t *dest, const char_t *src, const uint32_t size, const char_t first, const char_t last)
+{
+    uint32_t i = 0;
+    __m256i lo = _mm256_set1_epi8((char)(first - 1));
+    __m256i hi = _mm256_set1_epi8((char)(last + 1));
+    __m256i bit = _mm256_set1_epi8(0x20);
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i m = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+        v = _mm256_xor_si256(v, _mm256_and_si256(m, bit));
+        _mm256_storeu_si256((__m256i*)(dest + i), v);
+    }
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+i_AVX2_FUNC static uint32_t i_subs_avx2(char_t *str, const uint32_t size, const char_t replace, const char_t with)
+{
+    uint32_t i = 0;
+    __m256i r = _mm256_set1_epi8(replace);
+    __m256i w = _mm256_set1_epi8(with);
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(str + i));
+        __m256i m = _mm256_cmpeq_epi8(v, r);
+        if (_mm256_movemask_epi8(m) != 0)
+            _mm256_storeu_si256((__m256i*)(str + i), _mm256_blendv_epi8(v, w, m));
+    }
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+i_AVX2_FUNC static uint32_t i_equ_nocase_avx2(const char_t *str1, const char_t *str2, const uint32_t size, bool_t *equal)
+{
+    uint32_t i = 0;
+    __m256i lo = _mm256_set1_epi8('A' - 1);
+    __m256i hi = _mm256_set1_epi8('Z' + 1);
+    __m256i bit = _mm256_set1_epi8(0x20);
+    *equal = TRUE;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)(str1 + i));
+        __m256i v2 = _mm256_loadu_si256((const __m256i*)(str2 + i));
+        __m256i m1 = _mm256_and_si256(_mm256_cmpgt_epi8(v1, lo), _mm256_cmpgt_epi8(hi, v1));
+        __m256i m2 = _mm256_and_si256(_mm256_cmpgt_epi8(v2, lo), _mm256_cmpgt_epi8(hi, v2));
+        v1 = _mm256_or_si256(v1, _mm256_and_si256(m1, bit));
+        v2 = _mm256_or_si256(v2, _mm256_and_si256(m2, bit));
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, v2)) != 0xFFFFFFFF)
+        {
+            *equal = FALSE;
+            break;
+        }
+    }
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+i_AVX2_FUNC static uint32_t i_ascii_avx2(const char_t *str, const uint32_t size, const char_t stop, bool_t *found)
+{
+    uint32_t i = 0;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i s = _mm256_set1_epi8(stop);
+    *found = FALSE;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(str + i));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, zero), _mm256_cmpeq_epi8(v, s));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(v, m));
+        if (mask != 0)
+        {
+            *found = TRUE;
+            return i + i_ctz(mask);
+        }
+    }
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+i_AVX2_FUNC static uint32_t i_utf8_nchars_avx2(const char_t *str, const uint32_t size, uint32_t *count)
+{
+    uint32_t i = 0;
+    uint32_t total = 0;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i cont = _mm256_set1_epi8((char)0xBF);
+    while (i + 32 <= size)
+    {
+        /* Byte counters overflow after 255 iterations */
+        __m256i acc = zero;
+        uint32_t n = 0;
+        __m128i sum;
+        for (; n < 255 && i + 32 <= size; ++n, i += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(str + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(v, cont));
+        }
+
+        acc = _mm256_sad_epu8(acc, zero);
+        sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        total += (uint32_t)_mm_cvtsi128_si32(sum) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+    }
+
+    *count = total;
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+i_AVX2_FUNC static __INLINE uint64_t i_mask_avx2(const __m256i lo, const __m256i hi)
+{
+    return (uint64_t)(uint32_t)_mm256_movemask_epi8(lo) | ((uint64_t)(uint32_t)_mm256_movemask_epi8(hi) << 32);
+}
+
+/*---------------------------------------------------------------------------*/
+
+i_AVX2_FUNC static uint32_t i_json_index_avx2(const char_t *data, const uint32_t size, uint32_t *index, uint32_t *n, i_JState *state)
+{
+    uint32_t i = 0;
+    __m256i cquote = _mm256_set1_epi8('"');
+    __m256i cbslash = _mm256_set1_epi8('\\');
+    __m256i clower = _mm256_set1_epi8(0x20);
+    __m256i copen = _mm256_set1_epi8('{');
+    __m256i cclose = _mm256_set1_epi8('}');
+    __m256i ccolon = _mm256_set1_epi8(':');
+    __m256i ccomma = _mm256_set1_epi8(',');
+    __m256i cspace = _mm256_set1_epi8(' ');
+    __m256i ctab = _mm256_set1_epi8('\t');
+    __m256i clf = _mm256_set1_epi8('\n');
+    __m256i ccr = _mm256_set1_epi8('\r');
+    for (; i + 64 <= size; i += 64)
+    {
+        __m256i v0 = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)(data + i + 32));
+        __m256i l0 = _mm256_or_si256(v0, clower);
+        __m256i l1 = _mm256_or_si256(v1, clower);
+        uint64_t quote = i_mask_avx2(_mm256_cmpeq_epi8(v0, cquote), _mm256_cmpeq_epi8(v1, cquote));
+        uint64_t bslash = i_mask_avx2(_mm256_cmpeq_epi8(v0, cbslash), _mm256_cmpeq_epi8(v1, cbslash));
+        uint64_t op = i_mask_avx2(
+                        _mm256_or_si256(
+                            _mm256_or_si256(_mm256_cmpeq_epi8(l0, copen), _mm256_cmpeq_epi8(l0, cclose)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v0, ccolon), _mm256_cmpeq_epi8(v0, ccomma))),
+                        _mm256_or_si256(
+                            _mm256_or_si256(_mm256_cmpeq_epi8(l1, copen), _mm256_cmpeq_epi8(l1, cclose)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v1, ccolon), _mm256_cmpeq_epi8(v1, ccomma))));
+        uint64_t ws = i_mask_avx2(
+                        _mm256_or_si256(
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v0, cspace), _mm256_cmpeq_epi8(v0, ctab)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v0, clf), _mm256_cmpeq_epi8(v0, ccr))),
+                        _mm256_or_si256(
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v1, cspace), _mm256_cmpeq_epi8(v1, ctab)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v1, clf), _mm256_cmpeq_epi8(v1, ccr))));
+        *n += i_json_block(quote, bslash, op, ws, i, state, index + *n);
+    }
+
+    return i;
+}
+
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+/* Toggles the 0x20 bit of every byte in [first, last]. Bytes >= 0x80 are never touched */
+static void i_case(char_t *dest, const char_t *src, const uint32_t size, const char_t first, const char_t last)
+{
+    register uint32_t i = 0;
+    cassert_no_null(dest);
+    cassert_no_null(src);
+
+#if defined (i_AVX2)
+    if (size >= 32 && bsimd_avx2() == TRUE)
+        i = i_case_avx2(dest, src, size, first, last);
+#endif
+
+#if defined (i_SSE2)
+    {
+        __m128i lo = _mm_set1_epi8((char)(first - 1));
+        __m128i hi = _mm_set1_epi8((char)(last + 1));
+        __m128i bit = _mm_set1_epi8(0x20);
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i m = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+            v = _mm_xor_si128(v, _mm_and_si128(m, bit));
+            _mm_storeu_si128((__m128i*)(dest + i), v);
+        }
+    }
+#endif
+
+    for (; i < size; ++i)
+    {
+        char_t c = src[i];
+        if (c >= first && c <= last)
+            c = (char_t)(c ^ 0x20);
+        dest[i] = c;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void bsimd_upper(char_t *dest, const char_t *src, const uint32_t size)
+{
+    i_case(dest, src, size, 'a', 'z');
+}
+
+/*---------------------------------------------------------------------------*/
+
+void bsimd_lower(char_t *dest, const char_t *src, const uint32_t size)
+{
+    i_case(dest, src, size, 'A', 'Z');
+}
+
+/*---------------------------------------------------------------------------*/
+
+void bsimd_subs(char_t *str, const uint32_t size, const char_t replace, const char_t with)
+{
+    register uint32_t i = 0;
+    cassert_no_null(str);
+
+#if defined (i_AVX2)
+    if (size >= 32 && bsimd_avx2() == TRUE)
+        i = i_subs_avx2(str, size, replace, with);
+#endif
+
+#if defined (i_SSE2)
+    {
+        __m128i r = _mm_set1_epi8(replace);
+        __m128i w = _mm_set1_epi8(with);
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(str + i));
+            __m128i m = _mm_cmpeq_epi8(v, r);
+            if (_mm_movemask_epi8(m) != 0)
+            {
+                v = _mm_or_si128(_mm_and_si128(m, w), _mm_andnot_si128(m, v));
+                _mm_storeu_si128((__m128i*)(str + i), v);
+            }
+        }
+    }
+#endif
+
+    for (; i < size; ++i)
+    {
+        if (str[i] == replace)
+            str[i] = with;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool_t bsimd_equ_nocase(const char_t *str1, const char_t *str2, const uint32_t size)
+{
+    register uint32_t i = 0;
+    cassert_no_null(str1);
+    cassert_no_null(str2);
+
+#if defined (i_AVX2)
+    if (size >= 32 && bsimd_avx2() == TRUE)
+    {
+        bool_t equal;
+        i = i_equ_nocase_avx2(str1, str2, size, &equal);
+        if (equal == FALSE)
+            return FALSE;
+    }
+#endif
+
+#if defined (i_SSE2)
+    {
+        __m128i lo = _mm_set1_epi8('A' - 1);
+        __m128i hi = _mm_set1_epi8('Z' + 1);
+        __m128i bit = _mm_set1_epi8(0x20);
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v1 = _mm_loadu_si128((const __m128i*)(str1 + i));
+            __m128i v2 = _mm_loadu_si128((const __m128i*)(str2 + i));
+            __m128i m1 = _mm_and_si128(_mm_cmpgt_epi8(v1, lo), _mm_cmplt_epi8(v1, hi));
+            __m128i m2 = _mm_and_si128(_mm_cmpgt_epi8(v2, lo), _mm_cmplt_epi8(v2, hi));
+            v1 = _mm_or_si128(v1, _mm_and_si128(m1, bit));
+            v2 = _mm_or_si128(v2, _mm_and_si128(m2, bit));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(v1, v2)) != 0xFFFF)
+                return FALSE;
+        }
+    }
+#endif
+
+    for (; i < size; ++i)
+    {
+        char_t c1 = str1[i];
+        char_t c2 = str2[i];
+        if (c1 >= 'A' && c1 <= 'Z')
+            c1 = (char_t)(c1 | 0x20);
+        if (c2 >= 'A' && c2 <= 'Z')
+            c2 = (char_t)(c2 | 0x20);
+        if (c1 != c2)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Length of the leading run of ASCII bytes, not counting '\0' or 'stop' */
+uint32_t bsimd_ascii(const char_t *str, const uint32_t size, const char_t stop)
+{
+    register uint32_t i = 0;
+    cassert_no_null(str);
+
+#if defined (i_AVX2)
+    if (size >= 32 && bsimd_avx2() == TRUE)
+    {
+        bool_t found;
+        i = i_ascii_avx2(str, size, stop, &found);
+        if (found == TRUE)
+            return i;
+    }
+#endif
+
+#if defined (i_SSE2)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i s = _mm_set1_epi8(stop);
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(str + i));
+            __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, s));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(v, m));
+            if (mask != 0)
+                return i + i_ctz(mask);
+        }
+    }
+#endif
+
+    for (; i < size; ++i)
+    {
+        byte_t c = (byte_t)str[i];
+        if (c >= 0x80 || c == 0 || c == (byte_t)stop)
+            break;
+    }
+
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Widens the leading ASCII run of 'src' to native UTF16. Returns the converted chars */
+uint32_t bsimd_ascii_utf16(char_t *dest, const char_t *src, const uint32_t size)
+{
+    register uint32_t i = 0;
+    cassert_no_null(dest);
+    cassert_no_null(src);
+
+#if defined (i_SSE2)
+    {
+        __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+            if (_mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, zero))) != 0)
+                break;
+            _mm_storeu_si128((__m128i*)(dest + 2 * i), _mm_unpacklo_epi8(v, zero));
+            _mm_storeu_si128((__m128i*)(dest + 2 * i + 16), _mm_unpackhi_epi8(v, zero));
+        }
+    }
+#endif
+
+    for (; i < size; ++i)
+    {
+        byte_t c = (byte_t)src[i];
+        if (c >= 0x80 || c == 0)
+            break;
+        *((uint16_t*)(dest + 2 * i)) = (uint16_t)c;
+    }
+
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Widens the leading ASCII run of 'src' to native UTF32. Returns the converted chars */
+uint32_t bsimd_ascii_utf32(char_t *dest, const char_t *src, const uint32_t size)
+{
+    register uint32_t i = 0;
+    cassert_no_null(dest);
+    cassert_no_null(src);
+
+#if defined (i_SSE2)
+    {
+        __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i lo, hi;
+            if (_mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, zero))) != 0)
+                break;
+            lo = _mm_unpacklo_epi8(v, zero);
+            hi = _mm_unpackhi_epi8(v, zero);
+            _mm_storeu_si128((__m128i*)(dest + 4 * i), _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128((__m128i*)(dest + 4 * i + 16), _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128((__m128i*)(dest + 4 * i + 32), _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128((__m128i*)(dest + 4 * i + 48), _mm_unpackhi_epi16(hi, zero));
+        }
+    }
+#endif
+
+    for (; i < size; ++i)
+    {
+        byte_t c = (byte_t)src[i];
+        if (c >= 0x80 || c == 0)
+            break;
+        *((uint32_t*)(dest + 4 * i)) = (uint32_t)c;
+    }
+
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Narrows the leading run of native UTF16 ASCII units ('size' units), not counting 0 or 'stop' */
+uint32_t bsimd_utf16_ascii(char_t *dest, const char_t *src, const uint32_t size, const char_t stop)
+{
+    register uint32_t i = 0;
+    cassert_no_null(dest);
+    cassert_no_null(src);
+
+#if defined (i_SSE2)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i s = _mm_set1_epi8(stop);
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v1 = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+            __m128i v2 = _mm_loadu_si128((const __m128i*)(src + 2 * i + 16));
+            /* Units > 0xFF saturate to 0xFF: the high bit flags every non-ASCII unit */
+            __m128i v = _mm_packus_epi16(v1, v2);
+            __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, s));
+            if (_mm_movemask_epi8(_mm_or_si128(v, m)) != 0)
+                break;
+            _mm_storeu_si128((__m128i*)(dest + i), v);
+        }
+    }
+#endif
+
+    for (; i < size; ++i)
+    {
+        uint16_t c = *((const uint16_t*)(src + 2 * i));
+        if (c >= 0x80 || c == 0 || c == (uint16_t)(byte_t)stop)
+            break;
+        dest[i] = (char_t)c;
+    }
+
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Number of UTF8 lead bytes (non 10xx xxxx) in 'size' bytes */
+uint32_t bsimd_utf8_nchars(const char_t *str, const uint32_t size)
+{
+    register uint32_t i = 0;
+    uint32_t count = 0;
+    cassert_no_null(str);
+
+#if defined (i_AVX2)
+    if (size >= 32 && bsimd_avx2() == TRUE)
+        i = i_utf8_nchars_avx2(str, size, &count);
+#endif
+
+#if defined (i_SSE2)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i cont = _mm_set1_epi8((char)0xBF);
+        while (i + 16 <= size)
+        {
+            __m128i acc = zero;
+            uint32_t n = 0;
+            __m128i sum;
+            for (; n < 255 && i + 16 <= size; ++n, i += 16)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i*)(str + i));
+                acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, cont));
+            }
+
+            sum = _mm_sad_epu8(acc, zero);
+            count += (uint32_t)_mm_cvtsi128_si32(sum) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+        }
+    }
+#endif
+
+    for (; i < size; ++i)
+    {
+        if (((byte_t)str[i] & 0xC0) != 0x80)
+            count += 1;
+    }
+
+    return count;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t bsimd_json_index(const char_t *data, const uint32_t size, uint32_t *index)
+{
+    register uint32_t i = 0;
+    uint32_t n = 0;
+    i_JState state = { 0, 0, 0 };
+    cassert_no_null(data);
+    cassert_no_null(index);
+
+#if defined (i_AVX2)
+    if (size >= 64 && bsimd_avx2() == TRUE)
+        i = i_json_index_avx2(data, size, index, &n, &state);
+#endif
+
+    for (; i + 64 <= size; i += 64)
+    {
+        uint64_t quote, bslash, op, ws;
+#if defined (i_SSE2)
+        i_json_masks_sse2(data + i, &quote, &bslash, &op, &ws);
+#else
+        i_json_masks(data + i, &quote, &bslash, &op, &ws);
+#endif
+        n += i_json_block(quote, bslash, op, ws, i, &state, index + n);
+    }
+
+    /* Tail block padded with whitespace */
+    if (i < size)
+    {
+        char_t block[64];
+        uint64_t quote, bslash, op, ws;
+        uint32_t j;
+        for (j = 0; j < 64; ++j)
+            block[j] = i + j < size ? data[i + j] : ' ';
+        i_json_masks(block, &quote, &bslash, &op, &ws);
+        n += i_json_block(quote, bslash, op, ws, i, &state, index + n);
+    }
+
+    cassert(n <= size);
+    return n;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t bsimd_chr2(const char_t *str, const uint32_t size, const char_t c1, const char_t c2)
+{
+    register uint32_t i = 0;
+    cassert_no_null(str);
+
+#if defined (i_SSE2)
+    {
+        __m128i v1 = _mm_set1_epi8(c1);
+        __m128i v2 = _mm_set1_epi8(c2);
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(str + i));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, v1), _mm_cmpeq_epi8(v, v2)));
+            if (mask != 0)
+                return i + i_ctz(mask);
+        }
+    }
+#endif
+
+    for (; i < size; ++i)
+    {
+        if (str[i] == c1 || str[i] == c2)
+            break;
+    }
+
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t bsimd_json_plain(const char_t *str, const uint32_t size)
+{
+    register uint32_t i = 0;
+    cassert_no_null(str);
+
+#if defined (i_SSE2)
+    {
+        __m128i vquote = _mm_set1_epi8('"');
+        __m128i vbslash = _mm_set1_epi8('\\');
+        __m128i vctrl = _mm_set1_epi8(0x1F);
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(str + i));
+            /* Unsigned v <= 0x1F, so UTF8 bytes (>= 0x80) are plain */
+            __m128i ctrl = _mm_cmpeq_epi8(_mm_max_epu8(v, vctrl), vctrl);
+            __m128i esc = _mm_or_si128(ctrl, _mm_or_si128(_mm_cmpeq_epi8(v, vquote), _mm_cmpeq_epi8(v, vbslash)));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(esc);
+            if (mask != 0)
+                return i + i_ctz(mask);
+        }
+    }
+#endif
+
+    for (; i < size; ++i)
+    {
+        byte_t c = (byte_t)str[i];
+        if (c < 0x20 || c == '"' || c == '\\')
+            break;
+    }
+
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Length of the leading run of [A-Za-z0-9_] */
+uint32_t bsimd_ident(const char_t *str, const uint32_t size)
+{
+    register uint32_t i = 0;
+    cassert_no_null(str);
+
+#if defined (i_SSE2)
+    {
+        __m128i alo = _mm_set1_epi8('a' - 1);
+        __m128i ahi = _mm_set1_epi8('z' + 1);
+        __m128i dlo = _mm_set1_epi8('0' - 1);
+        __m128i dhi = _mm_set1_epi8('9' + 1);
+        __m128i bit = _mm_set1_epi8(0x20);
+        __m128i under = _mm_set1_epi8('_');
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(str + i));
+            /* Signed compares, so UTF8 bytes (>= 0x80) never match */
+            __m128i l = _mm_or_si128(v, bit);
+            __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(l, alo), _mm_cmplt_epi8(l, ahi));
+            __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, dlo), _mm_cmplt_epi8(v, dhi));
+            __m128i ident = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(v, under));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(ident) ^ 0xFFFF;
+            if (mask != 0)
+                return i + i_ctz(mask);
+        }
+    }
+#endif
+
+    for (; i < size; ++i)
+    {
+        char_t c = str[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'))
+            break;
+    }
+
+    return i;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static __INLINE bool_t i_equ(const char_t *str1, const char_t *str2, const uint32_t size)
+{
+    register uint32_t i;
+    for (i = 0; i < size; ++i)
+    {
+        if (str1[i] != str2[i])
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+uint32_t bsimd_find(const char_t *str, const uint32_t size, const char_t *substr, const uint32_t subsize)
+{
+    register uint32_t i = 0;
+    cassert_no_null(str);
+    cassert_no_null(substr);
+
+    if (subsize == 0)
+        return 0;
+
+    if (subsize > size)
+        return size;
+
+#if defined (i_SSE2)
+    {
+        /* Candidates match the first and last byte of 'substr' */
+        __m128i vfirst = _mm_set1_epi8(substr[0]);
+        __m128i vlast = _mm_set1_epi8(substr[subsize - 1]);
+        for (; i + subsize - 1 + 16 <= size; i += 16)
+        {
+            __m128i v0 = _mm_loadu_si128((const __m128i*)(str + i));
+            __m128i v1 = _mm_loadu_si128((const __m128i*)(str + i + subsize - 1));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v0, vfirst), _mm_cmpeq_epi8(v1, vlast)));
+            while (mask != 0)
+            {
+                uint32_t j = i + i_ctz(mask);
+                if (i_equ(str + j + 1, substr + 1, subsize - 1) == TRUE)
+                    return j;
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+
+    for (; i + subsize <= size; ++i)
+    {
+        if (str[i] == substr[0] && i_equ(str + i + 1, substr + 1, subsize - 1) == TRUE)
+            return i;
+    }
+
+    return size;
+}
@@ -0,0 +1,47 @@
+/*
+ * NAppGUI Cross-platform C SDK
+ * 2015-2022 Francisco Garcia Collado
+ * MIT Licence
+ * https://nappgui.com/en/legal/license.html
+ *
+ * File: bsimd.inl
+ *
+ */
+
+/* Vectorized byte-string primitives (SSE2/AVX2 with runtime dispatch) */
+
+#include "sewer.hxx"
+
+__EXTERN_C
+
+bool_t bsimd_avx2(void);
+
+void bsimd_upper(char_t *dest, const char_t *src, const uint32_t size);
+
+void bsimd_lower(char_t *dest, const char_t *src, const uint32_t size);
+
+void bsimd_subs(char_t *str, const uint32_t size, const char_t replace, const char_t with);
+
+bool_t bsimd_equ_nocase(const char_t *str1, const char_t *str2, const uint32_t size);
+
+uint32_t bsimd_ascii(const char_t *str, const uint32_t size, const char_t stop);
+
+uint32_t bsimd_ascii_utf16(char_t *dest, const char_t *src, const uint32_t size);
+
+uint32_t bsimd_ascii_utf32(char_t *dest, const char_t *src, const uint32_t size);
+
+uint32_t bsimd_utf16_ascii(char_t *dest, const char_t *src, const uint32_t size, const char_t stop);
+
+uint32_t bsimd_utf8_nchars(const char_t *str, const uint32_t size);
+
+uint32_t bsimd_json_index(const char_t *data, const uint32_t size, uint32_t *index);
+
+uint32_t bsimd_chr2(const char_t *str, const uint32_t size, const char_t c1, const char_t c2);
+
+uint32_t bsimd_json_plain(const char_t *str, const uint32_t size);
+
+uint32_t bsimd_ident(const char_t *str, const uint32_t size);
+
+uint32_t bsimd_find(const char_t *str, const uint32_t size, const char_t *substr, const uint32_t subsize);
+
+__END_C
@@ -11,6 +11,9 @@
 /* Unicode */
 
 #include "unicode.h"
+#include "blib.inl"
+#include "bmem.h"
+#include "bsimd.inl"
 #include "cassert.h"
 #include <ctype.h>
 
@@ -264,6 +267,55 @@ static i_Fptr_codepoint_to_str i_func_codepoint_to_str[] = {
 
 /*---------------------------------------------------------------------------*/
 
+static uint32_t i_utf16_buffer_size(const char_t *utf16_string);
+
+/*---------------------------------------------------------------------------*/
+
+/* Source bytes that can be scanned in blocks. 0 disables the ASCII fast path */
+static uint32_t i_ascii_avail(const char_t *str, const unicode_t from, const unicode_t to, const uint32_t isize)
+{
+    if (from == ekUTF8)
+        return isize != UINT32_MAX ? isize : blib_strlen(str);
+    if (from == ekUTF16 && to == ekUTF8)
+        return isize != UINT32_MAX ? isize : i_utf16_buffer_size(str) - 2;
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Converts the leading ASCII run in bulk. Returns the number of characters */
+static uint32_t i_ascii_convers(const char_t *from_str, char_t *to_str, const unicode_t from, const unicode_t to, const uint32_t ibytes, const uint32_t obytes)
+{
+    if (from == ekUTF16)
+    {
+        cassert(to == ekUTF8);
+        return bsimd_utf16_ascii(to_str, from_str, ibytes / 2 < obytes ? ibytes / 2 : obytes, 0);
+    }
+
+    cassert(from == ekUTF8);
+    switch (to) {
+    case ekUTF8:
+    {
+        uint32_t n = bsimd_ascii(from_str, ibytes < obytes ? ibytes : obytes, 0);
+        if (n > 0)
+            bmem_copy((byte_t*)to_str, (const byte_t*)from_str, n);
+        return n;
+    }
+
+    case ekUTF16:
+        return bsimd_ascii_utf16(to_str, from_str, ibytes < obytes / 2 ? ibytes : obytes / 2);
+
+    case ekUTF32:
+        return bsimd_ascii_utf32(to_str, from_str, ibytes < obytes / 4 ? ibytes : obytes / 4);
+
+    cassert_default();
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
 /*  Includes the null-terminated character */
 uint32_t unicode_convers_n(const char_t *from_str, char_t *to_str, const unicode_t from, const unicode_t to, const uint32_t isize, const uint32_t osize)
 {
@@ -272,15 +324,37 @@ uint32_t unicode_convers_n(const char_t *from_str, char_t *to_str, const unicode
     register uint32_t byte_count = 0;
     uint32_t num_bytes_src = 0;
     register uint32_t total_bytes_src = 0;
+    uint32_t avail = 0;
+    uint32_t isrc = 0, idest = 0;
     cassert_no_null(from_str);
     cassert_no_null(to_str);
     null_size = i_func_codepoint_bytes[to](0);
     /* At least, the null terminated */
     cassert(osize >= null_size);
-    codepoint = i_func_codepoint_from_str[from](from_str, &num_bytes_src);
-    while (codepoint != 0)
+    avail = i_ascii_avail(from_str, from, to, isize);
+    isrc = i_func_codepoint_bytes[from](0);
+    idest = null_size;
+    for (;;)
     {
-        register uint32_t num_bytes_dest = i_func_codepoint_to_str[to](codepoint, to_str);
+        register uint32_t num_bytes_dest;
+
+        /* ASCII runs are converted 16 chars at a time */
+        if (total_bytes_src < avail)
+        {
+            uint32_t n = i_ascii_convers(from_str, to_str, from, to, avail - total_bytes_src, osize - null_size - byte_count);
+            from_str += n * isrc;
+            to_str += n * idest;
+            byte_count += n * idest;
+            total_bytes_src += n * isrc;
+            if (total_bytes_src >= isize)
+                break;
+        }
+
+        codepoint = i_func_codepoint_from_str[from](from_str, &num_bytes_src);
+        if (codepoint == 0)
+            break;
+
+        num_bytes_dest = i_func_codepoint_to_str[to](codepoint, to_str);
         if (byte_count + num_bytes_dest + null_size <= osize)
         {            
             from_str += num_bytes_src;
@@ -289,7 +363,6 @@ uint32_t unicode_convers_n(const char_t *from_str, char_t *to_str, const unicode
             total_bytes_src += num_bytes_src;
             if (total_bytes_src >= isize)
                 break;
-            codepoint = i_func_codepoint_from_str[from](from_str, &num_bytes_src);
         }
         else
         {
@@ -323,6 +396,32 @@ uint32_t unicode_convers_nbytes(const char_t *str, const unicode_t from, const u
     register uint32_t codepoint = 0;
     register uint32_t byte_count = 0;
     cassert_no_null(str);
+
+    /* Each ASCII byte is a single code unit in any format */
+    if (from == ekUTF8)
+    {
+        uint32_t len = blib_strlen(str);
+        uint32_t unit = i_func_codepoint_bytes[to](0);
+        uint32_t i = 0;
+        for (;;)
+        {
+            uint32_t n = bsimd_ascii(str + i, len - i, 0);
+            byte_count += n * unit;
+            i += n;
+            if (i >= len)
+                break;
+
+            codepoint = i_func_codepoint_from_str[from](str + i, &num_bytes_char);
+            if (codepoint == 0)
+                break;
+            byte_count += i_func_codepoint_bytes[to](codepoint);
+            i += num_bytes_char;
+        }
+
+        byte_count += unit;
+        return byte_count;
+    }
+
     codepoint = i_func_codepoint_from_str[from](str, &num_bytes_char);
     while (codepoint != 0)
     {
@@ -404,16 +503,8 @@ uint32_t unicode_nbytes(const char_t *str, const unicode_t format)
 
 static uint32_t i_utf8_num_chars(const char_t *utf8_string)
 {
-    register uint32_t i = 0;
     cassert_no_null(utf8_string);
-    while (*utf8_string != 0)
-    {
-        if ((*utf8_string & 0xC0) != 0x80)
-            i += 1;
-        utf8_string += 1;
-    }
-
-    return i;
+    return bsimd_utf8_nchars(utf8_string, blib_strlen(utf8_string));
 }
 
 /*---------------------------------------------------------------------------*/
@@ -441,7 +532,10 @@ static uint32_t i_utf32_num_chars(const char_t *utf32_string)
     register uint32_t i = 0;
     cassert_no_null(utf32_string);
     while (*str != 0)
+    {
         i += 1;
+        str += 1;
+    }
 
     return i;
 }
@@ -491,12 +585,79 @@ bool_t unicode_valid_str(const char_t *str, const unicode_t format)
 
 /*---------------------------------------------------------------------------*/
 
+/* Length of a well-formed multi-byte UTF8 sequence, or 0 */
+static uint32_t i_utf8_sequence(const byte_t *str, const uint32_t size)
+{
+    uint32_t n, i, code;
+    if (str[0] < 0xC2 || str[0] > 0xF4)
+        return 0;
+
+    if (str[0] < 0xE0)
+    {
+        n = 2;
+        code = str[0] & 0x1F;
+    }
+    else if (str[0] < 0xF0)
+    {
+        n = 3;
+        code = str[0] & 0x0F;
+    }
+    else
+    {
+        n = 4;
+        code = str[0] & 0x07;
+    }
+
+    if (n > size)
+        return 0;
+
+    for (i = 1; i < n; ++i)
+    {
+        if ((str[i] & 0xC0) != 0x80)
+            return 0;
+        code = (code << 6) | (uint32_t)(str[i] & 0x3F);
+    }
+
+    /* Overlong forms */
+    if ((n == 3 && code < 0x800) || (n == 4 && code < 0x10000))
+        return 0;
+
+    return i_UNICODE_VALID_CODEPOINT(code) ? n : 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static bool_t i_utf8_valid_n(const char_t *str, const uint32_t size)
+{
+    uint32_t len = size != UINT32_MAX ? size : blib_strlen(str);
+    uint32_t i = 0;
+    for (;;)
+    {
+        uint32_t n;
+        i += bsimd_ascii(str + i, len - i, 0);
+        if (i >= len || str[i] == 0)
+            return TRUE;
+
+        n = i_utf8_sequence((const byte_t*)str + i, len - i);
+        if (n == 0)
+            return FALSE;
+        i += n;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
 bool_t unicode_valid_str_n(const char_t *str, const uint32_t size, const unicode_t format)
 {
     register bool_t ok = TRUE;
     register uint32_t tn = 0;
     uint32_t n;
-    uint32_t codepoint = i_func_codepoint_from_str[format](str, &n);
+    uint32_t codepoint;
+    cassert_no_null(str);
+    if (format == ekUTF8)
+        return i_utf8_valid_n(str, size);
+
+    codepoint = i_func_codepoint_from_str[format](str, &n);
     ok = i_UNICODE_VALID_CODEPOINT(codepoint);
     while(ok && codepoint != 0)
     {
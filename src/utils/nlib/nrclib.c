@@ -15,12 +15,21 @@
 #include "bnfparser.inl"
 #include "arrpt.h"
 #include "cassert.h"
-#include "date.h"
 #include "hfile.h"
 #include "log.h"
 #include "stream.h"
 #include "strings.h"
 
+typedef enum _i_mode_t
+{
+    i_ekMODE_EMBEDDED,
+    i_ekMODE_PACKED,
+    i_ekMODE_LINKED
+} i_mode_t;
+
+/* nrc option of each mode, also part of the pack key */
+static const char_t *i_MODE[] = {"-dc", "-dp", "-db"};
+
 /*---------------------------------------------------------------------------*/
 
 //Stream *nrclib_serial_file(const char_t *pathname, const char_t *variable_name);
@@ -56,51 +65,69 @@ static bool_t i_is_valid_dest(const char_t *pathname)
 
 /*---------------------------------------------------------------------------*/
 
-static bool_t i_is_update(const char_t *src_dir, const char_t *dest_path, const char_t *dest_file)
+static bool_t i_exists(const char_t *dest_path, const char_t *dest_file, const char_t *ext)
 {
-    Date date = kDATE_NULL;
+    String *path = str_cpath("%s/%s.%s", dest_path, dest_file, ext);
+    bool_t exists = hfile_exists(tc(path), NULL);
+    str_destroy(&path);
+    return exists;
+}
 
-    {
-        String *path = str_cpath("%s/%s.c", dest_path, dest_file);
-        date = hfile_date(tc(path), FALSE);
-        str_destroy(&path);
-    }
+/*---------------------------------------------------------------------------*/
 
-    if (date_is_null(&date) == FALSE)
-    {
-        String *path = str_cpath("%s/%s.h", dest_path, dest_file);
-        Date date2 = hfile_date(tc(path), FALSE);
+/*
+ * '.nrcache' keeps the processed source files of the last run. Only new or modified files
+ * are loaded again and the outputs are not rewritten if the content of the pack is the same.
+ */
+static void i_resdir(const char_t *src_dir, const char_t *dest_path, const char_t *dest_file, const i_mode_t mode, const uint32_t nthreads, ArrPt(String) *warnings, ArrPt(String) *errors)
+{
+    String *cache = str_cpath("%s/%s.nrcache", dest_path, dest_file);
+    bool_t outputs = i_exists(dest_path, dest_file, "c") && i_exists(dest_path, dest_file, "h");
+    ResourcePack *pack = NULL;
+    if (mode == i_ekMODE_PACKED)
+        outputs = outputs && i_exists(dest_path, dest_file, "res");
+    else if (mode == i_ekMODE_LINKED)
+        outputs = outputs && i_exists(dest_path, dest_file, "bin");
 
-        if (date_is_null(&date2) || date_cmp(&date2, &date) > 0)
-            date = date2;
+    pack = resgen_pack_read(src_dir, outputs ? tc(cache) : NULL, i_MODE[mode], nthreads, warnings, errors);
 
-        str_destroy(&path);
-    }
-    else
+    if (resgen_pack_is_update(pack) == FALSE)
     {
-        return FALSE;
-    }
+        resgen_write_h_file(pack, dest_path, dest_file, errors);
+        switch (mode)
+        {
+            case i_ekMODE_EMBEDDED:
+                resgen_write_c_file(pack, dest_path, dest_file, errors);
+                break;
+            case i_ekMODE_PACKED:
+                resgen_write_packed_file(pack, dest_path, dest_file, errors);
+                resgen_write_c_packed_file(pack, dest_path, dest_file, errors);
+                break;
+            case i_ekMODE_LINKED:
+                resgen_write_bin_file(pack, dest_path, dest_file, errors);
+                resgen_write_c_linked_file(pack, dest_path, dest_file, errors);
+                break;
+            cassert_default();
+        }
 
-    if (date_is_null(&date) == FALSE)
-    {
-        // 'date' = More recent date of 'respack.c' and 'respack.h'
-        // 'date2' = More recent date of whole resource dir
-        // 'date2' more recent than 'date' --> Is NOT up to date
-        Date date2 = hfile_date(src_dir, TRUE);
-        if (date_is_null(&date2) || date_cmp(&date2, &date) > 0)
-            return FALSE;
-        else
-            return TRUE;
+        log_printf("Regenerating '%s'", src_dir);
     }
     else
     {
-        return FALSE;
+        log_printf("Is update '%s'", src_dir);
     }
+
+    /* Failed files are not cached, they will be processed again */
+    if (arrpt_size(errors, String) == 0)
+        resgen_write_cache(pack, tc(cache));
+
+    resgen_destroy_pack(&pack);
+    str_destroy(&cache);
 }
 
 /*---------------------------------------------------------------------------*/
 
-void nrclib_serial_dir(const char_t *src_dir, const char_t *dest_file, ArrPt(String) **warnings, ArrPt(String) **errors)
+static void i_resdir_dest(const char_t *src_dir, const char_t *dest_file, const i_mode_t mode, const uint32_t nthreads, ArrPt(String) **warnings, ArrPt(String) **errors)
 {
     cassert_no_null(src_dir);
     cassert_no_null(dest_file);
@@ -113,20 +140,7 @@ void nrclib_serial_dir(const char_t *src_dir, const char_t *dest_file, ArrPt(Str
         String *path = NULL;
         String *file = NULL;
         str_split_pathext(dest_file, &path, &file, NULL);        
-
-        if (i_is_update(src_dir, tc(path), tc(file)) == FALSE)
-        {
-            ResourcePack *pack = resgen_pack_read(src_dir, *warnings, *errors);
-            resgen_write_h_file(pack, tc(path), tc(file), *errors);
-            resgen_write_c_file(pack, tc(path), tc(file), *errors);
-            resgen_destroy_pack(&pack);
-            log_printf("Regenerating '%s'", src_dir);
-        }
-        else
-        {
-            log_printf("Is update '%s'", src_dir);
-        }
-
+        i_resdir(src_dir, tc(path), tc(file), mode, nthreads, *warnings, *errors);
         str_destroy(&path);
         str_destroy(&file);
     }
@@ -147,50 +161,23 @@ void nrclib_serial_dir(const char_t *src_dir, const char_t *dest_file, ArrPt(Str
 
 /*---------------------------------------------------------------------------*/
 
-void nrclib_pack_dir(const char_t *src_dir, const char_t *dest_file, ArrPt(String) **warnings, ArrPt(String) **errors)
+void nrclib_serial_dir(const char_t *src_dir, const char_t *dest_file, const uint32_t nthreads, ArrPt(String) **warnings, ArrPt(String) **errors)
 {
-    cassert_no_null(src_dir);
-    cassert_no_null(dest_file);
-    cassert_no_null(warnings);
-    cassert_no_null(errors);
-    *warnings = arrpt_create(String);
-    *errors = arrpt_create(String);
-    if (hfile_dir(src_dir) == TRUE && i_is_valid_dest(dest_file) == TRUE)
-    {         
-        String *path = NULL;
-        String *file = NULL;
-        str_split_pathext(dest_file, &path, &file, NULL);        
+    i_resdir_dest(src_dir, dest_file, i_ekMODE_EMBEDDED, nthreads, warnings, errors);
+}
 
-        if (i_is_update(src_dir, tc(path), tc(file)) == FALSE)
-        {
-            ResourcePack *pack = resgen_pack_read(src_dir, *warnings, *errors);
-            resgen_write_h_file(pack, tc(path), tc(file), *errors);
-            resgen_write_packed_file(pack, tc(path), tc(file), *errors);
-            resgen_write_c_packed_file(pack, tc(path), tc(file), *errors);
-            resgen_destroy_pack(&pack);
-            log_printf("Regenerating '%s'", src_dir);
-        }
-        else
-        {
-            log_printf("Is update '%s'", src_dir);
-        }
+/*---------------------------------------------------------------------------*/
 
-        str_destroy(&path);
-        str_destroy(&file);
-    }
-    else
-    {
-        if (hfile_dir(src_dir) == FALSE)
-        {
-            String *error = str_printf("Invalid source directory '%s'.", src_dir);
-            arrpt_append(*errors, error, String);
-        }
-        else
-        {
-            String *error = str_printf("Invalid destiny file '%s'.", dest_file);
-            arrpt_append(*errors, error, String);
-        }
-    }
+void nrclib_pack_dir(const char_t *src_dir, const char_t *dest_file, const uint32_t nthreads, ArrPt(String) **warnings, ArrPt(String) **errors)
+{
+    i_resdir_dest(src_dir, dest_file, i_ekMODE_PACKED, nthreads, warnings, errors);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void nrclib_linked_dir(const char_t *src_dir, const char_t *dest_file, const uint32_t nthreads, ArrPt(String) **warnings, ArrPt(String) **errors)
+{
+    i_resdir_dest(src_dir, dest_file, i_ekMODE_LINKED, nthreads, warnings, errors);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -14,9 +14,11 @@
 
 __EXTERN_C
 
-void nrclib_serial_dir(const char_t *src_dir, const char_t *dest_file, ArrPt(String) **warnings, ArrPt(String) **errors);
+void nrclib_serial_dir(const char_t *src_dir, const char_t *dest_file, const uint32_t nthreads, ArrPt(String) **warnings, ArrPt(String) **errors);
 
-void nrclib_pack_dir(const char_t *src_dir, const char_t *dest_file, ArrPt(String) **warnings, ArrPt(String) **errors);
+void nrclib_pack_dir(const char_t *src_dir, const char_t *dest_file, const uint32_t nthreads, ArrPt(String) **warnings, ArrPt(String) **errors);
+
+void nrclib_linked_dir(const char_t *src_dir, const char_t *dest_file, const uint32_t nthreads, ArrPt(String) **warnings, ArrPt(String) **errors);
 
 bool_t nrclib_bnfparser(const char_t *src_file, const char_t *dest_file, String **error);
 
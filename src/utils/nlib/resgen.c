@@ -15,22 +15,31 @@
 #include "msgparser.inl"
 #include "arrpt.h"
 #include "arrst.h"
+#include "bhash.h"
 #include "bmem.h"
+#include "bmutex.h"
 #include "bfile.h"
+#include "bthread.h"
 #include "buffer.h"
 #include "cassert.h"
 #include "date.h"
 #include "event.h"
 #include "heap.h"
 #include "hfile.h"
+#include "lzc.inl"
 #include "ptr.h"
 #include "stream.h"
 #include "strings.h"
 #include "unicode.h"
 
-typedef union i_object_t i_Object;
+typedef struct i_object_t i_Object;
 typedef struct i_local_t i_Local;
 typedef struct i_resource_t i_Resource;
+typedef struct i_rfile_t i_RFile;
+typedef struct i_rdir_t i_RDir;
+typedef struct i_cfile_t i_CFile;
+typedef struct i_cache_t i_Cache;
+typedef struct i_jobs_t i_Jobs;
 
 typedef enum _i_resource_type_t
 {
@@ -39,10 +48,12 @@ typedef enum _i_resource_type_t
     i_ekRESOURCE_TYPE_FILE          = 2
 } i_resource_type_t;
 
-union i_object_t
+/* 'size' > 0: 'file_data' is lz compressed, 'size' bytes once inflated */
+struct i_object_t
 {
     String *string;
     Buffer *file_data;
+    uint32_t size;
 };
 
 struct i_local_t
@@ -60,22 +71,101 @@ struct i_resource_t
     ArrSt(i_Local) *locals;
 };
 
+/* A source file. 'data' goes to the pack as is: lz compressed if 'usize' > 0 */
+struct i_rfile_t
+{
+    String *pathname;
+    uint32_t dir;
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t hash;
+    uint32_t usize;
+    Buffer *data;
+};
+
+struct i_rdir_t
+{
+    String *pathname;
+    bool_t loaded;
+};
+
+/* A file of the previous run. 'data' is in the cache map */
+struct i_cfile_t
+{
+    String *pathname;
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t hash;
+    uint32_t usize;
+    const byte_t *data;
+    uint32_t data_size;
+};
+
+/* Files of the previous run, sorted by pathname, and the warnings of reading them */
+struct i_cache_t
+{
+    byte_t *map;
+    uint32_t map_size;
+    uint64_t key;
+    ArrSt(i_CFile) *files;
+    ArrPt(String) *warnings;
+};
+
+/* Files to load, taken in order by the workers */
+struct i_jobs_t
+{
+    Mutex *mutex;
+    i_RFile **files;
+    uint32_t nfiles;
+    uint32_t next;
+};
+
+/*
+ * 'key' identifies the output: contents of all files, their names and the generation mode.
+ * 'update': same key as the cached one, outputs don't change.
+ * 'fresh': files match the cache (name, size and date). Nothing has been loaded.
+ * 'cwarnings': warnings of reading the files, kept in the cache as fresh packs are not read.
+ */
 struct _resource_pack_t
 {
     uint32_t local_index;
     uint32_t num_locals;
     ArrPt(String) *local_codes;
     ArrSt(i_Resource) *resources;
+    ArrSt(i_RFile) *files;
+    ArrSt(i_RDir) *dirs;
+    uint64_t stamp;
+    uint64_t key;
+    bool_t update;
+    bool_t fresh;
     ArrPt(String) *warnings;
     ArrPt(String) *errors;
+    ArrPt(String) *cwarnings;
 };
 
 DeclSt(i_Local);
 DeclSt(i_Resource);
+DeclSt(i_RFile);
+DeclSt(i_RDir);
+DeclSt(i_CFile);
 
 /*---------------------------------------------------------------------------*/
 
 #define i_MAX_RESOURCE_PACK_SIZE    4194304
+
+/* Packed file layout. Same in respack.c */
+#define i_PACK_MAGIC                0x5345524E
+#define i_PACK_VERSION              3
+#define i_PACK_HEADER               16
+#define i_PACK_PAGE                 4096
+#define i_PACK_ALIGN                16
+#define i_PACK_ENTRY                3
+#define i_LZ_MIN_SIZE               64
+
+/* Cache of source files, for incremental generation */
+#define i_CACHE_MAGIC               0x4343524E
+#define i_CACHE_VERSION             2
+#define i_MAX_THREADS               64
 static const char_t i_HEX_CODE[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
 
 /*---------------------------------------------------------------------------*/
@@ -171,15 +261,36 @@ static void i_remove_resource(i_Resource *resource)
 
 /*---------------------------------------------------------------------------*/
 
+static void i_remove_rfile(i_RFile *file)
+{
+    cassert_no_null(file);
+    str_destroy(&file->pathname);
+    if (file->data != NULL)
+        buffer_destroy(&file->data);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_remove_rdir(i_RDir *dir)
+{
+    cassert_no_null(dir);
+    str_destroy(&dir->pathname);
+}
+
+/*---------------------------------------------------------------------------*/
+
 static ResourcePack *i_create_pack(const uint32_t local_index, const uint32_t num_locals, ArrPt(String) **local_codes, ArrSt(i_Resource) **resources, ArrPt(String) *warnings, ArrPt(String) *errors)
 {
-    ResourcePack *pack = heap_new(ResourcePack);
+    ResourcePack *pack = heap_new0(ResourcePack);
     pack->local_index = local_index;
     pack->num_locals = num_locals;
     pack->local_codes = ptr_dget_no_null(local_codes, ArrPt(String));
     pack->resources = ptr_dget_no_null(resources, ArrSt(i_Resource));
+    pack->files = arrst_create(i_RFile);
+    pack->dirs = arrst_create(i_RDir);
     pack->warnings = warnings;
     pack->errors = errors;
+    pack->cwarnings = arrpt_create(String);
     return pack;
 }
 
@@ -191,6 +302,9 @@ void resgen_destroy_pack(ResourcePack **pack)
     cassert_no_null(*pack);
     arrpt_destroy(&(*pack)->local_codes, str_destroy, String);
     arrst_destroy(&(*pack)->resources, i_remove_resource, i_Resource);
+    arrst_destroy(&(*pack)->files, i_remove_rfile, i_RFile);
+    arrst_destroy(&(*pack)->dirs, i_remove_rdir, i_RDir);
+    arrpt_destroy(&(*pack)->cwarnings, str_destroy, String);
     heap_delete(pack, ResourcePack);
 }
 
@@ -391,19 +505,43 @@ static void i_read_msgfile(ResourcePack *pack, const uint32_t local_index, const
 
 /*---------------------------------------------------------------------------*/
 
-static void i_read_file(ResourcePack *pack, const uint32_t local_code, const char_t *pathname, Buffer **file_data)
+/* Only kept compressed if it saves at least 1/8. Usually not for already compressed images */
+static void i_rfile_compress(i_RFile *file)
 {
-    const char_t *file_extension = NULL;
+    uint32_t size;
+    cassert_no_null(file);
+    size = buffer_size(file->data);
+    file->usize = 0;
+    if (size >= i_LZ_MIN_SIZE)
+    {
+        Buffer *lz = buffer_create(lzc_bound(size));
+        uint32_t zsize = lzc_compress(buffer_data(file->data), size, buffer_data(lz));
+        if (zsize <= size - size / 8)
+        {
+            buffer_destroy(&file->data);
+            file->data = buffer_with_data(buffer_data(lz), zsize);
+            file->usize = size;
+        }
+
+        buffer_destroy(&lz);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_read_file(ResourcePack *pack, const uint32_t local_code, const i_RFile *file)
+{
+    const char_t *pathname = NULL;
     i_resource_type_t type;
     cassert_no_null(pack);
-    cassert_no_null(file_data);
-    cassert(*file_data != NULL);
-    file_extension = str_filext(pathname);
-    type = i_resource_type_by_file_extension(file_extension);
+    cassert_no_null(file);
+    cassert_no_null(file->data);
+    pathname = tc(file->pathname);
+    type = i_resource_type_by_file_extension(str_filext(pathname));
     switch (type)
     {
         case i_ekRESOURCE_TYPE_MESSAGE:
-            i_read_msgfile(pack, local_code, pathname, buffer_data(*file_data), buffer_size(*file_data));
+            i_read_msgfile(pack, local_code, pathname, buffer_data(file->data), buffer_size(file->data));
             break;
 
         case i_ekRESOURCE_TYPE_IMAGE:
@@ -448,8 +586,8 @@ static void i_read_file(ResourcePack *pack, const uint32_t local_code, const cha
             if (object != NULL)
             {
                 cassert(i_object_is_null(object, type) == TRUE);
-                object->file_data = *file_data;
-                *file_data = NULL;
+                object->file_data = buffer_with_data(buffer_data(file->data), buffer_size(file->data));
+                object->size = file->usize;
             }
 
             str_destroy(&filename);
@@ -458,70 +596,416 @@ static void i_read_file(ResourcePack *pack, const uint32_t local_code, const cha
 
         cassert_default();
     }
-    
-    if (*file_data != NULL)
-        buffer_destroy(file_data);
 }
 
 /*---------------------------------------------------------------------------*/
 
-static void i_read_dir(ResourcePack *pack, Event *event)
+static void i_read_files(ResourcePack *pack, const uint32_t dir)
 {
-    const EvFileDir *params = NULL;
     cassert_no_null(pack);
-    params = event_params(event, EvFileDir);
-    cassert_no_null(params);
-    cassert(event_type(event) == ekEFILE);
-    if (i_file_is_resource(params->pathname) == TRUE)
-    {
-        Buffer *file_data = hfile_buffer(params->pathname, NULL);
-        if (file_data != NULL)
+    arrst_foreach_const(file, pack->files, i_RFile)
+        if (file->dir == dir)
         {
-            i_read_file(pack, pack->local_index, params->pathname, &file_data);
+            if (i_file_is_resource(tc(file->pathname)) == FALSE)
+            {
+                String *warning = str_printf("Ignored resource file '%s' (Unknown type).", tc(file->pathname));
+                arrpt_append(pack->warnings, warning, String);
+            }
+            else if (file->data == NULL)
+            {
+                String *error = str_printf("Can't load resource file '%s'", tc(file->pathname));
+                arrpt_append(pack->errors, error, String);
+            }
+            else
+            {
+                i_read_file(pack, pack->local_index, file);
+            }
         }
-        else
+    arrst_end();
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_read_localdir(ResourcePack *pack, const i_RDir *dir, const uint32_t index)
+{
+    const char_t *dirname = NULL;
+    String *local_code = NULL;
+    cassert_no_null(pack);
+    cassert_no_null(dir);
+    dirname = str_filename(tc(dir->pathname));
+    local_code = str_c(dirname);
+    pack->num_locals = 0;
+    pack->local_index = arrpt_size(pack->local_codes, String);
+    arrpt_append(pack->local_codes, local_code, String);
+    i_read_files(pack, index);
+
+    if (dir->loaded == TRUE)
+    {
+        if (pack->num_locals == 0)
         {
-            String *error = str_printf("Can't load resource file '%s'", params->pathname);
-            arrpt_append(pack->errors, error, String);
+            String *warning = str_printf("Localized directory '%s' is empty or has invalid resources.", tc(dir->pathname));
+            arrpt_append(pack->warnings, warning, String);
+            arrpt_delete(pack->local_codes, pack->local_index, str_destroy, String);
         }
     }
     else
     {
-        String *warning = str_printf("Ignored resource file '%s' (Unknown type).", params->pathname);
-        arrpt_append(pack->warnings, warning, String);
+        String *error = str_printf("Error reading '%s' resource directory.", tc(dir->pathname));
+        arrpt_append(pack->errors, error, String);
     }
 }
 
 /*---------------------------------------------------------------------------*/
 
-static void i_read_localdir(ResourcePack *pack, Event *event)
+/* Files are collected first and sorted, so the output doesn't depend on the directory order */
+static void i_collect_file(ResourcePack *pack, Event *event)
+{
+    cassert_no_null(pack);
+    if (event_type(event) == ekEFILE)
+    {
+        const EvFileDir *params = event_params(event, EvFileDir);
+        i_RFile *file = arrst_new0(pack->files, i_RFile);
+        file->pathname = str_c(params->pathname);
+        file->dir = pack->local_index;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_collect_dir(ResourcePack *pack, Event *event)
 {
     cassert_no_null(pack);
     if (event_type(event) == ekEENTRY)
     {
         const EvFileDir *params = event_params(event, EvFileDir);
-        const char_t *dirname = str_filename(params->pathname);
-        String *local_code = str_c(dirname);
-        bool_t loaded = FALSE;
-        pack->num_locals = 0;
-        pack->local_index = arrpt_size(pack->local_codes, String);
-        arrpt_append(pack->local_codes, local_code, String);
-        loaded = hfile_dir_loop(params->pathname, listener(pack, i_read_dir, ResourcePack), FALSE, FALSE, NULL);
-
-        if (loaded == TRUE)
+        i_RDir *dir = arrst_new0(pack->dirs, i_RDir);
+        dir->pathname = str_c(params->pathname);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int i_cmp_rfile(const i_RFile *file1, const i_RFile *file2)
+{
+    cassert_no_null(file1);
+    cassert_no_null(file2);
+    if (file1->dir != file2->dir)
+        return file1->dir < file2->dir ? -1 : 1;
+    return str_cmp(file1->pathname, tc(file2->pathname));
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int i_cmp_rdir(const i_RDir *dir1, const i_RDir *dir2)
+{
+    cassert_no_null(dir1);
+    cassert_no_null(dir2);
+    return str_cmp(dir1->pathname, tc(dir2->pathname));
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int i_cmp_cfile(const i_CFile *file1, const i_CFile *file2)
+{
+    cassert_no_null(file1);
+    cassert_no_null(file2);
+    return str_cmp(file1->pathname, tc(file2->pathname));
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int i_cmp_cfile_path(const i_CFile *file, const char_t *pathname)
+{
+    cassert_no_null(file);
+    return str_cmp(file->pathname, pathname);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_remove_cfile(i_CFile *file)
+{
+    cassert_no_null(file);
+    str_destroy(&file->pathname);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint64_t i_date_key(const Date *date)
+{
+    cassert_no_null(date);
+    return ((uint64_t)(uint16_t)date->year << 40)
+        | ((uint64_t)date->month << 32)
+        | ((uint64_t)date->mday << 24)
+        | ((uint64_t)date->hour << 16)
+        | ((uint64_t)date->minute << 8)
+        | (uint64_t)date->second;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint64_t i_now(void)
+{
+    Date date = date_system();
+    return i_date_key(&date);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Strings can't be bigger than the cache. NULL if damaged */
+static String *i_cache_str(Stream *stm, const uint32_t map_size)
+{
+    String *str = NULL;
+    uint32_t size = stm_read_u32(stm);
+    if (stm_state(stm) != ekSTOK || size == 0 || size > map_size)
+        return NULL;
+
+    str = str_reserve(size - 1);
+    stm_read(stm, (byte_t*)tcc(str), size);
+    tcc(str)[size - 1] = '\0';
+    return str;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Header, file entries (name, size, date, hash, data offset and size), warnings and data */
+static void i_cache_read(i_Cache *cache, const char_t *pathname)
+{
+    File *file = NULL;
+    cassert_no_null(cache);
+    bmem_zero(cache, i_Cache);
+    cache->files = arrst_create(i_CFile);
+    cache->warnings = arrpt_create(String);
+    if (pathname != NULL)
+        file = bfile_open(pathname, ekREAD, NULL);
+
+    if (file != NULL)
+    {
+        uint64_t size = 0;
+        if (bfile_fstat(file, NULL, &size, NULL, NULL) == TRUE && size > 0 && size < 0xFFFFFFFF)
+        {
+            cache->map = bfile_map(file, 0, (uint32_t)size, TRUE, NULL);
+            cache->map_size = (uint32_t)size;
+        }
+
+        bfile_close(&file);
+    }
+
+    if (cache->map != NULL)
+    {
+        Stream *stm = stm_from_block(cache->map, cache->map_size);
+        if (stm_read_u32(stm) == i_CACHE_MAGIC && stm_read_u32(stm) == i_CACHE_VERSION)
         {
-            if (pack->num_locals == 0)
+            uint32_t i, n, j, m = 0;
+            cache->key = stm_read_u64(stm);
+            n = stm_read_u32(stm);
+            for (i = 0; i < n && stm_state(stm) == ekSTOK; ++i)
             {
-                String *warning = str_printf("Localized directory '%s' is empty or has invalid resources.", params->pathname);
-                arrpt_append(pack->warnings, warning, String);
-                arrpt_delete(pack->local_codes, pack->local_index, str_destroy, String);
+                String *path = i_cache_str(stm, cache->map_size);
+                uint32_t offset;
+                i_CFile *cfile = NULL;
+                if (path == NULL)
+                    break;
+
+                cfile = arrst_new(cache->files, i_CFile);
+                cfile->pathname = path;
+                cfile->size = stm_read_u64(stm);
+                cfile->mtime = stm_read_u64(stm);
+                cfile->hash = stm_read_u64(stm);
+                cfile->usize = stm_read_u32(stm);
+                offset = stm_read_u32(stm);
+                cfile->data_size = stm_read_u32(stm);
+                cfile->data = cache->map + offset;
+                if ((uint64_t)offset + cfile->data_size > cache->map_size)
+                    break;
+            }
+
+            if (i == n)
+                m = stm_read_u32(stm);
+
+            for (j = 0; j < m && stm_state(stm) == ekSTOK; ++j)
+            {
+                String *warning = i_cache_str(stm, cache->map_size);
+                if (warning == NULL)
+                    break;
+                arrpt_append(cache->warnings, warning, String);
+            }
+
+            if (i < n || j < m || stm_state(stm) != ekSTOK)
+            {
+                arrst_clear(cache->files, i_remove_cfile, i_CFile);
+                arrpt_clear(cache->warnings, str_destroy, String);
+                cache->key = 0;
             }
         }
-        else
+
+        stm_close(&stm);
+    }
+
+    arrst_sort(cache->files, i_cmp_cfile, i_CFile);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_cache_close(i_Cache *cache)
+{
+    cassert_no_null(cache);
+    arrst_destroy(&cache->files, i_remove_cfile, i_CFile);
+    arrpt_destroy(&cache->warnings, str_destroy, String);
+    if (cache->map != NULL)
+        bfile_unmap(&cache->map, cache->map_size);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Names (relative to 'src_dir') and contents of all resource files, and how they are generated */
+static uint64_t i_pack_key(const ResourcePack *pack, const uint32_t src_len, const char_t *mode)
+{
+    uint64_t key = bhash_from_block64((const byte_t*)NAPPGUI_BUILD, str_len_c(NAPPGUI_BUILD), 0);
+    cassert_no_null(pack);
+    key = bhash_from_block64((const byte_t*)mode, str_len_c(mode), key);
+    arrst_foreach_const(file, pack->files, i_RFile)
+        if (i_file_is_resource(tc(file->pathname)) == TRUE)
+        {
+            cassert(str_len(file->pathname) > src_len);
+            key = bhash_from_block64((const byte_t*)tc(file->pathname) + src_len, str_len(file->pathname) - src_len + 1, key);
+            key = bhash_from_block64((const byte_t*)&file->hash, sizeof(file->hash), key);
+        }
+    arrst_end();
+    return key;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Load, hash and compress. Any order, each file is independent */
+static uint32_t i_jobs_main(i_Jobs *jobs)
+{
+    cassert_no_null(jobs);
+    for (;;)
+    {
+        i_RFile *file = NULL;
+        bmutex_lock(jobs->mutex);
+        if (jobs->next < jobs->nfiles)
+            file = jobs->files[jobs->next++];
+        bmutex_unlock(jobs->mutex);
+
+        if (file == NULL)
+            break;
+
+        file->data = hfile_buffer(tc(file->pathname), NULL);
+        if (file->data != NULL)
+        {
+            file->hash = bhash_from_block64(buffer_data(file->data), buffer_size(file->data), 0);
+            if (i_resource_type_by_file_extension(str_filext(tc(file->pathname))) != i_ekRESOURCE_TYPE_MESSAGE)
+                i_rfile_compress(file);
+        }
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_load_files(i_RFile **files, const uint32_t nfiles, const uint32_t nthreads)
+{
+    Thread *threads[i_MAX_THREADS];
+    i_Jobs jobs;
+    uint32_t nth = nthreads < i_MAX_THREADS ? nthreads : i_MAX_THREADS;
+    uint32_t i;
+    if (nth > nfiles)
+        nth = nfiles;
+
+    jobs.mutex = bmutex_create();
+    jobs.files = files;
+    jobs.nfiles = nfiles;
+    jobs.next = 0;
+    heap_start_mt();
+
+    /* The calling thread is also a worker */
+    for (i = 1; i < nth; ++i)
+        threads[i] = bthread_create(i_jobs_main, &jobs, i_Jobs);
+
+    i_jobs_main(&jobs);
+
+    for (i = 1; i < nth; ++i)
+    {
+        if (threads[i] != NULL)
+        {
+            bthread_wait(threads[i]);
+            bthread_close(&threads[i]);
+        }
+    }
+
+    heap_end_mt();
+    bmutex_close(&jobs.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Files not changed since the last run are taken from the cache. The rest are loaded in parallel */
+static void i_pack_files(ResourcePack *pack, const i_Cache *cache, const uint32_t src_len, const char_t *mode, const uint32_t nthreads)
+{
+    i_RFile **jobs = NULL;
+    const i_CFile **cfiles = NULL;
+    uint32_t nfiles, njobs = 0, ncached = 0, i;
+    cassert_no_null(pack);
+    cassert_no_null(cache);
+    nfiles = arrst_size(pack->files, i_RFile);
+    if (nfiles > 0)
+    {
+        jobs = heap_new_n(nfiles, i_RFile*);
+        cfiles = heap_new_n0(nfiles, const i_CFile*);
+    }
+
+    arrst_foreach(file, pack->files, i_RFile)
+        if (i_file_is_resource(tc(file->pathname)) == TRUE)
+        {
+            const i_CFile *cfile = NULL;
+            Date date;
+            if (bfile_lstat(tc(file->pathname), NULL, &file->size, &date, NULL) == TRUE)
+            {
+                file->mtime = i_date_key(&date);
+                cfile = arrst_bsearch_const(cache->files, i_cmp_cfile_path, tc(file->pathname), NULL, i_CFile, char_t);
+            }
+
+            if (cfile != NULL && cfile->mtime != 0 && cfile->mtime == file->mtime && cfile->size == file->size)
+            {
+                file->hash = cfile->hash;
+                file->usize = cfile->usize;
+                cfiles[file_i] = cfile;
+                ncached += 1;
+            }
+            else
+            {
+                jobs[njobs++] = file;
+            }
+        }
+    arrst_end();
+
+    /* Nothing changed: the pack is not even loaded */
+    pack->key = i_pack_key(pack, src_len, mode);
+    pack->fresh = (bool_t)(njobs == 0 && ncached == arrst_size(cache->files, i_CFile) && pack->key == cache->key);
+    pack->update = pack->fresh;
+
+    if (pack->fresh == FALSE)
+    {
+        for (i = 0; i < nfiles; ++i)
         {
-            String *error = str_printf("Error reading '%s' resource directory.", params->pathname);
-            arrpt_append(pack->errors, error, String);
+            if (cfiles[i] != NULL)
+            {
+                i_RFile *file = arrst_get(pack->files, i, i_RFile);
+                file->data = buffer_with_data(cfiles[i]->data, cfiles[i]->data_size);
+            }
         }
+
+        i_load_files(jobs, njobs, nthreads);
+        pack->key = i_pack_key(pack, src_len, mode);
+        pack->update = (bool_t)(pack->key == cache->key);
+    }
+
+    if (nfiles > 0)
+    {
+        heap_delete_n(&jobs, nfiles, i_RFile*);
+        heap_delete_n(&cfiles, nfiles, const i_CFile*);
     }
 }
 
@@ -553,33 +1037,63 @@ static int i_compare_resource(const i_Resource *res1, const i_Resource *res2)
 
 /*---------------------------------------------------------------------------*/
 
-ResourcePack *resgen_pack_read(const char_t *src_dir, ArrPt(String) *warnings, ArrPt(String) *errors)
+ResourcePack *resgen_pack_read(const char_t *src_dir, const char_t *cache_file, const char_t *mode, const uint32_t nthreads, ArrPt(String) *warnings, ArrPt(String) *errors)
 {
     ArrPt(String) *local_codes = NULL;
     ArrSt(i_Resource) *resources = NULL;
     ResourcePack *pack = NULL;
+    i_Cache cache;
+    cassert_no_null(mode);
     local_codes = arrpt_create(String);
     resources = arrst_create(i_Resource);
     pack = i_create_pack(UINT32_MAX, 0, &local_codes, &resources, warnings, errors);
+    pack->stamp = i_now();
 
+    /* Global files (dir 0), then the files of each localized directory (1..n) */
+    pack->local_index = 0;
+    if (hfile_dir_loop(src_dir, listener(pack, i_collect_file, ResourcePack), FALSE, FALSE, NULL) == FALSE)
     {
-        bool_t loaded = hfile_dir_loop(src_dir, listener(pack, i_read_dir, ResourcePack), FALSE, FALSE, NULL);
-        if (loaded == FALSE)
-        {
-            String *error = str_printf("Error reading '%s' resource directory.", src_dir);
-            arrpt_append(pack->errors, error, String);
-        }
+        String *error = str_printf("Error reading '%s' resource directory.", src_dir);
+        arrpt_append(pack->errors, error, String);
     }
 
+    if (hfile_dir_loop(src_dir, listener(pack, i_collect_dir, ResourcePack), TRUE, FALSE, NULL) == FALSE)
     {
-        bool_t loaded = hfile_dir_loop(src_dir, listener(pack, i_read_localdir, ResourcePack), TRUE, FALSE, NULL);
-        if (loaded == FALSE)
-        {
-            String *error = str_printf("Error reading '%s' subdirectories.", src_dir);
-            arrpt_append(pack->errors, error, String);
-        }
+        String *error = str_printf("Error reading '%s' subdirectories.", src_dir);
+        arrpt_append(pack->errors, error, String);
+    }
+
+    arrst_sort(pack->dirs, i_cmp_rdir, i_RDir);
+    arrst_foreach(dir, pack->dirs, i_RDir)
+        pack->local_index = dir_i + 1;
+        dir->loaded = hfile_dir_loop(tc(dir->pathname), listener(pack, i_collect_file, ResourcePack), FALSE, FALSE, NULL);
+    arrst_end();
+
+    arrst_sort(pack->files, i_cmp_rfile, i_RFile);
+    i_cache_read(&cache, cache_file);
+    i_pack_files(pack, &cache, str_len_c(src_dir), mode, nthreads);
+
+    if (pack->fresh == FALSE)
+    {
+        uint32_t i, first = arrpt_size(warnings, String);
+        pack->local_index = UINT32_MAX;
+        i_read_files(pack, 0);
+        arrst_foreach_const(dir, pack->dirs, i_RDir)
+            i_read_localdir(pack, dir, dir_i + 1);
+        arrst_end();
+
+        for (i = first; i < arrpt_size(warnings, String); ++i)
+            arrpt_append(pack->cwarnings, str_copy(arrpt_get(warnings, i, String)), String);
+    }
+    else
+    {
+        arrpt_foreach_const(warning, cache.warnings, String)
+            arrpt_append(warnings, str_copy(warning), String);
+        arrpt_end();
     }
 
+    i_cache_close(&cache);
+
     pack->warnings = NULL;
     pack->errors = NULL;
     arrst_sort(pack->resources, i_compare_resource, i_Resource);
@@ -588,6 +1102,74 @@ ResourcePack *resgen_pack_read(const char_t *src_dir, ArrPt(String) *warnings, A
 
 /*---------------------------------------------------------------------------*/
 
+bool_t resgen_pack_is_update(const ResourcePack *pack)
+{
+    cassert_no_null(pack);
+    return pack->update;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Dates not older than the start of the run are not trusted (modified while running) */
+void resgen_write_cache(const ResourcePack *pack, const char_t *cache_file)
+{
+    Stream *stm = NULL;
+    uint32_t n = 0, offset = 4 + 4 + 8 + 4;
+    cassert_no_null(pack);
+    if (pack->fresh == TRUE)
+        return;
+
+    arrst_foreach_const(file, pack->files, i_RFile)
+        if (file->data != NULL)
+        {
+            n += 1;
+            offset += 4 + str_len(file->pathname) + 1 + 8 + 8 + 8 + 4 + 4 + 4;
+        }
+    arrst_end();
+
+    offset += 4;
+    arrpt_foreach_const(warning, pack->cwarnings, String)
+        offset += 4 + str_len(warning) + 1;
+    arrpt_end();
+
+    stm = stm_to_file(cache_file, NULL);
+    if (stm != NULL)
+    {
+        stm_write_u32(stm, i_CACHE_MAGIC);
+        stm_write_u32(stm, i_CACHE_VERSION);
+        stm_write_u64(stm, pack->key);
+        stm_write_u32(stm, n);
+        arrst_foreach_const(file, pack->files, i_RFile)
+            if (file->data != NULL)
+            {
+                uint32_t size = buffer_size(file->data);
+                stm_write_u32(stm, str_len(file->pathname) + 1);
+                stm_write(stm, (const byte_t*)tc(file->pathname), str_len(file->pathname) + 1);
+                stm_write_u64(stm, file->size);
+                stm_write_u64(stm, file->mtime < pack->stamp ? file->mtime : 0);
+                stm_write_u64(stm, file->hash);
+                stm_write_u32(stm, file->usize);
+                stm_write_u32(stm, offset);
+                stm_write_u32(stm, size);
+                offset += size;
+            }
+        arrst_end();
+
+        stm_write_u32(stm, arrpt_size(pack->cwarnings, String));
+        arrpt_foreach_const(warning, pack->cwarnings, String)
+            str_write(stm, warning);
+        arrpt_end();
+
+        arrst_foreach_const(file, pack->files, i_RFile)
+            if (file->data != NULL)
+                stm_write(stm, buffer_data(file->data), buffer_size(file->data));
+        arrst_end();
+        stm_close(&stm);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
 static void i_stm_header(Stream *stream)
 {
     stm_printf(stream, "/* Automatic generated by NAppGUI Resource Compiler (nrc-v%s) */\n\n", NAPPGUI_BUILD);
@@ -733,6 +1315,20 @@ static void i_binary_to_ascii(Stream *stream, const byte_t *binary_code, const u
 
 /*---------------------------------------------------------------------------*/
 
+static void i_write_add(Stream *stream, const i_Resource *resource, const i_Object *object, const String *name)
+{
+    cassert_no_null(resource);
+    cassert_no_null(object);
+    if (resource->type == i_ekRESOURCE_TYPE_MESSAGE)
+        stm_printf(stream, "        respack_add_msg(pack, %s_TEXT);\n", tc(name));
+    else if (object->size > 0)
+        stm_printf(stream, "        respack_add_lzdata(pack, %d, %s_DATA, %s_SIZE, %u);\n", resource->type, tc(name), tc(name), object->size);
+    else
+        stm_printf(stream, "        respack_add_cdata(pack, %d, %s_DATA, %s_SIZE);\n", resource->type, tc(name), tc(name));
+}
+
+/*---------------------------------------------------------------------------*/
+
 static bool_t i_write_local(Stream *stream, const i_Resource *resource, const char_t *local_code, const uint32_t local_index)
 {
     cassert_no_null(resource);
@@ -740,10 +1336,7 @@ static bool_t i_write_local(Stream *stream, const i_Resource *resource, const ch
         if (local->index == local_index)
         {
             String *name = i_local_resname(resource->name, local_code);
-            if (resource->type == i_ekRESOURCE_TYPE_MESSAGE)
-                stm_printf(stream, "        respack_add_msg(pack, %s_TEXT);\n", tc(name));
-            else
-                stm_printf(stream, "        respack_add_cdata(pack, %d, %s_DATA, %s_SIZE);\n", resource->type, tc(name), tc(name));
+            i_write_add(stream, resource, &local->object, name);
             str_destroy(&name);
             return TRUE;
         }
@@ -758,10 +1351,7 @@ static void i_write_global(Stream *stream, const i_Resource *resource)
     String *name = NULL;
     cassert_no_null(resource);
     name = i_global_resname(resource->name);
-    if (resource->type == i_ekRESOURCE_TYPE_MESSAGE)
-        stm_printf(stream, "        respack_add_msg(pack, %s_TEXT);\n", tc(name));
-    else
-        stm_printf(stream, "        respack_add_cdata(pack, %d, %s_DATA, %s_SIZE);\n", resource->type, tc(name), tc(name));
+    i_write_add(stream, resource, &resource->global, name);
     str_destroy(&name);
 }
 
@@ -936,63 +1526,147 @@ void resgen_write_c_file(const ResourcePack *pack, const char_t *dest_path, cons
 
 /*---------------------------------------------------------------------------*/
 
-static void i_object_write(Stream *stream, const i_Object *object, const i_resource_type_t type)
+/* 'size' bytes in file. 'entry' is the table entry (offset not set) */
+static const byte_t *i_object_data(const i_Object *object, const i_resource_type_t type, uint32_t *size, uint32_t *entry)
 {
     cassert_no_null(object);
+    cassert_no_null(size);
+    cassert_no_null(entry);
     switch (type)
     {
         case i_ekRESOURCE_TYPE_MESSAGE:
-        {
-            uint32_t size = str_len(object->string);
-            const byte_t *data = (byte_t*)tc(object->string);
-            const byte_t end = 0;
-            stm_write_u32(stream, size);
-            stm_write(stream, data, size);
-            stm_write(stream, &end, 1);
-            break;
-        }
+            *size = str_len(object->string) + 1;
+            entry[1] = *size;
+            entry[2] = 0;
+            return (const byte_t*)tc(object->string);
 
         case i_ekRESOURCE_TYPE_IMAGE:
         case i_ekRESOURCE_TYPE_FILE:
-        {
-            uint32_t size = buffer_size(object->file_data);
-            const byte_t *data = buffer_data(object->file_data);
-            stm_write_u32(stream, size);
-            stm_write(stream, data, size);
-            break;
-        }
+            *size = buffer_size(object->file_data);
+            entry[1] = object->size > 0 ? object->size : *size;
+            entry[2] = object->size > 0 ? *size : 0;
+            return buffer_data(object->file_data);
+
         cassert_default();
     }
+
+    *size = 0;
+    return NULL;
 }
 
 /*---------------------------------------------------------------------------*/
 
-void resgen_write_packed_file(const ResourcePack *pack, const char_t *dest_path, const char_t *dest_file, ArrPt(String) *errors)
+/* Texts are packed. Raw files of a page or more start at page boundaries, so they map independently */
+static uint64_t i_object_offset(const uint64_t offset, const uint32_t *entry, const i_resource_type_t type)
 {
-    String *pathname = str_printf("%s%c%s.res", dest_path, DIR_SEPARATOR, dest_file);
-    Stream *stream = stm_to_file(tc(pathname), NULL);
+    uint64_t align = 1;
+    if (type != i_ekRESOURCE_TYPE_MESSAGE)
+        align = (entry[2] == 0 && entry[1] >= i_PACK_PAGE) ? i_PACK_PAGE : i_PACK_ALIGN;
+    return (offset + align - 1) & ~(align - 1);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void i_write_zeros(Stream *stream, const uint64_t size)
+{
+    static const byte_t i_ZEROS[i_PACK_PAGE] = {0};
+    uint64_t n = size;
+    while (n > 0)
+    {
+        uint32_t bytes = n < i_PACK_PAGE ? (uint32_t)n : i_PACK_PAGE;
+        stm_write(stream, i_ZEROS, bytes);
+        n -= bytes;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Header, locale names, types, offset table (by ResId) and data. Read by respack_packed() and respack_linked() */
+static void i_write_pack(const ResourcePack *pack, const char_t *dest_path, const char_t *dest_file, const char_t *ext, ArrPt(String) *errors)
+{
+    String *pathname = str_printf("%s%c%s.%s", dest_path, DIR_SEPARATOR, dest_file, ext);
+    uint32_t num_locals = arrpt_size(pack->local_codes, String);
+    uint32_t num_res = arrst_size(pack->resources, i_Resource);
+    uint32_t ncols = num_locals + 1;
+    uint32_t *table = num_res > 0 ? heap_new_n0(num_res * ncols * i_PACK_ENTRY, uint32_t) : NULL;
+    uint64_t locales = i_PACK_HEADER * sizeof(uint32_t);
+    uint64_t types = locales, offset = 0;
+    Stream *stream = NULL;
     cassert_no_null(pack);
+
+    arrpt_foreach(local, pack->local_codes, String)
+        types += str_len(local) + 1;
+    arrpt_end();
+
+    types = (types + 3) & ~(uint64_t)3;
+    offset = types + num_res * sizeof(uint32_t) + num_res * ncols * i_PACK_ENTRY * sizeof(uint32_t);
+
+    /* Data offsets, in writing order */
+    arrst_foreach(resource, pack->resources, i_Resource)
+        uint32_t *row = table + resource_i * ncols * i_PACK_ENTRY;
+        uint32_t size;
+        i_object_data(&resource->global, resource->type, &size, row);
+        offset = i_object_offset(offset, row, resource->type);
+        row[0] = (uint32_t)offset;
+        offset += size;
+        arrst_foreach(local, resource->locals, i_Local)
+            uint32_t *entry = row + (local->index + 1) * i_PACK_ENTRY;
+            cassert(local->index < num_locals);
+            i_object_data(&local->object, resource->type, &size, entry);
+            offset = i_object_offset(offset, entry, resource->type);
+            entry[0] = (uint32_t)offset;
+            offset += size;
+        arrst_end();
+    arrst_end();
+
+    if (offset < 0xFFFFFFFF)
+        stream = stm_to_file(tc(pathname), NULL);
+
     if (stream != NULL)
     {
-        register uint32_t num_locals = arrpt_size(pack->local_codes, String);
-        register uint32_t num_res = arrst_size(pack->resources, i_Resource);
-
-        /* Write localization codes */
+        uint64_t pos = 0;
+        uint32_t i;
+        stm_write_u32(stream, i_PACK_MAGIC);
+        stm_write_u32(stream, i_PACK_VERSION);
+        stm_write_u32(stream, i_PACK_PAGE);
         stm_write_u32(stream, num_locals);
+        stm_write_u32(stream, num_res);
+        stm_write_u32(stream, (uint32_t)locales);
+        stm_write_u32(stream, (uint32_t)types);
+        stm_write_u32(stream, (uint32_t)(types + num_res * sizeof(uint32_t)));
+        i_write_zeros(stream, (i_PACK_HEADER - 8) * sizeof(uint32_t));
+        pos = locales;
+
+        /* Localization codes */
         arrpt_foreach(local, pack->local_codes, String)
-            str_write(stream, local);
+            stm_write(stream, (const byte_t*)tc(local), str_len(local) + 1);
+            pos += str_len(local) + 1;
         arrpt_end();
 
-        /* Write resources */
-        stm_write_u32(stream, num_res);
+        i_write_zeros(stream, types - pos);
+
+        arrst_foreach(resource, pack->resources, i_Resource)
+            stm_write_u32(stream, (uint32_t)resource->type);
+        arrst_end();
+
+        for (i = 0; i < num_res * ncols * i_PACK_ENTRY; ++i)
+            stm_write_u32(stream, table[i]);
+
+        /* Resources */
+        pos = types + num_res * sizeof(uint32_t) + num_res * ncols * i_PACK_ENTRY * sizeof(uint32_t);
         arrst_foreach(resource, pack->resources, i_Resource)
-            register uint32_t num_localized = arrst_size(resource->locals, i_Local);
-            stm_write_u32(stream, resource->type);
-            i_object_write(stream, &resource->global, resource->type);
-            stm_write_u32(stream, num_localized);
-            arrst_foreach(local, resource->locals, i_Local);
-                stm_write_u32(stream, local->index);
-                i_object_write(stream, &local->object, resource->type);
+            const uint32_t *row = table + resource_i * ncols * i_PACK_ENTRY;
+            uint32_t size, entry[i_PACK_ENTRY];
+            const byte_t *data = i_object_data(&resource->global, resource->type, &size, entry);
+            i_write_zeros(stream, row[0] - pos);
+            stm_write(stream, data, size);
+            pos = row[0] + size;
+            arrst_foreach(local, resource->locals, i_Local)
+                const uint32_t *lrow = row + (local->index + 1) * i_PACK_ENTRY;
+                data = i_object_data(&local->object, resource->type, &size, entry);
+                i_write_zeros(stream, lrow[0] - pos);
+                stm_write(stream, data, size);
+                pos = lrow[0] + size;
             arrst_end();
         arrst_end();
 
@@ -1004,11 +1678,27 @@ void resgen_write_packed_file(const ResourcePack *pack, const char_t *dest_path,
         arrpt_append(errors, error, String);
     }
 
+    if (table != NULL)
+        heap_delete_n(&table, num_res * ncols * i_PACK_ENTRY, uint32_t);
     str_destroy(&pathname);
 }
 
 /*---------------------------------------------------------------------------*/
 
+void resgen_write_packed_file(const ResourcePack *pack, const char_t *dest_path, const char_t *dest_file, ArrPt(String) *errors)
+{
+    i_write_pack(pack, dest_path, dest_file, "res", errors);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void resgen_write_bin_file(const ResourcePack *pack, const char_t *dest_path, const char_t *dest_file, ArrPt(String) *errors)
+{
+    i_write_pack(pack, dest_path, dest_file, "bin", errors);
+}
+
+/*---------------------------------------------------------------------------*/
+
 void resgen_write_c_packed_file(const ResourcePack *pack, const char_t *dest_path, const char_t *dest_file, ArrPt(String) *errors)
 {
     String *pathname = str_printf("%s%c%s.c", dest_path, DIR_SEPARATOR, dest_file);
@@ -1044,3 +1734,104 @@ void resgen_write_c_packed_file(const ResourcePack *pack, const char_t *dest_pat
 
     str_destroy(&pathname);
 }
+
+/*---------------------------------------------------------------------------*/
+
+/* The assembler resolves '.incbin' from its own working directory */
+static String *i_incbin_path(const char_t *dest_path, const char_t *dest_file, ArrPt(String) *errors)
+{
+    String *pathname = NULL;
+    String *escaped = NULL;
+    if (dest_path[0] == '/' || dest_path[0] == '\\' || (dest_path[0] != '\0' && dest_path[1] == ':'))
+    {
+        pathname = str_printf("%s/%s.bin", dest_path, dest_file);
+    }
+    else
+    {
+        char_t work[1024];
+        uint32_t size = bfile_dir_work(work, sizeof(work));
+        if (size == 0 || size >= sizeof(work))
+        {
+            String *error = str_printf("Error getting the working directory for '%s/%s.bin'.", dest_path, dest_file);
+            arrpt_append(errors, error, String);
+            return NULL;
+        }
+
+        pathname = str_printf("%s/%s/%s.bin", work, dest_path, dest_file);
+    }
+
+    /* Quotes escaped for the assembler string, inside a C string */
+    str_subs(pathname, '\\', '/');
+    escaped = str_repl(tc(pathname), "\"", "\\\\\\\"", NULL);
+    str_destroy(&pathname);
+    return escaped;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * The '.bin' pack is included as is by the assembler (GCC and Clang), without going
+ * through the C parser. The pack key changes the source when the '.bin' does.
+ */
+void resgen_write_c_linked_file(const ResourcePack *pack, const char_t *dest_path, const char_t *dest_file, ArrPt(String) *errors)
+{
+    String *pathname = str_printf("%s%c%s.c", dest_path, DIR_SEPARATOR, dest_file);
+    String *binfile = i_incbin_path(dest_path, dest_file, errors);
+    Stream *stream = NULL;
+    cassert_no_null(pack);
+    if (binfile != NULL)
+        stream = stm_to_file(tc(pathname), NULL);
+
+    if (stream != NULL)
+    {
+        i_stm_header(stream);
+        stm_printf(stream, "#include \"%s.h\"\n", dest_file);
+        stm_writef(stream, "#include \"respackh.h\"\n\n");
+        stm_writef(stream, "/*---------------------------------------------------------------------------*/\n\n");
+
+        /* Resource IDs */
+        arrst_foreach(resource, pack->resources, i_Resource)
+            String *name = i_define_resname(resource->name);
+            stm_printf(stream, "ResId %s = \"N23R3C75::%s::%d\";\n", tc(name), dest_file, resource_i);
+            str_destroy(&name);
+        arrst_end();
+
+        stm_writef(stream, "\n/*---------------------------------------------------------------------------*/\n\n");
+        stm_printf(stream, "/* Pack key: %08X%08X */\n\n", (uint32_t)(pack->key >> 32), (uint32_t)pack->key);
+        stm_writef(stream, "#if !defined(__GNUC__)\n");
+        stm_writef(stream, "#error \"'nrc -db' needs GCC or Clang ('.incbin'). Use 'nrc -dc' or 'nrc -dp' with this compiler.\"\n");
+        stm_writef(stream, "#endif\n\n");
+        stm_writef(stream, "#if defined(__APPLE__)\n");
+        stm_writef(stream, "#define NRC_SECTION \"__TEXT,__const\"\n");
+        stm_writef(stream, "#elif defined(_WIN32)\n");
+        stm_writef(stream, "#define NRC_SECTION \".rdata,\\\"dr\\\"\"\n");
+        stm_writef(stream, "#else\n");
+        stm_writef(stream, "#define NRC_SECTION \".rodata\"\n");
+        stm_writef(stream, "#endif\n\n");
+        stm_writef(stream, "#define NRC_STR(x) #x\n");
+        stm_writef(stream, "#define NRC_LABEL(prefix, name) NRC_STR(prefix) #name\n\n");
+        stm_writef(stream, "__asm__(\n");
+        stm_writef(stream, "    \".pushsection \" NRC_SECTION \"\\n\"\n");
+        stm_writef(stream, "    \".balign 4096\\n\"\n");
+        stm_printf(stream, "    NRC_LABEL(__USER_LABEL_PREFIX__, %s_RESPACK) \":\\n\"\n", dest_file);
+        stm_printf(stream, "    \".incbin \\\"%s\\\"\\n\"\n", tc(binfile));
+        stm_printf(stream, "    NRC_LABEL(__USER_LABEL_PREFIX__, %s_RESPACK_END) \":\\n\"\n", dest_file);
+        stm_writef(stream, "    \".popsection\\n\");\n\n");
+        stm_printf(stream, "extern const byte_t %s_RESPACK[];\n", dest_file);
+        stm_printf(stream, "extern const byte_t %s_RESPACK_END[];\n", dest_file);
+        stm_writef(stream, "\n/*---------------------------------------------------------------------------*/\n\n");
+        stm_printf(stream, "ResPack *%s_respack(const char_t *locale)\n", dest_file);
+        stm_writef(stream, "{\n");
+        stm_printf(stream, "    return respack_linked(\"%s\", %s_RESPACK, (uint32_t)(%s_RESPACK_END - %s_RESPACK), locale);\n", dest_file, dest_file, dest_file, dest_file);
+        stm_writef(stream, "}\n");
+        stm_close(&stream);
+    }
+    else if (binfile != NULL)
+    {
+        String *error = str_printf("Error creating '%s' source file.", tc(pathname));
+        arrpt_append(errors, error, String);
+    }
+
+    str_destopt(&binfile);
+    str_destroy(&pathname);
+}
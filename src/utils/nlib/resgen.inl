@@ -14,7 +14,11 @@
 
 __EXTERN_C
 
-ResourcePack *resgen_pack_read(const char_t *src_dir, ArrPt(String) *warnings, ArrPt(String) *errors);
+ResourcePack *resgen_pack_read(const char_t *src_dir, const char_t *cache_file, const char_t *mode, const uint32_t nthreads, ArrPt(String) *warnings, ArrPt(String) *errors);
+
+bool_t resgen_pack_is_update(const ResourcePack *pack);
+
+void resgen_write_cache(const ResourcePack *pack, const char_t *cache_file);
 
 void resgen_destroy_pack(ResourcePack **pack);
 
@@ -26,5 +30,9 @@ void resgen_write_packed_file(const ResourcePack *pack, const char_t *dest_path,
 
 void resgen_write_c_packed_file(const ResourcePack *pack, const char_t *dest_path, const char_t *dest_file, ArrPt(String) *errors);
 
+void resgen_write_bin_file(const ResourcePack *pack, const char_t *dest_path, const char_t *dest_file, ArrPt(String) *errors);
+
+void resgen_write_c_linked_file(const ResourcePack *pack, const char_t *dest_path, const char_t *dest_file, ArrPt(String) *errors);
+
 __END_C
 
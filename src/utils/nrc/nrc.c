@@ -17,6 +17,7 @@
 #include "cassert.h"
 #include "core.h"
 #include "log.h"
+#include "osbs.h"
 #include "strings.h"
 
 static bool_t i_WITH_ASSERTS = FALSE;
@@ -34,6 +35,7 @@ static int i_error_in_use(void)
     bstd_printf("usage: nrc -v\n");
     bstd_printf("       nrc -dc input_resource_dir output_c_file\n");
     bstd_printf("       nrc -dp input_resource_dir output_c_file\n");
+    bstd_printf("       nrc -db input_resource_dir output_c_file\n");
     bstd_printf("       nrc -bnf input_bnf_file output_c_file\n");
     return ERROR_COMMAND_LINE;
 }
@@ -81,7 +83,7 @@ static int i_resdir_to_c_file(const char_t *src, const char_t *dest)
 {
     ArrPt(String) *warnings = NULL;
     ArrPt(String) *errors = NULL;
-    nrclib_serial_dir(src, dest, &warnings, &errors);
+    nrclib_serial_dir(src, dest, osbs_ncpus(), &warnings, &errors);
     return i_result(&warnings, &errors);
 }
 
@@ -91,7 +93,17 @@ static int i_resdir_to_packed_file(const char_t *src, const char_t *dest)
 {
     ArrPt(String) *warnings = NULL;
     ArrPt(String) *errors = NULL;
-    nrclib_pack_dir(src, dest, &warnings, &errors);
+    nrclib_pack_dir(src, dest, osbs_ncpus(), &warnings, &errors);
+    return i_result(&warnings, &errors);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int i_resdir_to_linked_file(const char_t *src, const char_t *dest)
+{
+    ArrPt(String) *warnings = NULL;
+    ArrPt(String) *errors = NULL;
+    nrclib_linked_dir(src, dest, osbs_ncpus(), &warnings, &errors);
     return i_result(&warnings, &errors);
 }
 
@@ -145,6 +157,13 @@ int main(int argc, char *argv[])
         else
             res = i_error_in_use();
     }
+    else if (str_equ_c(argv[1], "-db") == TRUE)
+    {
+        if (argc == 4)
+            res = i_resdir_to_linked_file((const char_t*)argv[2], (const char_t*)argv[3]);
+        else
+            res = i_error_in_use();
+    }
     else if (str_equ_c(argv[1], "-bnf") == TRUE)
     {
         if (argc == 4)